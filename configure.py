@@ -106,6 +106,9 @@ class Platform(object):
         return self._platform in ('freebsd', 'linux', 'openbsd', 'bitrig',
                                   'dragonfly')
 
+    def supports_epoll(self):
+        return self._platform == 'linux'
+
     def supports_ninja_browse(self):
         return (not self.is_windows()
                 and not self.is_solaris()
@@ -409,6 +412,8 @@ else:
 
 if platform.supports_ppoll() and not options.force_pselect:
     cflags.append('-DUSE_PPOLL')
+if platform.supports_epoll() and not options.force_pselect:
+    cflags.append('-DUSE_EPOLL')
 if platform.supports_ninja_browse():
     cflags.append('-DNINJA_HAVE_BROWSE')
 
@@ -0,0 +1,73 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_ARENA_H_
+#define NINJA_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+#include <utility>
+#include <vector>
+
+/// Bump allocates objects of type T, kPerBlock to a block, so that a large
+/// graph doesn't cost an allocation per object and objects created together
+/// (like the inputs of one edge) are next to each other in memory.
+///
+/// Blocks are aligned to kCacheLine bytes, so for a T declared alignas() a
+/// cache line, each object starts a line. Objects live until the arena is
+/// destroyed.
+template <typename T, size_t kPerBlock = 1024>
+struct Arena {
+  static const size_t kCacheLine = 64;
+
+  Arena() : in_last_block_(kPerBlock) {}
+  ~Arena() {
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+      size_t count = i + 1 == blocks_.size() ? in_last_block_ : kPerBlock;
+      for (size_t j = 0; j < count; ++j)
+        blocks_[i].objects[j].~T();
+      ::operator delete(blocks_[i].memory);
+    }
+  }
+
+  template <typename... Args>
+  T* New(Args&&... args) {
+    if (in_last_block_ == kPerBlock) {
+      Block block;
+      block.memory = ::operator new(sizeof(T) * kPerBlock + kCacheLine - 1);
+      uintptr_t start = reinterpret_cast<uintptr_t>(block.memory);
+      start = (start + kCacheLine - 1) & ~(uintptr_t)(kCacheLine - 1);
+      block.objects = reinterpret_cast<T*>(start);
+      blocks_.push_back(block);
+      in_last_block_ = 0;
+    }
+    return new (blocks_.back().objects + in_last_block_++)
+        T(std::forward<Args>(args)...);
+  }
+
+ private:
+  struct Block {
+    void* memory;
+    T* objects;
+  };
+  std::vector<Block> blocks_;
+  size_t in_last_block_;
+
+  Arena(const Arena&);
+  void operator=(const Arena&);
+};
+
+#endif  // NINJA_ARENA_H_
@@ -24,7 +24,6 @@
 #include <climits>
 #include <cstdint>
 #include <functional>
-#include <unordered_set>
 
 #include <set>
 #include <sstream>
@@ -55,6 +54,8 @@
 #include "util.h"
 
 #ifdef CLOUD_BUILD_SUPPORT
+#include "remote_executor/cas_client.h"
+#include "remote_executor/execution_context.h"
 #include "remote_process.h"
 #endif
 
@@ -103,13 +104,29 @@ Plan::Plan(Builder* builder)
   : builder_(builder)
   , command_edges_(0)
   , wanted_edges_(0)
+  , edges_in_plan_(0)
 {}
 
 void Plan::Reset() {
   command_edges_ = 0;
   wanted_edges_ = 0;
   ready_.clear();
-  want_.clear();
+  edge_states_.clear();
+  plan_edges_.clear();
+  edges_in_plan_ = 0;
+}
+
+bool Plan::InsertEdge(Edge* edge) {
+  if (edge->id_ >= edge_states_.size())
+    edge_states_.resize(edge->id_ + 1);
+  EdgeState& state = edge_states_[edge->id_];
+  if (state.in_plan)
+    return false;
+  state = EdgeState();
+  state.in_plan = true;
+  plan_edges_.push_back(edge);
+  ++edges_in_plan_;
+  return true;
 }
 
 bool Plan::AddTarget(const Node* target, string* err) {
@@ -139,11 +156,10 @@ bool Plan::AddSubTarget(const Node* node, const Node* dependent, string* err,
   if (edge->outputs_ready())
     return false;  // Don't need to do anything.
 
-  // If an entry in want_ does not already exist for edge, create an entry which
-  // maps to kWantNothing, indicating that we do not want to build this entry itself.
-  pair<map<Edge*, Want>::iterator, bool> want_ins =
-    want_.insert(make_pair(edge, kWantNothing));
-  Want& want = want_ins.first->second;
+  // If the edge is not already in the plan, add it wanting kWantNothing,
+  // indicating that we do not want to build this entry itself.
+  bool inserted = InsertEdge(edge);
+  Want& want = edge_states_[edge->id_].want;
 
   if (dyndep_walk && want == kWantToFinish)
     return false;  // Don't need to do anything with already-scheduled edge.
@@ -158,7 +174,7 @@ bool Plan::AddSubTarget(const Node* node, const Node* dependent, string* err,
   if (dyndep_walk)
     dyndep_walk->insert(edge);
 
-  if (!want_ins.second)
+  if (!inserted)
     return true;  // We've already processed the inputs.
 
   for (vector<Node*>::iterator i = edge->inputs_.begin();
@@ -190,18 +206,18 @@ Edge* Plan::FindWork() {
 }
 
 
-void Plan::ScheduleWork(map<Edge*, Want>::iterator want_e) {
-  if (want_e->second == kWantToFinish) {
+void Plan::ScheduleWork(Edge* edge) {
+  Want& want = FindEdge(edge)->want;
+  if (want == kWantToFinish) {
     // This edge has already been scheduled.  We can get here again if an edge
     // and one of its dependencies share an order-only input, or if a node
     // duplicates an out edge (see https://github.com/ninja-build/ninja/pull/519).
     // Avoid scheduling the work again.
     return;
   }
-  assert(want_e->second == kWantToStart);
-  want_e->second = kWantToFinish;
+  assert(want == kWantToStart);
+  want = kWantToFinish;
 
-  Edge* edge = want_e->first;
   Pool* pool = edge->pool();
   if (pool->ShouldDelayEdge()) {
     pool->DelayEdge(edge);
@@ -213,9 +229,10 @@ void Plan::ScheduleWork(map<Edge*, Want>::iterator want_e) {
 }
 
 bool Plan::EdgeFinished(Edge* edge, EdgeResult result, string* err) {
-  map<Edge*, Want>::iterator e = want_.find(edge);
-  assert(e != want_.end());
-  bool directly_wanted = e->second != kWantNothing;
+  METRIC_RECORD("EdgeFinished");
+  EdgeState* state = FindEdge(edge);
+  assert(state);
+  bool directly_wanted = state->want != kWantNothing;
 
   // See if this job frees up any delayed jobs.
   if (directly_wanted)
@@ -228,7 +245,8 @@ bool Plan::EdgeFinished(Edge* edge, EdgeResult result, string* err) {
 
   if (directly_wanted)
     --wanted_edges_;
-  want_.erase(e);
+  state->in_plan = false;
+  --edges_in_plan_;
   edge->outputs_ready_ = true;
 
   // Check off any nodes we were waiting for with this edge.
@@ -252,22 +270,30 @@ bool Plan::NodeFinished(Node* node, string* err) {
   // See if we we want any edges from this node.
   for (vector<Edge*>::const_iterator oe = node->out_edges().begin();
        oe != node->out_edges().end(); ++oe) {
-    map<Edge*, Want>::iterator want_e = want_.find(*oe);
-    if (want_e == want_.end())
+    if (!FindEdge(*oe))
       continue;
 
     // See if the edge is now ready.
-    if (!EdgeMaybeReady(want_e, err))
+    if (!EdgeMaybeReady(*oe, err))
       return false;
   }
   return true;
 }
 
-bool Plan::EdgeMaybeReady(map<Edge*, Want>::iterator want_e, string* err) {
-  Edge* edge = want_e->first;
-  if (edge->AllInputsReady()) {
-    if (want_e->second != kWantNothing) {
-      ScheduleWork(want_e);
+bool Plan::AllInputsReady(const Edge* edge) {
+  size_t& ready_inputs = FindEdge(edge)->ready_inputs;
+  for (; ready_inputs < edge->inputs_.size(); ++ready_inputs) {
+    const Edge* in_edge = edge->inputs_[ready_inputs]->in_edge();
+    if (in_edge && !in_edge->outputs_ready())
+      return false;
+  }
+  return true;
+}
+
+bool Plan::EdgeMaybeReady(Edge* edge, string* err) {
+  if (AllInputsReady(edge)) {
+    if (FindEdge(edge)->want != kWantNothing) {
+      ScheduleWork(edge);
     } else {
       // We do not need to build this edge, but we might need to build one of
       // its dependents.
@@ -284,8 +310,8 @@ bool Plan::CleanNode(DependencyScan* scan, Node* node, string* err) {
   for (vector<Edge*>::const_iterator oe = node->out_edges().begin();
        oe != node->out_edges().end(); ++oe) {
     // Don't process edges that we don't actually want.
-    map<Edge*, Want>::iterator want_e = want_.find(*oe);
-    if (want_e == want_.end() || want_e->second == kWantNothing)
+    EdgeState* state = FindEdge(*oe);
+    if (!state || state->want == kWantNothing)
       continue;
 
     // Don't attempt to clean an edge if it failed to load deps.
@@ -325,7 +351,7 @@ bool Plan::CleanNode(DependencyScan* scan, Node* node, string* err) {
             return false;
         }
 
-        want_e->second = kWantNothing;
+        FindEdge(*oe)->want = kWantNothing;
         --wanted_edges_;
         if (!(*oe)->is_phony()) {
           --command_edges_;
@@ -359,11 +385,9 @@ bool Plan::DyndepsLoaded(DependencyScan* scan, const Node* node,
     if (edge->outputs_ready())
       continue;
 
-    map<Edge*, Want>::iterator want_e = want_.find(edge);
-
     // If the edge has not been encountered before then nothing already in the
     // plan depends on it so we do not need to consider the edge yet either.
-    if (want_e == want_.end())
+    if (!FindEdge(edge))
       continue;
 
     // This edge is already in the plan so queue it for the walk.
@@ -387,19 +411,17 @@ bool Plan::DyndepsLoaded(DependencyScan* scan, const Node* node,
   // Plan::NodeFinished would have without taking the dyndep code path).
   for (vector<Edge*>::const_iterator oe = node->out_edges().begin();
        oe != node->out_edges().end(); ++oe) {
-    map<Edge*, Want>::iterator want_e = want_.find(*oe);
-    if (want_e == want_.end())
+    if (!FindEdge(*oe))
       continue;
-    dyndep_walk.insert(want_e->first);
+    dyndep_walk.insert(*oe);
   }
 
   // See if any encountered edges are now ready.
   for (set<Edge*>::iterator wi = dyndep_walk.begin();
        wi != dyndep_walk.end(); ++wi) {
-    map<Edge*, Want>::iterator want_e = want_.find(*wi);
-    if (want_e == want_.end())
+    if (!FindEdge(*wi))
       continue;
-    if (!EdgeMaybeReady(want_e, err))
+    if (!EdgeMaybeReady(*wi, err))
       return false;
   }
 
@@ -443,10 +465,10 @@ bool Plan::RefreshDyndepDependents(DependencyScan* scan, const Node* node,
     // information an output is now known to be dirty, so we want the edge.
     Edge* edge = n->in_edge();
     assert(edge && !edge->outputs_ready());
-    map<Edge*, Want>::iterator want_e = want_.find(edge);
-    assert(want_e != want_.end());
-    if (want_e->second == kWantNothing) {
-      want_e->second = kWantToStart;
+    EdgeState* state = FindEdge(edge);
+    assert(state);
+    if (state->want == kWantNothing) {
+      state->want = kWantToStart;
       EdgeWanted(edge);
     }
   }
@@ -458,10 +480,14 @@ void Plan::UnmarkDependents(const Node* node, set<Node*>* dependents) {
        oe != node->out_edges().end(); ++oe) {
     Edge* edge = *oe;
 
-    map<Edge*, Want>::iterator want_e = want_.find(edge);
-    if (want_e == want_.end())
+    EdgeState* state = FindEdge(edge);
+    if (!state)
       continue;
 
+    // Dyndeps add inputs, and recomputing the dirty state of the
+    // dependents may make their outputs not ready again.
+    state->ready_inputs = 0;
+
     if (edge->mark_ != Edge::VisitNone) {
       edge->mark_ = Edge::VisitNone;
       for (vector<Node*>::iterator o = edge->outputs_.begin();
@@ -518,13 +544,15 @@ void Plan::ComputeCriticalPath() {
     //   reasons. Hence the order used in result().
     //
     // - Since the graph cannot have any cycles, temporary marks
-    //   are not necessary, and a simple set is used to record
-    //   which edges have already been visited.
+    //   are not necessary, and a simple bitmap indexed by Edge::id_
+    //   is used to record which edges have already been visited.
     //
     void Visit(Edge* edge) {
-      auto insertion = visited_set_.emplace(edge);
-      if (!insertion.second)
+      if (edge->id_ >= visited_.size())
+        visited_.resize(edge->id_ + 1);
+      if (visited_[edge->id_])
         return;
+      visited_[edge->id_] = true;
 
       for (const Node* input : edge->inputs_) {
         Edge* producer = input->in_edge();
@@ -534,7 +562,7 @@ void Plan::ComputeCriticalPath() {
       sorted_edges_.push_back(edge);
     }
 
-    std::unordered_set<Edge*> visited_set_;
+    std::vector<bool> visited_;
     std::vector<Edge*> sorted_edges_;
   };
 
@@ -575,11 +603,11 @@ void Plan::ScheduleInitialEdges() {
   assert(ready_.empty());
   std::set<Pool*> pools;
 
-  for (std::map<Edge*, Plan::Want>::iterator it = want_.begin(),
-           end = want_.end(); it != end; ++it) {
-    Edge* edge = it->first;
-    Plan::Want want = it->second;
-    if (!(want == kWantToStart && edge->AllInputsReady())) {
+  for (std::vector<Edge*>::iterator it = plan_edges_.begin(),
+           end = plan_edges_.end(); it != end; ++it) {
+    Edge* edge = *it;
+    EdgeState* state = FindEdge(edge);
+    if (!(state && state->want == kWantToStart && edge->AllInputsReady())) {
       continue;
     }
 
@@ -588,13 +616,13 @@ void Plan::ScheduleInitialEdges() {
       pool->DelayEdge(edge);
       pools.insert(pool);
     } else {
-      ScheduleWork(it);
+      ScheduleWork(edge);
     }
   }
 
   // Call RetrieveReadyEdges only once at the end so higher priority
   // edges are retrieved first, not the ones that happen to be first
-  // in the want_ map.
+  // in the plan.
   for (std::set<Pool*>::iterator it=pools.begin(),
            end = pools.end(); it != end; ++it) {
     (*it)->RetrieveReadyEdges(&ready_);
@@ -607,11 +635,15 @@ void Plan::PrepareQueue() {
 }
 
 void Plan::Dump() const {
-  printf("pending: %d\n", (int)want_.size());
-  for (map<Edge*, Want>::const_iterator e = want_.begin(); e != want_.end(); ++e) {
-    if (e->second != kWantNothing)
+  printf("pending: %d\n", edges_in_plan_);
+  for (vector<Edge*>::const_iterator e = plan_edges_.begin();
+       e != plan_edges_.end(); ++e) {
+    const EdgeState& state = edge_states_[(*e)->id_];
+    if (!state.in_plan)
+      continue;
+    if (state.want != kWantNothing)
       printf("want ");
-    e->first->Dump();
+    (*e)->Dump();
   }
   printf("ready: %d\n", (int)ready_.size());
 }
@@ -630,7 +662,7 @@ void Plan::Progress(CommandRunner* runner) {
   char full_time[128];
   snprintf(full_time, sizeof(full_time), "%s.%03ld", time_buf, ms);
   
-  printf("\n[%s], pending/wanted: %d, ", full_time, (int)want_.size());
+  printf("\n[%s], pending/wanted: %d, ", full_time, edges_in_plan_);
   printf("ready: %d, ", (int)ready_.size());
   printf("running: %d\n\n", (int)runner->GetActiveEdges().size());
 }
@@ -681,8 +713,11 @@ size_t ShareCommandRunner::CanRunMore() const {
 
 bool ShareCommandRunner::StartCommand(Edge* edge) {
   EdgeCommand c;
-  c.command = edge->EvaluateCommand();
-  ShareThread* share_thread = share_threads_.Add(c, config_.rbe_config);
+  RemoteExecutor::RemoteSpawn* spawn = nullptr;
+  if (config_.rbe_config.ship_inputs)
+    spawn = RemoteExecutor::RemoteSpawn::CreateRemoteSpawn(edge);
+  c.command = spawn ? spawn->origin_command : edge->EvaluateCommand();
+  ShareThread* share_thread = share_threads_.Add(c, config_.rbe_config, spawn);
   if (!share_thread)
     return false;
   thread_to_edge_.insert(make_pair(share_thread, edge));
@@ -791,16 +826,23 @@ bool RealCommandRunner::WaitForCommand(Result* result) {
 constexpr int proportion = 3; //Best result from benchmark
 
 struct CloudCommandRunner : public CommandRunner {
-  explicit CloudCommandRunner(const BuildConfig& config)
-      : config_(config), remote_procs_(config.parallelism * proportion) {}
+  CloudCommandRunner(const BuildConfig& config, const Plan& plan)
+      : config_(config), plan_(plan),
+        remote_procs_(config.parallelism * proportion) {}
   virtual ~CloudCommandRunner() {}
   virtual size_t CanRunMore() const override;
   virtual bool StartCommand(Edge* edge) override;
   virtual bool WaitForCommand(Result* result) override;
   virtual vector<Edge*> GetActiveEdges() override;
   virtual void Abort() override;
+  virtual bool GetRemoteProgress(RemoteProgress* progress) const override;
+  /// Side outputs are downloaded after their edge is reported done.
+  virtual bool WaitForBackgroundWork(string* err) override {
+    return RemoteExecutor::ExecutionContext::WaitForBackgroundDownloads(err);
+  }
 
   const BuildConfig& config_;
+  const Plan& plan_;
   RemoteProcessSet remote_procs_;
   map<const RemoteProcess*, Edge*> remoteproc_to_edge;
 };
@@ -830,9 +872,8 @@ size_t CloudCommandRunner::CanRunMore() const {
 
 
 bool CloudCommandRunner::StartCommand(Edge* edge) {
-  string command = edge->EvaluateCommand();
-  auto spawn = RemoteExecutor::RemoteSpawn::CreateRemoteSpawn(edge);
-  string cmd_rule =spawn->edge->rule().name();
+  auto spawn =
+      RemoteExecutor::RemoteSpawn::CreateRemoteSpawn(edge, plan_.targets());
   RemoteProcess* remoteproc = remote_procs_.Add(spawn);
   if (!remoteproc)
     return false;
@@ -875,6 +916,15 @@ void CloudCommandRunner::Abort() {
   remote_procs_.Clear();
 }
 
+bool CloudCommandRunner::GetRemoteProgress(RemoteProgress* progress) const {
+  progress->queued = remote_procs_.QueuedCount();
+  progress->running = (int)remote_procs_.running_.size() - progress->queued;
+  if (progress->running < 0)
+    progress->running = 0;
+  progress->cache_hits = remote_procs_.cache_hits_;
+  return true;
+}
+
 #endif // CLOUD_BUILD_SUPPORT
 
 
@@ -973,6 +1023,31 @@ bool Builder::AlreadyUpToDate() const {
 }
 
 bool Builder::Build(string* err) {
+  bool ok = RunEdges(err);
+
+  // An edge may be reported done before all its outputs are written.
+  string background_err;
+  if (command_runner_.get() &&
+      !command_runner_->WaitForBackgroundWork(&background_err) && ok) {
+    *err = background_err;
+    ok = false;
+  }
+
+  // The logs are written in the background, so wait for this build's
+  // records, however it ended, before the caller may exit().
+  const char* failed = NULL;
+  if (scan_.build_log() && !scan_.build_log()->Flush())
+    failed = "build log";
+  else if (scan_.deps_log() && !scan_.deps_log()->Flush())
+    failed = "deps log";
+  if (failed && ok) {
+    *err = string("writing ") + failed + ": " + strerror(errno);
+    return false;
+  }
+  return ok;
+}
+
+bool Builder::RunEdges(string* err) {
   assert(!AlreadyUpToDate());
   plan_.PrepareQueue();
 
@@ -986,10 +1061,11 @@ bool Builder::Build(string* err) {
 #ifdef CLOUD_BUILD_SUPPORT
     else if (config_.cloud_run) {
       RemoteExecutor::RemoteSpawn::config = &config_;
-      command_runner_.reset(new CloudCommandRunner(config_));
+      command_runner_.reset(new CloudCommandRunner(config_, plan_));
     }
 #endif
     else if (config_.share_run) {
+        RemoteExecutor::RemoteSpawn::config = &config_;
         command_runner_.reset(new ShareCommandRunner(config_, plan_));
     } else {
         command_runner_.reset(new RealCommandRunner(config_));
@@ -1051,6 +1127,8 @@ bool Builder::Build(string* err) {
 
     // See if we can reap any finished commands.
     if (pending_commands) {
+      // The next command may take a while; don't leave a stale status up.
+      status_->BuildWaiting();
       CommandRunner::Result result;
       if (!command_runner_->WaitForCommand(&result) ||
           result.status == ExitInterrupted) {
@@ -1060,6 +1138,10 @@ bool Builder::Build(string* err) {
         return false;
       }
 
+      RemoteProgress progress;
+      if (command_runner_->GetRemoteProgress(&progress))
+        status_->BuildRemoteProgress(progress);
+
       --pending_commands;
       if (!FinishCommand(&result, err)) {
         Cleanup();
@@ -1183,11 +1265,15 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
 
   // Restat the edge outputs
   TimeStamp record_mtime = 0;
+  vector<BuildLog::ContentDigest> digests;
   if (!config_.dry_run) {
-    const bool restat = edge->GetBindingBool("restat");
+    const string restat_mode = edge->GetBinding("restat");
+    const bool restat = !restat_mode.empty();
     const bool generator = edge->GetBindingBool("generator");
     bool node_cleaned = false;
     record_mtime = edge->command_start_time_;
+    if (restat_mode == "hash")
+      digests.resize(edge->outputs_.size());
 
     // restat and generator rules must restat the outputs after the build
     // has finished. if record_mtime == 0, then there was an error while
@@ -1195,18 +1281,22 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
     // we should fall back to recording the outputs' current mtime in the
     // log.
     if (record_mtime == 0 || restat || generator) {
-      for (vector<Node*>::iterator o = edge->outputs_.begin();
-           o != edge->outputs_.end(); ++o) {
-        TimeStamp new_mtime = disk_interface_->Stat((*o)->path(), err);
+      for (size_t i = 0; i < edge->outputs_.size(); ++i) {
+        Node* o = edge->outputs_[i];
+        TimeStamp new_mtime = disk_interface_->Stat(o->path(), err);
         if (new_mtime == -1)
           return false;
         if (new_mtime > record_mtime)
           record_mtime = new_mtime;
-        if ((*o)->mtime() == new_mtime && restat) {
+        bool unchanged = o->mtime() == new_mtime && restat;
+        if (!digests.empty() &&
+            RestoreUnchangedOutput(o, new_mtime, &digests[i]))
+          unchanged = true;
+        if (unchanged) {
           // The rule command did not change the output.  Propagate the clean
           // state through the build graph.
           // Note that this also applies to nonexistent outputs (mtime == 0).
-          if (!plan_.CleanNode(&scan_, *o, err))
+          if (!plan_.CleanNode(&scan_, o, err))
             return false;
           node_cleaned = true;
         }
@@ -1227,7 +1317,8 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
 
   if (scan_.build_log()) {
     if (!scan_.build_log()->RecordCommand(edge, start_time_millis,
-                                          end_time_millis, record_mtime)) {
+                                          end_time_millis, record_mtime,
+                                          digests.empty() ? NULL : &digests)) {
       *err = string("Error writing to build log: ") + strerror(errno);
       return false;
     }
@@ -1249,6 +1340,51 @@ bool Builder::FinishCommand(CommandRunner::Result* result, string* err) {
   return true;
 }
 
+bool Builder::RestoreUnchangedOutput(Node* node, TimeStamp mtime,
+                                     BuildLog::ContentDigest* content) {
+  if (mtime <= 0)
+    return false;
+  BuildLog::LogEntry* entry =
+      scan_.build_log() ? scan_.build_log()->LookupByOutput(node->path())
+                        : NULL;
+  const BuildLog::ContentDigest* previous =
+      entry && !entry->content.digest.empty() ? &entry->content : NULL;
+  content->mtime = mtime;
+  if (previous && previous->mtime == mtime) {
+    // Not touched since it was hashed.
+    content->digest = previous->digest;
+    return false;
+  }
+
+#ifdef CLOUD_BUILD_SUPPORT
+  RemoteExecutor::DigestContext hasher =
+      RemoteExecutor::DigestGenerator(RemoteExecutor::CASHash::DigestFunction())
+          .CreateDigestContext();
+  string err;
+  if (disk_interface_->ReadFileChunks(
+          node->path(),
+          [&hasher](const char* data, size_t size) {
+            hasher.Update(data, size);
+          },
+          &err) != FileReader::Okay)
+    return false;
+  RemoteExecutor::Digest digest = hasher.FinalizeDigest();
+  content->digest = digest.hash() + "/" + to_string(digest.size_bytes());
+#else
+  return false;
+#endif
+
+  // The previous digest only describes the content the output had before
+  // the command ran if nothing has touched it since.
+  if (!previous || previous->mtime != node->mtime() ||
+      previous->digest != content->digest)
+    return false;
+  if (!disk_interface_->SetMtime(node->path(), node->mtime()))
+    return false;
+  content->mtime = node->mtime();
+  return true;
+}
+
 bool Builder::ExtractDeps(CommandRunner::Result* result,
                           const string& deps_type,
                           const string& deps_prefix,
@@ -22,6 +22,7 @@
 #include <string>
 #include <vector>
 
+#include "build_log.h"
 #include "depfile_parser.h"
 #include "graph.h"
 #include "exit_status.h"
@@ -79,6 +80,9 @@ struct Plan {
   /// Number of edges with commands to run.
   int command_edge_count() const { return command_edges_; }
 
+  /// The targets asked for, in the order they were added.
+  const std::vector<const Node*>& targets() const { return targets_; }
+
   /// Reset state.  Clears want and ready sets.
   void Reset();
 
@@ -121,18 +125,52 @@ private:
   bool NodeFinished(Node* node, std::string* err);
 
   void EdgeWanted(const Edge* edge);
-  bool EdgeMaybeReady(std::map<Edge*, Want>::iterator want_e, std::string* err);
+  bool AllInputsReady(const Edge* edge);
+  bool EdgeMaybeReady(Edge* edge, std::string* err);
 
   /// Submits a ready edge as a candidate for execution.
   /// The edge may be delayed from running, for example if it's a member of a
   /// currently-full pool.
-  void ScheduleWork(std::map<Edge*, Want>::iterator want_e);
+  void ScheduleWork(Edge* edge);
+
+  /// What the plan knows about an edge.
+  struct EdgeState {
+    EdgeState() : in_plan(false), want(kWantNothing), ready_inputs(0) {}
+
+    /// If false, we do not want to build the edge or its dependents.
+    bool in_plan;
+    /// What we want for the edge, if it is in the plan.
+    Want want;
+    /// How many leading inputs of the edge are known to be ready while it
+    /// waits for them. Inputs stay ready during the build, so checking an
+    /// edge with many inputs again carries on from there instead of
+    /// starting over.
+    size_t ready_inputs;
+  };
+
+  /// The state of |edge| if it is in the plan, else NULL. Only valid until
+  /// the next edge is added to the plan.
+  EdgeState* FindEdge(const Edge* edge) {
+    if (edge->id_ >= edge_states_.size() || !edge_states_[edge->id_].in_plan)
+      return NULL;
+    return &edge_states_[edge->id_];
+  }
 
-  /// Keep track of which edges we want to build in this plan.  If this map does
-  /// not contain an entry for an edge, we do not want to build the entry or its
-  /// dependents.  If it does contain an entry, the enumeration indicates what
-  /// we want for the edge.
-  std::map<Edge*, Want> want_;
+  /// Add |edge| to the plan, wanting nothing for it yet. Returns false if
+  /// it was already in the plan.
+  bool InsertEdge(Edge* edge);
+
+  /// Keep track of which edges we want to build in this plan, indexed by
+  /// Edge::id_. State numbers edges densely as they are loaded, so looking
+  /// up an edge is an array access rather than a walk down a tree.
+  std::vector<EdgeState> edge_states_;
+
+  /// The edges added to the plan, in order. Edges that leave the plan
+  /// stay in the list.
+  std::vector<Edge*> plan_edges_;
+
+  /// Number of edges in the plan.
+  int edges_in_plan_;
 
   EdgePriorityQueue ready_;
 
@@ -150,6 +188,17 @@ private:
 /// CommandRunner is an interface that wraps running the build
 /// subcommands.  This allows tests to abstract out running commands.
 /// RealCommandRunner is an implementation that actually runs commands.
+/// Counts of a CommandRunner that runs commands remotely.
+struct RemoteProgress {
+  RemoteProgress() : running(0), queued(0), cache_hits(0) {}
+  /// Commands being looked up in the cache or executed.
+  int running;
+  /// Commands waiting for a free connection.
+  int queued;
+  /// Commands found in the action cache so far.
+  int cache_hits;
+};
+
 struct CommandRunner {
   virtual ~CommandRunner() {}
   virtual size_t CanRunMore() const = 0;
@@ -168,6 +217,15 @@ struct CommandRunner {
 
   virtual std::vector<Edge*> GetActiveEdges() { return std::vector<Edge*>(); }
   virtual void Abort() {}
+
+  /// Fill in |progress| and return true if commands run remotely.
+  virtual bool GetRemoteProgress(RemoteProgress* progress) const {
+    return false;
+  }
+
+  /// Wait for work that outlives the commands it belongs to. Returns false
+  /// and fills in |err| if some of it failed.
+  virtual bool WaitForBackgroundWork(std::string* err) { return true; }
 };
 struct ProjectConfig {
   // project config
@@ -178,10 +236,16 @@ struct ProjectConfig {
   
   std::string shareproxy_addr;
   std::string self_ipv4_addr;
+  bool ship_inputs = false;                               // send input manifests instead of relying on a shared tree
+  int32_t blob_server_port = 0;                           // port serving input blobs to peers, 0 picks one
   std::string grpc_url;
   std::set<std::string>  local_only_rules;
   std::set<std::string>  local_only_fuzzy;
   std::set<std::string>  remote_exec_rules;
+  std::set<std::string>  remote_cache_rules;             // rules cached like `remote_cache = 1`
+  // absolute path prefixes rewritten before action digests are computed,
+  // e.g. {"/home/alice/toolchain", "/toolchain"}
+  std::vector<std::pair<std::string, std::string>> path_remaps;
 };
 /// Options (e.g. verbosity, parallelism) passed to a build.
 struct BuildConfig {
@@ -224,11 +288,18 @@ struct Builder {
   /// @return false on error.
   bool AddTarget(Node* target, std::string* err);
 
+  /// Stat everything the targets about to be added depend on and read their
+  /// depfiles in parallel, ahead of the AddTarget() calls.
+  void Prefetch(const std::vector<Node*>& targets) {
+    scan_.Prefetch(targets);
+  }
+
   /// Returns true if the build targets are already up to date.
   bool AlreadyUpToDate() const;
 
   /// Run the build.  Returns false on error.
   /// It is an error to call this function when AlreadyUpToDate() is true.
+  /// The records of the edges it ran are on disk when it returns.
   bool Build(std::string* err);
 
   bool StartEdge(Edge* edge, std::string* err);
@@ -252,10 +323,20 @@ struct Builder {
   Status* status_;
 
  private:
+  /// The build loop of Build(), which then flushes the logs.
+  bool RunEdges(std::string* err);
+
   bool ExtractDeps(CommandRunner::Result* result, const std::string& deps_type,
                    const std::string& deps_prefix,
                    std::vector<Node*>* deps_nodes, std::string* err);
 
+  /// For "restat = hash": record the content of output |node|, which its
+  /// command left with |mtime|, in |content|. Returns true if the command
+  /// rewrote the output with the content it had before, after moving its
+  /// mtime back so that its dependents stay clean.
+  bool RestoreUnchangedOutput(Node* node, TimeStamp mtime,
+                              BuildLog::ContentDigest* content);
+
   /// Map of running edge to time the edge started running.
   typedef std::map<const Edge*, int> RunningEdgeMap;
   RunningEdgeMap running_edges_;
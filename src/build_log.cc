@@ -23,6 +23,7 @@
 #include "build_log.h"
 #include "disk_interface.h"
 
+#include <algorithm>
 #include <cassert>
 #include <errno.h>
 #include <stdlib.h>
@@ -36,6 +37,7 @@
 #include "build.h"
 #include "graph.h"
 #include "metrics.h"
+#include "thread_pool.h"
 #include "util.h"
 #if defined(_MSC_VER) && (_MSC_VER < 1800)
 #define strtoll _strtoi64
@@ -54,7 +56,7 @@ namespace {
 
 const char kFileSignature[] = "# ninja log v%d\n";
 const int kOldestSupportedVersion = 6;
-const int kCurrentVersion = 6;
+const int kCurrentVersion = 7;
 
 // 64bit MurmurHash2, by Austin Appleby
 #if defined(_MSC_VER)
@@ -112,17 +114,17 @@ uint64_t BuildLog::LogEntry::HashCommand(StringPiece command) {
   return MurmurHash64A(command.str_, command.len_);
 }
 
-BuildLog::LogEntry::LogEntry(const string& output)
+BuildLog::LogEntry::LogEntry(StringPiece output)
   : output(output) {}
 
-BuildLog::LogEntry::LogEntry(const string& output, uint64_t command_hash,
+BuildLog::LogEntry::LogEntry(StringPiece output, uint64_t command_hash,
   int start_time, int end_time, TimeStamp mtime)
   : output(output), command_hash(command_hash),
     start_time(start_time), end_time(end_time), mtime(mtime)
 {}
 
 BuildLog::BuildLog()
-  : log_file_(NULL), needs_recompaction_(false) {}
+  : needs_recompaction_(false) {}
 
 BuildLog::~BuildLog() {
   Close();
@@ -135,232 +137,275 @@ bool BuildLog::OpenForWrite(const string& path, const BuildLogUser& user,
       return false;
   }
 
-  assert(!log_file_);
+  assert(!log_writer_.is_open());
   log_file_path_ = path;  // we don't actually open the file right now, but will
                           // do so on the first write attempt
   return true;
 }
 
 bool BuildLog::RecordCommand(Edge* edge, int start_time, int end_time,
-                             TimeStamp mtime) {
-  string command = edge->EvaluateCommand(true);
-  uint64_t command_hash = LogEntry::HashCommand(command);
-  for (vector<Node*>::iterator out = edge->outputs_.begin();
-       out != edge->outputs_.end(); ++out) {
-    const string& path = (*out)->path();
+                             TimeStamp mtime,
+                             const vector<ContentDigest>* digests) {
+  METRIC_RECORD(".ninja_log record");
+  assert(!digests || digests->size() == edge->outputs_.size());
+  uint64_t command_hash = edge->GetCommandHash();
+  string record;
+  for (size_t o = 0; o < edge->outputs_.size(); ++o) {
+    const string& path = edge->outputs_[o]->path();
     Entries::iterator i = entries_.find(path);
     LogEntry* log_entry;
     if (i != entries_.end()) {
       log_entry = i->second;
     } else {
-      log_entry = new LogEntry(path);
-      entries_.insert(Entries::value_type(log_entry->output, log_entry));
+      recorded_paths_.push_back(path);
+      log_entry = AddEntry(recorded_paths_.back());
     }
     log_entry->command_hash = command_hash;
     log_entry->start_time = start_time;
     log_entry->end_time = end_time;
     log_entry->mtime = mtime;
+    log_entry->content = digests ? (*digests)[o] : ContentDigest();
 
-    if (!OpenForWriteIfNeeded()) {
-      return false;
-    }
-    if (log_file_) {
-      if (!WriteEntry(log_file_, *log_entry))
-        return false;
-      if (fflush(log_file_) != 0) {
-          return false;
-      }
-    }
+    FormatEntry(*log_entry, &record);
   }
+
+  if (!OpenForWriteIfNeeded()) {
+    return false;
+  }
+  if (log_writer_.is_open())
+    return log_writer_.Append(record);
   return true;
 }
 
+bool BuildLog::Flush() {
+  return log_writer_.Flush();
+}
+
 void BuildLog::Close() {
   OpenForWriteIfNeeded();  // create the file even if nothing has been recorded
-  if (log_file_)
-    fclose(log_file_);
-  log_file_ = NULL;
+  log_writer_.Close();
 }
 
 bool BuildLog::OpenForWriteIfNeeded() {
-  if (log_file_ || log_file_path_.empty()) {
+  if (log_writer_.is_open() || log_file_path_.empty()) {
     return true;
   }
-  log_file_ = fopen(log_file_path_.c_str(), "ab");
-  if (!log_file_) {
-    return false;
-  }
-  if (setvbuf(log_file_, NULL, _IOLBF, BUFSIZ) != 0) {
+  FILE* file = fopen(log_file_path_.c_str(), "ab");
+  if (!file) {
     return false;
   }
-  SetCloseOnExec(fileno(log_file_));
+  SetCloseOnExec(fileno(file));
 
   // Opening a file in append mode doesn't set the file pointer to the file's
   // end on Windows. Do that explicitly.
-  fseek(log_file_, 0, SEEK_END);
+  fseek(file, 0, SEEK_END);
 
-  if (ftell(log_file_) == 0) {
-    if (fprintf(log_file_, kFileSignature, kCurrentVersion) < 0) {
+  if (ftell(file) == 0) {
+    if (fprintf(file, kFileSignature, kCurrentVersion) < 0 ||
+        fflush(file) != 0) {
+      fclose(file);
       return false;
     }
   }
+  log_writer_.Open(file);
   return true;
 }
 
-struct LineReader {
-  explicit LineReader(FILE* file)
-    : file_(file), buf_end_(buf_), line_start_(buf_), line_end_(NULL) {
-      memset(buf_, 0, sizeof(buf_));
-  }
-
-  // Reads a \n-terminated line from the file passed to the constructor.
-  // On return, *line_start points to the beginning of the next line, and
-  // *line_end points to the \n at the end of the line. If no newline is seen
-  // in a fixed buffer size, *line_end is set to NULL. Returns false on EOF.
-  bool ReadLine(char** line_start, char** line_end) {
-    if (line_start_ >= buf_end_ || !line_end_) {
-      // Buffer empty, refill.
-      size_t size_read = fread(buf_, 1, sizeof(buf_), file_);
-      if (!size_read)
-        return false;
-      line_start_ = buf_;
-      buf_end_ = buf_ + size_read;
-    } else {
-      // Advance to next line in buffer.
-      line_start_ = line_end_ + 1;
-    }
-
-    line_end_ = (char*)memchr(line_start_, '\n', buf_end_ - line_start_);
-    if (!line_end_) {
-      // No newline. Move rest of data to start of buffer, fill rest.
-      size_t already_consumed = line_start_ - buf_;
-      size_t size_rest = (buf_end_ - buf_) - already_consumed;
-      memmove(buf_, line_start_, size_rest);
-
-      size_t read = fread(buf_ + size_rest, 1, sizeof(buf_) - size_rest, file_);
-      buf_end_ = buf_ + size_rest + read;
-      line_start_ = buf_;
-      line_end_ = (char*)memchr(line_start_, '\n', buf_end_ - line_start_);
-    }
-
-    *line_start = line_start_;
-    *line_end = line_end_;
-    return true;
-  }
+BuildLog::LogEntry* BuildLog::AddEntry(StringPiece output) {
+  entry_storage_.emplace_back(output);
+  LogEntry* entry = &entry_storage_.back();
+  entries_.insert(Entries::value_type(entry->output, entry));
+  return entry;
+}
 
- private:
-  FILE* file_;
-  char buf_[256 << 10];
-  char* buf_end_;  // Points one past the last valid byte in |buf_|.
+namespace {
 
-  char* line_start_;
-  // Points at the next \n in buf_ after line_start, or NULL.
-  char* line_end_;
+/// A log line parsed in place, its output still pointing into the log.
+struct ParsedEntry {
+  StringPiece output;
+  uint64_t command_hash;
+  int start_time;
+  int end_time;
+  TimeStamp mtime;
+  TimeStamp content_mtime;
+  StringPiece content_digest;
 };
 
-LoadStatus BuildLog::Load(const string& path, string* err) {
-  METRIC_RECORD(".ninja_log load");
-  FILE* file = fopen(path.c_str(), "r");
-  if (!file) {
-    if (errno == ENOENT)
-      return LOAD_NOT_FOUND;
-    *err = strerror(errno);
-    return LOAD_ERROR;
-  }
-
-  int log_version = 0;
-  int unique_entry_count = 0;
-  int total_entry_count = 0;
-
-  LineReader reader(file);
-  char* line_start = 0;
-  char* line_end = 0;
-  while (reader.ReadLine(&line_start, &line_end)) {
-    if (!log_version) {
-      sscanf(line_start, kFileSignature, &log_version);
-
-      bool invalid_log_version = false;
-      if (log_version < kOldestSupportedVersion) {
-        invalid_log_version = true;
-        *err = "build log version is too old; starting over";
-
-      } else if (log_version > kCurrentVersion) {
-        invalid_log_version = true;
-        *err = "build log version is too new; starting over";
-      }
-      if (invalid_log_version) {
-        fclose(file);
-        unlink(path.c_str());
-        // Don't report this as a failure. A missing build log will cause
-        // us to rebuild the outputs anyway.
-        return LOAD_NOT_FOUND;
-      }
-    }
-
-    // If no newline was found in this chunk, read the next.
+/// Lines longer than this are ignored, as they were when the log was read
+/// through a buffer of this size.
+const size_t kMaxLineLength = 256 << 10;
+
+/// Parse the complete lines in [begin, end). A trailing line without a
+/// newline was cut short by an interrupted write and is ignored. The numbers
+/// are parsed without terminating them first, so the log can stay read-only:
+/// every field is followed by a tab or a newline that stops the conversion.
+void ParseLines(const char* begin, const char* end,
+                vector<ParsedEntry>* entries) {
+  const char kFieldSeparator = '\t';
+  const char* line_start = begin;
+  while (line_start < end) {
+    const char* line_end =
+        (const char*)memchr(line_start, '\n', end - line_start);
     if (!line_end)
+      break;
+    const char* start = line_start;
+    line_start = line_end + 1;
+    if (line_end - start >= (ptrdiff_t)kMaxLineLength)
       continue;
 
-    const char kFieldSeparator = '\t';
-
-    char* start = line_start;
-    char* end = (char*)memchr(start, kFieldSeparator, line_end - start);
-    if (!end)
+    ParsedEntry entry;
+    const char* field_end =
+        (const char*)memchr(start, kFieldSeparator, line_end - start);
+    if (!field_end)
       continue;
-    *end = 0;
-
-    int start_time = 0, end_time = 0;
-    TimeStamp mtime = 0;
+    entry.start_time = atoi(start);
+    start = field_end + 1;
 
-    start_time = atoi(start);
-    start = end + 1;
-
-    end = (char*)memchr(start, kFieldSeparator, line_end - start);
-    if (!end)
+    field_end = (const char*)memchr(start, kFieldSeparator, line_end - start);
+    if (!field_end)
       continue;
-    *end = 0;
-    end_time = atoi(start);
-    start = end + 1;
+    entry.end_time = atoi(start);
+    start = field_end + 1;
 
-    end = (char*)memchr(start, kFieldSeparator, line_end - start);
-    if (!end)
+    field_end = (const char*)memchr(start, kFieldSeparator, line_end - start);
+    if (!field_end)
       continue;
-    *end = 0;
-    mtime = strtoll(start, NULL, 10);
-    start = end + 1;
+    entry.mtime = strtoll(start, NULL, 10);
+    start = field_end + 1;
 
-    end = (char*)memchr(start, kFieldSeparator, line_end - start);
-    if (!end)
+    field_end = (const char*)memchr(start, kFieldSeparator, line_end - start);
+    if (!field_end)
       continue;
-    string output = string(start, end - start);
+    entry.output = StringPiece(start, field_end - start);
+
+    start = field_end + 1;
+
+    entry.command_hash = (uint64_t)strtoull(start, NULL, 16);
+    entry.content_mtime = 0;
+
+    // Since v7, outputs of "restat = hash" rules end in the mtime and the
+    // digest of their content.
+    field_end = (const char*)memchr(start, kFieldSeparator, line_end - start);
+    if (field_end) {
+      start = field_end + 1;
+      field_end =
+          (const char*)memchr(start, kFieldSeparator, line_end - start);
+      if (!field_end)
+        continue;
+      entry.content_mtime = strtoll(start, NULL, 10);
+      entry.content_digest = StringPiece(field_end + 1,
+                                         line_end - field_end - 1);
+    }
+    entries->push_back(entry);
+  }
+}
 
-    start = end + 1;
-    end = line_end;
+}  // namespace
 
-    LogEntry* entry;
-    Entries::iterator i = entries_.find(output);
-    if (i != entries_.end()) {
-      entry = i->second;
-    } else {
-      entry = new LogEntry(output);
-      entries_.insert(Entries::value_type(entry->output, entry));
-      ++unique_entry_count;
+LoadStatus BuildLog::Load(const string& path, string* err) {
+  METRIC_RECORD(".ninja_log load");
+  mapped_logs_.emplace_back();
+  MappedFile& file = mapped_logs_.back();
+  int ret = file.Open(path, err);
+  if (ret < 0) {
+    mapped_logs_.pop_back();
+    if (ret == -ENOENT) {
+      err->clear();
+      return LOAD_NOT_FOUND;
     }
-    ++total_entry_count;
-
-    entry->start_time = start_time;
-    entry->end_time = end_time;
-    entry->mtime = mtime;
-    char c = *end; *end = '\0';
-    entry->command_hash = (uint64_t)strtoull(start, NULL, 16);
-    *end = c;
+    return LOAD_ERROR;
   }
-  fclose(file);
 
-  if (!line_start) {
+  const char* begin = file.data();
+  const char* end = begin + file.size();
+  if (begin == end) {
+    mapped_logs_.pop_back();
     return LOAD_SUCCESS; // file was empty
   }
 
+  // The version header is the first line.
+  const char* header_end = (const char*)memchr(begin, '\n', end - begin);
+  header_end = header_end ? header_end + 1 : end;
+  char header[64];
+  size_t header_len = min<size_t>(header_end - begin, sizeof(header) - 1);
+  memcpy(header, begin, header_len);
+  header[header_len] = '\0';
+  int log_version = 0;
+  sscanf(header, kFileSignature, &log_version);
+
+  bool invalid_log_version = false;
+  if (log_version < kOldestSupportedVersion) {
+    invalid_log_version = true;
+    *err = "build log version is too old; starting over";
+  } else if (log_version > kCurrentVersion) {
+    invalid_log_version = true;
+    *err = "build log version is too new; starting over";
+  }
+  if (invalid_log_version) {
+    mapped_logs_.pop_back();
+    unlink(path.c_str());
+    // Don't report this as a failure. A missing build log will cause
+    // us to rebuild the outputs anyway.
+    return LOAD_NOT_FOUND;
+  }
+
+  // Split the entries at line boundaries and parse the pieces in parallel.
+  // Merging them into entries_ in file order keeps the last entry of each
+  // output, as a serial load would.
+  const size_t kMinBytesPerJob = 1 << 20;
+  const char* entries_begin = header_end;
+  size_t jobs = min<size_t>(GetOptimalThreadPoolJobCount(),
+                            (end - entries_begin) / kMinBytesPerJob + 1);
+  vector<const char*> bounds(1, entries_begin);
+  for (size_t i = 1; i < jobs; ++i) {
+    const char* split = entries_begin + (end - entries_begin) * i / jobs;
+    if (split < bounds.back())
+      split = bounds.back();
+    const char* newline = (const char*)memchr(split, '\n', end - split);
+    bounds.push_back(newline ? newline + 1 : end);
+  }
+  bounds.push_back(end);
+
+  vector<vector<ParsedEntry>> parsed(jobs);
+  vector<function<void()>> tasks;
+  for (size_t i = 0; i < jobs; ++i) {
+    tasks.push_back([&bounds, &parsed, i]() {
+      ParseLines(bounds[i], bounds[i + 1], &parsed[i]);
+    });
+  }
+  if (jobs > 1) {
+    unique_ptr<ThreadPool> pool = CreateThreadPool();
+    pool->RunTasks(move(tasks));
+  } else {
+    tasks[0]();
+  }
+
+  int unique_entry_count = 0;
+  int total_entry_count = 0;
+  for (size_t i = 0; i < jobs; ++i)
+    total_entry_count += parsed[i].size();
+  entries_.reserve(entries_.size() + total_entry_count);
+  for (size_t i = 0; i < jobs; ++i) {
+    for (const ParsedEntry& parsed_entry : parsed[i]) {
+      LogEntry* entry;
+      Entries::iterator it = entries_.find(parsed_entry.output);
+      if (it != entries_.end()) {
+        entry = it->second;
+      } else {
+        entry = AddEntry(parsed_entry.output);
+        ++unique_entry_count;
+      }
+      entry->start_time = parsed_entry.start_time;
+      entry->end_time = parsed_entry.end_time;
+      entry->mtime = parsed_entry.mtime;
+      entry->command_hash = parsed_entry.command_hash;
+      entry->content.digest.assign(parsed_entry.content_digest.str_,
+                                   parsed_entry.content_digest.len_);
+      entry->content.mtime = parsed_entry.content_mtime;
+    }
+    vector<ParsedEntry>().swap(parsed[i]);
+  }
+
   // Decide whether it's time to rebuild the log:
   // - if we're upgrading versions
   // - if it's getting large
@@ -383,10 +428,26 @@ BuildLog::LogEntry* BuildLog::LookupByOutput(const string& path) {
   return NULL;
 }
 
+void BuildLog::FormatEntry(const LogEntry& entry, string* out) {
+  char buf[128];
+  int len = snprintf(buf, sizeof(buf), "%d\t%d\t%" PRId64 "\t",
+                     entry.start_time, entry.end_time, entry.mtime);
+  out->append(buf, len);
+  out->append(entry.output.str_, entry.output.len_);
+  len = snprintf(buf, sizeof(buf), "\t%" PRIx64, entry.command_hash);
+  out->append(buf, len);
+  if (!entry.content.digest.empty()) {
+    len = snprintf(buf, sizeof(buf), "\t%" PRId64 "\t", entry.content.mtime);
+    out->append(buf, len);
+    out->append(entry.content.digest);
+  }
+  out->push_back('\n');
+}
+
 bool BuildLog::WriteEntry(FILE* f, const LogEntry& entry) {
-  return fprintf(f, "%d\t%d\t%" PRId64 "\t%s\t%" PRIx64 "\n",
-          entry.start_time, entry.end_time, entry.mtime,
-          entry.output.c_str(), entry.command_hash) > 0;
+  string line;
+  FormatEntry(entry, &line);
+  return fwrite(line.data(), 1, line.size(), f) == line.size();
 }
 
 bool BuildLog::Recompact(const string& path, const BuildLogUser& user,
@@ -466,7 +527,8 @@ bool BuildLog::Restat(const StringPiece path,
       }
     }
     if (!skip) {
-      const TimeStamp mtime = disk_interface.Stat(i->second->output, err);
+      const TimeStamp mtime = disk_interface.Stat(i->second->output.AsString(),
+                                                   err);
       if (mtime == -1) {
         fclose(f);
         return false;
@@ -15,11 +15,14 @@
 #ifndef NINJA_BUILD_LOG_H_
 #define NINJA_BUILD_LOG_H_
 
+#include <deque>
 #include <string>
+#include <vector>
 #include <stdio.h>
 
 #include "hash_map.h"
 #include "load_status.h"
+#include "log_writer.h"
 #include "timestamp.h"
 #include "util.h"  // uint64_t
 
@@ -40,6 +43,7 @@ struct BuildLogUser {
 ///    when we need to rebuild due to the command changing
 /// 2) timing information, perhaps for generating reports
 /// 3) restat information
+/// 4) content digests of outputs, for "restat = hash"
 struct BuildLog {
   BuildLog();
   ~BuildLog();
@@ -48,19 +52,35 @@ struct BuildLog {
   /// happen when/if it's needed
   bool OpenForWrite(const std::string& path, const BuildLogUser& user,
                     std::string* err);
+
+  /// The content of an output of a "restat = hash" rule: the CAS digest of
+  /// the file and the mtime the file had when it was hashed.
+  struct ContentDigest {
+    ContentDigest() : mtime(0) {}
+    std::string digest;
+    TimeStamp mtime;
+  };
+
+  /// Record a finished command. |digests|, if given, holds the content of
+  /// each of the edge's outputs.
   bool RecordCommand(Edge* edge, int start_time, int end_time,
-                     TimeStamp mtime = 0);
+                     TimeStamp mtime = 0,
+                     const std::vector<ContentDigest>* digests = NULL);
+  /// Wait until the recorded commands are on disk.
+  bool Flush();
   void Close();
 
-  /// Load the on-disk log.
+  /// Load the on-disk log. The log is memory mapped and the paths of the
+  /// loaded entries point into the mapping.
   LoadStatus Load(const std::string& path, std::string* err);
 
   struct LogEntry {
-    std::string output;
+    StringPiece output;
     uint64_t command_hash;
     int start_time;
     int end_time;
     TimeStamp mtime;
+    ContentDigest content;
 
     static uint64_t HashCommand(StringPiece command);
 
@@ -68,11 +88,12 @@ struct BuildLog {
     bool operator==(const LogEntry& o) {
       return output == o.output && command_hash == o.command_hash &&
           start_time == o.start_time && end_time == o.end_time &&
-          mtime == o.mtime;
+          mtime == o.mtime && content.digest == o.content.digest &&
+          content.mtime == o.content.mtime;
     }
 
-    explicit LogEntry(const std::string& output);
-    LogEntry(const std::string& output, uint64_t command_hash,
+    explicit LogEntry(StringPiece output);
+    LogEntry(StringPiece output, uint64_t command_hash,
              int start_time, int end_time, TimeStamp mtime);
   };
 
@@ -81,6 +102,8 @@ struct BuildLog {
 
   /// Serialize an entry into a log file.
   bool WriteEntry(FILE* f, const LogEntry& entry);
+  /// Append the log line of an entry to |out|.
+  static void FormatEntry(const LogEntry& entry, std::string* out);
 
   /// Rewrite the known log entries, throwing away old data.
   bool Recompact(const std::string& path, const BuildLogUser& user,
@@ -94,12 +117,19 @@ struct BuildLog {
   const Entries& entries() const { return entries_; }
 
  private:
-  /// Should be called before using log_file_. When false is returned, errno
-  /// will be set.
+  /// Should be called before using log_writer_. When false is returned,
+  /// errno will be set.
   bool OpenForWriteIfNeeded();
 
+  /// Add an entry for |output|, which must outlive the log.
+  LogEntry* AddEntry(StringPiece output);
+
   Entries entries_;
-  FILE* log_file_;
+  std::deque<LogEntry> entry_storage_;
+  /// Storage for the paths of entries that weren't loaded from a log file.
+  std::deque<std::string> recorded_paths_;
+  std::deque<MappedFile> mapped_logs_;
+  LogWriter log_writer_;
   std::string log_file_path_;
   bool needs_recompaction_;
 };
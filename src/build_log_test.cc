@@ -14,6 +14,7 @@
 
 #include "build_log.h"
 
+#include "thread_pool.h"
 #include "util.h"
 #include "test.h"
 
@@ -69,7 +70,36 @@ TEST_F(BuildLogTest, WriteRead) {
   ASSERT_TRUE(e2);
   ASSERT_TRUE(*e1 == *e2);
   ASSERT_EQ(15, e1->start_time);
-  ASSERT_EQ("out", e1->output);
+  ASSERT_EQ("out", e1->output.AsString());
+}
+
+TEST_F(BuildLogTest, ContentDigest) {
+  AssertParse(&state_,
+"build out1 out2: cat in\n");
+
+  BuildLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, *this, &err));
+  ASSERT_EQ("", err);
+  vector<BuildLog::ContentDigest> digests(2);
+  digests[0].digest = "abc/3";
+  digests[0].mtime = 7;
+  log1.RecordCommand(state_.edges_[0], 15, 18, 9, &digests);
+  log1.Close();
+
+  BuildLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  BuildLog::LogEntry* e = log2.LookupByOutput("out1");
+  ASSERT_TRUE(e);
+  EXPECT_TRUE(*e == *log1.LookupByOutput("out1"));
+  EXPECT_EQ("abc/3", e->content.digest);
+  EXPECT_EQ(7, e->content.mtime);
+  EXPECT_EQ(9, e->mtime);
+  e = log2.LookupByOutput("out2");
+  ASSERT_TRUE(e);
+  EXPECT_EQ("", e->content.digest);
+  EXPECT_EQ(0, e->content.mtime);
 }
 
 TEST_F(BuildLogTest, FirstWriteAddsSignature) {
@@ -121,6 +151,39 @@ TEST_F(BuildLogTest, DoubleEntry) {
   ASSERT_NO_FATAL_FAILURE(AssertHash("command def", e->command_hash));
 }
 
+TEST_F(BuildLogTest, ParallelLoad) {
+  // Enough lines to split the log across threads. Every output is written
+  // twice, in different pieces, and the later entry must win.
+  const int kNumOutputs = 20000;
+  FILE* f = fopen(kTestFilename, "wb");
+  fprintf(f, "# ninja log v6\n");
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < kNumOutputs; ++i) {
+      fprintf(f, "%d\t%d\t%d\tsome/fairly/long/output/directory/out%d.o\t%x\n",
+              round, i, round, i, round * kNumOutputs + i);
+    }
+  }
+  fclose(f);
+
+  SetThreadPoolThreadCount(4);
+  string err;
+  BuildLog log;
+  EXPECT_TRUE(log.Load(kTestFilename, &err));
+  SetThreadPoolThreadCount(1);
+  ASSERT_EQ("", err);
+
+  ASSERT_EQ((size_t)kNumOutputs, log.entries().size());
+  for (int i = 0; i < kNumOutputs; i += 997) {
+    char path[80];
+    sprintf(path, "some/fairly/long/output/directory/out%d.o", i);
+    BuildLog::LogEntry* e = log.LookupByOutput(path);
+    ASSERT_TRUE(e);
+    EXPECT_EQ(1, e->start_time);
+    EXPECT_EQ(i, e->end_time);
+    EXPECT_EQ((uint64_t)(kNumOutputs + i), e->command_hash);
+  }
+}
+
 TEST_F(BuildLogTest, Truncate) {
   AssertParse(&state_,
 "build out: cat mid\n"
@@ -317,8 +380,8 @@ TEST_F(BuildLogTest, MultiTargetEdge) {
   ASSERT_TRUE(e1);
   BuildLog::LogEntry* e2 = log.LookupByOutput("out.d");
   ASSERT_TRUE(e2);
-  ASSERT_EQ("out", e1->output);
-  ASSERT_EQ("out.d", e2->output);
+  ASSERT_EQ("out", e1->output.AsString());
+  ASSERT_EQ("out.d", e2->output.AsString());
   ASSERT_EQ(21, e1->start_time);
   ASSERT_EQ(21, e2->start_time);
   ASSERT_EQ(22, e2->end_time);
@@ -0,0 +1,345 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the build loop's own overhead: planning, scheduling, status
+// updates and log writes, with commands that finish instantly, as they
+// nearly do when they are cached remotely.
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <deque>
+#include <new>
+#include <string>
+
+#include "build.h"
+#include "build_log.h"
+#include "deps_log.h"
+#include "disk_interface.h"
+#include "graph.h"
+#include "manifest_parser.h"
+#include "metrics.h"
+#include "state.h"
+#include "status.h"
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+std::atomic<uint64_t> g_allocations(0);
+
+}  // namespace
+
+// Count allocations, so that per-edge allocations show up in the results.
+void* operator new(size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  free(p);
+}
+
+namespace {
+
+const char kBuildLogFilename[] = "BuildPerfTest-tempfile";
+
+/// A graph shape to build: its manifest and how many edges it has.
+struct Shape {
+  const char* name;
+  string manifest;
+  int edges;
+};
+
+const char kRules[] =
+    "rule cc\n"
+    "  command = cc -c $in -o $out\n"
+    "  description = CC $out\n";
+
+string Path(const char* dir, int i, int j) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "obj/%s/%d/file_%d.o", dir, i, j);
+  return buf;
+}
+
+/// Independent edges, all wanted by one target.
+Shape Wide(int n) {
+  Shape shape = { "wide", kRules, n };
+  string all = "build all: phony";
+  for (int i = 0; i < n; ++i) {
+    string out = Path("wide", i % 100, i);
+    shape.manifest += "build " + out + ": cc src/wide/" + to_string(i) + ".c\n";
+    all += " " + out;
+  }
+  shape.manifest += all + "\n";
+  return shape;
+}
+
+/// |chains| chains of |length| edges, each using the output of the one
+/// before.
+Shape Deep(int chains, int length) {
+  Shape shape = { "deep", kRules, chains * length };
+  string all = "build all: phony";
+  for (int i = 0; i < chains; ++i) {
+    shape.manifest += "build " + Path("deep", i, 0) + ": cc src/deep/" +
+                      to_string(i) + ".c\n";
+    for (int j = 1; j < length; ++j) {
+      shape.manifest += "build " + Path("deep", i, j) + ": cc " +
+                        Path("deep", i, j - 1) + "\n";
+    }
+    all += " " + Path("deep", i, length - 1);
+  }
+  shape.manifest += all + "\n";
+  return shape;
+}
+
+/// Layers of |width| edges, each using three outputs of the layer before,
+/// so that edges become ready in waves.
+Shape Diamond(int width, int depth) {
+  Shape shape = { "diamond", kRules, width * depth };
+  for (int j = 0; j < width; ++j) {
+    shape.manifest += "build " + Path("diamond", 0, j) + ": cc src/diamond/" +
+                      to_string(j) + ".c\n";
+  }
+  for (int i = 1; i < depth; ++i) {
+    for (int j = 0; j < width; ++j) {
+      shape.manifest += "build " + Path("diamond", i, j) + ": cc " +
+                        Path("diamond", i - 1, j) + " " +
+                        Path("diamond", i - 1, (j + 1) % width) + " " +
+                        Path("diamond", i - 1, (j + width / 2) % width) + "\n";
+    }
+  }
+  string all = "build all: phony";
+  for (int j = 0; j < width; ++j)
+    all += " " + Path("diamond", depth - 1, j);
+  shape.manifest += all + "\n";
+  return shape;
+}
+
+/// A disk where every file has the same mtime, except that outputs are
+/// missing while the build is planned, so that everything is dirty.
+struct FakeDiskInterface : public DiskInterface {
+  FakeDiskInterface() : built_(false) {}
+
+  virtual TimeStamp Stat(const string& path, string* err) const {
+    return !built_ && path.compare(0, 4, "obj/") == 0 ? 0 : 1;
+  }
+  virtual bool MakeDir(const string& path) { return true; }
+  virtual bool WriteFile(const string& path, const string& contents) {
+    return true;
+  }
+  virtual int RemoveFile(const string& path) { return 1; }
+  virtual Status ReadFile(const string& path, string* contents, string* err) {
+    return NotFound;
+  }
+
+  bool built_;
+};
+
+/// Runs up to |parallelism| commands, each finishing as soon as it's
+/// waited for.
+struct InstantCommandRunner : public CommandRunner {
+  explicit InstantCommandRunner(size_t parallelism)
+      : parallelism_(parallelism) {}
+
+  virtual size_t CanRunMore() const {
+    return parallelism_ - running_.size();
+  }
+  virtual bool StartCommand(Edge* edge) {
+    running_.push_back(edge);
+    return true;
+  }
+  virtual bool WaitForCommand(Result* result) {
+    if (running_.empty())
+      return false;
+    result->edge = running_.front();
+    result->status = ExitSuccess;
+    running_.pop_front();
+    return true;
+  }
+
+  size_t parallelism_;
+  deque<Edge*> running_;
+};
+
+/// Forwards to a StatusPrinter, timing the calls made for each edge.
+struct TimedStatus : public Status {
+  explicit TimedStatus(const BuildConfig& config)
+      : printer_(config), seconds_(0) {}
+
+  virtual void EdgeAddedToPlan(const Edge* edge) {
+    printer_.EdgeAddedToPlan(edge);
+  }
+  virtual void EdgeRemovedFromPlan(const Edge* edge) {
+    printer_.EdgeRemovedFromPlan(edge);
+  }
+  virtual void BuildEdgeStarted(const Edge* edge, int64_t start_time_millis) {
+    Stopwatch stopwatch;
+    stopwatch.Restart();
+    printer_.BuildEdgeStarted(edge, start_time_millis);
+    seconds_ += stopwatch.Elapsed();
+  }
+  virtual void BuildEdgeFinished(Edge* edge, int64_t start_time_millis,
+                                 int64_t end_time_millis, bool success,
+                                 const string& output) {
+    Stopwatch stopwatch;
+    stopwatch.Restart();
+    printer_.BuildEdgeFinished(edge, start_time_millis, end_time_millis,
+                               success, output);
+    seconds_ += stopwatch.Elapsed();
+  }
+  virtual void BuildLoadDyndeps() { printer_.BuildLoadDyndeps(); }
+  virtual void BuildStarted() { printer_.BuildStarted(); }
+  virtual void BuildFinished() { printer_.BuildFinished(); }
+
+  virtual void Info(const char* msg, ...) {
+    char buf[1024];
+    va_list ap;
+    va_start(ap, msg);
+    vsnprintf(buf, sizeof(buf), msg, ap);
+    va_end(ap);
+    printer_.Info("%s", buf);
+  }
+  virtual void Warning(const char* msg, ...) {
+    char buf[1024];
+    va_list ap;
+    va_start(ap, msg);
+    vsnprintf(buf, sizeof(buf), msg, ap);
+    va_end(ap);
+    printer_.Warning("%s", buf);
+  }
+  virtual void Error(const char* msg, ...) {
+    char buf[1024];
+    va_list ap;
+    va_start(ap, msg);
+    vsnprintf(buf, sizeof(buf), msg, ap);
+    va_end(ap);
+    printer_.Error("%s", buf);
+  }
+
+  StatusPrinter printer_;
+  double seconds_;
+};
+
+struct NoDeadPaths : public BuildLogUser {
+  virtual bool IsPathDead(StringPiece) const { return false; }
+};
+
+/// The times of one build of a shape, in milliseconds.
+struct Run {
+  double parse, plan, build, status;
+  uint64_t allocations;
+};
+
+bool BuildShape(const Shape& shape, Run* run, string* err) {
+  unlink(kBuildLogFilename);
+  State state;
+  Stopwatch stopwatch;
+  stopwatch.Restart();
+  ManifestParser parser(&state, NULL);
+  if (!parser.ParseTest(shape.manifest, err))
+    return false;
+  run->parse = stopwatch.Elapsed() * 1000;
+
+  BuildLog build_log;
+  DepsLog deps_log;
+  if (!build_log.OpenForWrite(kBuildLogFilename, NoDeadPaths(), err))
+    return false;
+
+  BuildConfig config;
+  config.parallelism = 1000;
+  FakeDiskInterface disk_interface;
+  TimedStatus status(config);
+  Builder builder(&state, config, &build_log, &deps_log, &disk_interface,
+                  &status, GetTimeMillis());
+  builder.command_runner_.reset(new InstantCommandRunner(config.parallelism));
+
+  stopwatch.Restart();
+  if (!builder.AddTarget("all", err))
+    return false;
+  run->plan = stopwatch.Elapsed() * 1000;
+  if (builder.plan_.command_edge_count() != shape.edges) {
+    *err = "unexpected number of edges to build";
+    return false;
+  }
+
+  // The status lines go to /dev/null, as they would to a terminal.
+  fflush(stdout);
+  int saved_stdout = dup(1);
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, 1);
+  close(null_fd);
+
+  disk_interface.built_ = true;
+  uint64_t allocations = g_allocations;
+  stopwatch.Restart();
+  bool ok = builder.Build(err);
+  build_log.Close();
+  run->build = stopwatch.Elapsed() * 1000;
+  run->allocations = g_allocations - allocations;
+  run->status = status.seconds_ * 1000;
+
+  fflush(stdout);
+  dup2(saved_stdout, 1);
+  close(saved_stdout);
+  unlink(kBuildLogFilename);
+  return ok;
+}
+
+}  // anonymous namespace
+
+int main() {
+  g_metrics = new Metrics;
+
+  Shape shapes[] = { Wide(100000), Deep(10, 2000), Diamond(200, 250) };
+  const int kNumRepetitions = 3;
+  for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); ++s) {
+    const Shape& shape = shapes[s];
+    Run best = { -1, -1, -1, -1, 0 };
+    for (int i = 0; i < kNumRepetitions; ++i) {
+      Run run;
+      string err;
+      if (!BuildShape(shape, &run, &err)) {
+        fprintf(stderr, "Failed to build %s: %s\n", shape.name, err.c_str());
+        return 1;
+      }
+      printf("%-8s %6d edges: parse %4.0fms  plan %4.0fms  build %5.0fms "
+             "(status %4.0fms)  %6.0f edges/s  %5.1f allocations/edge\n",
+             shape.name, shape.edges, run.parse, run.plan, run.build,
+             run.status, shape.edges / run.build * 1000,
+             (double)run.allocations / shape.edges);
+      if (best.build < 0 || run.build < best.build)
+        best = run;
+    }
+    printf("min: %s build %.0fms, %.0f edges/s\n", shape.name, best.build,
+           shape.edges / best.build * 1000);
+  }
+
+  // Where the build loop's time went, over all the builds above.
+  printf("\n");
+  g_metrics->Report();
+  return 0;
+}
@@ -122,6 +122,39 @@ TEST_F(PlanTest, DoubleOutputDirect) {
 }
 
 // Test that two outputs from one rule can eventually be routed to another.
+// An edge whose inputs finish in any order is ready only after the last.
+TEST_F(PlanTest, InputsFinishOutOfOrder) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat mid1 mid2 mid3 mid4\n"
+"build mid1: cat in\n"
+"build mid2: cat in\n"
+"build mid3: cat in\n"
+"build mid4: cat in\n"));
+  GetNode("mid1")->MarkDirty();
+  GetNode("mid2")->MarkDirty();
+  GetNode("mid3")->MarkDirty();
+  GetNode("mid4")->MarkDirty();
+  GetNode("out")->MarkDirty();
+  PrepareForTarget("out");
+
+  deque<Edge*> edges;
+  FindWorkSorted(&edges, 4);
+  const int order[] = { 0, 2, 3, 1 };
+  string err;
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_FALSE(plan_.FindWork());
+    plan_.EdgeFinished(edges[order[i]], Plan::kEdgeSucceeded, &err);
+    ASSERT_EQ("", err);
+  }
+
+  Edge* edge = plan_.FindWork();
+  ASSERT_TRUE(edge);
+  ASSERT_EQ("out", edge->outputs_[0]->path());
+  plan_.EdgeFinished(edge, Plan::kEdgeSucceeded, &err);
+  ASSERT_EQ("", err);
+  ASSERT_FALSE(plan_.more_to_do());
+}
+
 TEST_F(PlanTest, DoubleOutputIndirect) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out: cat b1 b2\n"
@@ -526,8 +559,11 @@ struct FakeCommandRunner : public CommandRunner {
   virtual bool WaitForCommand(Result* result) override;
   virtual vector<Edge*> GetActiveEdges() override;
   virtual void Abort() override;
+  virtual bool WaitForBackgroundWork(string* err) override;
 
   vector<string> commands_ran_;
+  /// If set, what WaitForBackgroundWork() reports as failed.
+  string background_err_;
   vector<Edge*> active_edges_;
   size_t max_active_edges_;
   VirtualFileSystem* fs_;
@@ -801,6 +837,11 @@ void FakeCommandRunner::Abort() {
   active_edges_.clear();
 }
 
+bool FakeCommandRunner::WaitForBackgroundWork(string* err) {
+  *err = background_err_;
+  return background_err_.empty();
+}
+
 void BuildTest::Dirty(const string& path) {
   Node* node = GetNode(path);
   node->MarkDirty();
@@ -830,6 +871,19 @@ TEST_F(BuildTest, OneStep) {
   EXPECT_EQ("cat in1 > cat1", command_runner_.commands_ran_[0]);
 }
 
+TEST_F(BuildTest, BackgroundWorkFails) {
+  // Work finishing after its edge was reported done, like downloading an
+  // output, still fails the build.
+  command_runner_.background_err_ = "downloading cat1: connection reset";
+  Dirty("cat1");
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("cat1", &err));
+  ASSERT_EQ("", err);
+  EXPECT_FALSE(builder_.Build(&err));
+  EXPECT_EQ("downloading cat1: connection reset", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+}
+
 TEST_F(BuildTest, OneStep2) {
   // Given a target with one dirty input,
   // we should rebuild the target.
@@ -1780,6 +1834,71 @@ TEST_F(BuildWithLogTest, RestatTest) {
   ASSERT_EQ(2u, command_runner_.commands_ran_.size());
 }
 
+TEST_F(BuildWithLogTest, RestatHash) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cp\n"
+"  command = cp $in $out\n"
+"  restat = hash\n"
+"build gen: cp in\n"
+"build out: cat gen\n"));
+
+  fs_.Create("in", "1");
+  string err;
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(2u, command_runner_.commands_ran_.size());
+  TimeStamp gen_mtime = fs_.files_["gen"].mtime;
+
+  // "cp" rewrites gen with the same content, so out is clean and gen gets
+  // its mtime back.
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  fs_.Tick();
+  fs_.Create("in", "1");
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  ASSERT_EQ(1u, command_runner_.commands_ran_.size());
+  EXPECT_EQ("cp in gen", command_runner_.commands_ran_[0]);
+  EXPECT_EQ(gen_mtime, fs_.files_["gen"].mtime);
+
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.AlreadyUpToDate());
+
+  // New content propagates.
+  fs_.Tick();
+  fs_.Create("in", "2");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(2u, command_runner_.commands_ran_.size());
+
+  // An output changed behind ninja's back isn't compared with the digest
+  // it had when ninja last wrote it.
+  fs_.Tick();
+  fs_.Create("gen", "3");
+  fs_.Tick();
+  fs_.Create("out", "");
+  fs_.Tick();
+  fs_.Create("in", "2");
+  command_runner_.commands_ran_.clear();
+  state_.Reset();
+  EXPECT_TRUE(builder_.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(builder_.Build(&err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(2u, command_runner_.commands_ran_.size());
+}
+
 TEST_F(BuildWithLogTest, RestatMissingFile) {
   // If a restat rule doesn't create its output, and the output didn't
   // exist before the rule was run, consider that behavior equivalent
@@ -2346,14 +2465,14 @@ TEST_F(BuildWithQueryDepsLogTest, TwoOutputsDepFileMSVC) {
   EXPECT_EQ("echo 'using in1' && for file in out1 out2; do cp in1 $file; done", command_runner_.commands_ran_[0]);
 
   Node* out1_node = state_.LookupNode("out1");
-  DepsLog::Deps* out1_deps = log_.GetDeps(out1_node);
-  EXPECT_EQ(1, out1_deps->node_count);
-  EXPECT_EQ("in1", out1_deps->nodes[0]->path());
+  DepsLog::Deps out1_deps = log_.GetDeps(out1_node);
+  EXPECT_EQ(1, out1_deps.node_count);
+  EXPECT_EQ("in1", out1_deps.nodes[0]->path());
 
   Node* out2_node = state_.LookupNode("out2");
-  DepsLog::Deps* out2_deps = log_.GetDeps(out2_node);
-  EXPECT_EQ(1, out2_deps->node_count);
-  EXPECT_EQ("in1", out2_deps->nodes[0]->path());
+  DepsLog::Deps out2_deps = log_.GetDeps(out2_node);
+  EXPECT_EQ(1, out2_deps.node_count);
+  EXPECT_EQ("in1", out2_deps.nodes[0]->path());
 }
 
 /// Test a GCC-style deps log with multiple outputs.
@@ -2375,16 +2494,16 @@ TEST_F(BuildWithQueryDepsLogTest, TwoOutputsDepFileGCCOneLine) {
   EXPECT_EQ("echo 'out1 out2: in1 in2' > in.d && for file in out1 out2; do cp in1 $file; done", command_runner_.commands_ran_[0]);
 
   Node* out1_node = state_.LookupNode("out1");
-  DepsLog::Deps* out1_deps = log_.GetDeps(out1_node);
-  EXPECT_EQ(2, out1_deps->node_count);
-  EXPECT_EQ("in1", out1_deps->nodes[0]->path());
-  EXPECT_EQ("in2", out1_deps->nodes[1]->path());
+  DepsLog::Deps out1_deps = log_.GetDeps(out1_node);
+  EXPECT_EQ(2, out1_deps.node_count);
+  EXPECT_EQ("in1", out1_deps.nodes[0]->path());
+  EXPECT_EQ("in2", out1_deps.nodes[1]->path());
 
   Node* out2_node = state_.LookupNode("out2");
-  DepsLog::Deps* out2_deps = log_.GetDeps(out2_node);
-  EXPECT_EQ(2, out2_deps->node_count);
-  EXPECT_EQ("in1", out2_deps->nodes[0]->path());
-  EXPECT_EQ("in2", out2_deps->nodes[1]->path());
+  DepsLog::Deps out2_deps = log_.GetDeps(out2_node);
+  EXPECT_EQ(2, out2_deps.node_count);
+  EXPECT_EQ("in1", out2_deps.nodes[0]->path());
+  EXPECT_EQ("in2", out2_deps.nodes[1]->path());
 }
 
 /// Test a GCC-style deps log with multiple outputs using a line per input.
@@ -2406,16 +2525,16 @@ TEST_F(BuildWithQueryDepsLogTest, TwoOutputsDepFileGCCMultiLineInput) {
   EXPECT_EQ("echo 'out1 out2: in1\\nout1 out2: in2' > in.d && for file in out1 out2; do cp in1 $file; done", command_runner_.commands_ran_[0]);
 
   Node* out1_node = state_.LookupNode("out1");
-  DepsLog::Deps* out1_deps = log_.GetDeps(out1_node);
-  EXPECT_EQ(2, out1_deps->node_count);
-  EXPECT_EQ("in1", out1_deps->nodes[0]->path());
-  EXPECT_EQ("in2", out1_deps->nodes[1]->path());
+  DepsLog::Deps out1_deps = log_.GetDeps(out1_node);
+  EXPECT_EQ(2, out1_deps.node_count);
+  EXPECT_EQ("in1", out1_deps.nodes[0]->path());
+  EXPECT_EQ("in2", out1_deps.nodes[1]->path());
 
   Node* out2_node = state_.LookupNode("out2");
-  DepsLog::Deps* out2_deps = log_.GetDeps(out2_node);
-  EXPECT_EQ(2, out2_deps->node_count);
-  EXPECT_EQ("in1", out2_deps->nodes[0]->path());
-  EXPECT_EQ("in2", out2_deps->nodes[1]->path());
+  DepsLog::Deps out2_deps = log_.GetDeps(out2_node);
+  EXPECT_EQ(2, out2_deps.node_count);
+  EXPECT_EQ("in1", out2_deps.nodes[0]->path());
+  EXPECT_EQ("in2", out2_deps.nodes[1]->path());
 }
 
 /// Test a GCC-style deps log with multiple outputs using a line per output.
@@ -2437,16 +2556,16 @@ TEST_F(BuildWithQueryDepsLogTest, TwoOutputsDepFileGCCMultiLineOutput) {
   EXPECT_EQ("echo 'out1: in1 in2\\nout2: in1 in2' > in.d && for file in out1 out2; do cp in1 $file; done", command_runner_.commands_ran_[0]);
 
   Node* out1_node = state_.LookupNode("out1");
-  DepsLog::Deps* out1_deps = log_.GetDeps(out1_node);
-  EXPECT_EQ(2, out1_deps->node_count);
-  EXPECT_EQ("in1", out1_deps->nodes[0]->path());
-  EXPECT_EQ("in2", out1_deps->nodes[1]->path());
+  DepsLog::Deps out1_deps = log_.GetDeps(out1_node);
+  EXPECT_EQ(2, out1_deps.node_count);
+  EXPECT_EQ("in1", out1_deps.nodes[0]->path());
+  EXPECT_EQ("in2", out1_deps.nodes[1]->path());
 
   Node* out2_node = state_.LookupNode("out2");
-  DepsLog::Deps* out2_deps = log_.GetDeps(out2_node);
-  EXPECT_EQ(2, out2_deps->node_count);
-  EXPECT_EQ("in1", out2_deps->nodes[0]->path());
-  EXPECT_EQ("in2", out2_deps->nodes[1]->path());
+  DepsLog::Deps out2_deps = log_.GetDeps(out2_node);
+  EXPECT_EQ(2, out2_deps.node_count);
+  EXPECT_EQ("in1", out2_deps.nodes[0]->path());
+  EXPECT_EQ("in2", out2_deps.nodes[1]->path());
 }
 
 /// Test a GCC-style deps log with multiple outputs mentioning only the main output.
@@ -2468,16 +2587,16 @@ TEST_F(BuildWithQueryDepsLogTest, TwoOutputsDepFileGCCOnlyMainOutput) {
   EXPECT_EQ("echo 'out1: in1 in2' > in.d && for file in out1 out2; do cp in1 $file; done", command_runner_.commands_ran_[0]);
 
   Node* out1_node = state_.LookupNode("out1");
-  DepsLog::Deps* out1_deps = log_.GetDeps(out1_node);
-  EXPECT_EQ(2, out1_deps->node_count);
-  EXPECT_EQ("in1", out1_deps->nodes[0]->path());
-  EXPECT_EQ("in2", out1_deps->nodes[1]->path());
+  DepsLog::Deps out1_deps = log_.GetDeps(out1_node);
+  EXPECT_EQ(2, out1_deps.node_count);
+  EXPECT_EQ("in1", out1_deps.nodes[0]->path());
+  EXPECT_EQ("in2", out1_deps.nodes[1]->path());
 
   Node* out2_node = state_.LookupNode("out2");
-  DepsLog::Deps* out2_deps = log_.GetDeps(out2_node);
-  EXPECT_EQ(2, out2_deps->node_count);
-  EXPECT_EQ("in1", out2_deps->nodes[0]->path());
-  EXPECT_EQ("in2", out2_deps->nodes[1]->path());
+  DepsLog::Deps out2_deps = log_.GetDeps(out2_node);
+  EXPECT_EQ(2, out2_deps.node_count);
+  EXPECT_EQ("in1", out2_deps.nodes[0]->path());
+  EXPECT_EQ("in2", out2_deps.nodes[1]->path());
 }
 
 /// Test a GCC-style deps log with multiple outputs mentioning only the secondary output.
@@ -2501,16 +2620,16 @@ TEST_F(BuildWithQueryDepsLogTest, TwoOutputsDepFileGCCOnlySecondaryOutput) {
   EXPECT_EQ("echo 'out2: in1 in2' > in.d && for file in out1 out2; do cp in1 $file; done", command_runner_.commands_ran_[0]);
 
   Node* out1_node = state_.LookupNode("out1");
-  DepsLog::Deps* out1_deps = log_.GetDeps(out1_node);
-  EXPECT_EQ(2, out1_deps->node_count);
-  EXPECT_EQ("in1", out1_deps->nodes[0]->path());
-  EXPECT_EQ("in2", out1_deps->nodes[1]->path());
+  DepsLog::Deps out1_deps = log_.GetDeps(out1_node);
+  EXPECT_EQ(2, out1_deps.node_count);
+  EXPECT_EQ("in1", out1_deps.nodes[0]->path());
+  EXPECT_EQ("in2", out1_deps.nodes[1]->path());
 
   Node* out2_node = state_.LookupNode("out2");
-  DepsLog::Deps* out2_deps = log_.GetDeps(out2_node);
-  EXPECT_EQ(2, out2_deps->node_count);
-  EXPECT_EQ("in1", out2_deps->nodes[0]->path());
-  EXPECT_EQ("in2", out2_deps->nodes[1]->path());
+  DepsLog::Deps out2_deps = log_.GetDeps(out2_node);
+  EXPECT_EQ(2, out2_deps.node_count);
+  EXPECT_EQ("in1", out2_deps.nodes[0]->path());
+  EXPECT_EQ("in2", out2_deps.nodes[1]->path());
 }
 
 /// Tests of builds involving deps logs necessarily must span
@@ -2707,6 +2826,53 @@ TEST_F(BuildWithDepsLogTest, DepsIgnoredInDryRun) {
   builder.command_runner_.release();
 }
 
+// The records of a build are on disk once Build() returns, though the logs
+// are written in the background and are still open.
+TEST_F(BuildWithDepsLogTest, LogsWrittenWhenBuildEnds) {
+  string err;
+  const char* manifest =
+      "build out: cat in1\n"
+      "  deps = gcc\n"
+      "  depfile = in1.d\n";
+
+  State state;
+  ASSERT_NO_FATAL_FAILURE(AddCatRule(&state));
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state, manifest));
+
+  BuildLog build_log;
+  ASSERT_TRUE(build_log.OpenForWrite(build_log_file_.path(), *this, &err));
+  DepsLog deps_log;
+  ASSERT_TRUE(deps_log.OpenForWrite(deps_log_file_.path(), &err));
+
+  Builder builder(&state, config_, &build_log, &deps_log, &fs_, &status_, 0);
+  builder.command_runner_.reset(&command_runner_);
+  EXPECT_TRUE(builder.AddTarget("out", &err));
+  ASSERT_EQ("", err);
+  fs_.Create("in1.d", "out: in2");
+  EXPECT_TRUE(builder.Build(&err));
+  EXPECT_EQ("", err);
+  builder.command_runner_.release();
+
+  BuildLog reloaded_build_log;
+  ASSERT_EQ(LOAD_SUCCESS, reloaded_build_log.Load(build_log_file_.path(), &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(reloaded_build_log.LookupByOutput("out"));
+
+  State reloaded_state;
+  ASSERT_NO_FATAL_FAILURE(AddCatRule(&reloaded_state));
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&reloaded_state, manifest));
+  DepsLog reloaded_deps_log;
+  ASSERT_EQ(LOAD_SUCCESS,
+            reloaded_deps_log.Load(deps_log_file_.path(), &reloaded_state,
+                                   &err));
+  ASSERT_EQ("", err);
+  DepsLog::Deps deps =
+      reloaded_deps_log.GetDeps(reloaded_state.LookupNode("out"));
+  ASSERT_TRUE(deps);
+  ASSERT_EQ(1, deps.node_count);
+  EXPECT_EQ("in2", deps.nodes[0]->path());
+}
+
 TEST_F(BuildWithDepsLogTest, TestInputMtimeRaceCondition) {
   string err;
   const char* manifest =
@@ -0,0 +1,82 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Parses the GCC command lines of many edges of one rule, which differ only
+// in their source and output paths, with and without the parse cache.
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "metrics.h"
+#include "remote_executor/compile_command_parser.h"
+
+using namespace std;
+using RemoteExecutor::CompileCommandParser;
+
+namespace {
+
+const int kEdges = 1000;
+
+vector<string> MakeCommand(int edge) {
+  const string name = "src/module" + to_string(edge % 37) + "/file" +
+                      to_string(edge);
+  vector<string> command = { "/usr/bin/c++" };
+  const char* const kFlags[] = {
+    "-DNDEBUG", "-D_FILE_OFFSET_BITS=64", "-DUSE_PPOLL=1",
+    "-DCLOUD_BUILD_SUPPORT", "-I../src", "-I../third_party/include",
+    "-I/usr/include/uuid", "-isystem", "/usr/local/include", "-O2", "-g",
+    "-fPIC", "-std=gnu++14", "-Wall", "-Wextra", "-Wno-unused-parameter",
+    "-fdiagnostics-color=always", "-pthread",
+  };
+  command.insert(command.end(), begin(kFlags), end(kFlags));
+  const vector<string> positional = {
+    "-MD", "-MT", "obj/" + name + ".o", "-MF", "obj/" + name + ".o.d",
+    "-o", "obj/" + name + ".o", "-c", "../" + name + ".cc",
+  };
+  command.insert(command.end(), positional.begin(), positional.end());
+  return command;
+}
+
+template <typename Parse>
+int Measure(const vector<vector<string>>& commands, Parse parse) {
+  int64_t start = GetTimeMillis();
+  size_t guard = 0;
+  for (int rep = 0; rep < 100; ++rep) {
+    for (const auto& command : commands)
+      guard += parse(command).deps_command.size();
+  }
+  if (guard == 0)
+    printf("no deps command\n");
+  return (int)(GetTimeMillis() - start);
+}
+
+}  // namespace
+
+int main() {
+  vector<vector<string>> commands;
+  for (int i = 0; i < kEdges; ++i)
+    commands.push_back(MakeCommand(i));
+
+  const int parses = 100 * kEdges;
+  int uncached = Measure(commands, CompileCommandParser::ParseCommandUncached);
+  printf("uncached: %d parses in %dms avg %.2fus\n", parses, uncached,
+         float(uncached * 1000) / parses);
+  CompileCommandParser::ClearParseCache();
+  int cached = Measure(commands, CompileCommandParser::ParseCommand);
+  printf("cached:   %d parses in %dms avg %.2fus\n", parses, cached,
+         float(cached * 1000) / parses);
+  return 0;
+}
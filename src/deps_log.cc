@@ -51,7 +51,7 @@ bool DepsLog::OpenForWrite(const string& path, string* err) {
       return false;
   }
 
-  assert(!file_);
+  assert(!writer_.is_open());
   file_path_ = path;  // we don't actually open the file right now, but will do
                       // so on the first write attempt
   return true;
@@ -84,14 +84,14 @@ bool DepsLog::RecordDeps(Node* node, TimeStamp mtime,
 
   // See if the new data is different than the existing data, if any.
   if (!made_change) {
-    Deps* deps = GetDeps(node);
+    Deps deps = GetDeps(node);
     if (!deps ||
-        deps->mtime != mtime ||
-        deps->node_count != node_count) {
+        deps.mtime != mtime ||
+        deps.node_count != node_count) {
       made_change = true;
     } else {
       for (int i = 0; i < node_count; ++i) {
-        if (deps->nodes[i] != nodes[i]) {
+        if (deps.nodes[i] != nodes[i]) {
           made_change = true;
           break;
         }
@@ -114,116 +114,121 @@ bool DepsLog::RecordDeps(Node* node, TimeStamp mtime,
     return false;
   }
   size |= 0x80000000;  // Deps record: set high bit.
-  if (fwrite(&size, 4, 1, file_) < 1)
-    return false;
   int id = node->id();
-  if (fwrite(&id, 4, 1, file_) < 1)
-    return false;
-  uint32_t mtime_part = static_cast<uint32_t>(mtime & 0xffffffff);
-  if (fwrite(&mtime_part, 4, 1, file_) < 1)
-    return false;
-  mtime_part = static_cast<uint32_t>((mtime >> 32) & 0xffffffff);
-  if (fwrite(&mtime_part, 4, 1, file_) < 1)
-    return false;
+  uint32_t mtime_lo = static_cast<uint32_t>(mtime & 0xffffffff);
+  uint32_t mtime_hi = static_cast<uint32_t>((mtime >> 32) & 0xffffffff);
+  string record;
+  record.reserve(4 * (4 + node_count));
+  record.append(reinterpret_cast<const char*>(&size), 4);
+  record.append(reinterpret_cast<const char*>(&id), 4);
+  record.append(reinterpret_cast<const char*>(&mtime_lo), 4);
+  record.append(reinterpret_cast<const char*>(&mtime_hi), 4);
   for (int i = 0; i < node_count; ++i) {
     id = nodes[i]->id();
-    if (fwrite(&id, 4, 1, file_) < 1)
-      return false;
+    record.append(reinterpret_cast<const char*>(&id), 4);
   }
-  if (fflush(file_) != 0)
+  if (!writer_.Append(record))
     return false;
 
   // Update in-memory representation.
-  Deps* deps = new Deps(mtime, node_count);
+  size_t offset = mapped_log_.size() / 4 + dep_ids_.size();
   for (int i = 0; i < node_count; ++i)
-    deps->nodes[i] = nodes[i];
-  UpdateDeps(node->id(), deps);
+    dep_ids_.push_back(nodes[i]->id());
+  UpdateDeps(node->id(), mtime, offset, node_count);
 
   return true;
 }
 
+bool DepsLog::Flush() {
+  return writer_.Flush();
+}
+
 void DepsLog::Close() {
   OpenForWriteIfNeeded();  // create the file even if nothing has been recorded
-  if (file_)
-    fclose(file_);
-  file_ = NULL;
+  writer_.Close();
 }
 
 LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
   METRIC_RECORD(".ninja_deps load");
-  char buf[kMaxRecordSize + 1];
-  FILE* f = fopen(path.c_str(), "rb");
-  if (!f) {
-    if (errno == ENOENT)
+  assert(!mapped_log_.data() && "a deps log can only be loaded once");
+  int ret = mapped_log_.Open(path, err);
+  if (ret < 0) {
+    if (ret == -ENOENT) {
+      err->clear();
       return LOAD_NOT_FOUND;
-    *err = strerror(errno);
+    }
     return LOAD_ERROR;
   }
+  const char* data = mapped_log_.data();
+  const size_t size = mapped_log_.size();
 
-  bool valid_header = true;
+  const size_t kSignatureSize = sizeof(kFileSignature) - 1;
+  const size_t kHeaderSize = kSignatureSize + 4;
   int version = 0;
-  if (!fgets(buf, sizeof(buf), f) || fread(&version, 4, 1, f) < 1)
-    valid_header = false;
+  bool valid_header = size >= kHeaderSize &&
+                      memcmp(data, kFileSignature, kSignatureSize) == 0;
+  if (size >= kHeaderSize)
+    memcpy(&version, data + kSignatureSize, 4);
   // Note: For version differences, this should migrate to the new format.
   // But the v1 format could sometimes (rarely) end up with invalid data, so
   // don't migrate v1 to v3 to force a rebuild. (v2 only existed for a few days,
   // and there was no release with it, so pretend that it never happened.)
-  if (!valid_header || strcmp(buf, kFileSignature) != 0 ||
-      version != kCurrentVersion) {
+  if (!valid_header || version != kCurrentVersion) {
     if (version == 1)
       *err = "deps log version change; rebuilding";
     else
       *err = "bad deps log signature or version; starting over";
-    fclose(f);
+    mapped_log_.Close();
     unlink(path.c_str());
     // Don't report this as a failure.  An empty deps log will cause
     // us to rebuild the outputs anyway.
     return LOAD_SUCCESS;
   }
 
-  long offset;
+  size_t offset = kHeaderSize;
   bool read_failed = false;
   int unique_dep_record_count = 0;
   int total_dep_record_count = 0;
-  for (;;) {
-    offset = ftell(f);
-
-    unsigned size;
-    if (fread(&size, 4, 1, f) < 1) {
-      if (!feof(f))
-        read_failed = true;
+  while (offset < size) {
+    unsigned record_size;
+    if (size - offset < 4) {
+      read_failed = true;
       break;
     }
-    bool is_deps = (size >> 31) != 0;
-    size = size & 0x7FFFFFFF;
-
-    if (size > kMaxRecordSize || fread(buf, size, 1, f) < 1) {
+    memcpy(&record_size, data + offset, 4);
+    bool is_deps = (record_size >> 31) != 0;
+    record_size = record_size & 0x7FFFFFFF;
+    if (record_size > kMaxRecordSize || size - offset - 4 < record_size ||
+        (is_deps && record_size < 12)) {
       read_failed = true;
       break;
     }
+    const char* buf = data + offset + 4;
 
     if (is_deps) {
-      assert(size % 4 == 0);
-      int* deps_data = reinterpret_cast<int*>(buf);
-      int out_id = deps_data[0];
-      TimeStamp mtime;
-      mtime = (TimeStamp)(((uint64_t)(unsigned int)deps_data[2] << 32) |
-                          (uint64_t)(unsigned int)deps_data[1]);
-      deps_data += 3;
-      int deps_count = (size / 4) - 3;
-
-      Deps* deps = new Deps(mtime, deps_count);
+      assert(record_size % 4 == 0);
+      int out_id;
+      uint32_t mtime_parts[2];
+      memcpy(&out_id, buf, 4);
+      memcpy(mtime_parts, buf + 4, 8);
+      TimeStamp mtime = (TimeStamp)(((uint64_t)mtime_parts[1] << 32) |
+                                    (uint64_t)mtime_parts[0]);
+      // The ids are used in place: they start 16 bytes into the record.
+      size_t ids_offset = (offset + 16) / 4;
+      int deps_count = (record_size / 4) - 3;
+#ifndef NDEBUG
       for (int i = 0; i < deps_count; ++i) {
-        assert(deps_data[i] < (int)nodes_.size());
-        assert(nodes_[deps_data[i]]);
-        deps->nodes[i] = nodes_[deps_data[i]];
+        int id;
+        memcpy(&id, buf + 12 + 4 * i, 4);
+        assert(id < (int)nodes_.size());
       }
+#endif
 
       total_dep_record_count++;
-      if (!UpdateDeps(out_id, deps))
+      if (!UpdateDeps(out_id, mtime, ids_offset, deps_count))
         ++unique_dep_record_count;
     } else {
-      int path_size = size - 4;
+      int path_size = record_size - 4;
       assert(path_size > 0);  // CanonicalizePath() rejects empty paths.
       // There can be up to 3 bytes of padding.
       if (buf[path_size - 1] == '\0') --path_size;
@@ -241,7 +246,8 @@ LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
       // happen if two ninja processes write to the same deps log concurrently.
       // (This uses unary complement to make the checksum look less like a
       // dependency record entry.)
-      unsigned checksum = *reinterpret_cast<unsigned*>(buf + size - 4);
+      unsigned checksum;
+      memcpy(&checksum, buf + record_size - 4, 4);
       int expected_id = ~checksum;
       int id = nodes_.size();
       if (id != expected_id) {
@@ -253,18 +259,14 @@ LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
       node->set_id(id);
       nodes_.push_back(node);
     }
+    offset += 4 + record_size;
   }
 
   if (read_failed) {
     // An error occurred while loading; try to recover by truncating the
-    // file to the last fully-read record.
-    if (ferror(f)) {
-      *err = strerror(ferror(f));
-    } else {
-      *err = "premature end of file";
-    }
-    fclose(f);
-
+    // file to the last fully-read record. The mapping stays valid up to
+    // there.
+    *err = "premature end of file";
     if (!Truncate(path, offset, err))
       return LOAD_ERROR;
 
@@ -274,8 +276,6 @@ LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
     return LOAD_SUCCESS;
   }
 
-  fclose(f);
-
   // Rebuild the log if there are too many dead records.
   int kMinCompactionEntryCount = 1000;
   int kCompactionRatio = 3;
@@ -287,21 +287,26 @@ LoadStatus DepsLog::Load(const string& path, State* state, string* err) {
   return LOAD_SUCCESS;
 }
 
-DepsLog::Deps* DepsLog::GetDeps(Node* node) {
+DepsLog::Deps DepsLog::GetDeps(Node* node) {
   // Abort if the node has no id (never referenced in the deps) or if
   // there's no deps recorded for the node.
   if (node->id() < 0 || node->id() >= (int)deps_.size())
-    return NULL;
-  return deps_[node->id()];
+    return Deps();
+  const DepsEntry& entry = deps_[node->id()];
+  if (entry.count < 0)
+    return Deps();
+  return Deps(entry.mtime, entry.count,
+              NodeList(DepIds(entry), nodes_.data()));
 }
 
 Node* DepsLog::GetFirstReverseDepsNode(Node* node) {
+  if (node->id() < 0)
+    return NULL;
   for (size_t id = 0; id < deps_.size(); ++id) {
-    Deps* deps = deps_[id];
-    if (!deps)
-      continue;
-    for (int i = 0; i < deps->node_count; ++i) {
-      if (deps->nodes[i] == node)
+    const DepsEntry& entry = deps_[id];
+    const int* ids = DepIds(entry);
+    for (int i = 0; i < entry.count; ++i) {
+      if (ids[i] == node->id())
         return nodes_[id];
     }
   }
@@ -328,15 +333,20 @@ bool DepsLog::Recompact(const string& path, string* err) {
     (*i)->set_id(-1);
 
   // Write out all deps again.
+  vector<Node*> deps;
   for (int old_id = 0; old_id < (int)deps_.size(); ++old_id) {
-    Deps* deps = deps_[old_id];
-    if (!deps) continue;  // If nodes_[old_id] is a leaf, it has no deps.
+    const DepsEntry& entry = deps_[old_id];
+    if (entry.count < 0)
+      continue;  // If nodes_[old_id] is a leaf, it has no deps.
 
     if (!IsDepsEntryLiveFor(nodes_[old_id]))
       continue;
 
-    if (!new_log.RecordDeps(nodes_[old_id], deps->mtime,
-                            deps->node_count, deps->nodes)) {
+    const int* ids = DepIds(entry);
+    deps.clear();
+    for (int i = 0; i < entry.count; ++i)
+      deps.push_back(nodes_[ids[i]]);
+    if (!new_log.RecordDeps(nodes_[old_id], entry.mtime, deps)) {
       new_log.Close();
       return false;
     }
@@ -344,9 +354,12 @@ bool DepsLog::Recompact(const string& path, string* err) {
 
   new_log.Close();
 
-  // All nodes now have ids that refer to new_log, so steal its data.
+  // All nodes now have ids that refer to new_log, so steal its data. Its
+  // deps are all in memory, so the old log can be unmapped.
   deps_.swap(new_log.deps_);
   nodes_.swap(new_log.nodes_);
+  dep_ids_.swap(new_log.dep_ids_);
+  mapped_log_.Close();
 
   if (unlink(path.c_str()) < 0) {
     *err = strerror(errno);
@@ -371,15 +384,24 @@ bool DepsLog::IsDepsEntryLiveFor(const Node* node) {
   return node->in_edge() && !node->in_edge()->GetBinding("deps").empty();
 }
 
-bool DepsLog::UpdateDeps(int out_id, Deps* deps) {
+bool DepsLog::UpdateDeps(int out_id, TimeStamp mtime, size_t offset,
+                         int count) {
   if (out_id >= (int)deps_.size())
     deps_.resize(out_id + 1);
 
-  bool delete_old = deps_[out_id] != NULL;
-  if (delete_old)
-    delete deps_[out_id];
-  deps_[out_id] = deps;
-  return delete_old;
+  DepsEntry& entry = deps_[out_id];
+  bool replaced = entry.count >= 0;
+  entry.mtime = mtime;
+  entry.offset = offset;
+  entry.count = count;
+  return replaced;
+}
+
+const int* DepsLog::DepIds(const DepsEntry& entry) const {
+  size_t mapped_words = mapped_log_.size() / 4;
+  if (entry.offset < mapped_words)
+    return reinterpret_cast<const int*>(mapped_log_.data()) + entry.offset;
+  return dep_ids_.data() + (entry.offset - mapped_words);
 }
 
 bool DepsLog::RecordId(Node* node) {
@@ -395,19 +417,15 @@ bool DepsLog::RecordId(Node* node) {
   if (!OpenForWriteIfNeeded()) {
     return false;
   }
-  if (fwrite(&size, 4, 1, file_) < 1)
-    return false;
-  if (fwrite(node->path().data(), path_size, 1, file_) < 1) {
-    assert(!node->path().empty());
-    return false;
-  }
-  if (padding && fwrite("\0\0", padding, 1, file_) < 1)
-    return false;
   int id = nodes_.size();
   unsigned checksum = ~(unsigned)id;
-  if (fwrite(&checksum, 4, 1, file_) < 1)
-    return false;
-  if (fflush(file_) != 0)
+  string record;
+  record.reserve(size + 4);
+  record.append(reinterpret_cast<const char*>(&size), 4);
+  record.append(node->path());
+  record.append(padding, '\0');
+  record.append(reinterpret_cast<const char*>(&checksum), 4);
+  if (!writer_.Append(record))
     return false;
 
   node->set_id(id);
@@ -420,32 +438,30 @@ bool DepsLog::OpenForWriteIfNeeded() {
   if (file_path_.empty()) {
     return true;
   }
-  file_ = fopen(file_path_.c_str(), "ab");
-  if (!file_) {
-    return false;
-  }
-  // Set the buffer size to this and flush the file buffer after every record
-  // to make sure records aren't written partially.
-  if (setvbuf(file_, NULL, _IOFBF, kMaxRecordSize + 1) != 0) {
+  FILE* file = fopen(file_path_.c_str(), "ab");
+  if (!file) {
     return false;
   }
-  SetCloseOnExec(fileno(file_));
+  SetCloseOnExec(fileno(file));
 
   // Opening a file in append mode doesn't set the file pointer to the file's
   // end on Windows. Do that explicitly.
-  fseek(file_, 0, SEEK_END);
-
-  if (ftell(file_) == 0) {
-    if (fwrite(kFileSignature, sizeof(kFileSignature) - 1, 1, file_) < 1) {
-      return false;
-    }
-    if (fwrite(&kCurrentVersion, 4, 1, file_) < 1) {
+  fseek(file, 0, SEEK_END);
+
+  // The header is written right away, records by |writer_| in batches of
+  // whole records so that a crash never leaves one half-written.
+  if (ftell(file) == 0) {
+    if (fwrite(kFileSignature, sizeof(kFileSignature) - 1, 1, file) < 1 ||
+        fwrite(&kCurrentVersion, 4, 1, file) < 1) {
+      fclose(file);
       return false;
     }
   }
-  if (fflush(file_) != 0) {
+  if (fflush(file) != 0) {
+    fclose(file);
     return false;
   }
+  writer_.Open(file);
   file_path_.clear();
   return true;
 }
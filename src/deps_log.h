@@ -21,7 +21,9 @@
 #include <stdio.h>
 
 #include "load_status.h"
+#include "log_writer.h"
 #include "timestamp.h"
+#include "util.h"
 
 struct Node;
 struct State;
@@ -65,27 +67,53 @@ struct State;
 /// If two records reference the same output the latter one in the file
 /// wins, allowing updates to just be appended to the file.  A separate
 /// repacking step can run occasionally to remove dead records.
+///
+/// In memory the deps are kept in compressed sparse row form: an entry per
+/// output id holding an offset into one array of 32-bit input ids. Since
+/// every record is 4-byte aligned, the loaded log is kept mapped and serves
+/// as that array directly; deps recorded afterwards are appended to an
+/// array in memory.
 struct DepsLog {
-  DepsLog() : needs_recompaction_(false), file_(NULL) {}
+  DepsLog() : needs_recompaction_(false) {}
   ~DepsLog();
 
   // Writing (build-time) interface.
   bool OpenForWrite(const std::string& path, std::string* err);
   bool RecordDeps(Node* node, TimeStamp mtime, const std::vector<Node*>& nodes);
   bool RecordDeps(Node* node, TimeStamp mtime, int node_count, Node** nodes);
+  /// Wait until the recorded deps are on disk.
+  bool Flush();
   void Close();
 
   // Reading (startup-time) interface.
+
+  /// The input nodes of a deps entry, looked up by id.
+  struct NodeList {
+    NodeList(const int* ids, Node* const* nodes) : ids_(ids), nodes_(nodes) {}
+    Node* operator[](int i) const { return nodes_[ids_[i]]; }
+
+   private:
+    const int* ids_;
+    Node* const* nodes_;
+  };
+
+  /// A view of the deps recorded for an output, which is invalidated by the
+  /// next change to the log. Converts to false if nothing was recorded.
   struct Deps {
-    Deps(int64_t mtime, int node_count)
-        : mtime(mtime), node_count(node_count), nodes(new Node*[node_count]) {}
-    ~Deps() { delete [] nodes; }
+    Deps() : mtime(0), node_count(-1), nodes(NULL, NULL) {}
+    Deps(TimeStamp mtime, int node_count, NodeList nodes)
+        : mtime(mtime), node_count(node_count), nodes(nodes) {}
+    explicit operator bool() const { return node_count >= 0; }
+
     TimeStamp mtime;
     int node_count;
-    Node** nodes;
+    NodeList nodes;
   };
+
+  /// Load the on-disk log. The file stays mapped for the lifetime of the
+  /// log; records are used in place.
   LoadStatus Load(const std::string& path, State* state, std::string* err);
-  Deps* GetDeps(Node* node);
+  Deps GetDeps(Node* node);
   Node* GetFirstReverseDepsNode(Node* node);
 
   /// Rewrite the known log entries, throwing away old data.
@@ -101,27 +129,40 @@ struct DepsLog {
 
   /// Used for tests.
   const std::vector<Node*>& nodes() const { return nodes_; }
-  const std::vector<Deps*>& deps() const { return deps_; }
 
  private:
-  // Updates the in-memory representation.  Takes ownership of |deps|.
-  // Returns true if a prior deps record was deleted.
-  bool UpdateDeps(int out_id, Deps* deps);
+  /// The deps of an output id: |count| ids starting at |offset| in the
+  /// mapped log's words followed by dep_ids_. A |count| of -1 means none.
+  struct DepsEntry {
+    DepsEntry() : mtime(0), offset(0), count(-1) {}
+    TimeStamp mtime;
+    size_t offset;
+    int count;
+  };
+
+  // Updates the in-memory representation.
+  // Returns true if a prior deps record was replaced.
+  bool UpdateDeps(int out_id, TimeStamp mtime, size_t offset, int count);
+  const int* DepIds(const DepsEntry& entry) const;
   // Write a node name record, assigning it an id.
   bool RecordId(Node* node);
 
-  /// Should be called before using file_. When false is returned, errno will
-  /// be set.
+  /// Should be called before using writer_. When false is returned, errno
+  /// will be set.
   bool OpenForWriteIfNeeded();
 
   bool needs_recompaction_;
-  FILE* file_;
+  LogWriter writer_;
   std::string file_path_;
 
   /// Maps id -> Node.
   std::vector<Node*> nodes_;
   /// Maps id -> deps of that id.
-  std::vector<Deps*> deps_;
+  std::vector<DepsEntry> deps_;
+  /// The loaded log, whose dependency records deps_ point into.
+  MappedFile mapped_log_;
+  /// Ids of the deps recorded since loading.
+  std::vector<int> dep_ids_;
 
   friend struct DepsLogTest;
 };
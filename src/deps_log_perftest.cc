@@ -0,0 +1,133 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "deps_log.h"
+#include "graph.h"
+#include "metrics.h"
+#include "state.h"
+#include "thread_pool.h"
+#include "util.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+const char kTestFilename[] = "DepsLogPerfTest-tempfile";
+
+bool WriteTestData(string* err) {
+  DepsLog log;
+  if (!log.OpenForWrite(kTestFilename, err))
+    return false;
+
+  // A large C++ project: 50000 objects, each including 300 out of 20000
+  // headers. Every object is recorded twice, as after a header changed, so
+  // half the records are stale. That is ~130 MB of deps log.
+  const int kNumOutputs = 50000;
+  const int kNumHeaders = 20000;
+  const int kDepsPerOutput = 300;
+
+  State state;
+  vector<Node*> headers;
+  for (int i = 0; i < kNumHeaders; ++i) {
+    char buf[80];
+    sprintf(buf, "../../third_party/some/include/dir%d/header%d.h", i % 97, i);
+    headers.push_back(state.GetNode(buf, 0));
+  }
+
+  // Recording happens on the main build loop, so time it, and the final
+  // flush separately.
+  int64_t start = GetTimeMillis();
+  vector<Node*> deps(kDepsPerOutput);
+  for (int build = 0; build < 2; ++build) {
+    for (int i = 0; i < kNumOutputs; ++i) {
+      char buf[80];
+      sprintf(buf, "obj/some/component%d/source%d.o", i % 113, i);
+      Node* out = state.GetNode(buf, 0);
+      for (int j = 0; j < kDepsPerOutput; ++j)
+        deps[j] = headers[(i * 7 + j * 13 + build) % kNumHeaders];
+      if (!log.RecordDeps(out, 1000 + build, deps)) {
+        *err = strerror(errno);
+        return false;
+      }
+    }
+  }
+  int64_t recorded = GetTimeMillis();
+  log.Close();
+  printf("recorded %d deps in %dms, closed in %dms\n", 2 * kNumOutputs,
+         (int)(recorded - start), (int)(GetTimeMillis() - recorded));
+  return true;
+}
+
+int main() {
+  SetThreadPoolThreadCount(GetProcessorCount());
+
+  vector<int> times;
+  string err;
+
+  if (!WriteTestData(&err)) {
+    fprintf(stderr, "Failed to write test data: %s\n", err.c_str());
+    return 1;
+  }
+
+  {
+    // Read once to warm up disk cache.
+    State state;
+    DepsLog log;
+    if (log.Load(kTestFilename, &state, &err) == LOAD_ERROR) {
+      fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+      return 1;
+    }
+  }
+  const int kNumRepetitions = 5;
+  for (int i = 0; i < kNumRepetitions; ++i) {
+    State state;
+    DepsLog log;
+    int64_t memory = GetPrivateResidentKB();
+    int64_t start = GetTimeMillis();
+    if (log.Load(kTestFilename, &state, &err) == LOAD_ERROR) {
+      fprintf(stderr, "Failed to read test data: %s\n", err.c_str());
+      return 1;
+    }
+    int delta = (int)(GetTimeMillis() - start);
+    printf("%dms  private memory +%lld kB\n", delta,
+           (long long)(GetPrivateResidentKB() - memory));
+    times.push_back(delta);
+  }
+
+  int min = times[0];
+  int max = times[0];
+  float total = 0;
+  for (size_t i = 0; i < times.size(); ++i) {
+    total += times[i];
+    if (times[i] < min)
+      min = times[i];
+    else if (times[i] > max)
+      max = times[i];
+  }
+
+  printf("min %dms  max %dms  avg %.1fms\n",
+         min, max, total / times.size());
+
+  unlink(kTestFilename);
+
+  return 0;
+}
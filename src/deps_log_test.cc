@@ -57,12 +57,12 @@ TEST_F(DepsLogTest, WriteRead) {
     deps.push_back(state1.GetNode("bar2.h", 0));
     log1.RecordDeps(state1.GetNode("out2.o", 0), 2, deps);
 
-    DepsLog::Deps* log_deps = log1.GetDeps(state1.GetNode("out.o", 0));
+    DepsLog::Deps log_deps = log1.GetDeps(state1.GetNode("out.o", 0));
     ASSERT_TRUE(log_deps);
-    ASSERT_EQ(1, log_deps->mtime);
-    ASSERT_EQ(2, log_deps->node_count);
-    ASSERT_EQ("foo.h", log_deps->nodes[0]->path());
-    ASSERT_EQ("bar.h", log_deps->nodes[1]->path());
+    ASSERT_EQ(1, log_deps.mtime);
+    ASSERT_EQ(2, log_deps.node_count);
+    ASSERT_EQ("foo.h", log_deps.nodes[0]->path());
+    ASSERT_EQ("bar.h", log_deps.nodes[1]->path());
   }
 
   log1.Close();
@@ -81,12 +81,12 @@ TEST_F(DepsLogTest, WriteRead) {
   }
 
   // Spot-check the entries in log2.
-  DepsLog::Deps* log_deps = log2.GetDeps(state2.GetNode("out2.o", 0));
+  DepsLog::Deps log_deps = log2.GetDeps(state2.GetNode("out2.o", 0));
   ASSERT_TRUE(log_deps);
-  ASSERT_EQ(2, log_deps->mtime);
-  ASSERT_EQ(2, log_deps->node_count);
-  ASSERT_EQ("foo.h", log_deps->nodes[0]->path());
-  ASSERT_EQ("bar2.h", log_deps->nodes[1]->path());
+  ASSERT_EQ(2, log_deps.mtime);
+  ASSERT_EQ(2, log_deps.node_count);
+  ASSERT_EQ("foo.h", log_deps.nodes[0]->path());
+  ASSERT_EQ("bar2.h", log_deps.nodes[1]->path());
 }
 
 TEST_F(DepsLogTest, LotsOfDeps) {
@@ -107,8 +107,8 @@ TEST_F(DepsLogTest, LotsOfDeps) {
     }
     log1.RecordDeps(state1.GetNode("out.o", 0), 1, deps);
 
-    DepsLog::Deps* log_deps = log1.GetDeps(state1.GetNode("out.o", 0));
-    ASSERT_EQ(kNumDeps, log_deps->node_count);
+    DepsLog::Deps log_deps = log1.GetDeps(state1.GetNode("out.o", 0));
+    ASSERT_EQ(kNumDeps, log_deps.node_count);
   }
 
   log1.Close();
@@ -118,8 +118,60 @@ TEST_F(DepsLogTest, LotsOfDeps) {
   EXPECT_TRUE(log2.Load(kTestFilename, &state2, &err));
   ASSERT_EQ("", err);
 
-  DepsLog::Deps* log_deps = log2.GetDeps(state2.GetNode("out.o", 0));
-  ASSERT_EQ(kNumDeps, log_deps->node_count);
+  DepsLog::Deps log_deps = log2.GetDeps(state2.GetNode("out.o", 0));
+  ASSERT_EQ(kNumDeps, log_deps.node_count);
+}
+
+TEST_F(DepsLogTest, SupersededRecords) {
+  // The second record of each output supersedes the first.
+  const int kNumOutputs = 100;
+  const int kNumDeps = 100;
+
+  State state1;
+  DepsLog log1;
+  string err;
+  EXPECT_TRUE(log1.OpenForWrite(kTestFilename, &err));
+  ASSERT_EQ("", err);
+  vector<Node*> deps(kNumDeps);
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < kNumOutputs; ++i) {
+      char buf[32];
+      for (int j = 0; j < kNumDeps; ++j) {
+        sprintf(buf, "file%d.h", (i + j + round) % 1000);
+        deps[j] = state1.GetNode(buf, 0);
+      }
+      sprintf(buf, "out%d.o", i);
+      ASSERT_TRUE(log1.RecordDeps(state1.GetNode(buf, 0), round, deps));
+    }
+  }
+  log1.Close();
+
+  State state2;
+  DepsLog log2;
+  EXPECT_TRUE(log2.Load(kTestFilename, &state2, &err));
+  ASSERT_EQ("", err);
+
+  // Deps recorded after loading live next to the loaded ones.
+  EXPECT_TRUE(log2.OpenForWrite(kTestFilename, &err));
+  deps.assign(1, state2.GetNode("new.h", 0));
+  ASSERT_TRUE(log2.RecordDeps(state2.GetNode("out0.o", 0), 2, deps));
+  log2.Close();
+  DepsLog::Deps new_deps = log2.GetDeps(state2.GetNode("out0.o", 0));
+  ASSERT_EQ(1, new_deps.node_count);
+  ASSERT_EQ("new.h", new_deps.nodes[0]->path());
+
+  for (int i = 1; i < kNumOutputs; ++i) {
+    char buf[32];
+    sprintf(buf, "out%d.o", i);
+    DepsLog::Deps log_deps = log2.GetDeps(state2.GetNode(buf, 0));
+    ASSERT_TRUE(log_deps);
+    ASSERT_EQ(1, log_deps.mtime);
+    ASSERT_EQ(kNumDeps, log_deps.node_count);
+    for (int j = 0; j < kNumDeps; j += 7) {
+      sprintf(buf, "file%d.h", (i + j + 1) % 1000);
+      ASSERT_EQ(buf, log_deps.nodes[j]->path());
+    }
+  }
 }
 
 // Verify that adding the same deps twice doesn't grow the file.
@@ -257,36 +309,36 @@ TEST_F(DepsLogTest, Recompact) {
     ASSERT_TRUE(log.Load(kTestFilename, &state, &err));
 
     Node* out = state.GetNode("out.o", 0);
-    DepsLog::Deps* deps = log.GetDeps(out);
+    DepsLog::Deps deps = log.GetDeps(out);
     ASSERT_TRUE(deps);
-    ASSERT_EQ(1, deps->mtime);
-    ASSERT_EQ(1, deps->node_count);
-    ASSERT_EQ("foo.h", deps->nodes[0]->path());
+    ASSERT_EQ(1, deps.mtime);
+    ASSERT_EQ(1, deps.node_count);
+    ASSERT_EQ("foo.h", deps.nodes[0]->path());
 
     Node* other_out = state.GetNode("other_out.o", 0);
     deps = log.GetDeps(other_out);
     ASSERT_TRUE(deps);
-    ASSERT_EQ(1, deps->mtime);
-    ASSERT_EQ(2, deps->node_count);
-    ASSERT_EQ("foo.h", deps->nodes[0]->path());
-    ASSERT_EQ("baz.h", deps->nodes[1]->path());
+    ASSERT_EQ(1, deps.mtime);
+    ASSERT_EQ(2, deps.node_count);
+    ASSERT_EQ("foo.h", deps.nodes[0]->path());
+    ASSERT_EQ("baz.h", deps.nodes[1]->path());
 
     ASSERT_TRUE(log.Recompact(kTestFilename, &err));
 
     // The in-memory deps graph should still be valid after recompaction.
     deps = log.GetDeps(out);
     ASSERT_TRUE(deps);
-    ASSERT_EQ(1, deps->mtime);
-    ASSERT_EQ(1, deps->node_count);
-    ASSERT_EQ("foo.h", deps->nodes[0]->path());
+    ASSERT_EQ(1, deps.mtime);
+    ASSERT_EQ(1, deps.node_count);
+    ASSERT_EQ("foo.h", deps.nodes[0]->path());
     ASSERT_EQ(out, log.nodes()[out->id()]);
 
     deps = log.GetDeps(other_out);
     ASSERT_TRUE(deps);
-    ASSERT_EQ(1, deps->mtime);
-    ASSERT_EQ(2, deps->node_count);
-    ASSERT_EQ("foo.h", deps->nodes[0]->path());
-    ASSERT_EQ("baz.h", deps->nodes[1]->path());
+    ASSERT_EQ(1, deps.mtime);
+    ASSERT_EQ(2, deps.node_count);
+    ASSERT_EQ("foo.h", deps.nodes[0]->path());
+    ASSERT_EQ("baz.h", deps.nodes[1]->path());
     ASSERT_EQ(other_out, log.nodes()[other_out->id()]);
 
     // The file should have shrunk a bit for the smaller deps.
@@ -311,19 +363,19 @@ TEST_F(DepsLogTest, Recompact) {
     ASSERT_TRUE(log.Load(kTestFilename, &state, &err));
 
     Node* out = state.GetNode("out.o", 0);
-    DepsLog::Deps* deps = log.GetDeps(out);
+    DepsLog::Deps deps = log.GetDeps(out);
     ASSERT_TRUE(deps);
-    ASSERT_EQ(1, deps->mtime);
-    ASSERT_EQ(1, deps->node_count);
-    ASSERT_EQ("foo.h", deps->nodes[0]->path());
+    ASSERT_EQ(1, deps.mtime);
+    ASSERT_EQ(1, deps.node_count);
+    ASSERT_EQ("foo.h", deps.nodes[0]->path());
 
     Node* other_out = state.GetNode("other_out.o", 0);
     deps = log.GetDeps(other_out);
     ASSERT_TRUE(deps);
-    ASSERT_EQ(1, deps->mtime);
-    ASSERT_EQ(2, deps->node_count);
-    ASSERT_EQ("foo.h", deps->nodes[0]->path());
-    ASSERT_EQ("baz.h", deps->nodes[1]->path());
+    ASSERT_EQ(1, deps.mtime);
+    ASSERT_EQ(2, deps.node_count);
+    ASSERT_EQ("foo.h", deps.nodes[0]->path());
+    ASSERT_EQ("baz.h", deps.nodes[1]->path());
 
     ASSERT_TRUE(log.Recompact(kTestFilename, &err));
 
@@ -431,9 +483,8 @@ TEST_F(DepsLogTest, Truncated) {
 
     // Count how many non-NULL deps entries there are.
     int new_deps_count = 0;
-    for (vector<DepsLog::Deps*>::const_iterator i = log.deps().begin();
-         i != log.deps().end(); ++i) {
-      if (*i)
+    for (size_t id = 0; id < log.nodes().size(); ++id) {
+      if (log.GetDeps(log.nodes()[id]))
         ++new_deps_count;
     }
     ASSERT_GE(deps_count, new_deps_count);
@@ -487,7 +538,7 @@ TEST_F(DepsLogTest, TruncatedRecovery) {
     err.clear();
 
     // The truncated entry should've been discarded.
-    EXPECT_EQ(NULL, log.GetDeps(state.GetNode("out2.o", 0)));
+    EXPECT_FALSE(log.GetDeps(state.GetNode("out2.o", 0)));
 
     EXPECT_TRUE(log.OpenForWrite(kTestFilename, &err));
     ASSERT_EQ("", err);
@@ -510,7 +561,7 @@ TEST_F(DepsLogTest, TruncatedRecovery) {
     EXPECT_TRUE(log.Load(kTestFilename, &state, &err));
 
     // The truncated entry should exist.
-    DepsLog::Deps* deps = log.GetDeps(state.GetNode("out2.o", 0));
+    DepsLog::Deps deps = log.GetDeps(state.GetNode("out2.o", 0));
     ASSERT_TRUE(deps);
   }
 }
@@ -0,0 +1,79 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Compares SHA-256 and BLAKE3 throughput on blob sizes typical of remote
+// build inputs: headers, sources, object files and large archives.
+
+#include <stdio.h>
+
+#include <string>
+
+#include "metrics.h"
+#include "thread_pool.h"
+#include "util.h"
+#include "remote_executor/cas_client.h"
+
+using namespace std;
+using RemoteExecutor::DigestFunction_Value;
+using RemoteExecutor::DigestGenerator;
+
+namespace {
+
+const struct {
+  const char* name;
+  size_t size;
+} kSizes[] = {
+  { "4KiB header", 4 << 10 },
+  { "64KiB source", 64 << 10 },
+  { "1MiB object", 1 << 20 },
+  { "32MiB archive", 32 << 20 },
+};
+
+// Returns the best throughput over a few runs in MiB/s.
+double Measure(const DigestGenerator& generator, const string& blob) {
+  const size_t kBytesPerRun = 256 << 20;
+  size_t iterations = max<size_t>(1, kBytesPerRun / blob.size());
+  double best = 0;
+  for (int run = 0; run < 3; ++run) {
+    int64_t start = GetTimeMillis();
+    for (size_t i = 0; i < iterations; ++i)
+      generator.Hash(blob);
+    int64_t delta = max<int64_t>(1, GetTimeMillis() - start);
+    double mib = double(blob.size()) * iterations / (1 << 20);
+    best = max(best, mib * 1000 / delta);
+  }
+  return best;
+}
+
+}  // namespace
+
+int main() {
+  SetThreadPoolThreadCount(GetProcessorCount());
+
+  DigestGenerator sha256(DigestFunction_Value::DigestFunction_Value_SHA256);
+  DigestGenerator blake3(DigestFunction_Value::DigestFunction_Value_BLAKE3);
+  printf("blake3 kernel: %s, %d cpus\n",
+         RemoteExecutor::Blake3Hasher::Implementation(), GetProcessorCount());
+
+  for (size_t i = 0; i < sizeof(kSizes) / sizeof(kSizes[0]); ++i) {
+    string blob(kSizes[i].size, '\0');
+    for (size_t j = 0; j < blob.size(); ++j)
+      blob[j] = static_cast<char>(j * 2654435761u >> 24);
+    double sha_rate = Measure(sha256, blob);
+    double blake_rate = Measure(blake3, blob);
+    printf("%-14s sha256 %8.1f MiB/s  blake3 %8.1f MiB/s  (%.1fx)\n",
+           kSizes[i].name, sha_rate, blake_rate, blake_rate / sha_rate);
+  }
+  return 0;
+}
@@ -28,6 +28,7 @@
 
 #include <sstream>
 #else
+#include <fcntl.h>
 #include <unistd.h>
 #endif
 
@@ -135,6 +136,18 @@ bool StatAllFilesInDir(const string& dir, map<string, TimeStamp>* stamps,
 
 }  // namespace
 
+// FileReader ------------------------------------------------------------------
+
+FileReader::Status FileReader::ReadFileChunks(const string& path,
+                                              const ChunkConsumer& consume,
+                                              string* err) {
+  string contents;
+  Status status = ReadFile(path, &contents, err);
+  if (status == Okay)
+    consume(contents.data(), contents.size());
+  return status;
+}
+
 // DiskInterface ---------------------------------------------------------------
 
 bool DiskInterface::MakeDirs(const string& path) {
@@ -290,6 +303,27 @@ FileReader::Status RealDiskInterface::ReadFile(const string& path,
   }
 }
 
+FileReader::Status RealDiskInterface::ReadFileChunks(
+    const string& path, const ChunkConsumer& consume, string* err) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) {
+    int error = errno;
+    err->assign(strerror(error));
+    return error == ENOENT ? NotFound : OtherError;
+  }
+  char buf[64 << 10];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+    consume(buf, len);
+  Status status = Okay;
+  if (ferror(f)) {
+    err->assign(strerror(errno));
+    status = OtherError;
+  }
+  fclose(f);
+  return status;
+}
+
 int RealDiskInterface::RemoveFile(const string& path) {
 #ifdef _WIN32
   DWORD attributes = GetFileAttributesA(path.c_str());
@@ -345,6 +379,33 @@ int RealDiskInterface::RemoveFile(const string& path) {
   return 0;
 }
 
+bool RealDiskInterface::SetMtime(const string& path, TimeStamp mtime) {
+#ifdef _WIN32
+  // The stat cache doesn't expect files to travel back in time.
+  return false;
+#else
+  struct timespec times[2];
+  times[0].tv_sec = 0;
+  times[0].tv_nsec = UTIME_OMIT;
+  times[1].tv_sec = mtime / 1000000000LL;
+  times[1].tv_nsec = mtime % 1000000000LL;
+  if (utimensat(AT_FDCWD, path.c_str(), times, 0) < 0) {
+    Error("utimensat(%s): %s", path.c_str(), strerror(errno));
+    return false;
+  }
+  return true;
+#endif
+}
+
+bool RealDiskInterface::IsThreadSafe() const {
+#ifdef _WIN32
+  // The stat cache is filled in by Stat().
+  return !use_cache_;
+#else
+  return true;
+#endif
+}
+
 void RealDiskInterface::AllowStatCache(bool allow) {
 #ifdef _WIN32
   use_cache_ = allow;
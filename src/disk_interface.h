@@ -15,6 +15,7 @@
 #ifndef NINJA_DISK_INTERFACE_H_
 #define NINJA_DISK_INTERFACE_H_
 
+#include <functional>
 #include <map>
 #include <string>
 
@@ -36,6 +37,13 @@ struct FileReader {
   /// On error, return another Status and fill |err|.
   virtual Status ReadFile(const std::string& path, std::string* contents,
                           std::string* err) = 0;
+
+  /// Pass the contents of a file to |consume| piece by piece, for callers
+  /// that only stream over it.  The default reads it whole with ReadFile().
+  typedef std::function<void(const char* data, size_t size)> ChunkConsumer;
+  virtual Status ReadFileChunks(const std::string& path,
+                                const ChunkConsumer& consume,
+                                std::string* err);
 };
 
 /// Interface for accessing the disk.
@@ -47,6 +55,10 @@ struct DiskInterface: public FileReader {
   /// other errors.
   virtual TimeStamp Stat(const std::string& path, std::string* err) const = 0;
 
+  /// Whether Stat() and ReadFile() may be called from several threads at
+  /// once.
+  virtual bool IsThreadSafe() const { return false; }
+
   /// Create a directory, returning false on failure.
   virtual bool MakeDir(const std::string& path) = 0;
 
@@ -62,6 +74,12 @@ struct DiskInterface: public FileReader {
   ///          -1 if an error occurs.
   virtual int RemoveFile(const std::string& path) = 0;
 
+  /// Set the mtime of an existing file, returning false on failure or if
+  /// it isn't supported.
+  virtual bool SetMtime(const std::string& path, TimeStamp mtime) {
+    return false;
+  }
+
   /// Create all the parent directories for path; like mkdir -p
   /// `basename path`.
   bool MakeDirs(const std::string& path);
@@ -73,11 +91,16 @@ struct RealDiskInterface : public DiskInterface {
   RealDiskInterface();
   virtual ~RealDiskInterface() {}
   virtual TimeStamp Stat(const std::string& path, std::string* err) const;
+  virtual bool IsThreadSafe() const;
   virtual bool MakeDir(const std::string& path);
   virtual bool WriteFile(const std::string& path, const std::string& contents);
   virtual Status ReadFile(const std::string& path, std::string* contents,
                           std::string* err);
+  virtual Status ReadFileChunks(const std::string& path,
+                                const ChunkConsumer& consume,
+                                std::string* err);
   virtual int RemoveFile(const std::string& path);
+  virtual bool SetMtime(const std::string& path, TimeStamp mtime);
 
   /// Whether stat information can be cached.  Only has an effect on Windows.
   void AllowStatCache(bool allow);
@@ -220,6 +220,30 @@ TEST_F(DiskInterfaceTest, ReadFile) {
   EXPECT_EQ("", err);
 }
 
+TEST_F(DiskInterfaceTest, ReadFileChunks) {
+  string err;
+  string content;
+  DiskInterface::ChunkConsumer append = [&content](const char* data,
+                                                   size_t size) {
+    content.append(data, size);
+  };
+  ASSERT_EQ(DiskInterface::NotFound,
+            disk_.ReadFileChunks("foobar", append, &err));
+  EXPECT_EQ("", content);
+  EXPECT_NE("", err);
+  err.clear();
+
+  // Larger than one read, so it arrives in several chunks.
+  string test_content;
+  for (int i = 0; test_content.size() < (200 << 10); ++i)
+    test_content += "line " + std::to_string(i) + "\n";
+  ASSERT_TRUE(disk_.WriteFile("testfile", test_content));
+  ASSERT_EQ(DiskInterface::Okay,
+            disk_.ReadFileChunks("testfile", append, &err));
+  EXPECT_EQ(test_content, content);
+  EXPECT_EQ("", err);
+}
+
 TEST_F(DiskInterfaceTest, MakeDirs) {
   string path = "path/with/double//slash/";
   EXPECT_TRUE(disk_.MakeDirs(path));
@@ -257,6 +281,18 @@ TEST_F(DiskInterfaceTest, RemoveDirectory) {
   EXPECT_EQ(1, disk_.RemoveFile("does not exist"));
 }
 
+#ifndef _WIN32
+TEST_F(DiskInterfaceTest, SetMtime) {
+  string err;
+  ASSERT_TRUE(Touch("file"));
+  TimeStamp mtime =
+      (disk_.Stat("file", &err) / 1000000000LL - 5) * 1000000000LL;
+  EXPECT_TRUE(disk_.SetMtime("file", mtime));
+  EXPECT_EQ(mtime, disk_.Stat("file", &err));
+  EXPECT_EQ("", err);
+}
+#endif
+
 struct StatTest : public StateTestWithBuiltinRules,
                   public DiskInterface {
   StatTest() : scan_(&state_, NULL, NULL, this, NULL) {}
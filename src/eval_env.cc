@@ -18,6 +18,17 @@
 
 using namespace std;
 
+// static
+Env::Variable Env::Classify(const string& var) {
+  if (var == "in")
+    return kIn;
+  if (var == "in_newline")
+    return kInNewline;
+  if (var == "out")
+    return kOut;
+  return kOther;
+}
+
 string BindingEnv::LookupVariable(const string& var) {
   map<string, string>::iterator i = bindings_.find(var);
   if (i != bindings_.end())
@@ -27,6 +38,17 @@ string BindingEnv::LookupVariable(const string& var) {
   return "";
 }
 
+void BindingEnv::AppendVariable(const string& var, Variable /* kind */,
+                                string* result) {
+  for (BindingEnv* env = this; env; env = env->parent_) {
+    map<string, string>::iterator i = env->bindings_.find(var);
+    if (i != env->bindings_.end()) {
+      result->append(i->second);
+      return;
+    }
+  }
+}
+
 void BindingEnv::AddBinding(const string& key, const string& val) {
   bindings_[key] = val;
 }
@@ -72,6 +94,7 @@ bool Rule::IsReservedBinding(const string& var) {
       var == "deps" ||
       var == "generator" ||
       var == "pool" ||
+      var == "remote_cache" ||
       var == "restat" ||
       var == "rspfile" ||
       var == "rspfile_content" ||
@@ -82,53 +105,62 @@ const map<string, const Rule*>& BindingEnv::GetRules() const {
   return rules_;
 }
 
-string BindingEnv::LookupWithFallback(const string& var,
-                                      const EvalString* eval,
-                                      Env* env) {
+void BindingEnv::AppendWithFallback(const string& var, const EvalString* eval,
+                                    Env* env, string* result) {
   map<string, string>::iterator i = bindings_.find(var);
-  if (i != bindings_.end())
-    return i->second;
+  if (i != bindings_.end()) {
+    result->append(i->second);
+    return;
+  }
 
-  if (eval)
-    return eval->Evaluate(env);
+  if (eval) {
+    eval->EvaluateInto(env, result);
+    return;
+  }
 
   if (parent_)
-    return parent_->LookupVariable(var);
-
-  return "";
+    parent_->AppendVariable(var, kOther, result);
 }
 
 string EvalString::Evaluate(Env* env) const {
   string result;
-  for (TokenList::const_iterator i = parsed_.begin(); i != parsed_.end(); ++i) {
-    if (i->second == RAW)
-      result.append(i->first);
+  EvaluateInto(env, &result);
+  return result;
+}
+
+void EvalString::EvaluateInto(Env* env, string* result) const {
+  for (vector<Op>::const_iterator i = ops_.begin(); i != ops_.end(); ++i) {
+    if (i->type == RAW)
+      result->append(text_, i->start, i->size);
     else
-      result.append(env->LookupVariable(i->first));
+      env->AppendVariable(names_[i->start], i->variable, result);
   }
-  return result;
 }
 
 void EvalString::AddText(StringPiece text) {
-  // Add it to the end of an existing RAW token if possible.
-  if (!parsed_.empty() && parsed_.back().second == RAW) {
-    parsed_.back().first.append(text.str_, text.len_);
-  } else {
-    parsed_.push_back(make_pair(text.AsString(), RAW));
+  // Extend an existing RAW token if possible. Its text is always last.
+  if (ops_.empty() || ops_.back().type != RAW) {
+    Op op = { RAW, Env::kOther, (uint32_t)text_.size(), 0 };
+    ops_.push_back(op);
   }
+  text_.append(text.str_, text.len_);
+  ops_.back().size += text.len_;
 }
+
 void EvalString::AddSpecial(StringPiece text) {
-  parsed_.push_back(make_pair(text.AsString(), SPECIAL));
+  names_.push_back(text.AsString());
+  Op op = { SPECIAL, Env::Classify(names_.back()), (uint32_t)names_.size() - 1,
+            0 };
+  ops_.push_back(op);
 }
 
 string EvalString::Serialize() const {
   string result;
-  for (TokenList::const_iterator i = parsed_.begin();
-       i != parsed_.end(); ++i) {
+  for (vector<Op>::const_iterator i = ops_.begin(); i != ops_.end(); ++i) {
     result.append("[");
-    if (i->second == SPECIAL)
+    if (i->type == SPECIAL)
       result.append("$");
-    result.append(i->first);
+    result.append(Text(*i).AsString());
     result.append("]");
   }
   return result;
@@ -136,12 +168,11 @@ string EvalString::Serialize() const {
 
 string EvalString::Unparse() const {
   string result;
-  for (TokenList::const_iterator i = parsed_.begin();
-       i != parsed_.end(); ++i) {
-    bool special = (i->second == SPECIAL);
+  for (vector<Op>::const_iterator i = ops_.begin(); i != ops_.end(); ++i) {
+    bool special = (i->type == SPECIAL);
     if (special)
       result.append("${");
-    result.append(i->first);
+    result.append(Text(*i).AsString());
     if (special)
       result.append("}");
   }
@@ -15,6 +15,8 @@
 #ifndef NINJA_EVAL_ENV_H_
 #define NINJA_EVAL_ENV_H_
 
+#include <stdint.h>
+
 #include <map>
 #include <string>
 #include <vector>
@@ -25,22 +27,42 @@ struct Rule;
 
 /// An interface for a scope for variable (e.g. "$foo") lookups.
 struct Env {
+  /// The variables an EvalString tells apart when it is built, so that
+  /// expanding them needs no comparison by name.
+  enum Variable { kOther, kIn, kInNewline, kOut };
+  static Variable Classify(const std::string& var);
+
   virtual ~Env() {}
   virtual std::string LookupVariable(const std::string& var) = 0;
+
+  /// Append the value of |var|, which Classify() maps to |kind|, to
+  /// |result|.
+  virtual void AppendVariable(const std::string& var, Variable kind,
+                              std::string* result) {
+    result->append(LookupVariable(var));
+  }
 };
 
 /// A tokenized string that contains variable references.
 /// Can be evaluated relative to an Env.
+///
+/// It is kept compiled: the literal text back to back in one string, and a
+/// flat list of instructions that either copy a span of that text or expand
+/// a variable, with $in, $in_newline and $out already recognized.
 struct EvalString {
   /// @return The evaluated string with variable expanded using value found in
   ///         environment @a env.
   std::string Evaluate(Env* env) const;
 
+  /// Like Evaluate(), but append to @a result, so that a caller can reuse
+  /// one buffer.
+  void EvaluateInto(Env* env, std::string* result) const;
+
   /// @return The string with variables not expanded.
   std::string Unparse() const;
 
-  void Clear() { parsed_.clear(); }
-  bool empty() const { return parsed_.empty(); }
+  void Clear() { text_.clear(); names_.clear(); ops_.clear(); }
+  bool empty() const { return ops_.empty(); }
 
   void AddText(StringPiece text);
   void AddSpecial(StringPiece text);
@@ -50,9 +72,27 @@ struct EvalString {
   std::string Serialize() const;
 
 private:
+  friend struct ManifestSnapshot;
+
   enum TokenType { RAW, SPECIAL };
-  typedef std::vector<std::pair<std::string, TokenType> > TokenList;
-  TokenList parsed_;
+  struct Op {
+    TokenType type;
+    Env::Variable variable;
+    /// For RAW, the span of text_ to copy. For SPECIAL, the index of the
+    /// name in names_ (and no size).
+    uint32_t start;
+    uint32_t size;
+  };
+
+  /// The text of token |op|.
+  StringPiece Text(const Op& op) const {
+    return op.type == RAW ? StringPiece(text_.data() + op.start, op.size)
+                          : StringPiece(names_[op.start]);
+  }
+
+  std::string text_;
+  std::vector<std::string> names_;
+  std::vector<Op> ops_;
 };
 
 /// An invocable build command and associated metadata (description, etc.).
@@ -70,6 +110,7 @@ struct Rule {
  private:
   // Allow the parsers to reach into this object and fill out its fields.
   friend struct ManifestParser;
+  friend struct ManifestSnapshot;
 
   std::string name_;
   typedef std::map<std::string, EvalString> Bindings;
@@ -84,6 +125,8 @@ struct BindingEnv : public Env {
 
   virtual ~BindingEnv() {}
   virtual std::string LookupVariable(const std::string& var);
+  virtual void AppendVariable(const std::string& var, Variable kind,
+                              std::string* result);
 
   void AddRule(const Rule* rule);
   const Rule* LookupRule(const std::string& rule_name);
@@ -96,11 +139,14 @@ struct BindingEnv : public Env {
   /// 1) value set on edge itself (edge_->env_)
   /// 2) value set on rule, with expansion in the edge's scope
   /// 3) value set on enclosing scope of edge (edge_->env_->parent_)
-  /// This function takes as parameters the necessary info to do (2).
-  std::string LookupWithFallback(const std::string& var, const EvalString* eval,
-                                 Env* env);
+  /// This function takes as parameters the necessary info to do (2), and
+  /// appends the value to \a result.
+  void AppendWithFallback(const std::string& var, const EvalString* eval,
+                          Env* env, std::string* result);
 
 private:
+  friend struct ManifestSnapshot;
+
   std::map<std::string, std::string> bindings_;
   std::map<std::string, const Rule*> rules_;
   BindingEnv* parent_;
@@ -16,7 +16,9 @@
 
 #include <algorithm>
 #include <deque>
+#include <functional>
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include "build_log.h"
@@ -27,6 +29,7 @@
 #include "manifest_parser.h"
 #include "metrics.h"
 #include "state.h"
+#include "thread_pool.h"
 #include "util.h"
 
 using namespace std;
@@ -79,18 +82,170 @@ bool DependencyScan::RecomputeDirty(Node* initial_node,
   return true;
 }
 
+namespace {
+
+/// The edges one walk of DependencyScan::Prefetch() claimed, and the
+/// leaves it reached whose status isn't known.
+struct PrefetchWalk {
+  vector<Edge*> edges;
+  vector<Node*> leaves;
+};
+
+/// Call |work| on |jobs| slices of |items|, each on a thread of |pool|.
+template <typename T, typename Work>
+void RunSlices(ThreadPool* pool, int jobs, const vector<T>& items,
+               const Work& work) {
+  if (items.empty())
+    return;
+  vector<function<void()>> tasks;
+  for (int i = 0; i < jobs; ++i) {
+    size_t begin = items.size() * i / jobs;
+    size_t end = items.size() * (i + 1) / jobs;
+    tasks.push_back([&work, &items, i, begin, end]() {
+      for (size_t j = begin; j < end; ++j)
+        work(i, items[j]);
+    });
+  }
+  pool->RunTasks(move(tasks));
+}
+
+/// Stat |nodes| on |pool|, sorting them and dropping duplicates first, so
+/// that every Node is written by one thread.
+void StatNodes(ThreadPool* pool, int jobs, DiskInterface* disk_interface,
+               vector<Node*>* nodes) {
+  sort(nodes->begin(), nodes->end());
+  nodes->erase(unique(nodes->begin(), nodes->end()), nodes->end());
+  RunSlices(pool, jobs, *nodes, [disk_interface](int, Node* node) {
+    // Failures are left for the dirty walk to report.
+    string err;
+    if (!node->status_known())
+      node->Stat(disk_interface, &err);
+  });
+}
+
+}  // namespace
+
+void DependencyScan::Prefetch(const vector<Node*>& targets) {
+  int jobs = GetOptimalThreadPoolJobCount();
+  if (jobs <= 1 || !disk_interface_->IsThreadSafe())
+    return;
+  METRIC_RECORD("prefetch");
+
+  // Walk the graph the way RecomputeDirty() will, without loading depfiles
+  // or dyndep files. Each edge is claimed, through an atomic mark indexed
+  // by its id, by the walk that reaches it first, which also owns its
+  // outputs. Leaves may be reached by several walks, so they are
+  // deduplicated before they are stat()ed.
+  DepsLog* deps_log = dep_loader_.deps_log();
+  unique_ptr<atomic<bool>[]> claimed(
+      new atomic<bool>[state_->edges_.size()]());
+  auto walk = [&](vector<Node*>* stack, size_t limit, PrefetchWalk* found) {
+    while (!stack->empty() && stack->size() < limit) {
+      Node* node = stack->back();
+      stack->pop_back();
+      Edge* edge = node->in_edge();
+      if (!edge) {
+        if (!node->status_known())
+          found->leaves.push_back(node);
+        continue;
+      }
+      if (edge->mark_ == Edge::VisitDone ||
+          claimed[edge->id_].exchange(true, memory_order_relaxed)) {
+        continue;
+      }
+      found->edges.push_back(edge);
+      stack->insert(stack->end(), edge->inputs_.begin(), edge->inputs_.end());
+      stack->insert(stack->end(), edge->validations_.begin(),
+                    edge->validations_.end());
+      if (deps_log && !edge->deps_loaded_) {
+        DepsLog::Deps deps = deps_log->GetDeps(edge->outputs_[0]);
+        for (int i = 0; deps && i < deps.node_count; ++i)
+          stack->push_back(deps.nodes[i]);
+      }
+    }
+  };
+
+  // Expand the top of the graph here until there are enough independent
+  // subtrees to share out, then walk those on the pool.
+  const size_t kSubtreesPerJob = 16;
+  vector<Node*> roots(targets.begin(), targets.end());
+  vector<PrefetchWalk> found(jobs + 1);
+  walk(&roots, jobs * kSubtreesPerJob, &found[jobs]);
+  unique_ptr<ThreadPool> pool = CreateThreadPool();
+  if (!roots.empty()) {
+    vector<function<void()>> tasks;
+    for (int i = 0; i < jobs; ++i) {
+      tasks.push_back([&walk, &roots, &found, jobs, i]() {
+        // Every jobs-th subtree, as neighbouring ones tend to be alike.
+        vector<Node*> stack;
+        for (size_t j = i; j < roots.size(); j += jobs)
+          stack.push_back(roots[j]);
+        walk(&stack, SIZE_MAX, &found[i]);
+      });
+    }
+    pool->RunTasks(move(tasks));
+  }
+
+  vector<Edge*> edges;
+  vector<Node*> leaves;
+  for (size_t i = 0; i < found.size(); ++i) {
+    edges.insert(edges.end(), found[i].edges.begin(), found[i].edges.end());
+    leaves.insert(leaves.end(), found[i].leaves.begin(),
+                  found[i].leaves.end());
+  }
+  claimed.reset();
+  found.clear();
+
+  // Stat the outputs of each edge, read its depfile and hash its command
+  // if the build log will be asked about it, then stat the leaves.
+  dep_loader_.ReservePreloads(state_->edges_.size());
+  vector<vector<Node*>> depfile_inputs(jobs);
+  RunSlices(pool.get(), jobs, edges, [&](int job, Edge* edge) {
+    string err;
+    for (vector<Node*>::iterator o = edge->outputs_.begin();
+         o != edge->outputs_.end(); ++o) {
+      if (!(*o)->status_known())
+        (*o)->Stat(disk_interface_, &err);
+    }
+
+    dep_loader_.PreloadDepFile(edge);
+    if (const vector<StringPiece>* ins = dep_loader_.PreloadedInputs(edge)) {
+      for (vector<StringPiece>::const_iterator i = ins->begin();
+           i != ins->end(); ++i) {
+        string path = i->AsString();
+        uint64_t slash_bits;
+        CanonicalizePath(&path, &slash_bits);
+        if (Node* node = state_->LookupNode(path))
+          depfile_inputs[job].push_back(node);
+      }
+    }
+
+    if (build_log_ && !edge->is_phony() && !edge->dyndep_ &&
+        build_log_->LookupByOutput(edge->outputs_[0]->path())) {
+      edge->GetCommandHash();
+    }
+  });
+  StatNodes(pool.get(), jobs, disk_interface_, &leaves);
+
+  // The inputs the depfiles name which are already in the graph.
+  vector<Node*> named;
+  for (int i = 0; i < jobs; ++i) {
+    named.insert(named.end(), depfile_inputs[i].begin(),
+                 depfile_inputs[i].end());
+  }
+  StatNodes(pool.get(), jobs, disk_interface_, &named);
+}
+
 bool DependencyScan::RecomputeNodeDirty(Node* node, std::vector<Node*>* stack,
                                         std::vector<Node*>* validation_nodes,
                                         string* err) {
   Edge* edge = node->in_edge();
   if (!edge) {
-    // If we already visited this leaf node then we are done.
-    if (node->status_known())
-      return true;
-    // This node has no in-edge; it is dirty if it is missing.
+    // This node has no in-edge; it is dirty if it is missing. It may have
+    // been stat()ed already, by an earlier visit or by Prefetch().
     if (!node->StatIfNecessary(disk_interface_, err))
       return false;
-    if (!node->exists())
+    if (!node->exists() && !node->dirty())
       EXPLAIN("%s has no in-edge and is missing", node->path().c_str());
     node->set_dirty(!node->exists());
     return true;
@@ -263,10 +418,9 @@ bool DependencyScan::VerifyDAG(Node* node, vector<Node*>* stack, string* err) {
 
 bool DependencyScan::RecomputeOutputsDirty(Edge* edge, Node* most_recent_input,
                                            bool* outputs_dirty, string* err) {
-  string command = edge->EvaluateCommand(/*incl_rsp_file=*/true);
   for (vector<Node*>::iterator o = edge->outputs_.begin();
        o != edge->outputs_.end(); ++o) {
-    if (RecomputeOutputDirty(edge, most_recent_input, command, *o)) {
+    if (RecomputeOutputDirty(edge, most_recent_input, *o)) {
       *outputs_dirty = true;
       return true;
     }
@@ -276,7 +430,6 @@ bool DependencyScan::RecomputeOutputsDirty(Edge* edge, Node* most_recent_input,
 
 bool DependencyScan::RecomputeOutputDirty(const Edge* edge,
                                           const Node* most_recent_input,
-                                          const string& command,
                                           Node* output) {
   if (edge->is_phony()) {
     // Phony edges don't write any output.  Outputs are only dirty if
@@ -331,7 +484,7 @@ bool DependencyScan::RecomputeOutputDirty(const Edge* edge,
     bool generator = edge->GetBindingBool("generator");
     if (entry || (entry = build_log()->LookupByOutput(output->path()))) {
       if (!generator &&
-          BuildLog::LogEntry::HashCommand(command) != entry->command_hash) {
+          edge->GetCommandHash() != entry->command_hash) {
         // May also be dirty due to the command changing since the last build.
         // But if this is a generator rule, the command changing does not make us
         // dirty.
@@ -385,10 +538,13 @@ struct EdgeEnv : public Env {
   EdgeEnv(const Edge* const edge, const EscapeKind escape)
       : edge_(edge), escape_in_out_(escape), recursive_(false) {}
   virtual string LookupVariable(const string& var);
+  virtual void AppendVariable(const string& var, Variable kind,
+                              string* result);
 
-  /// Given a span of Nodes, construct a list of paths suitable for a command
-  /// line.
-  std::string MakePathList(const Node* const* span, size_t size, char sep) const;
+  /// Given a span of Nodes, append a list of paths suitable for a command
+  /// line to |result|.
+  void AppendPathList(const Node* const* span, size_t size, char sep,
+                      string* result) const;
 
  private:
   std::vector<std::string> lookups_;
@@ -398,14 +554,23 @@ struct EdgeEnv : public Env {
 };
 
 string EdgeEnv::LookupVariable(const string& var) {
-  if (var == "in" || var == "in_newline") {
+  string result;
+  AppendVariable(var, Classify(var), &result);
+  return result;
+}
+
+void EdgeEnv::AppendVariable(const string& var, Variable kind,
+                             string* result) {
+  if (kind == kIn || kind == kInNewline) {
     int explicit_deps_count = edge_->inputs_.size() - edge_->implicit_deps_ -
       edge_->order_only_deps_;
-    return MakePathList(edge_->inputs_.data(), explicit_deps_count,
-                        var == "in" ? ' ' : '\n');
-  } else if (var == "out") {
+    AppendPathList(edge_->inputs_.data(), explicit_deps_count,
+                   kind == kIn ? ' ' : '\n', result);
+    return;
+  } else if (kind == kOut) {
     int explicit_outs_count = edge_->outputs_.size() - edge_->implicit_outs_;
-    return MakePathList(&edge_->outputs_[0], explicit_outs_count, ' ');
+    AppendPathList(edge_->outputs_.data(), explicit_outs_count, ' ', result);
+    return;
   }
 
   // Technical note about the lookups_ vector.
@@ -452,7 +617,7 @@ string EdgeEnv::LookupVariable(const string& var) {
     }
   }
 
-  // See notes on BindingEnv::LookupWithFallback.
+  // See notes on BindingEnv::AppendWithFallback.
   const EvalString* eval = edge_->rule_->GetBinding(var);
   bool record_varname = recursive_ && eval;
   if (record_varname)
@@ -461,30 +626,27 @@ string EdgeEnv::LookupVariable(const string& var) {
   // In practice, variables defined on rules never use another rule variable.
   // For performance, only start checking for cycles after the first lookup.
   recursive_ = true;
-  std::string result = edge_->env_->LookupWithFallback(var, eval, this);
+  edge_->env_->AppendWithFallback(var, eval, this, result);
   if (record_varname)
     lookups_.pop_back();
-  return result;
 }
 
-std::string EdgeEnv::MakePathList(const Node* const* const span,
-                                  const size_t size, const char sep) const {
-  string result;
+void EdgeEnv::AppendPathList(const Node* const* const span, const size_t size,
+                             const char sep, string* result) const {
   for (const Node* const* i = span; i != span + size; ++i) {
-    if (!result.empty())
-      result.push_back(sep);
+    if (i != span)
+      result->push_back(sep);
     const string& path = (*i)->PathDecanonicalized();
     if (escape_in_out_ == kShellEscape) {
 #ifdef _WIN32
-      GetWin32EscapedString(path, &result);
+      GetWin32EscapedString(path, result);
 #else
-      GetShellEscapedString(path, &result);
+      GetShellEscapedString(path, result);
 #endif
     } else {
-      result.append(path);
+      result->append(path);
     }
   }
-  return result;
 }
 
 void Edge::CollectInputs(bool shell_escape,
@@ -510,13 +672,35 @@ void Edge::CollectInputs(bool shell_escape,
 }
 
 std::string Edge::EvaluateCommand(const bool incl_rsp_file) const {
-  string command = GetBinding("command");
+  string command;
+  AppendCommand(incl_rsp_file, &command);
+  return command;
+}
+
+void Edge::AppendCommand(const bool incl_rsp_file, string* command) const {
+  static const string kCommand = "command";
+  static const string kRspfileContent = "rspfile_content";
+  static const string kRspfileSeparator = ";rspfile=";
+  EdgeEnv env(this, EdgeEnv::kShellEscape);
+  env.AppendVariable(kCommand, Env::kOther, command);
   if (incl_rsp_file) {
-    string rspfile_content = GetBinding("rspfile_content");
-    if (!rspfile_content.empty())
-      command += ";rspfile=" + rspfile_content;
+    size_t size = command->size();
+    command->append(kRspfileSeparator);
+    size_t content = command->size();
+    env.AppendVariable(kRspfileContent, Env::kOther, command);
+    if (command->size() == content)
+      command->resize(size);
   }
-  return command;
+}
+
+uint64_t Edge::GetCommandHash() const {
+  if (!command_hash_known_) {
+    string command;
+    AppendCommand(/*incl_rsp_file=*/true, &command);
+    command_hash_ = BuildLog::LogEntry::HashCommand(command);
+    command_hash_known_ = true;
+  }
+  return command_hash_;
 }
 
 std::string Edge::GetBinding(const std::string& key) const {
@@ -524,6 +708,11 @@ std::string Edge::GetBinding(const std::string& key) const {
   return env.LookupVariable(key);
 }
 
+void Edge::AppendBinding(const std::string& key, std::string* value) const {
+  EdgeEnv env(this, EdgeEnv::kShellEscape);
+  env.AppendVariable(key, Env::Classify(key), value);
+}
+
 bool Edge::GetBindingBool(const string& key) const {
   return !GetBinding(key).empty();
 }
@@ -602,6 +791,15 @@ string Node::PathDecanonicalized(const string& path, uint64_t slash_bits) {
   return result;
 }
 
+void Node::RemoveOutEdge(Edge* edge) {
+  for (size_t i = out_edges_.size(); i > 0; --i) {
+    if (out_edges_[i - 1] == edge) {
+      out_edges_.erase(out_edges_.begin() + i - 1);
+      return;
+    }
+  }
+}
+
 void Node::Dump(const char* prefix) const {
   printf("%s <%s 0x%p> mtime: %" PRId64 "%s, (:%s), ",
          prefix, path().c_str(), this,
@@ -650,43 +848,112 @@ struct matches {
   std::vector<StringPiece>::iterator i_;
 };
 
+struct ImplicitDepLoader::ParsedDepfile {
+  explicit ParsedDepfile(const DepfileParserOptions* options)
+      : status(FileReader::Okay),
+        parser(options ? *options : DepfileParserOptions()), parsed(false) {}
+
+  /// Read and parse |path|, touching nothing but this and the disk.
+  void Load(FileReader* file_reader, const string& path);
+
+  string path;
+  FileReader::Status status;
+  /// The error reading the file if status is OtherError, else the error
+  /// parsing it if !parsed.
+  string err;
+  /// Empty if the file is missing.
+  string content;
+  DepfileParser parser;
+  bool parsed;
+};
+
+void ImplicitDepLoader::ParsedDepfile::Load(FileReader* file_reader,
+                                            const string& path) {
+  this->path = path;
+  // Treat a missing depfile as empty.
+  status = file_reader->ReadFile(path, &content, &err);
+  if (status == FileReader::NotFound)
+    err.clear();
+  if (status != FileReader::OtherError && !content.empty())
+    parsed = parser.Parse(&content, &err);
+}
+
+ImplicitDepLoader::ImplicitDepLoader(
+    State* state, DepsLog* deps_log, DiskInterface* disk_interface,
+    DepfileParserOptions const* depfile_parser_options)
+    : state_(state), disk_interface_(disk_interface), deps_log_(deps_log),
+      depfile_parser_options_(depfile_parser_options), preloaded_bytes_(0) {}
+
+ImplicitDepLoader::~ImplicitDepLoader() {}
+
+void ImplicitDepLoader::ReservePreloads(size_t edge_count) {
+  if (preloaded_.size() < edge_count)
+    preloaded_.resize(edge_count);
+}
+
+void ImplicitDepLoader::PreloadDepFile(Edge* edge) {
+  if (edge->deps_loaded_ || preloaded_[edge->id_] ||
+      preloaded_bytes_ >= kMaxPreloadedBytes ||
+      !edge->GetBinding("deps").empty()) {
+    return;
+  }
+  string path = edge->GetUnescapedDepfile();
+  if (path.empty())
+    return;
+  unique_ptr<ParsedDepfile> depfile(
+      new ParsedDepfile(depfile_parser_options_));
+  depfile->Load(disk_interface_, path);
+  preloaded_bytes_ += depfile->content.size();
+  preloaded_[edge->id_] = move(depfile);
+}
+
+const vector<StringPiece>* ImplicitDepLoader::PreloadedInputs(
+    const Edge* edge) const {
+  if (edge->id_ >= preloaded_.size() || !preloaded_[edge->id_] ||
+      !preloaded_[edge->id_]->parsed) {
+    return NULL;
+  }
+  return &preloaded_[edge->id_]->parser.ins_;
+}
+
 bool ImplicitDepLoader::LoadDepFile(Edge* edge, const string& path,
                                     string* err) {
   METRIC_RECORD("depfile load");
-  // Read depfile content.  Treat a missing depfile as empty.
-  string content;
-  switch (disk_interface_->ReadFile(path, &content, err)) {
-  case DiskInterface::Okay:
-    break;
-  case DiskInterface::NotFound:
-    err->clear();
-    break;
-  case DiskInterface::OtherError:
-    *err = "loading '" + path + "': " + *err;
+  // Use the depfile Prefetch() read, if it did.
+  unique_ptr<ParsedDepfile> preloaded;
+  if (edge->id_ < preloaded_.size()) {
+    preloaded = move(preloaded_[edge->id_]);
+    if (preloaded)
+      preloaded_bytes_ -= preloaded->content.size();
+  }
+  ParsedDepfile loaded(depfile_parser_options_);
+  ParsedDepfile* depfile = preloaded.get();
+  if (!depfile || depfile->path != path) {
+    loaded.Load(disk_interface_, path);
+    depfile = &loaded;
+  }
+
+  if (depfile->status == FileReader::OtherError) {
+    *err = "loading '" + path + "': " + depfile->err;
     return false;
   }
   // On a missing depfile: return false and empty *err.
-  if (content.empty()) {
+  if (depfile->content.empty()) {
     EXPLAIN("depfile '%s' is missing", path.c_str());
     return false;
   }
-
-  DepfileParser depfile(depfile_parser_options_
-                        ? *depfile_parser_options_
-                        : DepfileParserOptions());
-  string depfile_err;
-  if (!depfile.Parse(&content, &depfile_err)) {
-    *err = path + ": " + depfile_err;
+  if (!depfile->parsed) {
+    *err = path + ": " + depfile->err;
     return false;
   }
 
-  if (depfile.outs_.empty()) {
+  if (depfile->parser.outs_.empty()) {
     *err = path + ": no outputs declared";
     return false;
   }
 
   uint64_t unused;
-  std::vector<StringPiece>::iterator primary_out = depfile.outs_.begin();
+  std::vector<StringPiece>::iterator primary_out = depfile->parser.outs_.begin();
   CanonicalizePath(const_cast<char*>(primary_out->str_), &primary_out->len_,
                    &unused);
 
@@ -701,8 +968,8 @@ bool ImplicitDepLoader::LoadDepFile(Edge* edge, const string& path,
   }
 
   // Ensure that all mentioned outputs are outputs of the edge.
-  for (std::vector<StringPiece>::iterator o = depfile.outs_.begin();
-       o != depfile.outs_.end(); ++o) {
+  for (std::vector<StringPiece>::iterator o = depfile->parser.outs_.begin();
+       o != depfile->parser.outs_.end(); ++o) {
     matches m(o);
     if (std::find_if(edge->outputs_.begin(), edge->outputs_.end(), m) == edge->outputs_.end()) {
       *err = path + ": depfile mentions '" + o->AsString() + "' as an output, but no such output was declared";
@@ -710,7 +977,7 @@ bool ImplicitDepLoader::LoadDepFile(Edge* edge, const string& path,
     }
   }
 
-  return ProcessDepfileDeps(edge, &depfile.ins_, err);
+  return ProcessDepfileDeps(edge, &depfile->parser.ins_, err);
 }
 
 bool ImplicitDepLoader::ProcessDepfileDeps(
@@ -735,23 +1002,25 @@ bool ImplicitDepLoader::ProcessDepfileDeps(
 bool ImplicitDepLoader::LoadDepsFromLog(Edge* edge, string* err) {
   // NOTE: deps are only supported for single-target edges.
   Node* output = edge->outputs_[0];
-  DepsLog::Deps* deps = deps_log_ ? deps_log_->GetDeps(output) : NULL;
+  DepsLog::Deps deps;
+  if (deps_log_)
+    deps = deps_log_->GetDeps(output);
   if (!deps) {
     EXPLAIN("deps for '%s' are missing", output->path().c_str());
     return false;
   }
 
   // Deps are invalid if the output is newer than the deps.
-  if (output->mtime() > deps->mtime) {
+  if (output->mtime() > deps.mtime) {
     EXPLAIN("stored deps info out of date for '%s' (%" PRId64 " vs %" PRId64 ")",
-            output->path().c_str(), deps->mtime, output->mtime());
+            output->path().c_str(), deps.mtime, output->mtime());
     return false;
   }
 
   vector<Node*>::iterator implicit_dep =
-      PreallocateSpace(edge, deps->node_count);
-  for (int i = 0; i < deps->node_count; ++i, ++implicit_dep) {
-    Node* node = deps->nodes[i];
+      PreallocateSpace(edge, deps.node_count);
+  for (int i = 0; i < deps.node_count; ++i, ++implicit_dep) {
+    Node* node = deps.nodes[i];
     *implicit_dep = node;
     node->AddOutEdge(edge);
   }
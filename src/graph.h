@@ -16,6 +16,8 @@
 #define NINJA_GRAPH_H_
 
 #include <algorithm>
+#include <atomic>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -37,9 +39,13 @@ struct State;
 
 /// Information about a node in the dependency graph: the file, whether
 /// it's dirty, mtime, etc.
-struct Node {
-  Node(const std::string& path, uint64_t slash_bits)
-      : path_(path), slash_bits_(slash_bits) {}
+///
+/// Nodes start a cache line, and the fields the dirty walk reads for each
+/// input (its in-edge, mtime and state) come first, so that visiting an
+/// input costs a single cache miss. See State::nodes_.
+struct alignas(64) Node {
+  Node(StringPiece path, uint64_t slash_bits)
+      : path_(path.str_, path.len_), slash_bits_(slash_bits) {}
 
   /// Return false on error.
   bool Stat(DiskInterface* disk_interface, std::string* err);
@@ -112,17 +118,13 @@ struct Node {
   const std::vector<Edge*>& out_edges() const { return out_edges_; }
   const std::vector<Edge*>& validation_out_edges() const { return validation_out_edges_; }
   void AddOutEdge(Edge* edge) { out_edges_.push_back(edge); }
+  /// Remove |edge| from the out edges. Edges added last are found fastest.
+  void RemoveOutEdge(Edge* edge);
   void AddValidationOutEdge(Edge* edge) { validation_out_edges_.push_back(edge); }
 
   void Dump(const char* prefix="") const;
 
 private:
-  std::string path_;
-
-  /// Set bits starting from lowest for backslashes that were normalized to
-  /// forward slashes by CanonicalizePath. See |PathDecanonicalized|.
-  uint64_t slash_bits_ = 0;
-
   /// Possible values of mtime_:
   ///   -1: file hasn't been examined
   ///   0:  we looked, and file doesn't exist
@@ -159,14 +161,20 @@ private:
   /// known edge to produce it.
   Edge* in_edge_ = nullptr;
 
+  /// A dense integer id for the node, assigned and used by DepsLog.
+  int id_ = -1;
+
+  std::string path_;
+
+  /// Set bits starting from lowest for backslashes that were normalized to
+  /// forward slashes by CanonicalizePath. See |PathDecanonicalized|.
+  uint64_t slash_bits_ = 0;
+
   /// All Edges that use this Node as an input.
   std::vector<Edge*> out_edges_;
 
   /// All Edges that use this Node as a validation.
   std::vector<Edge*> validation_out_edges_;
-
-  /// A dense integer id for the node, assigned and used by DepsLog.
-  int id_ = -1;
 };
 
 struct EdgeCommand {
@@ -176,7 +184,11 @@ struct EdgeCommand {
 };
 
 /// An edge in the dependency graph; links between Nodes using Rules.
-struct Edge {
+///
+/// Like Node, edges start a cache line: the fields the dirty walk uses
+/// come first, in the first line, and those the plan and its ready queue
+/// use follow in the second. See State::edge_objects_.
+struct alignas(64) Edge {
   enum VisitMark {
     VisitNone,
     VisitInStack,
@@ -192,9 +204,17 @@ struct Edge {
   /// If incl_rsp_file is enabled, the string will also contain the
   /// full contents of a response file (if applicable)
   std::string EvaluateCommand(bool incl_rsp_file = false) const;
+  /// Like EvaluateCommand(), but append to \a command.
+  void AppendCommand(bool incl_rsp_file, std::string* command) const;
+
+  /// The BuildLog hash of EvaluateCommand(true). The command can't change
+  /// while the graph is loaded, so it is only evaluated once.
+  uint64_t GetCommandHash() const;
 
   /// Returns the shell-escaped value of |key|.
   std::string GetBinding(const std::string& key) const;
+  /// Like GetBinding(), but append to \a value.
+  void AppendBinding(const std::string& key, std::string* value) const;
   bool GetBindingBool(const std::string& key) const;
 
   /// Like GetBinding("depfile"), but without shell escaping.
@@ -218,26 +238,13 @@ struct Edge {
     critical_path_weight_ = critical_path_weight;
   }
 
-  const Rule* rule_ = nullptr;
-  Pool* pool_ = nullptr;
   std::vector<Node*> inputs_;
   std::vector<Node*> outputs_;
-  std::vector<Node*> validations_;
-  Node* dyndep_ = nullptr;
-  BindingEnv* env_ = nullptr;
   VisitMark mark_ = VisitNone;
-  size_t id_ = 0;
-  int64_t critical_path_weight_ = -1;
   bool outputs_ready_ = false;
   bool deps_loaded_ = false;
   bool deps_missing_ = false;
   bool generated_by_dep_loader_ = false;
-  TimeStamp command_start_time_ = 0;
-
-  const Rule& rule() const { return *rule_; }
-  Pool* pool() const { return pool_; }
-  int weight() const { return 1; }
-  bool outputs_ready() const { return outputs_ready_; }
 
   // There are three types of inputs.
   // 1) explicit deps, which show up as $in on the command line;
@@ -249,6 +256,26 @@ struct Edge {
   // #2 and #3 when we need to access the various subsets.
   int implicit_deps_ = 0;
   int order_only_deps_ = 0;
+
+  /// Assigned densely by State::AddEdge(), so that per-edge state can be
+  /// kept in arrays, as Plan does.
+  size_t id_ = 0;
+  int64_t critical_path_weight_ = -1;
+  const Rule* rule_ = nullptr;
+  Pool* pool_ = nullptr;
+  Node* dyndep_ = nullptr;
+  std::vector<Node*> validations_;
+
+  BindingEnv* env_ = nullptr;
+  TimeStamp command_start_time_ = 0;
+  mutable uint64_t command_hash_ = 0;
+  mutable bool command_hash_known_ = false;
+
+  const Rule& rule() const { return *rule_; }
+  Pool* pool() const { return pool_; }
+  int weight() const { return 1; }
+  bool outputs_ready() const { return outputs_ready_; }
+
   bool is_implicit(size_t index) {
     return index >= inputs_.size() - order_only_deps_ - implicit_deps_ &&
         !is_order_only(index);
@@ -289,9 +316,8 @@ typedef std::set<Edge*, EdgeCmp> EdgeSet;
 struct ImplicitDepLoader {
   ImplicitDepLoader(State* state, DepsLog* deps_log,
                     DiskInterface* disk_interface,
-                    DepfileParserOptions const* depfile_parser_options)
-      : state_(state), disk_interface_(disk_interface), deps_log_(deps_log),
-        depfile_parser_options_(depfile_parser_options) {}
+                    DepfileParserOptions const* depfile_parser_options);
+  virtual ~ImplicitDepLoader();
 
   /// Load implicit dependencies for \a edge.
   /// @return false on error (without filling \a err if info is just missing
@@ -302,7 +328,25 @@ struct ImplicitDepLoader {
     return deps_log_;
   }
 
+  /// Make room to preload the depfiles of edges with ids below |edge_count|.
+  void ReservePreloads(size_t edge_count);
+
+  /// Read and parse the depfile that LoadDeps() would load for |edge|, if
+  /// any, for LoadDeps() to use instead of reading it again. This doesn't
+  /// touch the graph, so it may run for different edges on several threads
+  /// at once, after ReservePreloads(). Depfiles beyond kMaxPreloadedBytes
+  /// are left for LoadDeps() to read.
+  void PreloadDepFile(Edge* edge);
+  static const size_t kMaxPreloadedBytes = 256 << 20;
+
+  /// The inputs of the depfile preloaded for |edge|, not yet canonicalized,
+  /// or NULL if none was.
+  const std::vector<StringPiece>* PreloadedInputs(const Edge* edge) const;
+
  protected:
+  /// A depfile read and parsed, possibly ahead of time on another thread.
+  struct ParsedDepfile;
+
   /// Process loaded implicit dependencies for \a edge and update the graph
   /// @return false on error (without filling \a err if info is just missing)
   virtual bool ProcessDepfileDeps(Edge* edge,
@@ -325,6 +369,11 @@ struct ImplicitDepLoader {
   DiskInterface* disk_interface_;
   DepsLog* deps_log_;
   DepfileParserOptions const* depfile_parser_options_;
+
+  /// Depfiles preloaded by PreloadDepFile(), indexed by Edge::id_ and
+  /// released as LoadDeps() uses them, and the size of their contents.
+  std::vector<std::unique_ptr<ParsedDepfile>> preloaded_;
+  std::atomic<size_t> preloaded_bytes_;
 };
 
 
@@ -334,7 +383,8 @@ struct DependencyScan {
   DependencyScan(State* state, BuildLog* build_log, DepsLog* deps_log,
                  DiskInterface* disk_interface,
                  DepfileParserOptions const* depfile_parser_options)
-      : build_log_(build_log),
+      : state_(state),
+        build_log_(build_log),
         disk_interface_(disk_interface),
         dep_loader_(state, deps_log, disk_interface, depfile_parser_options),
         dyndep_loader_(state, disk_interface) {}
@@ -348,6 +398,20 @@ struct DependencyScan {
   /// Returns false on failure.
   bool RecomputeDirty(Node* node, std::vector<Node*>* validation_nodes, std::string* err);
 
+  /// Do the disk work of RecomputeDirty() for |targets| ahead of time on a
+  /// thread pool: stat the nodes it would stat (their inputs, outputs and
+  /// logged deps, transitively), read and parse the depfiles it would load
+  /// and stat the inputs they name, and hash the commands it would compare
+  /// with the build log.
+  ///
+  /// Independent subtrees of the graph are walked on separate threads, and
+  /// each edge is claimed by one of them through an atomic mark. Only the
+  /// results are kept; what they mean for the graph, including any error,
+  /// is worked out by RecomputeDirty() in its usual order, so it reaches
+  /// the same state as without the prefetch. Does nothing if the pool has
+  /// a single thread or the disk interface isn't thread safe.
+  void Prefetch(const std::vector<Node*>& targets);
+
   /// Recompute whether any output of the edge is dirty, if so sets |*dirty|.
   /// Returns false on failure.
   bool RecomputeOutputsDirty(Edge* edge, Node* most_recent_input,
@@ -379,8 +443,9 @@ struct DependencyScan {
   /// Recompute whether a given single output should be marked dirty.
   /// Returns true if so.
   bool RecomputeOutputDirty(const Edge* edge, const Node* most_recent_input,
-                            const std::string& command, Node* output);
+                            Node* output);
 
+  State* state_;
   BuildLog* build_log_;
   DiskInterface* disk_interface_;
   ImplicitDepLoader dep_loader_;
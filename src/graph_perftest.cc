@@ -0,0 +1,195 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures the dirty walk and planning over a graph of a million nodes,
+// where they are dominated by cache misses on the nodes and edges.
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "build.h"
+#include "disk_interface.h"
+#include "graph.h"
+#include "metrics.h"
+#include "state.h"
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+// 300000 compile edges in 1000 directories, each including 10 out of
+// 400000 headers, linked into 1000 libraries: about a million nodes.
+const int kNumSources = 300000;
+const int kNumHeaders = 400000;
+const int kHeadersPerSource = 10;
+const int kNumLibraries = 1000;
+
+string SourcePath(int i) {
+  char buf[80];
+  snprintf(buf, sizeof(buf), "../../components/module%d/src/source_file_%d.cc",
+           i % 1000, i);
+  return buf;
+}
+
+string HeaderPath(int i) {
+  char buf[80];
+  snprintf(buf, sizeof(buf), "../../components/module%d/include/header_%d.h",
+           i % 1000, i);
+  return buf;
+}
+
+string ObjectPath(int i) {
+  char buf[80];
+  snprintf(buf, sizeof(buf), "obj/components/module%d/source_file_%d.o",
+           i % 1000, i);
+  return buf;
+}
+
+/// Creates the graph through State, as the manifest parser does, and
+/// returns the target that depends on everything.
+Node* MakeGraph(State* state) {
+  Rule* cxx = new Rule("cxx");
+  Rule* link = new Rule("link");
+  state->bindings_.AddRule(cxx);
+  state->bindings_.AddRule(link);
+
+  vector<Edge*> libraries;
+  for (int i = 0; i < kNumLibraries; ++i) {
+    Edge* edge = state->AddEdge(link);
+    state->AddOut(edge, "lib/libmodule" + to_string(i) + ".a", 0);
+    libraries.push_back(edge);
+  }
+  for (int i = 0; i < kNumSources; ++i) {
+    Edge* edge = state->AddEdge(cxx);
+    state->AddOut(edge, ObjectPath(i), 0);
+    state->AddIn(edge, SourcePath(i), 0);
+    for (int j = 0; j < kHeadersPerSource; ++j) {
+      // Sources in a module share most of their headers, as they do in
+      // real projects, but their nodes are created in a scattered order.
+      state->AddIn(edge, HeaderPath((i % 1000 * 397 + j * 7919 + i / 1000) %
+                                    kNumHeaders),
+                   0);
+    }
+    edge->implicit_deps_ = kHeadersPerSource;
+    state->AddIn(libraries[i % kNumLibraries], ObjectPath(i), 0);
+  }
+  Edge* all = state->AddEdge(&State::kPhonyRule);
+  state->AddOut(all, "all", 0);
+  for (int i = 0; i < kNumLibraries; ++i)
+    state->AddIn(all, "lib/libmodule" + to_string(i) + ".a", 0);
+  return state->LookupNode("all");
+}
+
+/// A disk where every file exists, with outputs older than the sources
+/// when |dirty| so that everything must be rebuilt.
+struct FakeDiskInterface : public DiskInterface {
+  FakeDiskInterface() : dirty_(false) {}
+
+  virtual TimeStamp Stat(const string& path, string* err) const {
+    if (path.compare(0, 4, "obj/") == 0 || path.compare(0, 4, "lib/") == 0)
+      return dirty_ ? 1 : 3;
+    return 2;
+  }
+  virtual bool MakeDir(const string& path) { return true; }
+  virtual bool WriteFile(const string& path, const string& contents) {
+    return true;
+  }
+  virtual int RemoveFile(const string& path) { return 1; }
+  virtual Status ReadFile(const string& path, string* contents, string* err) {
+    return NotFound;
+  }
+
+  bool dirty_;
+};
+
+/// Reset the graph and stat every node, as DependencyScan::Prefetch()
+/// does before the walk, so that the walk only measures the graph itself.
+void ResetAndStat(State* state, DiskInterface* disk_interface) {
+  state->Reset();
+  string err;
+  for (State::Paths::const_iterator i = state->paths_.begin();
+       i != state->paths_.end(); ++i) {
+    (*i)->StatIfNecessary(disk_interface, &err);
+  }
+}
+
+}  // anonymous namespace
+
+int main() {
+  State state;
+  int64_t start = GetTimeMillis();
+  Node* all = MakeGraph(&state);
+  printf("created %d nodes and %d edges in %dms\n",
+         (int)state.paths_.size(), (int)state.edges_.size(),
+         (int)(GetTimeMillis() - start));
+
+  FakeDiskInterface disk_interface;
+  const int kNumRepetitions = 5;
+  int64_t best_clean = -1, best_dirty = -1, best_plan = -1;
+  for (int i = 0; i < kNumRepetitions; ++i) {
+    string err;
+    vector<Node*> validation_nodes;
+
+    // Nothing to do: the walk visits every node and edge once.
+    disk_interface.dirty_ = false;
+    ResetAndStat(&state, &disk_interface);
+    DependencyScan clean_scan(&state, NULL, NULL, &disk_interface, NULL);
+    start = GetTimeMillis();
+    if (!clean_scan.RecomputeDirty(all, &validation_nodes, &err)) {
+      fprintf(stderr, "Failed to scan: %s\n", err.c_str());
+      return 1;
+    }
+    int64_t clean = GetTimeMillis() - start;
+    if (all->dirty()) {
+      fprintf(stderr, "Graph should be clean\n");
+      return 1;
+    }
+
+    // Everything to do: the walk, then planning every edge.
+    disk_interface.dirty_ = true;
+    ResetAndStat(&state, &disk_interface);
+    DependencyScan dirty_scan(&state, NULL, NULL, &disk_interface, NULL);
+    start = GetTimeMillis();
+    if (!dirty_scan.RecomputeDirty(all, &validation_nodes, &err)) {
+      fprintf(stderr, "Failed to scan: %s\n", err.c_str());
+      return 1;
+    }
+    int64_t dirty = GetTimeMillis() - start;
+
+    Plan plan;
+    start = GetTimeMillis();
+    if (!plan.AddTarget(all, &err)) {
+      fprintf(stderr, "Failed to plan: %s\n", err.c_str());
+      return 1;
+    }
+    plan.PrepareQueue();
+    int64_t planned = GetTimeMillis() - start;
+    if (plan.command_edge_count() != kNumSources + kNumLibraries) {
+      fprintf(stderr, "Unexpected number of edges to build\n");
+      return 1;
+    }
+
+    printf("clean walk %4dms  dirty walk %4dms  plan %4dms\n", (int)clean,
+           (int)dirty, (int)planned);
+    if (best_clean < 0 || clean < best_clean) best_clean = clean;
+    if (best_dirty < 0 || dirty < best_dirty) best_dirty = dirty;
+    if (best_plan < 0 || planned < best_plan) best_plan = planned;
+  }
+  printf("min: clean walk %dms  dirty walk %dms  plan %dms\n",
+         (int)best_clean, (int)best_dirty, (int)best_plan);
+  return 0;
+}
@@ -14,26 +14,47 @@
 
 #include "graph.h"
 #include "build.h"
+#include "build_log.h"
 
 #include "test.h"
+#include "thread_pool.h"
 
 using namespace std;
 
-struct GraphTest : public StateTestWithBuiltinRules {
+/// Runs each test with the serial dirty walk alone, and again with
+/// DependencyScan::Prefetch() on several threads before it, which must not
+/// change the outcome.
+struct GraphTest : public StateTestWithBuiltinRules,
+                   public testing::WithParamInterface<bool> {
   GraphTest() : scan_(&state_, NULL, NULL, &fs_, NULL) {}
 
+  bool RecomputeDirty(Node* node, vector<Node*>* validation_nodes,
+                      string* err) {
+    if (GetParam()) {
+      SetThreadPoolThreadCount(4);
+      scan_.Prefetch(vector<Node*>(1, node));
+      SetThreadPoolThreadCount(1);
+    }
+    return scan_.RecomputeDirty(node, validation_nodes, err);
+  }
+
   VirtualFileSystem fs_;
   DependencyScan scan_;
 };
 
-TEST_F(GraphTest, MissingImplicit) {
+INSTANTIATE_TEST_SUITE_P(Walk, GraphTest, testing::Values(false, true),
+                         [](const testing::TestParamInfo<bool>& info) {
+                           return info.param ? "Prefetched" : "Serial";
+                         });
+
+TEST_P(GraphTest, MissingImplicit) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out: cat in | implicit\n"));
   fs_.Create("in", "");
   fs_.Create("out", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("", err);
 
   // A missing implicit dep *should* make the output dirty.
@@ -42,7 +63,7 @@ TEST_F(GraphTest, MissingImplicit) {
   EXPECT_TRUE(GetNode("out")->dirty());
 }
 
-TEST_F(GraphTest, ModifiedImplicit) {
+TEST_P(GraphTest, ModifiedImplicit) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out: cat in | implicit\n"));
   fs_.Create("in", "");
@@ -51,14 +72,14 @@ TEST_F(GraphTest, ModifiedImplicit) {
   fs_.Create("implicit", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("", err);
 
   // A modified implicit dep should make the output dirty.
   EXPECT_TRUE(GetNode("out")->dirty());
 }
 
-TEST_F(GraphTest, FunkyMakefilePath) {
+TEST_P(GraphTest, FunkyMakefilePath) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule catdep\n"
 "  depfile = $out.d\n"
@@ -71,7 +92,7 @@ TEST_F(GraphTest, FunkyMakefilePath) {
   fs_.Create("implicit.h", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out.o"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out.o"), NULL, &err));
   ASSERT_EQ("", err);
 
   // implicit.h has changed, though our depfile refers to it with a
@@ -79,7 +100,7 @@ TEST_F(GraphTest, FunkyMakefilePath) {
   EXPECT_TRUE(GetNode("out.o")->dirty());
 }
 
-TEST_F(GraphTest, ExplicitImplicit) {
+TEST_P(GraphTest, ExplicitImplicit) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule catdep\n"
 "  depfile = $out.d\n"
@@ -94,7 +115,7 @@ TEST_F(GraphTest, ExplicitImplicit) {
   fs_.Create("data", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out.o"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out.o"), NULL, &err));
   ASSERT_EQ("", err);
 
   // We have both an implicit and an explicit dep on implicit.h.
@@ -103,7 +124,7 @@ TEST_F(GraphTest, ExplicitImplicit) {
   EXPECT_TRUE(GetNode("out.o")->dirty());
 }
 
-TEST_F(GraphTest, ImplicitOutputParse) {
+TEST_P(GraphTest, ImplicitOutputParse) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out | out.imp: cat in\n"));
 
@@ -115,21 +136,21 @@ TEST_F(GraphTest, ImplicitOutputParse) {
   EXPECT_EQ(edge, GetNode("out.imp")->in_edge());
 }
 
-TEST_F(GraphTest, ImplicitOutputMissing) {
+TEST_P(GraphTest, ImplicitOutputMissing) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out | out.imp: cat in\n"));
   fs_.Create("in", "");
   fs_.Create("out", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("", err);
 
   EXPECT_TRUE(GetNode("out")->dirty());
   EXPECT_TRUE(GetNode("out.imp")->dirty());
 }
 
-TEST_F(GraphTest, ImplicitOutputOutOfDate) {
+TEST_P(GraphTest, ImplicitOutputOutOfDate) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out | out.imp: cat in\n"));
   fs_.Create("out.imp", "");
@@ -138,14 +159,14 @@ TEST_F(GraphTest, ImplicitOutputOutOfDate) {
   fs_.Create("out", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("", err);
 
   EXPECT_TRUE(GetNode("out")->dirty());
   EXPECT_TRUE(GetNode("out.imp")->dirty());
 }
 
-TEST_F(GraphTest, ImplicitOutputOnlyParse) {
+TEST_P(GraphTest, ImplicitOutputOnlyParse) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build | out.imp: cat in\n"));
 
@@ -156,19 +177,19 @@ TEST_F(GraphTest, ImplicitOutputOnlyParse) {
   EXPECT_EQ(edge, GetNode("out.imp")->in_edge());
 }
 
-TEST_F(GraphTest, ImplicitOutputOnlyMissing) {
+TEST_P(GraphTest, ImplicitOutputOnlyMissing) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build | out.imp: cat in\n"));
   fs_.Create("in", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out.imp"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out.imp"), NULL, &err));
   ASSERT_EQ("", err);
 
   EXPECT_TRUE(GetNode("out.imp")->dirty());
 }
 
-TEST_F(GraphTest, ImplicitOutputOnlyOutOfDate) {
+TEST_P(GraphTest, ImplicitOutputOnlyOutOfDate) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build | out.imp: cat in\n"));
   fs_.Create("out.imp", "");
@@ -176,13 +197,13 @@ TEST_F(GraphTest, ImplicitOutputOnlyOutOfDate) {
   fs_.Create("in", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out.imp"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out.imp"), NULL, &err));
   ASSERT_EQ("", err);
 
   EXPECT_TRUE(GetNode("out.imp")->dirty());
 }
 
-TEST_F(GraphTest, PathWithCurrentDirectory) {
+TEST_P(GraphTest, PathWithCurrentDirectory) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule catdep\n"
 "  depfile = $out.d\n"
@@ -193,13 +214,13 @@ TEST_F(GraphTest, PathWithCurrentDirectory) {
   fs_.Create("out.o", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out.o"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out.o"), NULL, &err));
   ASSERT_EQ("", err);
 
   EXPECT_FALSE(GetNode("out.o")->dirty());
 }
 
-TEST_F(GraphTest, RootNodes) {
+TEST_P(GraphTest, RootNodes) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out1: cat in1\n"
 "build mid1: cat in1\n"
@@ -215,7 +236,7 @@ TEST_F(GraphTest, RootNodes) {
   }
 }
 
-TEST_F(GraphTest, CollectInputs) {
+TEST_P(GraphTest, CollectInputs) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(
       &state_,
       "build out$ 1: cat in1 in2 in$ with$ space | implicit || order_only\n"));
@@ -248,7 +269,7 @@ TEST_F(GraphTest, CollectInputs) {
   EXPECT_EQ("order_only", inputs[4]);
 }
 
-TEST_F(GraphTest, VarInOutPathEscaping) {
+TEST_P(GraphTest, VarInOutPathEscaping) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build a$ b: cat no'space with$ space$$ no\"space2\n"));
 
@@ -263,7 +284,7 @@ TEST_F(GraphTest, VarInOutPathEscaping) {
 }
 
 // Regression test for https://github.com/ninja-build/ninja/issues/380
-TEST_F(GraphTest, DepfileWithCanonicalizablePath) {
+TEST_P(GraphTest, DepfileWithCanonicalizablePath) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule catdep\n"
 "  depfile = $out.d\n"
@@ -274,14 +295,14 @@ TEST_F(GraphTest, DepfileWithCanonicalizablePath) {
   fs_.Create("out.o", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out.o"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out.o"), NULL, &err));
   ASSERT_EQ("", err);
 
   EXPECT_FALSE(GetNode("out.o")->dirty());
 }
 
 // Regression test for https://github.com/ninja-build/ninja/issues/404
-TEST_F(GraphTest, DepfileRemoved) {
+TEST_P(GraphTest, DepfileRemoved) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule catdep\n"
 "  depfile = $out.d\n"
@@ -294,19 +315,19 @@ TEST_F(GraphTest, DepfileRemoved) {
   fs_.Create("out.o", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out.o"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out.o"), NULL, &err));
   ASSERT_EQ("", err);
   EXPECT_FALSE(GetNode("out.o")->dirty());
 
   state_.Reset();
   fs_.RemoveFile("out.o.d");
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out.o"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out.o"), NULL, &err));
   ASSERT_EQ("", err);
   EXPECT_TRUE(GetNode("out.o")->dirty());
 }
 
 // Check that rule-level variables are in scope for eval.
-TEST_F(GraphTest, RuleVariablesInScope) {
+TEST_P(GraphTest, RuleVariablesInScope) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule r\n"
 "  depfile = x\n"
@@ -316,8 +337,32 @@ TEST_F(GraphTest, RuleVariablesInScope) {
   EXPECT_EQ("depfile is x", edge->EvaluateCommand());
 }
 
+// The command hash covers the response file and is only computed once.
+TEST_P(GraphTest, CommandHash) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule r\n"
+"  command = r $in > $out\n"
+"rule rsp\n"
+"  command = rsp @$out.rsp\n"
+"  rspfile = $out.rsp\n"
+"  rspfile_content = $in_newline\n"
+"build out: r a b\n"
+"build out2: rsp a b\n"));
+  Edge* edge = GetNode("out")->in_edge();
+  EXPECT_EQ(BuildLog::LogEntry::HashCommand("r a b > out"),
+            edge->GetCommandHash());
+  Edge* rsp_edge = GetNode("out2")->in_edge();
+  EXPECT_EQ("rsp @out2.rsp;rspfile=a\nb", rsp_edge->EvaluateCommand(true));
+  EXPECT_EQ(BuildLog::LogEntry::HashCommand(rsp_edge->EvaluateCommand(true)),
+            rsp_edge->GetCommandHash());
+
+  string command = "prefix ";
+  edge->AppendCommand(false, &command);
+  EXPECT_EQ("prefix r a b > out", command);
+}
+
 // Check that build statements can override rule builtins like depfile.
-TEST_F(GraphTest, DepfileOverride) {
+TEST_P(GraphTest, DepfileOverride) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule r\n"
 "  depfile = x\n"
@@ -329,7 +374,7 @@ TEST_F(GraphTest, DepfileOverride) {
 }
 
 // Check that overridden values show up in expansion of rule-level bindings.
-TEST_F(GraphTest, DepfileOverrideParent) {
+TEST_P(GraphTest, DepfileOverrideParent) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule r\n"
 "  depfile = x\n"
@@ -341,13 +386,13 @@ TEST_F(GraphTest, DepfileOverrideParent) {
 }
 
 // Verify that building a nested phony rule prints "no work to do"
-TEST_F(GraphTest, NestedPhonyPrintsDone) {
+TEST_P(GraphTest, NestedPhonyPrintsDone) {
   AssertParse(&state_,
 "build n1: phony \n"
 "build n2: phony n1\n"
   );
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("n2"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("n2"), NULL, &err));
   ASSERT_EQ("", err);
 
   Plan plan_;
@@ -358,7 +403,7 @@ TEST_F(GraphTest, NestedPhonyPrintsDone) {
   ASSERT_FALSE(plan_.more_to_do());
 }
 
-TEST_F(GraphTest, PhonySelfReferenceError) {
+TEST_P(GraphTest, PhonySelfReferenceError) {
   ManifestParserOptions parser_opts;
   parser_opts.phony_cycle_action_ = kPhonyCycleActionError;
   AssertParse(&state_,
@@ -366,11 +411,11 @@ TEST_F(GraphTest, PhonySelfReferenceError) {
   parser_opts);
 
   string err;
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("a"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("a"), NULL, &err));
   ASSERT_EQ("dependency cycle: a -> a [-w phonycycle=err]", err);
 }
 
-TEST_F(GraphTest, DependencyCycle) {
+TEST_P(GraphTest, DependencyCycle) {
   AssertParse(&state_,
 "build out: cat mid\n"
 "build mid: cat in\n"
@@ -378,36 +423,36 @@ TEST_F(GraphTest, DependencyCycle) {
 "build pre: cat out\n");
 
   string err;
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("dependency cycle: out -> mid -> in -> pre -> out", err);
 }
 
-TEST_F(GraphTest, CycleInEdgesButNotInNodes1) {
+TEST_P(GraphTest, CycleInEdgesButNotInNodes1) {
   string err;
   AssertParse(&state_,
 "build a b: cat a\n");
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("b"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("b"), NULL, &err));
   ASSERT_EQ("dependency cycle: a -> a", err);
 }
 
-TEST_F(GraphTest, CycleInEdgesButNotInNodes2) {
+TEST_P(GraphTest, CycleInEdgesButNotInNodes2) {
   string err;
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build b a: cat a\n"));
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("b"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("b"), NULL, &err));
   ASSERT_EQ("dependency cycle: a -> a", err);
 }
 
-TEST_F(GraphTest, CycleInEdgesButNotInNodes3) {
+TEST_P(GraphTest, CycleInEdgesButNotInNodes3) {
   string err;
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build a b: cat c\n"
 "build c: cat a\n"));
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("b"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("b"), NULL, &err));
   ASSERT_EQ("dependency cycle: a -> c -> a", err);
 }
 
-TEST_F(GraphTest, CycleInEdgesButNotInNodes4) {
+TEST_P(GraphTest, CycleInEdgesButNotInNodes4) {
   string err;
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build d: cat c\n"
@@ -415,13 +460,13 @@ TEST_F(GraphTest, CycleInEdgesButNotInNodes4) {
 "build b: cat a\n"
 "build a e: cat d\n"
 "build f: cat e\n"));
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("f"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("f"), NULL, &err));
   ASSERT_EQ("dependency cycle: a -> d -> c -> b -> a", err);
 }
 
 // Verify that cycles in graphs with multiple outputs are handled correctly
 // in RecomputeDirty() and don't cause deps to be loaded multiple times.
-TEST_F(GraphTest, CycleWithLengthZeroFromDepfile) {
+TEST_P(GraphTest, CycleWithLengthZeroFromDepfile) {
   AssertParse(&state_,
 "rule deprule\n"
 "   depfile = dep.d\n"
@@ -431,7 +476,7 @@ TEST_F(GraphTest, CycleWithLengthZeroFromDepfile) {
   fs_.Create("dep.d", "a: b\n");
 
   string err;
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("a"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("a"), NULL, &err));
   ASSERT_EQ("dependency cycle: b -> b", err);
 
   // Despite the depfile causing edge to be a cycle (it has outputs a and b,
@@ -443,7 +488,7 @@ TEST_F(GraphTest, CycleWithLengthZeroFromDepfile) {
 }
 
 // Like CycleWithLengthZeroFromDepfile but with a higher cycle length.
-TEST_F(GraphTest, CycleWithLengthOneFromDepfile) {
+TEST_P(GraphTest, CycleWithLengthOneFromDepfile) {
   AssertParse(&state_,
 "rule deprule\n"
 "   depfile = dep.d\n"
@@ -456,7 +501,7 @@ TEST_F(GraphTest, CycleWithLengthOneFromDepfile) {
   fs_.Create("dep.d", "a: c\n");
 
   string err;
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("a"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("a"), NULL, &err));
   ASSERT_EQ("dependency cycle: b -> c -> b", err);
 
   // Despite the depfile causing edge to be a cycle (|edge| has outputs a and b,
@@ -469,7 +514,7 @@ TEST_F(GraphTest, CycleWithLengthOneFromDepfile) {
 
 // Like CycleWithLengthOneFromDepfile but building a node one hop away from
 // the cycle.
-TEST_F(GraphTest, CycleWithLengthOneFromDepfileOneHopAway) {
+TEST_P(GraphTest, CycleWithLengthOneFromDepfileOneHopAway) {
   AssertParse(&state_,
 "rule deprule\n"
 "   depfile = dep.d\n"
@@ -483,7 +528,7 @@ TEST_F(GraphTest, CycleWithLengthOneFromDepfileOneHopAway) {
   fs_.Create("dep.d", "a: c\n");
 
   string err;
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("d"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("d"), NULL, &err));
   ASSERT_EQ("dependency cycle: b -> c -> b", err);
 
   // Despite the depfile causing edge to be a cycle (|edge| has outputs a and b,
@@ -495,7 +540,7 @@ TEST_F(GraphTest, CycleWithLengthOneFromDepfileOneHopAway) {
 }
 
 #ifdef _WIN32
-TEST_F(GraphTest, Decanonicalize) {
+TEST_P(GraphTest, Decanonicalize) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out\\out1: cat src\\in1\n"
 "build out\\out2/out3\\out4: cat mid1\n"
@@ -515,7 +560,7 @@ TEST_F(GraphTest, Decanonicalize) {
 }
 #endif
 
-TEST_F(GraphTest, DyndepLoadTrivial) {
+TEST_P(GraphTest, DyndepLoadTrivial) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -544,7 +589,7 @@ TEST_F(GraphTest, DyndepLoadTrivial) {
   EXPECT_FALSE(edge->GetBindingBool("restat"));
 }
 
-TEST_F(GraphTest, DyndepLoadImplicit) {
+TEST_P(GraphTest, DyndepLoadImplicit) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -575,7 +620,7 @@ TEST_F(GraphTest, DyndepLoadImplicit) {
   EXPECT_FALSE(edge->GetBindingBool("restat"));
 }
 
-TEST_F(GraphTest, DyndepLoadMissingFile) {
+TEST_P(GraphTest, DyndepLoadMissingFile) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -589,7 +634,7 @@ TEST_F(GraphTest, DyndepLoadMissingFile) {
   EXPECT_EQ("loading 'dd': No such file or directory", err);
 }
 
-TEST_F(GraphTest, DyndepLoadMissingEntry) {
+TEST_P(GraphTest, DyndepLoadMissingEntry) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -606,7 +651,7 @@ TEST_F(GraphTest, DyndepLoadMissingEntry) {
   EXPECT_EQ("'out' not mentioned in its dyndep file 'dd'", err);
 }
 
-TEST_F(GraphTest, DyndepLoadExtraEntry) {
+TEST_P(GraphTest, DyndepLoadExtraEntry) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -627,7 +672,7 @@ TEST_F(GraphTest, DyndepLoadExtraEntry) {
             "does not have a dyndep binding for the file", err);
 }
 
-TEST_F(GraphTest, DyndepLoadOutputWithMultipleRules1) {
+TEST_P(GraphTest, DyndepLoadOutputWithMultipleRules1) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -646,7 +691,7 @@ TEST_F(GraphTest, DyndepLoadOutputWithMultipleRules1) {
   EXPECT_EQ("multiple rules generate out-twice.imp", err);
 }
 
-TEST_F(GraphTest, DyndepLoadOutputWithMultipleRules2) {
+TEST_P(GraphTest, DyndepLoadOutputWithMultipleRules2) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -673,7 +718,7 @@ TEST_F(GraphTest, DyndepLoadOutputWithMultipleRules2) {
   EXPECT_EQ("multiple rules generate out-twice.imp", err);
 }
 
-TEST_F(GraphTest, DyndepLoadMultiple) {
+TEST_P(GraphTest, DyndepLoadMultiple) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -729,7 +774,7 @@ TEST_F(GraphTest, DyndepLoadMultiple) {
   EXPECT_EQ(edge2, in2imp->out_edges()[0]);
 }
 
-TEST_F(GraphTest, DyndepFileMissing) {
+TEST_P(GraphTest, DyndepFileMissing) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -738,11 +783,11 @@ TEST_F(GraphTest, DyndepFileMissing) {
   );
 
   string err;
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("loading 'dd': No such file or directory", err);
 }
 
-TEST_F(GraphTest, DyndepFileError) {
+TEST_P(GraphTest, DyndepFileError) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -754,11 +799,11 @@ TEST_F(GraphTest, DyndepFileError) {
   );
 
   string err;
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("'out' not mentioned in its dyndep file 'dd'", err);
 }
 
-TEST_F(GraphTest, DyndepImplicitInputNewer) {
+TEST_P(GraphTest, DyndepImplicitInputNewer) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -774,7 +819,7 @@ TEST_F(GraphTest, DyndepImplicitInputNewer) {
   fs_.Create("in", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("", err);
 
   EXPECT_FALSE(GetNode("in")->dirty());
@@ -784,7 +829,7 @@ TEST_F(GraphTest, DyndepImplicitInputNewer) {
   EXPECT_TRUE(GetNode("out")->dirty());
 }
 
-TEST_F(GraphTest, DyndepFileReady) {
+TEST_P(GraphTest, DyndepFileReady) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -802,7 +847,7 @@ TEST_F(GraphTest, DyndepFileReady) {
   fs_.Create("in", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("", err);
 
   EXPECT_FALSE(GetNode("in")->dirty());
@@ -813,7 +858,7 @@ TEST_F(GraphTest, DyndepFileReady) {
   EXPECT_TRUE(GetNode("out")->dirty());
 }
 
-TEST_F(GraphTest, DyndepFileNotClean) {
+TEST_P(GraphTest, DyndepFileNotClean) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -827,7 +872,7 @@ TEST_F(GraphTest, DyndepFileNotClean) {
   fs_.Create("out", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("", err);
 
   EXPECT_TRUE(GetNode("dd")->dirty());
@@ -838,7 +883,7 @@ TEST_F(GraphTest, DyndepFileNotClean) {
   EXPECT_FALSE(GetNode("out")->in_edge()->outputs_ready());
 }
 
-TEST_F(GraphTest, DyndepFileNotReady) {
+TEST_P(GraphTest, DyndepFileNotReady) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -853,7 +898,7 @@ TEST_F(GraphTest, DyndepFileNotReady) {
   fs_.Create("out", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("", err);
 
   EXPECT_FALSE(GetNode("dd")->dirty());
@@ -862,7 +907,7 @@ TEST_F(GraphTest, DyndepFileNotReady) {
   EXPECT_FALSE(GetNode("out")->in_edge()->outputs_ready());
 }
 
-TEST_F(GraphTest, DyndepFileSecondNotReady) {
+TEST_P(GraphTest, DyndepFileSecondNotReady) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -881,7 +926,7 @@ TEST_F(GraphTest, DyndepFileSecondNotReady) {
   fs_.Create("out", "");
 
   string err;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out"), NULL, &err));
   ASSERT_EQ("", err);
 
   EXPECT_TRUE(GetNode("dd1")->dirty());
@@ -892,7 +937,7 @@ TEST_F(GraphTest, DyndepFileSecondNotReady) {
   EXPECT_FALSE(GetNode("out")->in_edge()->outputs_ready());
 }
 
-TEST_F(GraphTest, DyndepFileCircular) {
+TEST_P(GraphTest, DyndepFileCircular) {
   AssertParse(&state_,
 "rule r\n"
 "  command = unused\n"
@@ -910,7 +955,7 @@ TEST_F(GraphTest, DyndepFileCircular) {
 
   Edge* edge = GetNode("out")->in_edge();
   string err;
-  EXPECT_FALSE(scan_.RecomputeDirty(GetNode("out"), NULL, &err));
+  EXPECT_FALSE(RecomputeDirty(GetNode("out"), NULL, &err));
   EXPECT_EQ("dependency cycle: circ -> in -> circ", err);
 
   // Verify that "out.d" was loaded exactly once despite
@@ -923,7 +968,7 @@ TEST_F(GraphTest, DyndepFileCircular) {
   EXPECT_EQ(1u, edge->order_only_deps_);
 }
 
-TEST_F(GraphTest, Validation) {
+TEST_P(GraphTest, Validation) {
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "build out: cat in |@ validate\n"
 "build validate: cat in\n"));
@@ -931,7 +976,7 @@ TEST_F(GraphTest, Validation) {
   fs_.Create("in", "");
   string err;
   std::vector<Node*> validation_nodes;
-  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), &validation_nodes, &err));
+  EXPECT_TRUE(RecomputeDirty(GetNode("out"), &validation_nodes, &err));
   ASSERT_EQ("", err);
 
   ASSERT_EQ(validation_nodes.size(), 1);
@@ -942,7 +987,7 @@ TEST_F(GraphTest, Validation) {
 }
 
 // Check that phony's dependencies' mtimes are propagated.
-TEST_F(GraphTest, PhonyDepsMtimes) {
+TEST_P(GraphTest, PhonyDepsMtimes) {
   string err;
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule touch\n"
@@ -955,7 +1000,7 @@ TEST_F(GraphTest, PhonyDepsMtimes) {
   Node* out1 = GetNode("out1");
   Node* in1  = GetNode("in1");
 
-  EXPECT_TRUE(scan_.RecomputeDirty(out1, NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(out1, NULL, &err));
   EXPECT_TRUE(!out1->dirty());
 
   // Get the mtime of out1
@@ -972,14 +1017,14 @@ TEST_F(GraphTest, PhonyDepsMtimes) {
   ASSERT_TRUE(in1->Stat(&fs_, &err));
   EXPECT_GT(in1->mtime(), in1Mtime1);
 
-  EXPECT_TRUE(scan_.RecomputeDirty(out1, NULL, &err));
+  EXPECT_TRUE(RecomputeDirty(out1, NULL, &err));
   EXPECT_GT(in1->mtime(), in1Mtime1);
   EXPECT_EQ(out1->mtime(), out1Mtime1);
   EXPECT_TRUE(out1->dirty());
 }
 
 // Test that EdgeQueue correctly prioritizes by critical time
-TEST_F(GraphTest, EdgeQueuePriority) {
+TEST_P(GraphTest, EdgeQueuePriority) {
 
   ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
 "rule r\n"
@@ -1030,3 +1075,93 @@ TEST_F(GraphTest, EdgeQueuePriority) {
 }
 
 
+
+TEST_P(GraphTest, Prefetch) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build mid: cat in1 in2 | implicit || order_only |@ validation\n"
+"build out: cat mid other\n"
+"build unrelated: cat in3\n"));
+  fs_.Create("in1", "");
+  fs_.Create("in2", "");
+  fs_.Create("other", "");
+  fs_.Create("mid", "");
+  fs_.Create("out", "");
+  fs_.files_["in2"].mtime = -1;
+  fs_.files_["in2"].stat_error = "permission denied";
+
+  SetThreadPoolThreadCount(4);
+  vector<Node*> targets(1, GetNode("out"));
+  scan_.Prefetch(targets);
+  SetThreadPoolThreadCount(1);
+
+  const char* known[] = { "out", "mid", "other", "in1", "implicit",
+                          "order_only", "validation" };
+  for (size_t i = 0; i < sizeof(known) / sizeof(known[0]); ++i)
+    EXPECT_TRUE(GetNode(known[i])->status_known()) << known[i];
+  EXPECT_TRUE(GetNode("in1")->exists());
+  EXPECT_FALSE(GetNode("implicit")->exists());
+  EXPECT_FALSE(GetNode("unrelated")->status_known());
+  EXPECT_FALSE(GetNode("in3")->status_known());
+
+  // The failed stat is left for the dirty walk to report.
+  EXPECT_FALSE(GetNode("in2")->status_known());
+  string err;
+  vector<Node*> validation_nodes;
+  EXPECT_FALSE(RecomputeDirty(GetNode("out"), &validation_nodes, &err));
+  EXPECT_EQ("permission denied", err);
+}
+
+// A missing input stat()ed ahead of the walk still makes its output dirty.
+TEST_P(GraphTest, PrefetchMissingInput) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out: cat in\n"));
+  fs_.Create("out", "");
+
+  SetThreadPoolThreadCount(4);
+  vector<Node*> targets(1, GetNode("out"));
+  scan_.Prefetch(targets);
+  SetThreadPoolThreadCount(1);
+  EXPECT_TRUE(GetNode("in")->status_known());
+
+  string err;
+  vector<Node*> validation_nodes;
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out"), &validation_nodes, &err));
+  ASSERT_EQ("", err);
+  EXPECT_TRUE(GetNode("in")->dirty());
+  EXPECT_TRUE(GetNode("out")->dirty());
+}
+
+TEST_P(GraphTest, PrefetchDepfile) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule catdep\n"
+"  depfile = $out.d\n"
+"  command = cat $in > $out\n"
+"build out.o: catdep foo.cc\n"
+"build gen.h: cat gen.in\n"));
+  fs_.Create("foo.cc", "");
+  fs_.Create("gen.in", "");
+  fs_.Create("gen.h", "");
+  fs_.Create("sys.h", "");
+  fs_.Create("out.o", "");
+  fs_.Create("out.o.d", "out.o: ./gen.h sys.h\n");
+
+  SetThreadPoolThreadCount(4);
+  vector<Node*> targets(1, GetNode("out.o"));
+  scan_.Prefetch(targets);
+  SetThreadPoolThreadCount(1);
+
+  // The depfile was read, and the inputs it names that are in the graph
+  // were stat()ed, though the graph doesn't know about them yet.
+  ASSERT_EQ(1u, fs_.files_read_.size());
+  EXPECT_EQ("out.o.d", fs_.files_read_[0]);
+  EXPECT_TRUE(GetNode("gen.h")->status_known());
+  EXPECT_EQ(1u, GetNode("out.o")->in_edge()->inputs_.size());
+
+  // The dirty walk uses the parsed depfile instead of reading it again.
+  string err;
+  EXPECT_TRUE(scan_.RecomputeDirty(GetNode("out.o"), NULL, &err));
+  ASSERT_EQ("", err);
+  EXPECT_EQ(1u, fs_.files_read_.size());
+  EXPECT_EQ(3u, GetNode("out.o")->in_edge()->inputs_.size());
+  EXPECT_FALSE(GetNode("out.o")->dirty());
+}
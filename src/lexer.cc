@@ -20,8 +20,50 @@
 #include "eval_env.h"
 #include "util.h"
 
+#ifdef NINJA_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
+namespace {
+
+/// Skip the plain text at |p| 16 bytes at a time, up to the first
+/// character that ReadEvalString() has to look at: a '$', a line break or
+/// a NUL and, in paths, a ' ', ':' or '|'. The text left in the last block
+/// before |end| is left to the lexer.
+const char* SkipPlainText(const char* p, const char* end, bool path) {
+#ifdef NINJA_HAVE_SSE2
+  const __m128i dollar = _mm_set1_epi8('$');
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i carriage_return = _mm_set1_epi8('\r');
+  const __m128i nul = _mm_setzero_si128();
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i colon = _mm_set1_epi8(':');
+  const __m128i pipe = _mm_set1_epi8('|');
+  for (; end - p >= 16; p += 16) {
+    __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i special = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(c, dollar), _mm_cmpeq_epi8(c, newline)),
+        _mm_or_si128(_mm_cmpeq_epi8(c, carriage_return),
+                     _mm_cmpeq_epi8(c, nul)));
+    if (path) {
+      special = _mm_or_si128(
+          special,
+          _mm_or_si128(_mm_cmpeq_epi8(c, space),
+                       _mm_or_si128(_mm_cmpeq_epi8(c, colon),
+                                    _mm_cmpeq_epi8(c, pipe))));
+    }
+    uint32_t mask = _mm_movemask_epi8(special);
+    if (mask)
+      return p + LowestSetBit(mask);
+  }
+#endif
+  return p;
+}
+
+}  // namespace
+
 bool Lexer::Error(const string& message, string* err) {
   // Compute line/column.
   int line = 1;
@@ -624,8 +666,15 @@ bool Lexer::ReadEvalString(EvalString* eval, bool path, string* err) {
   const char* p = ofs_;
   const char* q;
   const char* start;
+  const char* end = input_.str_ + input_.len_;
   for (;;) {
     start = p;
+    // Take runs of plain text in bulk.
+    p = SkipPlainText(p, end, path);
+    if (p != start) {
+      eval->AddText(StringPiece(start, p - start));
+      continue;
+    }
     
 {
 	unsigned char yych;
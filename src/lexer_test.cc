@@ -96,3 +96,23 @@ TEST(Lexer, Tabs) {
   EXPECT_EQ(Lexer::ERROR, token);
   EXPECT_EQ("tabs are not allowed, use spaces", lexer.DescribeLastError());
 }
+
+TEST(Lexer, LongText) {
+  // Plain text is skipped 16 bytes at a time; put the special characters
+  // at every offset.
+  for (int i = 0; i < 40; ++i) {
+    string text(i, 'a');
+    string input = text + "$$b c|d:$e\n" + text + "|f\n";
+    Lexer lexer(input.c_str());
+    EvalString eval;
+    string err;
+    EXPECT_TRUE(lexer.ReadVarValue(&eval, &err));
+    EXPECT_EQ("", err);
+    EXPECT_EQ("[" + text + "$b c|d:][$e]", eval.Serialize());
+    eval.Clear();
+    EXPECT_TRUE(lexer.ReadPath(&eval, &err));
+    EXPECT_EQ("", err);
+    EXPECT_EQ(i ? "[" + text + "]" : "", eval.Serialize());
+    EXPECT_EQ(Lexer::PIPE, lexer.ReadToken());
+  }
+}
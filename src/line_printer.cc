@@ -32,7 +32,8 @@
 
 using namespace std;
 
-LinePrinter::LinePrinter() : have_blank_line_(true), console_locked_(false) {
+LinePrinter::LinePrinter()
+    : have_blank_line_(true), status_lines_(0), console_locked_(false) {
   const char* term = getenv("TERM");
 #ifndef _WIN32
   smart_terminal_ = isatty(1) && term && string(term) != "dumb";
@@ -63,7 +64,7 @@ LinePrinter::LinePrinter() : have_blank_line_(true), console_locked_(false) {
   }
 }
 
-void LinePrinter::Print(string to_print, LineType type) {
+void LinePrinter::Print(const string& to_print, LineType type) {
   if (console_locked_) {
     line_buffer_ = to_print;
     line_type_ = type;
@@ -81,10 +82,12 @@ void LinePrinter::Print(string to_print, LineType type) {
     CONSOLE_SCREEN_BUFFER_INFO csbi;
     GetConsoleScreenBufferInfo(console_, &csbi);
 
-    to_print = ElideMiddle(to_print, static_cast<size_t>(csbi.dwSize.X));
+    // Only the first line is shown.
+    string line = ElideMiddle(to_print.substr(0, to_print.find('\n')),
+                              static_cast<size_t>(csbi.dwSize.X));
     if (supports_color_) {  // this means ENABLE_VIRTUAL_TERMINAL_PROCESSING
                             // succeeded
-      printf("%s\x1B[K", to_print.c_str());  // Clear to end of line.
+      printf("%s\x1B[K", line.c_str());  // Clear to end of line.
       fflush(stdout);
     } else {
       // We don't want to have the cursor spamming back and forth, so instead of
@@ -98,20 +101,44 @@ void LinePrinter::Print(string to_print, LineType type) {
                             csbi.dwCursorPosition.Y };
       vector<CHAR_INFO> char_data(csbi.dwSize.X);
       for (size_t i = 0; i < static_cast<size_t>(csbi.dwSize.X); ++i) {
-        char_data[i].Char.AsciiChar = i < to_print.size() ? to_print[i] : ' ';
+        char_data[i].Char.AsciiChar = i < line.size() ? line[i] : ' ';
         char_data[i].Attributes = csbi.wAttributes;
       }
       WriteConsoleOutput(console_, &char_data[0], buf_size, zero_zero, &target);
     }
 #else
+    // Go back up to the first line of the previous status.
+    if (status_lines_ > 1)
+      printf("\x1B[%dA", status_lines_ - 1);
+
     // Limit output to width of the terminal if provided so we don't cause
     // line-wrapping.
     winsize size;
-    if ((ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0) && size.ws_col) {
-      to_print = ElideMiddle(to_print, size.ws_col);
+    size_t width = 0;
+    if ((ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0) && size.ws_col)
+      width = size.ws_col;
+    int lines = 0;
+    for (size_t start = 0;;) {
+      size_t end = to_print.find('\n', start);
+      if (end == string::npos)
+        end = to_print.size();
+      if (lines++)
+        fputc('\n', stdout);
+      if (width && end - start > width) {
+        string line = ElideMiddle(to_print.substr(start, end - start), width);
+        fwrite(line.data(), 1, line.size(), stdout);
+      } else {
+        fwrite(to_print.data() + start, 1, end - start, stdout);
+      }
+      printf("\x1B[K");  // Clear to end of line.
+      if (end == to_print.size())
+        break;
+      start = end + 1;
     }
-    printf("%s", to_print.c_str());
-    printf("\x1B[K");  // Clear to end of line.
+    // Clear what's left of a longer previous status.
+    if (lines < status_lines_)
+      printf("\x1B[J");
+    status_lines_ = lines;
     fflush(stdout);
 #endif
 
@@ -129,6 +156,7 @@ void LinePrinter::PrintOrBuffer(const char* data, size_t size) {
     // Avoid printf and C strings, since the actual output might contain null
     // bytes like UTF-16 does (yuck).
     fwrite(data, 1, size, stdout);
+    status_lines_ = 0;
   }
 }
 
@@ -33,8 +33,9 @@ struct LinePrinter {
     ELIDE
   };
   /// Overprints the current line. If type is ELIDE, elides to_print to fit on
-  /// one line.
-  void Print(std::string to_print, LineType type);
+  /// one line. On a smart terminal, to_print may hold several lines, which
+  /// are overprinted together; elsewhere it should be a single line.
+  void Print(const std::string& to_print, LineType type);
 
   /// Prints a string on a new line, not overprinting previous output.
   void PrintOnNewLine(const std::string& to_print);
@@ -53,6 +54,10 @@ struct LinePrinter {
   /// Whether the caret is at the beginning of a blank line.
   bool have_blank_line_;
 
+  /// How many lines the last overprintable status took, 0 once something
+  /// was printed after it.
+  int status_lines_;
+
   /// Whether console is locked.
   bool console_locked_;
 
@@ -0,0 +1,152 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "log_writer.h"
+
+#include <assert.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+using namespace std;
+
+const size_t LogWriter::kBatchSize;
+const size_t LogWriter::kMaxQueued;
+
+namespace {
+
+/// How long a record may wait in memory for others to join its batch.
+const chrono::milliseconds kMaxDelay(50);
+
+}  // namespace
+
+LogWriter::LogWriter()
+    : queued_(0), written_(0), flush_to_(0), error_(0), closing_(false),
+      file_(NULL) {}
+
+LogWriter::~LogWriter() {
+  Close();
+}
+
+void LogWriter::Open(FILE* file) {
+  assert(!file_);
+  file_ = file;
+  queued_ = written_ = flush_to_ = 0;
+  error_ = 0;
+  closing_ = false;
+}
+
+bool LogWriter::Append(const string& record) {
+  unique_lock<mutex> lock(mutex_);
+  if (!thread_.joinable()) {
+#ifndef _WIN32
+    // Signals are for the main thread, which is waiting for them in
+    // SubprocessSet::DoWork().
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    thread_ = thread(&LogWriter::Run, this);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+#else
+    thread_ = thread(&LogWriter::Run, this);
+#endif
+  }
+  while (!error_ && pending_.size() >= kMaxQueued)
+    written_cond_.wait(lock);
+  if (error_) {
+    errno = error_;
+    return false;
+  }
+
+  size_t before = pending_.size();
+  pending_.append(record);
+  queued_ += record.size();
+  if (before == 0) {
+    oldest_ = chrono::steady_clock::now();
+    work_.notify_one();
+  } else if (before < kBatchSize && pending_.size() >= kBatchSize) {
+    work_.notify_one();
+  }
+  return true;
+}
+
+bool LogWriter::Flush() {
+  unique_lock<mutex> lock(mutex_);
+  size_t target = queued_;
+  if (written_ < target) {
+    flush_to_ = target;
+    work_.notify_one();
+    while (!error_ && written_ < target)
+      written_cond_.wait(lock);
+  }
+  if (error_) {
+    errno = error_;
+    return false;
+  }
+  return true;
+}
+
+bool LogWriter::Close() {
+  if (!file_)
+    return true;
+  bool ok = Flush();
+  {
+    lock_guard<mutex> lock(mutex_);
+    closing_ = true;
+  }
+  work_.notify_one();
+  if (thread_.joinable())
+    thread_.join();
+  if (fclose(file_) != 0)
+    ok = false;
+  file_ = NULL;
+  pending_.clear();
+  return ok;
+}
+
+void LogWriter::Run() {
+  string batch;
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    if (pending_.empty() || error_) {
+      if (closing_)
+        return;
+      work_.wait(lock);
+      continue;
+    }
+    if (!closing_ && flush_to_ <= written_ && pending_.size() < kBatchSize &&
+        chrono::steady_clock::now() < oldest_ + kMaxDelay) {
+      work_.wait_until(lock, oldest_ + kMaxDelay);
+      continue;
+    }
+
+    // Write without the lock, so that the build can keep queueing records.
+    batch.swap(pending_);
+    lock.unlock();
+    bool ok = fwrite(batch.data(), 1, batch.size(), file_) == batch.size() &&
+              fflush(file_) == 0;
+    int write_error = errno;
+    lock.lock();
+
+    if (ok) {
+      written_ += batch.size();
+    } else {
+      error_ = write_error ? write_error : EIO;
+    }
+    batch.clear();
+    written_cond_.notify_all();
+  }
+}
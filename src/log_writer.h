@@ -0,0 +1,88 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_LOG_WRITER_H_
+#define NINJA_LOG_WRITER_H_
+
+#include <stdio.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// Appends records to an append-only log from a background thread, so that
+/// recording a finished edge doesn't wait for the disk.
+///
+/// Records are queued in memory and written in batches ("group commit"):
+/// once kBatchSize bytes are queued, once the oldest queued record has
+/// waited for 50ms, or when asked to flush. Records are written in order
+/// and each batch only holds whole records, so after a crash the log is a
+/// prefix of what was recorded, as with a write per record; the loaders
+/// already cope with a record cut short at the end.
+///
+/// Queued records are lost if the process ends without Flush() or Close(),
+/// as exit() doesn't run the destructor of a log that outlives it:
+/// Builder::Build() flushes the logs when a build ends, and ninja closes
+/// them before it exits. A crash loses the records that were still queued,
+/// whose outputs are rebuilt next time.
+struct LogWriter {
+  LogWriter();
+  ~LogWriter();
+
+  /// Write to |file|, which must be open for appending and is closed by
+  /// Close(). The writer thread starts with the first record.
+  void Open(FILE* file);
+  bool is_open() const { return file_ != NULL; }
+
+  /// Queue a complete record. Blocks while kMaxQueued bytes are waiting.
+  /// Returns false and sets errno if an earlier write failed.
+  bool Append(const std::string& record);
+
+  /// Wait until every queued record is written. Returns false and sets
+  /// errno if a write failed.
+  bool Flush();
+
+  /// Flush, stop the writer thread and close the file.
+  bool Close();
+
+  static const size_t kBatchSize = 64 << 10;
+  static const size_t kMaxQueued = 16 << 20;
+
+ private:
+  void Run();
+
+  /// Bytes queued by Append() and written by the writer thread so far.
+  /// Both only grow, so Flush() can wait for a position.
+  size_t queued_;
+  size_t written_;
+  /// The position Flush() waits for, to be written without delay.
+  size_t flush_to_;
+  /// errno of a failed write, 0 if none.
+  int error_;
+  bool closing_;
+  std::string pending_;
+  std::chrono::steady_clock::time_point oldest_;
+
+  FILE* file_;
+  std::mutex mutex_;
+  /// Signalled for the writer thread when there is work to do.
+  std::condition_variable work_;
+  /// Signalled by the writer thread after each batch.
+  std::condition_variable written_cond_;
+  std::thread thread_;
+};
+
+#endif  // NINJA_LOG_WRITER_H_
@@ -0,0 +1,88 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "log_writer.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "util.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+const char kTestFilename[] = "LogWriterTest-tempfile";
+
+struct LogWriterTest : public testing::Test {
+  virtual void SetUp() {
+    // In case a crashing test left a stale file behind.
+    unlink(kTestFilename);
+  }
+  virtual void TearDown() {
+    unlink(kTestFilename);
+  }
+
+  string Contents() {
+    string contents, err;
+    EXPECT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+    return contents;
+  }
+};
+
+TEST_F(LogWriterTest, Flush) {
+  LogWriter writer;
+  writer.Open(fopen(kTestFilename, "ab"));
+  ASSERT_TRUE(writer.is_open());
+  EXPECT_TRUE(writer.Append("one\n"));
+  EXPECT_TRUE(writer.Append("two\n"));
+  EXPECT_TRUE(writer.Flush());
+  EXPECT_EQ("one\ntwo\n", Contents());
+
+  EXPECT_TRUE(writer.Append("three\n"));
+  EXPECT_TRUE(writer.Close());
+  EXPECT_FALSE(writer.is_open());
+  EXPECT_EQ("one\ntwo\nthree\n", Contents());
+}
+
+// Records queued faster than they are written keep their order across
+// batches.
+TEST_F(LogWriterTest, ManyBatches) {
+  string expected;
+  LogWriter writer;
+  writer.Open(fopen(kTestFilename, "ab"));
+  for (int i = 0; i < 100000; ++i) {
+    string record = "record " + std::to_string(i) + "\n";
+    expected += record;
+    ASSERT_TRUE(writer.Append(record));
+  }
+  EXPECT_TRUE(writer.Close());
+  EXPECT_EQ(expected, Contents());
+}
+
+// Reopening after Close() starts a new writer thread.
+TEST_F(LogWriterTest, Reopen) {
+  LogWriter writer;
+  writer.Open(fopen(kTestFilename, "ab"));
+  EXPECT_TRUE(writer.Append("a\n"));
+  EXPECT_TRUE(writer.Close());
+  writer.Open(fopen(kTestFilename, "ab"));
+  EXPECT_TRUE(writer.Append("b\n"));
+  EXPECT_TRUE(writer.Close());
+  EXPECT_EQ("a\nb\n", Contents());
+}
+
+}  // anonymous namespace
@@ -360,8 +360,8 @@ bool ManifestParser::ParseEdge(string* err) {
   if (edge->outputs_.empty()) {
     // All outputs of the edge are already created by other edges. Don't add
     // this edge.  Do this check before input nodes are connected to the edge.
+    // The State still owns the edge; the next edge takes its id.
     state_->edges_.pop_back();
-    delete edge;
     return true;
   }
   edge->implicit_outs_ = implicit_outs;
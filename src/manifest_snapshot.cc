@@ -0,0 +1,505 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest_snapshot.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <map>
+#include <unordered_map>
+
+#include "eval_env.h"
+#include "graph.h"
+#include "metrics.h"
+#include "state.h"
+#include "util.h"
+#include "version.h"
+
+using namespace std;
+
+// The snapshot is a signature, a version and then a stream of fields:
+// uint32s, int64s and strings (a uint32 length followed by the bytes).
+//
+//   key:    ninja version, input file, parser options,
+//           [manifest file path, mtime]...
+//   pools:  [name, depth]...
+//   rules:  [name, [key, [token type, text]...]...]...
+//   scopes: [parent, [key, value]..., [rule]...]...  (scope 0 is the root)
+//   nodes:  [path, slash bits, flags]...
+//   edges:  [rule, pool, scope, dyndep, implicit deps, order-only deps,
+//            implicit outs, [input]..., [output]..., [validation]...]...
+//   node edges: [[out edge]..., [validation out edge]...] for each node
+//   defaults: [node]...
+//
+// Lists are prefixed with their length and references are indices into
+// the tables above.  Rule kPhonyRule and "none" are written as kNone.
+
+namespace {
+
+const char kFileSignature[] = "# ninjamanifest\n";
+const uint32_t kCurrentVersion = 1;
+const uint32_t kNone = 0xffffffff;
+
+enum NodeFlags {
+  kGeneratedByDepLoader = 1,
+  kDyndepPending = 2,
+};
+
+struct Writer {
+  void Write32(uint32_t value) {
+    data_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+  void Write64(int64_t value) {
+    data_.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  }
+  void WriteString(StringPiece value) {
+    Write32(value.len_);
+    data_.append(value.str_, value.len_);
+  }
+
+  string data_;
+};
+
+/// Reads fields back, failing (and returning zeros and empty strings from
+/// then on) if the data runs out.
+struct Reader {
+  Reader(const char* begin, const char* end)
+      : pos_(begin), end_(end), ok_(true) {}
+
+  uint32_t Read32() {
+    uint32_t value = 0;
+    Read(&value, sizeof(value));
+    return value;
+  }
+  int64_t Read64() {
+    int64_t value = 0;
+    Read(&value, sizeof(value));
+    return value;
+  }
+  StringPiece ReadString() {
+    uint32_t size = Read32();
+    if (!ok_ || size > (size_t)(end_ - pos_)) {
+      ok_ = false;
+      return StringPiece();
+    }
+    StringPiece value(pos_, size);
+    pos_ += size;
+    return value;
+  }
+  /// Read the length of a list, each entry of which takes 4 bytes or more.
+  uint32_t ReadCount() {
+    uint32_t value = Read32();
+    if (value > (size_t)(end_ - pos_) / 4) {
+      ok_ = false;
+      return 0;
+    }
+    return value;
+  }
+  /// Read an index into a table of |count| entries, or kNone if |nullable|.
+  /// Returns kNone on failure.
+  uint32_t ReadIndex(size_t count, bool nullable = false) {
+    uint32_t value = Read32();
+    if (value >= count && !(nullable && value == kNone)) {
+      ok_ = false;
+      return kNone;
+    }
+    return value;
+  }
+
+  bool ok() const { return ok_; }
+  bool at_end() const { return pos_ == end_; }
+
+ private:
+  void Read(void* value, size_t size) {
+    if (!ok_ || size > (size_t)(end_ - pos_)) {
+      ok_ = false;
+      return;
+    }
+    memcpy(value, pos_, size);
+    pos_ += size;
+  }
+
+  const char* pos_;
+  const char* end_;
+  bool ok_;
+};
+
+/// The entry of |table| at |index|, or NULL for kNone.
+template <typename T>
+T* At(const vector<T*>& table, uint32_t index) {
+  return index < table.size() ? table[index] : NULL;
+}
+
+template <typename T>
+uint32_t IndexOf(const unordered_map<const T*, uint32_t>& indices,
+                 const T* value) {
+  typename unordered_map<const T*, uint32_t>::const_iterator i =
+      indices.find(value);
+  return i == indices.end() ? kNone : i->second;
+}
+
+}  // namespace
+
+FileReader::Status ManifestSnapshot::Recorder::ReadFile(const string& path,
+                                                        string* contents,
+                                                        string* err) {
+  // Stat before reading so that an edit made while the manifest is being
+  // parsed invalidates the snapshot instead of going unnoticed.
+  TimeStamp mtime = disk_interface_->Stat(path, err);
+  if (mtime == -1)
+    return OtherError;
+  files_.push_back(make_pair(path, mtime));
+  return disk_interface_->ReadFile(path, contents, err);
+}
+
+LoadStatus ManifestSnapshot::Load(const string& path, const string& input_file,
+                                  uint32_t options,
+                                  DiskInterface* disk_interface, State* state,
+                                  vector<string>* manifest_files,
+                                  string* err) {
+  METRIC_RECORD(".ninja_manifest load");
+  MappedFile file;
+  if (file.Open(path, err) < 0) {
+    if (errno == ENOENT) {
+      err->clear();
+      return LOAD_NOT_FOUND;
+    }
+    return LOAD_ERROR;
+  }
+
+  const size_t kSignatureSize = sizeof(kFileSignature) - 1;
+  if (file.size() < kSignatureSize ||
+      memcmp(file.data(), kFileSignature, kSignatureSize) != 0)
+    return LOAD_NOT_FOUND;
+  Reader reader(file.data() + kSignatureSize, file.data() + file.size());
+  if (reader.Read32() != kCurrentVersion ||
+      reader.ReadString() != kNinjaVersion ||
+      reader.ReadString() != input_file || reader.Read32() != options) {
+    return LOAD_NOT_FOUND;
+  }
+  vector<string> files(reader.ReadCount());
+  for (size_t i = 0; i < files.size() && reader.ok(); ++i) {
+    files[i] = reader.ReadString().AsString();
+    TimeStamp mtime = reader.Read64();
+    string stat_err;
+    if (disk_interface->Stat(files[i], &stat_err) != mtime)
+      return LOAD_NOT_FOUND;
+  }
+  if (!reader.ok())
+    return LOAD_NOT_FOUND;
+
+  // The manifest files are unchanged; from here on any problem means the
+  // snapshot itself is bad.
+  vector<Pool*> pools(reader.ReadCount());
+  for (size_t i = 0; i < pools.size() && reader.ok(); ++i) {
+    string name = reader.ReadString().AsString();
+    int depth = (int)reader.Read32();
+    pools[i] = state->LookupPool(name);
+    if (!pools[i]) {
+      pools[i] = new Pool(name, depth);
+      state->AddPool(pools[i]);
+    }
+  }
+
+  vector<Rule*> rules(reader.ReadCount());
+  for (size_t i = 0; i < rules.size() && reader.ok(); ++i) {
+    rules[i] = new Rule(reader.ReadString().AsString());
+    for (uint32_t j = 0, count = reader.ReadCount(); j < count && reader.ok();
+         ++j) {
+      EvalString& value = rules[i]->bindings_[reader.ReadString().AsString()];
+      for (uint32_t k = 0, tokens = reader.ReadCount();
+           k < tokens && reader.ok(); ++k) {
+        bool special = reader.Read32() != 0;
+        StringPiece text = reader.ReadString();
+        if (special)
+          value.AddSpecial(text);
+        else
+          value.AddText(text);
+      }
+    }
+  }
+
+  vector<BindingEnv*> scopes(reader.ReadCount());
+  for (size_t i = 0; i < scopes.size() && reader.ok(); ++i) {
+    if (i == 0) {
+      scopes[i] = &state->bindings_;
+    } else {
+      // Parents are always written before their children.
+      scopes[i] = new BindingEnv(At(scopes, reader.ReadIndex(i)));
+    }
+    for (uint32_t j = 0, count = reader.ReadCount(); j < count && reader.ok();
+         ++j) {
+      string key = reader.ReadString().AsString();
+      scopes[i]->bindings_[key] = reader.ReadString().AsString();
+    }
+    for (uint32_t j = 0, count = reader.ReadCount(); j < count && reader.ok();
+         ++j) {
+      uint32_t rule = reader.ReadIndex(rules.size(), true);
+      if (rule != kNone)
+        scopes[i]->AddRule(rules[rule]);
+    }
+  }
+
+  vector<Node*> nodes(reader.ReadCount());
+  state->paths_.Reserve(nodes.size());
+  for (size_t i = 0; i < nodes.size() && reader.ok(); ++i) {
+    StringPiece node_path = reader.ReadString();
+    uint64_t slash_bits = (uint64_t)reader.Read64();
+    uint32_t flags = reader.Read32();
+    nodes[i] = state->GetNode(node_path, slash_bits);
+    nodes[i]->set_generated_by_dep_loader(flags & kGeneratedByDepLoader);
+    nodes[i]->set_dyndep_pending(flags & kDyndepPending);
+  }
+
+  size_t edge_count = reader.ReadCount();
+  if (reader.ok())
+    state->edges_.reserve(edge_count);
+  for (size_t i = 0; i < edge_count && reader.ok(); ++i) {
+    uint32_t rule = reader.ReadIndex(rules.size(), true);
+    Edge* edge =
+        state->AddEdge(rule == kNone ? &State::kPhonyRule : rules[rule]);
+    edge->pool_ = At(pools, reader.ReadIndex(pools.size()));
+    edge->env_ = At(scopes, reader.ReadIndex(scopes.size()));
+    edge->dyndep_ = At(nodes, reader.ReadIndex(nodes.size(), true));
+    edge->implicit_deps_ = (int)reader.Read32();
+    edge->order_only_deps_ = (int)reader.Read32();
+    edge->implicit_outs_ = (int)reader.Read32();
+    vector<Node*>* lists[] = {
+      &edge->inputs_, &edge->outputs_, &edge->validations_
+    };
+    for (size_t j = 0; j < sizeof(lists) / sizeof(lists[0]); ++j) {
+      lists[j]->resize(reader.ReadCount());
+      for (size_t k = 0; k < lists[j]->size(); ++k)
+        (*lists[j])[k] = At(nodes, reader.ReadIndex(nodes.size()));
+    }
+    for (size_t j = 0; j < edge->outputs_.size() && reader.ok(); ++j)
+      edge->outputs_[j]->set_in_edge(edge);
+  }
+
+  for (size_t i = 0; i < nodes.size() && reader.ok(); ++i) {
+    for (uint32_t j = 0, count = reader.ReadCount(); j < count && reader.ok();
+         ++j) {
+      nodes[i]->AddOutEdge(At(state->edges_, reader.ReadIndex(edge_count)));
+    }
+    for (uint32_t j = 0, count = reader.ReadCount(); j < count && reader.ok();
+         ++j) {
+      nodes[i]->AddValidationOutEdge(
+          At(state->edges_, reader.ReadIndex(edge_count)));
+    }
+  }
+
+  for (uint32_t i = 0, count = reader.ReadCount(); i < count && reader.ok();
+       ++i) {
+    state->defaults_.push_back(At(nodes, reader.ReadIndex(nodes.size())));
+  }
+
+  if (!reader.ok() || !reader.at_end()) {
+    *err = "manifest snapshot is corrupt";
+    return LOAD_ERROR;
+  }
+  if (manifest_files)
+    manifest_files->insert(manifest_files->end(), files.begin(), files.end());
+  return LOAD_SUCCESS;
+}
+
+bool ManifestSnapshot::Write(const string& path, const string& input_file,
+                             uint32_t options, const Recorder& recorder,
+                             const State& state, string* err) {
+  METRIC_RECORD(".ninja_manifest write");
+  Writer writer;
+  writer.data_.append(kFileSignature, sizeof(kFileSignature) - 1);
+  writer.Write32(kCurrentVersion);
+  writer.WriteString(kNinjaVersion);
+  writer.WriteString(input_file);
+  writer.Write32(options);
+  writer.Write32(recorder.files_.size());
+  for (size_t i = 0; i < recorder.files_.size(); ++i) {
+    writer.WriteString(recorder.files_[i].first);
+    writer.Write64(recorder.files_[i].second);
+  }
+
+  unordered_map<const Pool*, uint32_t> pools;
+  writer.Write32(state.pools_.size());
+  for (map<string, Pool*>::const_iterator i = state.pools_.begin();
+       i != state.pools_.end(); ++i) {
+    pools[i->second] = pools.size();
+    writer.WriteString(i->second->name());
+    writer.Write32(i->second->depth());
+  }
+
+  // Number the scopes parents first, starting from the root.
+  vector<const BindingEnv*> scopes(1, &state.bindings_);
+  unordered_map<const BindingEnv*, uint32_t> scope_indices;
+  scope_indices[&state.bindings_] = 0;
+  for (vector<Edge*>::const_iterator e = state.edges_.begin();
+       e != state.edges_.end(); ++e) {
+    vector<const BindingEnv*> chain;
+    for (const BindingEnv* env = (*e)->env_;
+         env && !scope_indices.count(env); env = env->parent_) {
+      chain.push_back(env);
+    }
+    for (size_t i = chain.size(); i > 0; --i) {
+      scope_indices[chain[i - 1]] = scopes.size();
+      scopes.push_back(chain[i - 1]);
+    }
+  }
+
+  unordered_map<const Rule*, uint32_t> rules;
+  vector<const Rule*> rule_list;
+  for (size_t i = 0; i < scopes.size(); ++i) {
+    const map<string, const Rule*>& scope_rules = scopes[i]->GetRules();
+    for (map<string, const Rule*>::const_iterator r = scope_rules.begin();
+         r != scope_rules.end(); ++r) {
+      if (r->second != &State::kPhonyRule && !rules.count(r->second)) {
+        rules[r->second] = rule_list.size();
+        rule_list.push_back(r->second);
+      }
+    }
+  }
+  writer.Write32(rule_list.size());
+  for (size_t i = 0; i < rule_list.size(); ++i) {
+    writer.WriteString(rule_list[i]->name());
+    writer.Write32(rule_list[i]->bindings_.size());
+    for (Rule::Bindings::const_iterator b = rule_list[i]->bindings_.begin();
+         b != rule_list[i]->bindings_.end(); ++b) {
+      writer.WriteString(b->first);
+      const EvalString& value = b->second;
+      writer.Write32(value.ops_.size());
+      for (size_t t = 0; t < value.ops_.size(); ++t) {
+        writer.Write32(value.ops_[t].type == EvalString::SPECIAL);
+        writer.WriteString(value.Text(value.ops_[t]));
+      }
+    }
+  }
+
+  writer.Write32(scopes.size());
+  for (size_t i = 0; i < scopes.size(); ++i) {
+    if (i > 0)
+      writer.Write32(scope_indices[scopes[i]->parent_]);
+    writer.Write32(scopes[i]->bindings_.size());
+    for (map<string, string>::const_iterator b = scopes[i]->bindings_.begin();
+         b != scopes[i]->bindings_.end(); ++b) {
+      writer.WriteString(b->first);
+      writer.WriteString(b->second);
+    }
+    const map<string, const Rule*>& scope_rules = scopes[i]->GetRules();
+    writer.Write32(scope_rules.size());
+    for (map<string, const Rule*>::const_iterator r = scope_rules.begin();
+         r != scope_rules.end(); ++r) {
+      writer.Write32(IndexOf(rules, r->second));
+    }
+  }
+
+  // Number the nodes in the order the parser created them, as near as the
+  // edges tell, so that loading allocates them close to the edges using
+  // them. Then any others.
+  unordered_map<const Node*, uint32_t> nodes;
+  vector<const Node*> node_list;
+  nodes.reserve(state.paths_.size());
+  node_list.reserve(state.paths_.size());
+  for (vector<Edge*>::const_iterator e = state.edges_.begin();
+       e != state.edges_.end(); ++e) {
+    const vector<Node*>* lists[] = {
+      &(*e)->outputs_, &(*e)->inputs_, &(*e)->validations_
+    };
+    for (size_t j = 0; j < sizeof(lists) / sizeof(lists[0]); ++j) {
+      for (size_t k = 0; k < lists[j]->size(); ++k) {
+        if (nodes.insert(make_pair((*lists[j])[k], node_list.size())).second)
+          node_list.push_back((*lists[j])[k]);
+      }
+    }
+  }
+  for (State::Paths::const_iterator i = state.paths_.begin();
+       i != state.paths_.end(); ++i) {
+    if (nodes.insert(make_pair(*i, node_list.size())).second)
+      node_list.push_back(*i);
+  }
+  writer.Write32(node_list.size());
+  for (size_t i = 0; i < node_list.size(); ++i) {
+    const Node* node = node_list[i];
+    writer.WriteString(node->path());
+    writer.Write64(node->slash_bits());
+    writer.Write32((node->generated_by_dep_loader() ? kGeneratedByDepLoader
+                                                     : 0) |
+                   (node->dyndep_pending() ? kDyndepPending : 0));
+  }
+
+  writer.Write32(state.edges_.size());
+  for (vector<Edge*>::const_iterator e = state.edges_.begin();
+       e != state.edges_.end(); ++e) {
+    const Edge* edge = *e;
+    writer.Write32(IndexOf(rules, edge->rule_));
+    writer.Write32(pools[edge->pool_]);
+    writer.Write32(scope_indices[edge->env_]);
+    writer.Write32(IndexOf(nodes, edge->dyndep_));
+    writer.Write32(edge->implicit_deps_);
+    writer.Write32(edge->order_only_deps_);
+    writer.Write32(edge->implicit_outs_);
+    const vector<Node*>* lists[] = {
+      &edge->inputs_, &edge->outputs_, &edge->validations_
+    };
+    for (size_t j = 0; j < sizeof(lists) / sizeof(lists[0]); ++j) {
+      writer.Write32(lists[j]->size());
+      for (size_t k = 0; k < lists[j]->size(); ++k)
+        writer.Write32(nodes[(*lists[j])[k]]);
+    }
+  }
+
+  for (size_t i = 0; i < node_list.size(); ++i) {
+    const vector<Edge*>* lists[] = {
+      &node_list[i]->out_edges(), &node_list[i]->validation_out_edges()
+    };
+    for (size_t j = 0; j < sizeof(lists) / sizeof(lists[0]); ++j) {
+      writer.Write32(lists[j]->size());
+      for (size_t k = 0; k < lists[j]->size(); ++k)
+        writer.Write32((*lists[j])[k]->id_);
+    }
+  }
+
+  writer.Write32(state.defaults_.size());
+  for (size_t i = 0; i < state.defaults_.size(); ++i)
+    writer.Write32(nodes[state.defaults_[i]]);
+
+  // Replace any old snapshot atomically, so a reader never sees half of one.
+  string temp_path = path + ".tmp";
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f) {
+    *err = strerror(errno);
+    return false;
+  }
+  if (fwrite(writer.data_.data(), 1, writer.data_.size(), f) !=
+      writer.data_.size()) {
+    *err = strerror(errno);
+    fclose(f);
+    unlink(temp_path.c_str());
+    return false;
+  }
+  if (fclose(f) < 0) {
+    *err = strerror(errno);
+    unlink(temp_path.c_str());
+    return false;
+  }
+  if (unlink(path.c_str()) < 0 && errno != ENOENT) {
+    *err = strerror(errno);
+    return false;
+  }
+  if (rename(temp_path.c_str(), path.c_str()) < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,71 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_MANIFEST_SNAPSHOT_H_
+#define NINJA_MANIFEST_SNAPSHOT_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "disk_interface.h"
+#include "load_status.h"
+#include "timestamp.h"
+
+struct State;
+
+/// A binary copy of the State built from a manifest: pools, rules, scopes
+/// with their evaluated bindings, nodes, edges and defaults. Loading it
+/// skips lexing, evaluating and canonicalizing the manifest altogether.
+///
+/// A snapshot is keyed by every manifest file the parser read, with the
+/// mtime each had when it was read, plus the input file name and parser
+/// options. It is only used while all of those still match.
+struct ManifestSnapshot {
+  /// A FileReader that records each file read through it, for Write().
+  struct Recorder : public FileReader {
+    explicit Recorder(DiskInterface* disk_interface)
+        : disk_interface_(disk_interface) {}
+
+    virtual Status ReadFile(const std::string& path, std::string* contents,
+                            std::string* err);
+
+    /// Each file read and its mtime just before it was read.
+    std::vector<std::pair<std::string, TimeStamp> > files_;
+
+   private:
+    DiskInterface* disk_interface_;
+  };
+
+  /// Load the snapshot at |path| into |state|, which must be freshly
+  /// constructed. Returns LOAD_NOT_FOUND if there is no snapshot or it
+  /// doesn't match the manifest files on disk, leaving |state| untouched.
+  /// Returns LOAD_ERROR if the snapshot is corrupt, possibly after
+  /// modifying |state|. If |manifest_files| isn't NULL, the manifest files
+  /// the snapshot was made from are appended to it.
+  static LoadStatus Load(const std::string& path,
+                         const std::string& input_file, uint32_t options,
+                         DiskInterface* disk_interface, State* state,
+                         std::vector<std::string>* manifest_files,
+                         std::string* err);
+
+  /// Write a snapshot of |state|, loaded from the files |recorder| saw.
+  static bool Write(const std::string& path, const std::string& input_file,
+                    uint32_t options, const Recorder& recorder,
+                    const State& state, std::string* err);
+};
+
+#endif  // NINJA_MANIFEST_SNAPSHOT_H_
@@ -0,0 +1,214 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "manifest_snapshot.h"
+
+#include <stdio.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include "graph.h"
+#include "manifest_parser.h"
+#include "state.h"
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+const char kTestFilename[] = "ManifestSnapshotTest-tempfile";
+
+string NodeList(const vector<Node*>& nodes) {
+  string result;
+  for (size_t i = 0; i < nodes.size(); ++i)
+    result += " " + nodes[i]->path();
+  return result;
+}
+
+string EdgeList(const vector<Edge*>& edges) {
+  string result;
+  for (size_t i = 0; i < edges.size(); ++i) {
+    char id[16];
+    snprintf(id, sizeof(id), " %d", (int)edges[i]->id_);
+    result += id;
+  }
+  return result;
+}
+
+/// Everything about |state| a build looks at, as text.
+string Describe(const State& state) {
+  string result;
+  for (size_t i = 0; i < state.edges_.size(); ++i) {
+    Edge* edge = state.edges_[i];
+    char counts[64];
+    snprintf(counts, sizeof(counts), " implicit=%d order_only=%d outs=%d\n",
+             edge->implicit_deps_, edge->order_only_deps_,
+             edge->implicit_outs_);
+    result += "edge " + edge->rule().name() + " pool=" + edge->pool()->name() +
+              " command=" + edge->EvaluateCommand() +
+              " description=" + edge->GetBinding("description") +
+              " in:" + NodeList(edge->inputs_) +
+              " out:" + NodeList(edge->outputs_) +
+              " validations:" + NodeList(edge->validations_) +
+              " dyndep=" + (edge->dyndep_ ? edge->dyndep_->path() : "") +
+              counts;
+  }
+  vector<string> nodes;
+  for (State::Paths::const_iterator i = state.paths_.begin();
+       i != state.paths_.end(); ++i) {
+    Node* node = *i;
+    char details[64];
+    snprintf(details, sizeof(details), " slash_bits=%d generated=%d dyndep=%d",
+             (int)node->slash_bits(), node->generated_by_dep_loader(),
+             node->dyndep_pending());
+    nodes.push_back("node " + node->path() + details + " in_edge:" +
+                    (node->in_edge() ? EdgeList(vector<Edge*>(
+                                           1, node->in_edge()))
+                                     : string()) +
+                    " out_edges:" + EdgeList(node->out_edges()) +
+                    " validation_out_edges:" +
+                    EdgeList(node->validation_out_edges()) + "\n");
+  }
+  sort(nodes.begin(), nodes.end());
+  for (size_t i = 0; i < nodes.size(); ++i)
+    result += nodes[i];
+  result += "defaults:" + NodeList(state.defaults_) + "\n";
+  return result;
+}
+
+struct ManifestSnapshotTest : public testing::Test {
+  virtual void SetUp() {
+    // In case a crashing test left a stale file behind.
+    unlink(kTestFilename);
+    fs_.Create("build.ninja",
+"pool link\n"
+"  depth = 2\n"
+"cflags = -O2\n"
+"rule cc\n"
+"  command = cc $cflags -c $in -o $out\n"
+"  description = CC $out\n"
+"rule link\n"
+"  command = ld $in -o $out\n"
+"  pool = link\n"
+"build a.o: cc a.c | a.h || gen\n"
+"  cflags = -O0\n"
+"build b.o | b.o.map: cc dir\\\\b.c |@ check\n"
+"build out: link a.o b.o\n"
+"build dd: phony\n"
+"build gen: cc gen.c || dd\n"
+"  dyndep = dd\n"
+"build alias: phony out\n"
+"default alias\n"
+"subninja sub.ninja\n");
+    fs_.Create("sub.ninja",
+"cflags = -g\n"
+"rule cc\n"
+"  command = cc2 $cflags $in > $out\n"
+"build sub.o: cc sub.c\n");
+  }
+  virtual void TearDown() {
+    unlink(kTestFilename);
+  }
+
+  /// Parse build.ninja into |state| and snapshot it.
+  void ParseAndWrite(State* state, uint32_t options = 0) {
+    ManifestSnapshot::Recorder recorder(&fs_);
+    ManifestParser parser(state, &recorder);
+    string err;
+    ASSERT_TRUE(parser.Load("build.ninja", &err)) << err;
+    ASSERT_EQ(2u, recorder.files_.size());
+    ASSERT_TRUE(ManifestSnapshot::Write(kTestFilename, "build.ninja", options,
+                                        recorder, *state, &err)) << err;
+  }
+
+  LoadStatus Load(State* state, uint32_t options = 0,
+                  vector<string>* files = NULL) {
+    string err;
+    LoadStatus status = ManifestSnapshot::Load(
+        kTestFilename, "build.ninja", options, &fs_, state, files, &err);
+    EXPECT_EQ(status == LOAD_ERROR, !err.empty()) << err;
+    return status;
+  }
+
+  VirtualFileSystem fs_;
+};
+
+TEST_F(ManifestSnapshotTest, RoundTrip) {
+  State parsed;
+  ASSERT_NO_FATAL_FAILURE(ParseAndWrite(&parsed));
+
+  State loaded;
+  vector<string> files;
+  ASSERT_EQ(LOAD_SUCCESS, Load(&loaded, 0, &files));
+  EXPECT_EQ(Describe(parsed), Describe(loaded));
+  ASSERT_EQ(2u, files.size());
+  EXPECT_EQ("build.ninja", files[0]);
+  EXPECT_EQ("sub.ninja", files[1]);
+
+  Edge* edge = loaded.LookupNode("sub.o")->in_edge();
+  EXPECT_EQ("cc2 -g sub.c > sub.o", edge->EvaluateCommand());
+  EXPECT_EQ("link", loaded.LookupNode("out")->in_edge()->pool()->name());
+  EXPECT_EQ(2, loaded.LookupPool("link")->depth());
+}
+
+TEST_F(ManifestSnapshotTest, Missing) {
+  State state;
+  EXPECT_EQ(LOAD_NOT_FOUND, Load(&state));
+}
+
+TEST_F(ManifestSnapshotTest, Stale) {
+  {
+    State parsed;
+    ASSERT_NO_FATAL_FAILURE(ParseAndWrite(&parsed, 1));
+  }
+
+  // Other parser options.
+  State state;
+  EXPECT_EQ(LOAD_NOT_FOUND, Load(&state, 2));
+
+  // An included file changed.
+  fs_.Tick();
+  fs_.Create("sub.ninja", "");
+  EXPECT_EQ(LOAD_NOT_FOUND, Load(&state, 1));
+
+  // Nothing was loaded into the State.
+  EXPECT_TRUE(state.edges_.empty());
+  EXPECT_EQ(0u, state.paths_.size());
+}
+
+TEST_F(ManifestSnapshotTest, Truncated) {
+  {
+    State parsed;
+    ASSERT_NO_FATAL_FAILURE(ParseAndWrite(&parsed));
+  }
+  string contents;
+  string err;
+  ASSERT_EQ(0, ReadFile(kTestFilename, &contents, &err));
+
+  // Any truncation past the manifest files must be reported, not crash.
+  for (size_t size = contents.size() - 1; size > contents.size() / 2;
+       size -= 7) {
+    FILE* f = fopen(kTestFilename, "wb");
+    ASSERT_TRUE(f);
+    fwrite(contents.data(), 1, size, f);
+    fclose(f);
+    State state;
+    EXPECT_EQ(LOAD_ERROR, Load(&state)) << size;
+  }
+}
+
+}  // namespace
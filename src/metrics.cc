@@ -21,6 +21,10 @@
 #include <algorithm>
 #include <chrono>
 
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
 #include "util.h"
 
 using namespace std;
@@ -104,7 +108,7 @@ void Metrics::Report() {
     double total = micros / (double)1000;
     double avg = micros / (double)metric->count;
     printf("%-*s\t%-6d\t%-8.1f\t%.1f\n", width, metric->name.c_str(),
-           metric->count, avg, total);
+           metric->count.load(), avg, total);
   }
 }
 
@@ -120,3 +124,19 @@ uint64_t Stopwatch::NowRaw() const {
 int64_t GetTimeMillis() {
   return TimerToMicros(HighResTimer()) / 1000;
 }
+
+int64_t GetPrivateResidentKB() {
+#ifdef __linux__
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (!f)
+    return 0;
+  long pages = 0, resident = 0, shared = 0;
+  int matched = fscanf(f, "%ld %ld %ld", &pages, &resident, &shared);
+  fclose(f);
+  if (matched != 3)
+    return 0;
+  return (int64_t)(resident - shared) * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+  return 0;
+#endif
+}
@@ -15,6 +15,7 @@
 #ifndef NINJA_METRICS_H_
 #define NINJA_METRICS_H_
 
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -24,12 +25,13 @@
 /// various actions.  To use, see METRIC_RECORD below.
 
 /// A single metrics we're tracking, like "depfile load time".
+/// Code paths run on a ThreadPool may record concurrently.
 struct Metric {
   std::string name;
   /// Number of times we've hit the code path.
-  int count;
+  std::atomic<int> count;
   /// Total time (in platform-dependent units) we've spent on the code path.
-  int64_t sum;
+  std::atomic<int64_t> sum;
 };
 
 /// A scoped object for recording a metric across the body of a function.
@@ -60,6 +62,11 @@ private:
 /// Epoch varies between platforms; only useful for measuring elapsed time.
 int64_t GetTimeMillis();
 
+/// Get the resident memory of this process in kilobytes that isn't shared
+/// with the page cache (so not counting mapped files), or 0 where the
+/// platform doesn't report it.
+int64_t GetPrivateResidentKB();
+
 /// A simple stopwatch which returns the time
 /// in seconds since Restart() was called.
 struct Stopwatch {
@@ -91,9 +91,14 @@ void MissingDependencyScanner::ProcessNode(Node* node) {
 
   std::string deps_type = edge->GetBinding("deps");
   if (!deps_type.empty()) {
-    DepsLog::Deps* deps = deps_log_->GetDeps(node);
-    if (deps)
-      ProcessNodeDeps(node, deps->nodes, deps->node_count);
+    DepsLog::Deps deps = deps_log_->GetDeps(node);
+    if (deps) {
+      std::vector<Node*> dep_nodes;
+      for (int i = 0; i < deps.node_count; ++i)
+        dep_nodes.push_back(deps.nodes[i]);
+      if (!dep_nodes.empty())
+        ProcessNodeDeps(node, &dep_nodes[0], dep_nodes.size());
+    }
   } else {
     DepfileParserOptions parser_opts;
     std::vector<Node*> depfile_deps;
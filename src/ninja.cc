@@ -20,6 +20,7 @@
 
 #include <algorithm>
 #include <cstdlib>
+#include <memory>
 
 #ifdef _WIN32
 #include "getopt.h"
@@ -45,6 +46,7 @@
 #include "graphviz.h"
 #include "json.h"
 #include "manifest_parser.h"
+#include "manifest_snapshot.h"
 #include "metrics.h"
 #include "missing_deps.h"
 #include "state.h"
@@ -55,9 +57,22 @@
 #ifndef _WIN32
 #include "thread_pool.h"
 #include "rbe_config.h"
+#include "remote_executor/execution_context.h"
+#include "remote_executor/static_file_utils.h"
 #include "share_build/sharebuild.h"
 #endif
 
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+
+#include <map>
+#include <set>
+
+#include "server.h"
+#endif
+
 using namespace std;
 
 #ifdef _WIN32
@@ -115,6 +130,9 @@ struct NinjaMain : public BuildLogUser {
   BuildLog build_log_;
   DepsLog deps_log_;
 
+  /// The manifest files state_ was loaded from, once LoadManifest() ran.
+  vector<string> manifest_files_;
+
   /// The type of functions that are the entry points to tools (subcommands).
   typedef int (NinjaMain::*ToolFunc)(const Options*, int, char**);
 
@@ -144,6 +162,8 @@ struct NinjaMain : public BuildLogUser {
   int ToolUrtle(const Options* options, int argc, char** argv);
   int ToolRules(const Options* options, int argc, char* argv[]);
   int ToolWinCodePage(const Options* options, int argc, char* argv[]);
+  int ToolActionDigest(const Options* options, int argc, char* argv[]);
+  int ToolServe(const Options* options, int argc, char* argv[]);
 
   /// Open the build log.
   /// @return false on error.
@@ -153,10 +173,24 @@ struct NinjaMain : public BuildLogUser {
   /// @return false on error.
   bool OpenDepsLog(bool recompact_only = false);
 
+  /// Write out and close the build and deps logs, whose records are
+  /// written in the background, before exit() skips their destructors.
+  void CloseLogs() {
+    build_log_.Close();
+    deps_log_.Close();
+  }
+
   /// Ensure the build directory exists, creating it if necessary.
   /// @return false on error.
   bool EnsureBuildDirExists();
 
+  /// Load the manifest from its snapshot if that is up to date, otherwise
+  /// parse it and write a new snapshot.
+  /// @return false on error. An empty \a err means a corrupt snapshot was
+  /// removed and state_ must be thrown away.
+  bool LoadManifest(const char* input_file,
+                    const ManifestParserOptions& options, string* err);
+
   /// Rebuild the manifest, if necessary.
   /// Fills in \a err on error.
   /// @return true if the manifest was rebuilt.
@@ -268,6 +302,56 @@ int GuessParallelism() {
   }
 }
 
+/// The manifest parser options selected by the command-line flags.
+ManifestParserOptions ParserOptions(const Options& options) {
+  ManifestParserOptions parser_opts;
+  if (options.dupe_edges_should_err) {
+    parser_opts.dupe_edge_action_ = kDupeEdgeActionError;
+  }
+  if (options.phony_cycle_should_err) {
+    parser_opts.phony_cycle_action_ = kPhonyCycleActionError;
+  }
+  return parser_opts;
+}
+
+bool NinjaMain::LoadManifest(const char* input_file,
+                             const ManifestParserOptions& options,
+                             string* err) {
+  const char kSnapshotPath[] = ".ninja_manifest";
+  uint32_t options_key =
+      options.dupe_edge_action_ | (options.phony_cycle_action_ << 8);
+  switch (ManifestSnapshot::Load(kSnapshotPath, input_file, options_key,
+                                 &disk_interface_, &state_, &manifest_files_,
+                                 err)) {
+  case LOAD_SUCCESS:
+    return true;
+  case LOAD_ERROR:
+    Warning("%s: %s; reparsing manifest", kSnapshotPath, err->c_str());
+    unlink(kSnapshotPath);
+    err->clear();
+    return false;
+  case LOAD_NOT_FOUND:
+    break;
+  }
+
+  ManifestSnapshot::Recorder recorder(&disk_interface_);
+  ManifestParser parser(&state_, &recorder, options);
+  bool success = parser.Load(input_file, err);
+  for (size_t i = 0; i < recorder.files_.size(); ++i)
+    manifest_files_.push_back(recorder.files_[i].first);
+  if (!success)
+    return false;
+
+  // The snapshot only speeds up the next run, so failing to write it isn't
+  // worth reporting.
+  if (!config_.dry_run) {
+    string write_err;
+    ManifestSnapshot::Write(kSnapshotPath, input_file, options_key, recorder,
+                            state_, &write_err);
+  }
+  return true;
+}
+
 /// Rebuild the build manifest, if necessary.
 /// Returns true if the manifest was rebuilt.
 bool NinjaMain::RebuildManifest(const char* input_file, string* err,
@@ -576,7 +660,7 @@ int NinjaMain::ToolDeps(const Options* options, int argc, char** argv) {
   RealDiskInterface disk_interface;
   for (vector<Node*>::iterator it = nodes.begin(), end = nodes.end();
        it != end; ++it) {
-    DepsLog::Deps* deps = deps_log_.GetDeps(*it);
+    DepsLog::Deps deps = deps_log_.GetDeps(*it);
     if (!deps) {
       printf("%s: deps not found\n", (*it)->path().c_str());
       continue;
@@ -587,10 +671,10 @@ int NinjaMain::ToolDeps(const Options* options, int argc, char** argv) {
     if (mtime == -1)
       Error("%s", err.c_str());  // Log and ignore Stat() errors;
     printf("%s: #deps %d, deps mtime %" PRId64 " (%s)\n",
-           (*it)->path().c_str(), deps->node_count, deps->mtime,
-           (!mtime || mtime > deps->mtime ? "STALE":"VALID"));
-    for (int i = 0; i < deps->node_count; ++i)
-      printf("    %s\n", deps->nodes[i]->path().c_str());
+           (*it)->path().c_str(), deps.node_count, deps.mtime,
+           (!mtime || mtime > deps.mtime ? "STALE":"VALID"));
+    for (int i = 0; i < deps.node_count; ++i)
+      printf("    %s\n", deps.nodes[i]->path().c_str());
     printf("\n");
   }
 
@@ -1090,6 +1174,603 @@ int NinjaMain::ToolRestat(const Options* options, int argc, char* argv[]) {
   return EXIT_SUCCESS;
 }
 
+#ifndef _WIN32
+namespace {
+
+void PrintInputRoot(const RemoteExecutor::DigestStringMap& blobs,
+                    const RemoteExecutor::Digest& digest,
+                    const string& prefix) {
+  RemoteExecutor::Directory directory;
+  auto blob = blobs.find(digest);
+  if (blob == blobs.end() || !directory.ParseFromString(blob->second))
+    return;
+  for (const auto& file : directory.files()) {
+    printf("    %s %s%s\n", RemoteExecutor::toString(file.digest()).c_str(),
+           prefix.c_str(), file.name().c_str());
+  }
+  for (const auto& symlink : directory.symlinks()) {
+    printf("    symlink %s%s -> %s\n", prefix.c_str(), symlink.name().c_str(),
+           symlink.target().c_str());
+  }
+  for (const auto& subdir : directory.directories())
+    PrintInputRoot(blobs, subdir.digest(), prefix + subdir.name() + "/");
+}
+
+}  // anonymous namespace
+
+int NinjaMain::ToolActionDigest(const Options* options, int argc,
+                                char* argv[]) {
+  // The actiondigest tool uses getopt, and expects argv[0] to contain the
+  // name of the tool, i.e. "actiondigest".
+  ++argc;
+  --argv;
+
+  optind = 1;
+  int opt;
+  while ((opt = getopt(argc, argv, const_cast<char*>("h"))) != -1) {
+    switch (opt) {
+    case 'h':
+    default:
+      printf("usage: ninja -t actiondigest [targets]\n"
+"\n"
+"Print the remote action of each target and everything its digest is\n"
+"computed from. Diff the output of two machines to see why they miss each\n"
+"other's cache entries.\n");
+      return 1;
+    }
+  }
+  argv += optind;
+  argc -= optind;
+
+  vector<Node*> nodes;
+  string err;
+  if (!CollectTargetsFromArgs(argc, argv, &nodes, &err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+
+  // Outside cloud and share builds main() has not looked at the project.
+  BuildConfig config = config_;
+  if (config.rbe_config.cwd.empty()) {
+    if (!GetCurrentDirectory(&config.rbe_config.cwd, &err)) {
+      Error("%s", err.c_str());
+      return 1;
+    }
+    const string project_root = config.rbe_config.project_root.empty()
+        ? "../" : config.rbe_config.project_root;
+    load_rules_file(project_root, config);
+    load_devcontainer_config(project_root, config);
+  }
+  RemoteExecutor::RemoteSpawn::config = &config;
+  const RemoteExecutor::PathRemapper remapper =
+      RemoteExecutor::RemoteSpawn::MakePathRemapper();
+  const char* home = getenv("HOME");
+
+  // Digest with the function a cloud build would agree on with the server.
+  const bool negotiated = !config.rbe_config.grpc_url.empty();
+  if (negotiated)
+    RemoteExecutor::ExecutionContext::NegotiateCapabilities();
+  printf("digest function: %s%s\n",
+         RemoteExecutor::DigestFunction_Value_Name(
+             RemoteExecutor::CASHash::DigestFunction()).c_str(),
+         negotiated ? "" : " (no grpc_url configured to ask)");
+  for (Node* node : nodes) {
+    Edge* edge = node->in_edge();
+    if (!edge || edge->is_phony())
+      continue;
+    std::unique_ptr<RemoteExecutor::RemoteSpawn> spawn(
+        RemoteExecutor::RemoteSpawn::CreateRemoteSpawn(edge));
+    printf("%s\n", node->path().c_str());
+    if (!spawn->can_cache) {
+      printf("  runs locally, no action\n");
+      continue;
+    }
+    spawn->ConvertAllPathToRelative();
+    for (const auto& header : spawn->GetHeaderFiles())
+      spawn->inputs.push_back(header);
+
+    RemoteExecutor::DigestStringMap blobs, digest_files;
+    std::set<string> products;
+    const RemoteExecutor::Action action = RemoteExecutor::BuildAction(
+        spawn.get(), config.rbe_config.cwd, &blobs, &digest_files, products);
+    RemoteExecutor::Command command;
+    command.ParseFromString(blobs[action.command_digest()]);
+
+    printf("  action %s\n", RemoteExecutor::toString(
+        RemoteExecutor::CASHash::Hash(action.SerializeAsString())).c_str());
+    printf("  command %s\n",
+           RemoteExecutor::toString(action.command_digest()).c_str());
+    for (const auto& arg : command.arguments())
+      printf("    arg %s\n", arg.c_str());
+    printf("    working_directory %s\n", command.working_directory().c_str());
+    for (const auto& path : command.output_paths())
+      printf("    output_path %s\n", path.c_str());
+    for (const auto& path : command.output_files())
+      printf("    output_file %s\n", path.c_str());
+    for (const auto& property : command.platform().properties()) {
+      printf("    platform %s=%s\n", property.name().c_str(),
+             property.value().c_str());
+    }
+    printf("  input_root %s\n",
+           RemoteExecutor::toString(action.input_root_digest()).c_str());
+    PrintInputRoot(blobs, action.input_root_digest(), "");
+
+    // Point out the arguments that are most likely to differ between users.
+    const vector<string> args(command.arguments().begin(),
+                              command.arguments().end());
+    for (size_t i = 0; i < args.size(); ++i) {
+      if (RemoteExecutor::PathRemapper::DefinesMacro(args, i))
+        continue;
+      const string& arg = args[i];
+      for (const auto& path : RemoteExecutor::PathRemapper::AbsolutePaths(arg)) {
+        if ((home && RemoteExecutor::StaticFileUtils::HasPathPrefix(path, home)) ||
+            RemoteExecutor::StaticFileUtils::HasPathPrefix(
+                path, config.rbe_config.cwd)) {
+          Warning("%s: argument '%s' contains the machine specific path '%s'; "
+                  "add a path_remaps entry for it", node->path().c_str(),
+                  arg.c_str(), path.c_str());
+        }
+      }
+    }
+  }
+  return 0;
+}
+#endif
+
+#ifdef __linux__
+/// Set when "ninja -t serve" should exit.
+volatile sig_atomic_t g_server_stop = 0;
+/// Set while a request is served. A SIGINT then comes from its client and
+/// is for the build, which picks it up itself.
+volatile sig_atomic_t g_server_busy = 0;
+
+void HandleServerSignal(int signum) {
+  if (signum != SIGINT || !g_server_busy)
+    g_server_stop = 1;
+}
+
+/// Unlike SIG_IGN, a handler doesn't carry over to the commands run.
+void IgnoreServerSignal(int /* signum */) {}
+
+/// The directory \a path is in, as FileWatcher reports it.
+string DirName(const string& path) {
+  string::size_type slash = path.rfind('/');
+  if (slash == string::npos)
+    return ".";
+  return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+/// The -d and -w flags in effect, for ServerRequest::debug_flags.
+string ServerDebugFlags(const Options& options) {
+  string flags;
+  if (g_metrics)
+    flags += "stats,";
+  if (g_explaining)
+    flags += "explain,";
+  if (g_keep_depfile)
+    flags += "keepdepfile,";
+  if (g_keep_rsp)
+    flags += "keeprsp,";
+  if (!g_experimental_statcache)
+    flags += "nostatcache,";
+  flags += options.dupe_edges_should_err ? "dupbuild=err," : "dupbuild=warn,";
+  flags += options.phony_cycle_should_err ? "phonycycle=err" : "phonycycle=warn";
+  return flags;
+}
+
+/// "ninja -t serve" for one load of the manifest. The graph, the logs and
+/// what is known about each file stay in memory from build to build. A
+/// build only stat()s the files inotify reported as changed since the last
+/// one, the outputs of the commands that ran and files in directories that
+/// can't be watched.
+struct BuildServer {
+  BuildServer(NinjaMain* ninja, const Options* options,
+              ServerListener* listener, const BuildConfig& base_config,
+              BuildConfig* config, const vector<string>& environment)
+      : ninja_(ninja), options_(options), listener_(listener),
+        base_config_(base_config), config_(config), environment_(environment),
+        watched_nodes_(0), reload_(false) {}
+
+  /// Returned by Run() to start over with a fresh NinjaMain. Distinct from
+  /// kServerDeclined.
+  static const int kReload = -2;
+
+  /// Load the manifest and serve requests until it needs to be loaded
+  /// again. \a pending is the request being served, if any; it is kept
+  /// across reloads. Returns kReload or the exit code of the server.
+  int Run(std::unique_ptr<ServerConnection>* pending);
+
+ private:
+  /// Load the manifest and the logs and watch the directories of all
+  /// files involved. Returns false with an empty \a err to load again.
+  bool Load(string* err);
+
+  bool Watch(const string& dir);
+  /// Watch the directories of the nodes added since the last call.
+  void WatchNodes();
+
+  /// Forget the state of the files that changed. \a own_writes means the
+  /// logs were written by us. Returns false if the manifest has to be
+  /// loaded again.
+  bool ReadChanges(bool own_writes);
+
+  /// Undo what the previous build recorded in the graph, except for the
+  /// state of the files that are unchanged.
+  void PrepareGraph();
+
+  /// Drop the implicit deps loaded for \a edge from its depfile or the
+  /// deps log, keeping those from the manifest.
+  void UnloadDeps(Edge* edge);
+
+  /// Serve one request, with its client's stdout and stderr as ours.
+  int Serve(const ServerConnection& connection);
+  int Build(const ServerRequest& request);
+
+  NinjaMain* ninja_;
+  const Options* options_;
+  ServerListener* listener_;
+  const BuildConfig& base_config_;
+  /// The config ninja_ builds with: base_config_ with the flags of the
+  /// current request.
+  BuildConfig* config_;
+  /// The environment the server was started in, which its commands run in.
+  const vector<string>& environment_;
+  FileWatcher watcher_;
+  /// Why the manifest or the logs failed to load, reported to every client
+  /// until the manifest changes.
+  string load_error_;
+  set<string> manifest_files_;
+  set<string> log_files_;
+  set<string> watched_dirs_;
+  /// Directories that couldn't be watched, with the nodes in them. Those
+  /// are stat()ed again for every build.
+  map<string, vector<Node*> > unwatched_;
+  /// Nodes in watched directories whose changes inotify doesn't report,
+  /// also stat()ed again for every build.
+  set<Node*> unreported_;
+  /// The number of nodes at the last WatchNodes().
+  size_t watched_nodes_;
+  /// The number of implicit deps of each edge in the manifest.
+  vector<int> manifest_implicit_deps_;
+  /// Set when the graph changed in a way that can't be undone.
+  bool reload_;
+};
+
+int BuildServer::Run(std::unique_ptr<ServerConnection>* pending) {
+  string err;
+  if (!watcher_.Init(&err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+  if (!Load(&err)) {
+    if (err.empty())
+      return kReload;
+    Error("%s", err.c_str());
+    load_error_ = err;
+  }
+
+  for (;;) {
+    if (!*pending) {
+      pollfd fds[2] = { { listener_->fd(), POLLIN, 0 },
+                        { watcher_.fd(), POLLIN, 0 } };
+      int ret = poll(fds, 2, -1);
+      if (g_server_stop)
+        return 0;
+      if (ret < 0) {
+        if (errno == EINTR)
+          continue;
+        Error("poll: %s", strerror(errno));
+        return 1;
+      }
+      if (fds[1].revents && !ReadChanges(false))
+        return kReload;
+      if (!fds[0].revents)
+        continue;
+      pending->reset(new ServerConnection);
+      err.clear();
+      if (!listener_->Accept(pending->get(), &err)) {
+        if (!err.empty())
+          Warning("%s", err.c_str());
+        pending->reset();
+        continue;
+      }
+    }
+
+    // Anything the client changed before connecting is queued by now.
+    if (!ReadChanges(false))
+      return kReload;
+    g_server_busy = 1;
+    int result = Serve(**pending);
+    g_server_busy = 0;
+    if (result == kReload)
+      return kReload;
+    // Write out the logs, so that the changes they make are queued as our
+    // own below.
+    ninja_->build_log_.Flush();
+    ninja_->deps_log_.Flush();
+    (*pending)->Finish(result);
+    pending->reset();
+    if (reload_ || !ReadChanges(true))
+      return kReload;
+    if (g_server_stop)
+      return 0;
+  }
+}
+
+bool BuildServer::Load(string* err) {
+  bool loaded = ninja_->LoadManifest(options_->input_file,
+                                     ParserOptions(*options_), err);
+  // Watch the manifest before anything else, so that no edit goes unseen,
+  // even if it failed to parse.
+  for (size_t i = 0; i < ninja_->manifest_files_.size(); ++i) {
+    const string& path = ninja_->manifest_files_[i];
+    manifest_files_.insert(path);
+    Watch(DirName(path));
+  }
+  if (!loaded)
+    return false;
+
+  if (!ninja_->EnsureBuildDirExists() || !ninja_->OpenBuildLog() ||
+      !ninja_->OpenDepsLog()) {
+    *err = "loading the build and deps logs failed; see the server's output";
+    return false;
+  }
+  string log_dir = ninja_->build_dir_.empty() ? "" : ninja_->build_dir_ + "/";
+  log_files_.insert(log_dir + ".ninja_log");
+  log_files_.insert(log_dir + ".ninja_deps");
+  ninja_->ParsePreviousElapsedTimes();
+
+  const vector<Edge*>& edges = ninja_->state_.edges_;
+  manifest_implicit_deps_.resize(edges.size());
+  for (size_t i = 0; i < edges.size(); ++i)
+    manifest_implicit_deps_[edges[i]->id_] = edges[i]->implicit_deps_;
+  WatchNodes();
+  return ReadChanges(true);
+}
+
+bool BuildServer::Watch(const string& dir) {
+  string err;
+  if (!watcher_.Watch(dir, &err))
+    return false;
+  watched_dirs_.insert(dir);
+  return true;
+}
+
+void BuildServer::WatchNodes() {
+  const State::Paths& paths = ninja_->state_.paths_;
+  if (paths.size() == watched_nodes_)
+    return;
+  METRIC_RECORD("server watch");
+  unwatched_.clear();
+  for (State::Paths::const_iterator i = paths.begin(); i != paths.end(); ++i) {
+    string dir = DirName((*i)->path());
+    if (watched_dirs_.count(dir)) {
+      if (!FileWatcher::Reports((*i)->path()))
+        unreported_.insert(*i);
+      continue;
+    }
+    map<string, vector<Node*> >::iterator unwatched = unwatched_.find(dir);
+    if (unwatched == unwatched_.end()) {
+      if (Watch(dir))
+        continue;
+      unwatched = unwatched_.insert(make_pair(dir, vector<Node*>())).first;
+    }
+    unwatched->second.push_back(*i);
+  }
+  watched_nodes_ = paths.size();
+}
+
+bool BuildServer::ReadChanges(bool own_writes) {
+  vector<string> paths;
+  if (!watcher_.ReadChanges(&paths))
+    return false;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (manifest_files_.count(paths[i]))
+      return false;
+    // Another ninja wrote the logs; ours are out of date.
+    if (log_files_.count(paths[i]) && !own_writes)
+      return false;
+    if (Node* node = ninja_->state_.LookupNode(paths[i])) {
+      node->ResetState();
+      // It may have been replaced with a symlink.
+      if (!FileWatcher::Reports(node->path()))
+        unreported_.insert(node);
+    }
+  }
+  return true;
+}
+
+void BuildServer::PrepareGraph() {
+  for (map<string, vector<Node*> >::iterator i = unwatched_.begin();
+       i != unwatched_.end();) {
+    for (size_t j = 0; j < i->second.size(); ++j)
+      i->second[j]->ResetState();
+    // Nodes reset already; nothing is missed if the watch starts now.
+    if (Watch(i->first))
+      unwatched_.erase(i++);
+    else
+      ++i;
+  }
+  for (set<Node*>::iterator i = unreported_.begin(); i != unreported_.end();) {
+    (*i)->ResetState();
+    // Forget it once it is a plain file again.
+    if (FileWatcher::Reports((*i)->path()))
+      unreported_.erase(i++);
+    else
+      ++i;
+  }
+
+  State& state = ninja_->state_;
+  for (State::Paths::const_iterator i = state.paths_.begin();
+       i != state.paths_.end(); ++i) {
+    (*i)->set_dirty(false);
+  }
+  for (size_t i = 0; i < state.edges_.size(); ++i) {
+    Edge* edge = state.edges_[i];
+    // State::Reset() clears deps_loaded_ without dropping the deps.
+    if (!edge->deps_loaded_)
+      UnloadDeps(edge);
+    edge->mark_ = Edge::VisitNone;
+    edge->outputs_ready_ = false;
+    edge->deps_missing_ = false;
+    edge->command_start_time_ = 0;
+  }
+}
+
+void BuildServer::UnloadDeps(Edge* edge) {
+  int manifest_deps = edge->id_ < manifest_implicit_deps_.size()
+                          ? manifest_implicit_deps_[edge->id_]
+                          : 0;
+  int count = edge->implicit_deps_ - manifest_deps;
+  edge->deps_loaded_ = false;
+  if (count <= 0)
+    return;
+  vector<Node*>::iterator end = edge->inputs_.end() - edge->order_only_deps_;
+  for (vector<Node*>::iterator i = end - count; i != end; ++i)
+    (*i)->RemoveOutEdge(edge);
+  edge->inputs_.erase(end - count, end);
+  edge->implicit_deps_ = manifest_deps;
+}
+
+int BuildServer::Serve(const ServerConnection& connection) {
+  const ServerRequest& request = connection.request_;
+  // Commands would run in our environment and the build would follow our
+  // -d and -w flags; only serve a client who would build the same way.
+  if (request.input_file != options_->input_file ||
+      request.debug_flags != ServerDebugFlags(*options_) ||
+      request.environment != environment_)
+    return kServerDeclined;
+
+  *config_ = base_config_;
+  config_->parallelism = request.parallelism;
+  config_->failures_allowed = request.failures_allowed;
+  config_->max_load_average = request.max_load_average;
+  config_->verbosity = (BuildConfig::Verbosity)request.verbosity;
+  config_->dry_run = request.dry_run;
+
+  fflush(stdout);
+  fflush(stderr);
+  int saved_stdout = fcntl(1, F_DUPFD_CLOEXEC, 3);
+  int saved_stderr = fcntl(2, F_DUPFD_CLOEXEC, 3);
+  dup2(connection.stdout_fd_, 1);
+  dup2(connection.stderr_fd_, 2);
+
+  int result = 1;
+  if (!load_error_.empty())
+    Error("%s", load_error_.c_str());
+  else
+    result = Build(request);
+
+  fflush(stdout);
+  fflush(stderr);
+  dup2(saved_stdout, 1);
+  dup2(saved_stderr, 2);
+  close(saved_stdout);
+  close(saved_stderr);
+  return result;
+}
+
+int BuildServer::Build(const ServerRequest& request) {
+  // Created now, so that it sees the client's terminal.
+  std::unique_ptr<Status> status(new StatusPrinter(*config_));
+  PrepareGraph();
+
+  string err;
+  if (ninja_->RebuildManifest(options_->input_file, &err, status.get())) {
+    if (config_->dry_run)
+      return 0;
+    return kReload;
+  } else if (!err.empty()) {
+    status->Error("rebuilding '%s': %s", options_->input_file, err.c_str());
+    return 1;
+  }
+  // Checking the manifest visited part of the graph.
+  PrepareGraph();
+
+  vector<char*> argv;
+  for (size_t i = 0; i < request.targets.size(); ++i)
+    argv.push_back(const_cast<char*>(request.targets[i].c_str()));
+  int result = ninja_->RunBuild(argv.size(), argv.data(), status.get());
+  if (g_metrics)
+    ninja_->DumpMetrics();
+
+  // The commands that ran changed their outputs and maybe their deps.
+  State& state = ninja_->state_;
+  for (size_t i = 0; i < state.edges_.size(); ++i) {
+    Edge* edge = state.edges_[i];
+    if (edge->command_start_time_ != 0) {
+      UnloadDeps(edge);
+      for (size_t j = 0; j < edge->outputs_.size(); ++j)
+        edge->outputs_[j]->ResetState();
+    }
+    // A loaded dyndep file changed the graph for good.
+    if (edge->dyndep_ && !edge->dyndep_->dyndep_pending())
+      reload_ = true;
+  }
+  // Deps may have added nodes.
+  WatchNodes();
+  return result;
+}
+
+int NinjaMain::ToolServe(const Options* options, int argc, char* argv[]) {
+  if (argc > 0) {
+    Error("-t serve takes no arguments");
+    return 1;
+  }
+  if (config_.share_run) {
+    Error("-t serve doesn't support sharebuild mode");
+    return 1;
+  }
+
+  ServerListener listener;
+  string err;
+  if (!listener.Listen(&err)) {
+    Error("%s", err.c_str());
+    return 1;
+  }
+  const vector<string> environment = CurrentEnvironment();
+  // A ninja run by a command builds by itself rather than waiting for us.
+  setenv(kServerBuildEnv, "1", 1);
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = HandleServerSignal;
+  sigaction(SIGINT, &act, NULL);
+  sigaction(SIGTERM, &act, NULL);
+  sigaction(SIGHUP, &act, NULL);
+  act.sa_handler = IgnoreServerSignal;
+  sigaction(SIGPIPE, &act, NULL);
+  Info("serving builds of '%s'", options->input_file);
+
+  BuildConfig config = config_;
+  std::unique_ptr<ServerConnection> pending;
+  // Limit number of rebuilds of the manifest per request, as real_main()
+  // does.
+  const int kCycleLimit = 100;
+  const ServerConnection* cycling = NULL;
+  int cycle = 0;
+  for (;;) {
+    NinjaMain ninja(ninja_command_, config);
+    BuildServer server(&ninja, options, &listener, config_, &config,
+                       environment);
+    int result = server.Run(&pending);
+    if (result != BuildServer::kReload)
+      return result;
+    if (pending.get() != cycling) {
+      cycling = pending.get();
+      cycle = 0;
+    }
+    if (pending && ++cycle == kCycleLimit) {
+      dprintf(pending->stderr_fd_,
+              "ninja: error: manifest '%s' still dirty after %d tries\n",
+              options->input_file, kCycleLimit);
+      pending->Finish(1);
+      pending.reset();
+      cycling = NULL;
+    }
+  }
+}
+#endif  // __linux__
+
 int NinjaMain::ToolUrtle(const Options* options, int argc, char** argv) {
   // RLE encoded.
   const char* urtle =
@@ -1152,6 +1833,14 @@ const Tool* ChooseTool(const string& tool_name) {
       Tool::RUN_AFTER_LOAD, &NinjaMain::ToolRules },
     { "cleandead",  "clean built files that are no longer produced by the manifest",
       Tool::RUN_AFTER_LOGS, &NinjaMain::ToolCleanDead },
+#ifndef _WIN32
+    { "actiondigest",  "explain the remote action digest of targets",
+      Tool::RUN_AFTER_LOAD, &NinjaMain::ToolActionDigest },
+#endif
+#ifdef __linux__
+    { "serve",  "keep the build loaded and run the builds asked for by ninja",
+      Tool::RUN_AFTER_FLAGS, &NinjaMain::ToolServe },
+#endif
     { "urtle", NULL,
       Tool::RUN_AFTER_FLAGS, &NinjaMain::ToolUrtle },
 #ifdef _WIN32
@@ -1353,9 +2042,9 @@ void NinjaMain::DumpMetrics() {
 
   printf("\n");
   int count = (int)state_.paths_.size();
-  int buckets = (int)state_.paths_.bucket_count();
-  printf("path->node hash load %.2f (%d entries / %d buckets)\n",
-         count / (double) buckets, count, buckets);
+  int slots = (int)state_.paths_.capacity();
+  printf("path->node hash load %.2f (%d entries / %d slots)\n",
+         count / (double) slots, count, slots);
 }
 
 bool NinjaMain::EnsureBuildDirExists() {
@@ -1382,6 +2071,7 @@ int NinjaMain::RunBuild(int argc, char** argv, Status* status) {
 
   Builder builder(&state_, config_, &build_log_, &deps_log_, &disk_interface_,
                   status, start_time_millis_);
+  builder.Prefetch(targets);
   for (size_t i = 0; i < targets.size(); ++i) {
     if (!builder.AddTarget(targets[i], &err)) {
       if (!err.empty()) {
@@ -1623,6 +2313,33 @@ NORETURN void real_main(int argc, char** argv) {
       Fatal("chdir to '%s' - %s", options.working_dir, strerror(errno));
     }
   } 
+
+#ifdef __linux__
+  // Let a "ninja -t serve" running in this directory do the build.
+  if (!options.tool && !config.cloud_run && !config.share_run &&
+      !getenv(kServerBuildEnv)) {
+    ServerClient client;
+    if (client.Connect()) {
+      ServerRequest request;
+      request.input_file = options.input_file;
+      request.parallelism = config.parallelism;
+      request.failures_allowed = config.failures_allowed;
+      request.max_load_average = config.max_load_average;
+      request.verbosity = config.verbosity;
+      request.dry_run = config.dry_run;
+      request.debug_flags = ServerDebugFlags(options);
+      request.environment = CurrentEnvironment();
+      request.targets.assign(argv, argv + argc);
+      string err;
+      if (!client.Run(request, &exit_code, &err)) {
+        status->Error("%s", err.c_str());
+        exit(1);
+      }
+      if (exit_code != kServerDeclined)
+        exit(exit_code);
+    }
+  }
+#endif
   std::string project_root = "../";
   if (config.cloud_run || config.share_run) {
      string err;
@@ -1672,16 +2389,11 @@ NORETURN void real_main(int argc, char** argv) {
   for (int cycle = 1; cycle <= kCycleLimit; ++cycle) {
     NinjaMain ninja(ninja_command, config);
 
-    ManifestParserOptions parser_opts;
-    if (options.dupe_edges_should_err) {
-      parser_opts.dupe_edge_action_ = kDupeEdgeActionError;
-    }
-    if (options.phony_cycle_should_err) {
-      parser_opts.phony_cycle_action_ = kPhonyCycleActionError;
-    }
-    ManifestParser parser(&ninja.state_, &ninja.disk_interface_, parser_opts);
     string err;
-    if (!parser.Load(options.input_file, &err)) {
+    if (!ninja.LoadManifest(options.input_file, ParserOptions(options), &err)) {
+      // Start over with a fresh State after dropping a corrupt snapshot.
+      if (err.empty())
+        continue;
       status->Error("%s", err.c_str());
       exit(1);
     }
@@ -1692,22 +2404,30 @@ NORETURN void real_main(int argc, char** argv) {
     if (!ninja.EnsureBuildDirExists())
       exit(1);
 
-    if (!ninja.OpenBuildLog() || !ninja.OpenDepsLog())
+    if (!ninja.OpenBuildLog() || !ninja.OpenDepsLog()) {
+      ninja.CloseLogs();
       exit(1);
+    }
 
-    if (options.tool && options.tool->when == Tool::RUN_AFTER_LOGS)
-      exit((ninja.*options.tool->func)(&options, argc, argv));
+    if (options.tool && options.tool->when == Tool::RUN_AFTER_LOGS) {
+      int result = (ninja.*options.tool->func)(&options, argc, argv);
+      ninja.CloseLogs();
+      exit(result);
+    }
 
     // Attempt to rebuild the manifest before building anything else
     if (ninja.RebuildManifest(options.input_file, &err, status)) {
       // In dry_run mode the regeneration will succeed without changing the
       // manifest forever. Better to return immediately.
-      if (config.dry_run)
+      if (config.dry_run) {
+        ninja.CloseLogs();
         exit(0);
+      }
       // Start the build over with the new manifest.
       continue;
     } else if (!err.empty()) {
       status->Error("rebuilding '%s': %s", options.input_file, err.c_str());
+      ninja.CloseLogs();
       exit(1);
     }
 
@@ -1717,11 +2437,13 @@ NORETURN void real_main(int argc, char** argv) {
       bool ret = InitShareBuildEnv(config.rbe_config);
       if (!ret) {
         Error("Failed to initialize sharebuild environment.");
+        ninja.CloseLogs();
         exit(1);
       }
       Info("Success to initialize sharebuild environment.");
     }
     int result = ninja.RunBuild(argc, argv, status);
+    ninja.CloseLogs();
     if (g_metrics)
       ninja.DumpMetrics();
 
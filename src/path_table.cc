@@ -0,0 +1,111 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "path_table.h"
+
+#include <assert.h>
+#include <string.h>
+
+#include "graph.h"
+#include "util.h"
+
+#ifdef NINJA_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+const size_t PathTable::kGroupSize;
+const uint8_t PathTable::kEmpty;
+
+// static
+uint32_t PathTable::MatchGroup(const uint8_t* ctrl, uint8_t byte) {
+#ifdef NINJA_HAVE_SSE2
+  __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+#else
+  uint32_t mask = 0;
+  for (size_t i = 0; i < kGroupSize; ++i) {
+    if (ctrl[i] == byte)
+      mask |= 1u << i;
+  }
+  return mask;
+#endif
+}
+
+Node* PathTable::Lookup(StringPiece path, uint32_t hash) const {
+  if (slots_.empty())
+    return NULL;
+  const size_t group_mask = slots_.size() / kGroupSize - 1;
+  const uint8_t fingerprint = hash & 0x7f;
+  size_t group = (hash >> 7) & group_mask;
+  for (size_t step = 1;; ++step) {
+    const uint8_t* ctrl = &ctrl_[group * kGroupSize];
+    for (uint32_t match = MatchGroup(ctrl, fingerprint); match;
+         match &= match - 1) {
+      Node* node = slots_[group * kGroupSize + LowestSetBit(match)];
+      const std::string& node_path = node->path();
+      if (node_path.size() == path.len_ &&
+          memcmp(node_path.data(), path.str_, path.len_) == 0) {
+        return node;
+      }
+    }
+    if (MatchGroup(ctrl, kEmpty))
+      return NULL;
+    // Triangular probing visits every group of a power of two table.
+    group = (group + step) & group_mask;
+  }
+}
+
+void PathTable::Insert(Node* node, uint32_t hash) {
+  assert(!Lookup(node->path(), hash));
+  // Keep at least 1/8 of the slots empty so probes end quickly.
+  if ((size_ + 1) * 8 > slots_.size() * 7)
+    Grow();
+  const size_t group_mask = slots_.size() / kGroupSize - 1;
+  size_t group = (hash >> 7) & group_mask;
+  for (size_t step = 1;; ++step) {
+    uint32_t empty = MatchGroup(&ctrl_[group * kGroupSize], kEmpty);
+    if (empty) {
+      size_t slot = group * kGroupSize + LowestSetBit(empty);
+      ctrl_[slot] = hash & 0x7f;
+      slots_[slot] = node;
+      ++size_;
+      return;
+    }
+    group = (group + step) & group_mask;
+  }
+}
+
+void PathTable::Reserve(size_t count) {
+  size_t capacity = slots_.empty() ? 8 * kGroupSize : slots_.size();
+  while (count * 8 > capacity * 7)
+    capacity *= 2;
+  if (capacity > slots_.size())
+    Rehash(capacity);
+}
+
+void PathTable::Grow() {
+  Rehash(slots_.empty() ? 8 * kGroupSize : slots_.size() * 2);
+}
+
+void PathTable::Rehash(size_t capacity) {
+  std::vector<Node*> old_slots;
+  old_slots.swap(slots_);
+  ctrl_.assign(capacity, kEmpty);
+  slots_.assign(capacity, NULL);
+  size_ = 0;
+  for (size_t i = 0; i < old_slots.size(); ++i) {
+    if (old_slots[i])
+      Insert(old_slots[i], Hash(old_slots[i]->path()));
+  }
+}
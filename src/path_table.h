@@ -0,0 +1,88 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_PATH_TABLE_H_
+#define NINJA_PATH_TABLE_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "hash_map.h"
+#include "string_piece.h"
+
+struct Node;
+
+/// Maps paths to the Nodes that own them, for State.
+///
+/// An open addressing table probed in groups of 16 slots. Each slot has a
+/// control byte holding 7 bits of its path's hash, so a probe compares a
+/// whole group of control bytes at once (with SSE2 where available) and
+/// only looks at a Node's path on a fingerprint match. Nodes are never
+/// removed, so a group with an empty slot ends a probe.
+struct PathTable {
+  PathTable() : size_(0) {}
+
+  static uint32_t Hash(StringPiece path) {
+    return MurmurHash2(path.str_, path.len_);
+  }
+
+  Node* Lookup(StringPiece path) const { return Lookup(path, Hash(path)); }
+  Node* Lookup(StringPiece path, uint32_t hash) const;
+
+  /// Add |node| under its path, which must not be in the table yet.
+  /// |hash| is Hash(node->path()).
+  void Insert(Node* node, uint32_t hash);
+
+  /// Make room for |count| paths without growing again.
+  void Reserve(size_t count);
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return slots_.size(); }
+
+  struct const_iterator {
+    const_iterator(const PathTable* table, size_t slot)
+        : table_(table), slot_(slot) { SkipEmpty(); }
+    Node* operator*() const { return table_->slots_[slot_]; }
+    const_iterator& operator++() { ++slot_; SkipEmpty(); return *this; }
+    bool operator!=(const const_iterator& other) const {
+      return slot_ != other.slot_;
+    }
+
+   private:
+    void SkipEmpty() {
+      while (slot_ < table_->slots_.size() && !table_->slots_[slot_])
+        ++slot_;
+    }
+    const PathTable* table_;
+    size_t slot_;
+  };
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, slots_.size()); }
+
+ private:
+  static const size_t kGroupSize = 16;
+  static const uint8_t kEmpty = 0x80;
+
+  /// A bit per slot of the group at |ctrl| whose control byte is |byte|.
+  static uint32_t MatchGroup(const uint8_t* ctrl, uint8_t byte);
+  void Grow();
+  void Rehash(size_t capacity);
+
+  std::vector<uint8_t> ctrl_;
+  std::vector<Node*> slots_;
+  size_t size_;
+};
+
+#endif  // NINJA_PATH_TABLE_H_
@@ -25,6 +25,20 @@
 // 获取当前主机 ipv4 地址
 std::string get_ipv4_address(size_t address_size);
 
+// path_remaps:
+//   - from: /home/alice/toolchain
+//     to: /toolchain
+static void load_path_remaps(const YAML::Node& node, BuildConfig &config) {
+    if (!node)
+        return;
+    for (const auto& entry : node) {
+        if (!entry["from"] || !entry["to"])
+            Fatal("path_remaps entries need both `from` and `to`");
+        config.rbe_config.path_remaps.emplace_back(
+            entry["from"].as<std::string>(), entry["to"].as<std::string>());
+    }
+}
+
 bool load_config_file(BuildConfig &config) {
     // 设置默认值 
     config.cloud_run = false;
@@ -74,6 +88,14 @@ bool load_config_file(BuildConfig &config) {
         config.share_run = ninja2_conf["sharebuild"].as<bool>(config.share_run);
         config.rbe_config.shareproxy_addr = ninja2_conf["shareproxy_addr"].as<std::string>(config.rbe_config.shareproxy_addr);
         config.rbe_config.self_ipv4_addr = ninja2_conf["self_ipv4_addr"].as<std::string>(config.rbe_config.self_ipv4_addr);
+        config.rbe_config.ship_inputs = ninja2_conf["ship_inputs"].as<bool>(config.rbe_config.ship_inputs);
+        config.rbe_config.blob_server_port = ninja2_conf["blob_server_port"].as<int32_t>(config.rbe_config.blob_server_port);
+        load_path_remaps(ninja2_conf["path_remaps"], config);
+        if (ninja2_conf["remote_cache_rules"]) {
+            for (const auto& rule : ninja2_conf["remote_cache_rules"]) {
+                config.rbe_config.remote_cache_rules.insert(rule.as<std::string>());
+            }
+        }
         return true;
     } catch (const std::exception& e) {
         std::cerr << "Error loading config file: " << config_file << std::endl;  
@@ -142,6 +164,12 @@ void load_rules_file(const std::string& project_root, BuildConfig &config){
                 config.rbe_config.remote_exec_rules.insert(cmd.as<std::string>());
             }
         }
+        if (rule_set["rules"]["remote_cache_rules"]) {
+            for (const auto& cmd : rule_set["rules"]["remote_cache_rules"]) {
+                config.rbe_config.remote_cache_rules.insert(cmd.as<std::string>());
+            }
+        }
+        load_path_remaps(rule_set["path_remaps"], config);
     }
 }
 
@@ -0,0 +1,773 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+#include "blake3.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BLAKE3_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#include "../thread_pool.h"
+
+namespace RemoteExecutor {
+
+namespace {
+
+constexpr size_t kBlockLen = 64;
+constexpr size_t kChunkLen = 1024;
+// Number of chunks handed to the kernel per call by the incremental hasher.
+constexpr size_t kBatchChunks = 16;
+
+enum Flags : uint8_t {
+  CHUNK_START = 1 << 0,
+  CHUNK_END = 1 << 1,
+  PARENT = 1 << 2,
+  ROOT = 1 << 3,
+};
+
+const uint32_t kIV[8] = {
+  0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+  0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+const uint8_t kMsgSchedule[7][16] = {
+  { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+  { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+  { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+  { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+  { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+  { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+  { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+inline uint32_t Load32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+inline void Store32(uint8_t* p, uint32_t w) {
+  p[0] = (uint8_t)w;
+  p[1] = (uint8_t)(w >> 8);
+  p[2] = (uint8_t)(w >> 16);
+  p[3] = (uint8_t)(w >> 24);
+}
+
+inline void StoreCv(uint8_t out[32], const uint32_t cv[8]) {
+  for (int i = 0; i < 8; ++i)
+    Store32(out + 4 * i, cv[i]);
+}
+
+inline void LoadCv(uint32_t cv[8], const uint8_t in[32]) {
+  for (int i = 0; i < 8; ++i)
+    cv[i] = Load32(in + 4 * i);
+}
+
+inline uint32_t Rotr32(uint32_t w, int c) {
+  return (w >> c) | (w << (32 - c));
+}
+
+inline void G(uint32_t* s, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+  s[a] = s[a] + s[b] + x;
+  s[d] = Rotr32(s[d] ^ s[a], 16);
+  s[c] = s[c] + s[d];
+  s[b] = Rotr32(s[b] ^ s[c], 12);
+  s[a] = s[a] + s[b] + y;
+  s[d] = Rotr32(s[d] ^ s[a], 8);
+  s[c] = s[c] + s[d];
+  s[b] = Rotr32(s[b] ^ s[c], 7);
+}
+
+void Compress(uint32_t state[16], const uint32_t cv[8],
+              const uint8_t block[kBlockLen], uint8_t block_len,
+              uint64_t counter, uint8_t flags) {
+  uint32_t m[16];
+  for (int i = 0; i < 16; ++i)
+    m[i] = Load32(block + 4 * i);
+  for (int i = 0; i < 8; ++i)
+    state[i] = cv[i];
+  for (int i = 0; i < 4; ++i)
+    state[8 + i] = kIV[i];
+  state[12] = (uint32_t)counter;
+  state[13] = (uint32_t)(counter >> 32);
+  state[14] = block_len;
+  state[15] = flags;
+  for (int r = 0; r < 7; ++r) {
+    const uint8_t* s = kMsgSchedule[r];
+    G(state, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+    G(state, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+    G(state, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+    G(state, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+    G(state, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+    G(state, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+    G(state, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+    G(state, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+  }
+}
+
+void CompressInPlace(uint32_t cv[8], const uint8_t block[kBlockLen],
+                     uint8_t block_len, uint64_t counter, uint8_t flags) {
+  uint32_t state[16];
+  Compress(state, cv, block, block_len, counter, flags);
+  for (int i = 0; i < 8; ++i)
+    cv[i] = state[i] ^ state[i + 8];
+}
+
+/// The final compression of a node, kept around until we know whether it
+/// is the root.
+struct Output {
+  uint32_t cv[8];
+  uint8_t block[kBlockLen];
+  uint8_t block_len;
+  uint64_t counter;
+  uint8_t flags;
+
+  void ChainingValue(uint8_t out[32]) const {
+    uint32_t words[8];
+    memcpy(words, cv, sizeof(words));
+    CompressInPlace(words, block, block_len, counter, flags);
+    StoreCv(out, words);
+  }
+
+  void RootBytes(uint8_t out[32]) const {
+    uint32_t words[8];
+    memcpy(words, cv, sizeof(words));
+    CompressInPlace(words, block, block_len, 0, flags | ROOT);
+    StoreCv(out, words);
+  }
+};
+
+Output ParentOutput(const uint8_t left_right[2 * 32]) {
+  Output out;
+  memcpy(out.cv, kIV, sizeof(out.cv));
+  memcpy(out.block, left_right, kBlockLen);
+  out.block_len = kBlockLen;
+  out.counter = 0;
+  out.flags = PARENT;
+  return out;
+}
+
+/// Hash |num_inputs| inputs of |blocks| blocks each, the i-th one starting
+/// at |input| + i * |stride|, writing one 32 byte chaining value per input
+/// to |out|. Inputs are chunks (stride kChunkLen) or parents (stride 64).
+using HashManyFn = void (*)(const uint8_t* input, size_t stride,
+                            size_t num_inputs, size_t blocks,
+                            uint64_t counter, bool increment_counter,
+                            uint8_t flags, uint8_t flags_start,
+                            uint8_t flags_end, uint8_t* out);
+
+void HashManyPortable(const uint8_t* input, size_t stride, size_t num_inputs,
+                      size_t blocks, uint64_t counter, bool increment_counter,
+                      uint8_t flags, uint8_t flags_start, uint8_t flags_end,
+                      uint8_t* out) {
+  for (size_t i = 0; i < num_inputs; ++i) {
+    uint32_t cv[8];
+    memcpy(cv, kIV, sizeof(cv));
+    uint8_t block_flags = flags | flags_start;
+    for (size_t b = 0; b < blocks; ++b) {
+      if (b + 1 == blocks)
+        block_flags |= flags_end;
+      CompressInPlace(cv, input + i * stride + b * kBlockLen, kBlockLen,
+                      counter + (increment_counter ? i : 0), block_flags);
+      block_flags = flags;
+    }
+    StoreCv(out + i * 32, cv);
+  }
+}
+
+#ifdef BLAKE3_X86_SIMD
+
+#define AVX2_FN __attribute__((target("avx2")))
+
+AVX2_FN inline __m256i Add8(__m256i a, __m256i b) {
+  return _mm256_add_epi32(a, b);
+}
+AVX2_FN inline __m256i Xor8(__m256i a, __m256i b) {
+  return _mm256_xor_si256(a, b);
+}
+AVX2_FN inline __m256i Rot16x8(__m256i x) {
+  return _mm256_shuffle_epi8(
+      x, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                         13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+}
+AVX2_FN inline __m256i Rot12x8(__m256i x) {
+  return _mm256_or_si256(_mm256_srli_epi32(x, 12), _mm256_slli_epi32(x, 20));
+}
+AVX2_FN inline __m256i Rot8x8(__m256i x) {
+  return _mm256_shuffle_epi8(
+      x, _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+                         12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+}
+AVX2_FN inline __m256i Rot7x8(__m256i x) {
+  return _mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 25));
+}
+
+/// One round over 8 transposed states; v[i] holds word i of every lane.
+AVX2_FN inline void Round8(__m256i v[16], const __m256i m[16], int r) {
+  const uint8_t* s = kMsgSchedule[r];
+  v[0] = Add8(v[0], m[s[0]]); v[1] = Add8(v[1], m[s[2]]);
+  v[2] = Add8(v[2], m[s[4]]); v[3] = Add8(v[3], m[s[6]]);
+  v[0] = Add8(v[0], v[4]); v[1] = Add8(v[1], v[5]);
+  v[2] = Add8(v[2], v[6]); v[3] = Add8(v[3], v[7]);
+  v[12] = Rot16x8(Xor8(v[12], v[0])); v[13] = Rot16x8(Xor8(v[13], v[1]));
+  v[14] = Rot16x8(Xor8(v[14], v[2])); v[15] = Rot16x8(Xor8(v[15], v[3]));
+  v[8] = Add8(v[8], v[12]); v[9] = Add8(v[9], v[13]);
+  v[10] = Add8(v[10], v[14]); v[11] = Add8(v[11], v[15]);
+  v[4] = Rot12x8(Xor8(v[4], v[8])); v[5] = Rot12x8(Xor8(v[5], v[9]));
+  v[6] = Rot12x8(Xor8(v[6], v[10])); v[7] = Rot12x8(Xor8(v[7], v[11]));
+  v[0] = Add8(v[0], m[s[1]]); v[1] = Add8(v[1], m[s[3]]);
+  v[2] = Add8(v[2], m[s[5]]); v[3] = Add8(v[3], m[s[7]]);
+  v[0] = Add8(v[0], v[4]); v[1] = Add8(v[1], v[5]);
+  v[2] = Add8(v[2], v[6]); v[3] = Add8(v[3], v[7]);
+  v[12] = Rot8x8(Xor8(v[12], v[0])); v[13] = Rot8x8(Xor8(v[13], v[1]));
+  v[14] = Rot8x8(Xor8(v[14], v[2])); v[15] = Rot8x8(Xor8(v[15], v[3]));
+  v[8] = Add8(v[8], v[12]); v[9] = Add8(v[9], v[13]);
+  v[10] = Add8(v[10], v[14]); v[11] = Add8(v[11], v[15]);
+  v[4] = Rot7x8(Xor8(v[4], v[8])); v[5] = Rot7x8(Xor8(v[5], v[9]));
+  v[6] = Rot7x8(Xor8(v[6], v[10])); v[7] = Rot7x8(Xor8(v[7], v[11]));
+
+  v[0] = Add8(v[0], m[s[8]]); v[1] = Add8(v[1], m[s[10]]);
+  v[2] = Add8(v[2], m[s[12]]); v[3] = Add8(v[3], m[s[14]]);
+  v[0] = Add8(v[0], v[5]); v[1] = Add8(v[1], v[6]);
+  v[2] = Add8(v[2], v[7]); v[3] = Add8(v[3], v[4]);
+  v[15] = Rot16x8(Xor8(v[15], v[0])); v[12] = Rot16x8(Xor8(v[12], v[1]));
+  v[13] = Rot16x8(Xor8(v[13], v[2])); v[14] = Rot16x8(Xor8(v[14], v[3]));
+  v[10] = Add8(v[10], v[15]); v[11] = Add8(v[11], v[12]);
+  v[8] = Add8(v[8], v[13]); v[9] = Add8(v[9], v[14]);
+  v[5] = Rot12x8(Xor8(v[5], v[10])); v[6] = Rot12x8(Xor8(v[6], v[11]));
+  v[7] = Rot12x8(Xor8(v[7], v[8])); v[4] = Rot12x8(Xor8(v[4], v[9]));
+  v[0] = Add8(v[0], m[s[9]]); v[1] = Add8(v[1], m[s[11]]);
+  v[2] = Add8(v[2], m[s[13]]); v[3] = Add8(v[3], m[s[15]]);
+  v[0] = Add8(v[0], v[5]); v[1] = Add8(v[1], v[6]);
+  v[2] = Add8(v[2], v[7]); v[3] = Add8(v[3], v[4]);
+  v[15] = Rot8x8(Xor8(v[15], v[0])); v[12] = Rot8x8(Xor8(v[12], v[1]));
+  v[13] = Rot8x8(Xor8(v[13], v[2])); v[14] = Rot8x8(Xor8(v[14], v[3]));
+  v[10] = Add8(v[10], v[15]); v[11] = Add8(v[11], v[12]);
+  v[8] = Add8(v[8], v[13]); v[9] = Add8(v[9], v[14]);
+  v[5] = Rot7x8(Xor8(v[5], v[10])); v[6] = Rot7x8(Xor8(v[6], v[11]));
+  v[7] = Rot7x8(Xor8(v[7], v[8])); v[4] = Rot7x8(Xor8(v[4], v[9]));
+}
+
+/// Transpose an 8x8 matrix of 32-bit words held in 8 rows.
+AVX2_FN inline void Transpose8(__m256i v[8]) {
+  __m256i ab_0145 = _mm256_unpacklo_epi32(v[0], v[1]);
+  __m256i ab_2367 = _mm256_unpackhi_epi32(v[0], v[1]);
+  __m256i cd_0145 = _mm256_unpacklo_epi32(v[2], v[3]);
+  __m256i cd_2367 = _mm256_unpackhi_epi32(v[2], v[3]);
+  __m256i ef_0145 = _mm256_unpacklo_epi32(v[4], v[5]);
+  __m256i ef_2367 = _mm256_unpackhi_epi32(v[4], v[5]);
+  __m256i gh_0145 = _mm256_unpacklo_epi32(v[6], v[7]);
+  __m256i gh_2367 = _mm256_unpackhi_epi32(v[6], v[7]);
+
+  __m256i abcd_04 = _mm256_unpacklo_epi64(ab_0145, cd_0145);
+  __m256i abcd_15 = _mm256_unpackhi_epi64(ab_0145, cd_0145);
+  __m256i abcd_26 = _mm256_unpacklo_epi64(ab_2367, cd_2367);
+  __m256i abcd_37 = _mm256_unpackhi_epi64(ab_2367, cd_2367);
+  __m256i efgh_04 = _mm256_unpacklo_epi64(ef_0145, gh_0145);
+  __m256i efgh_15 = _mm256_unpackhi_epi64(ef_0145, gh_0145);
+  __m256i efgh_26 = _mm256_unpacklo_epi64(ef_2367, gh_2367);
+  __m256i efgh_37 = _mm256_unpackhi_epi64(ef_2367, gh_2367);
+
+  v[0] = _mm256_permute2x128_si256(abcd_04, efgh_04, 0x20);
+  v[1] = _mm256_permute2x128_si256(abcd_15, efgh_15, 0x20);
+  v[2] = _mm256_permute2x128_si256(abcd_26, efgh_26, 0x20);
+  v[3] = _mm256_permute2x128_si256(abcd_37, efgh_37, 0x20);
+  v[4] = _mm256_permute2x128_si256(abcd_04, efgh_04, 0x31);
+  v[5] = _mm256_permute2x128_si256(abcd_15, efgh_15, 0x31);
+  v[6] = _mm256_permute2x128_si256(abcd_26, efgh_26, 0x31);
+  v[7] = _mm256_permute2x128_si256(abcd_37, efgh_37, 0x31);
+}
+
+/// Hash |lanes| <= 8 inputs side by side. Unused lanes repeat the last
+/// input and their results are dropped, which still beats the portable
+/// kernel for as few as two inputs.
+AVX2_FN void Hash8(const uint8_t* input, size_t stride, size_t lanes,
+                   size_t blocks, uint64_t counter, bool increment_counter,
+                   uint8_t flags, uint8_t flags_start, uint8_t flags_end,
+                   uint8_t* out) {
+  __m256i h[8];
+  for (int i = 0; i < 8; ++i)
+    h[i] = _mm256_set1_epi32((int)kIV[i]);
+  alignas(32) uint32_t ctr_lo[8], ctr_hi[8];
+  for (int i = 0; i < 8; ++i) {
+    uint64_t c = counter + (increment_counter ? i : 0);
+    ctr_lo[i] = (uint32_t)c;
+    ctr_hi[i] = (uint32_t)(c >> 32);
+  }
+  const __m256i counter_lo = _mm256_load_si256((const __m256i*)ctr_lo);
+  const __m256i counter_hi = _mm256_load_si256((const __m256i*)ctr_hi);
+
+  uint8_t block_flags = flags | flags_start;
+  for (size_t b = 0; b < blocks; ++b) {
+    if (b + 1 == blocks)
+      block_flags |= flags_end;
+    __m256i m[16];
+    for (size_t i = 0; i < 8; ++i) {
+      const uint8_t* p = input + std::min(i, lanes - 1) * stride + b * kBlockLen;
+      m[i] = _mm256_loadu_si256((const __m256i*)p);
+      m[i + 8] = _mm256_loadu_si256((const __m256i*)(p + 32));
+    }
+    Transpose8(m);
+    Transpose8(m + 8);
+
+    __m256i v[16] = {
+      h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+      _mm256_set1_epi32((int)kIV[0]), _mm256_set1_epi32((int)kIV[1]),
+      _mm256_set1_epi32((int)kIV[2]), _mm256_set1_epi32((int)kIV[3]),
+      counter_lo, counter_hi, _mm256_set1_epi32((int)kBlockLen),
+      _mm256_set1_epi32(block_flags),
+    };
+    for (int r = 0; r < 7; ++r)
+      Round8(v, m, r);
+    for (int i = 0; i < 8; ++i)
+      h[i] = Xor8(v[i], v[i + 8]);
+    block_flags = flags;
+  }
+
+  Transpose8(h);
+  alignas(32) uint8_t partial[8 * 32];
+  uint8_t* dest = lanes == 8 ? out : partial;
+  for (int i = 0; i < 8; ++i)
+    _mm256_storeu_si256((__m256i*)(dest + 32 * i), h[i]);
+  if (lanes < 8)
+    memcpy(out, partial, lanes * 32);
+}
+
+AVX2_FN void HashManyAvx2(const uint8_t* input, size_t stride,
+                          size_t num_inputs, size_t blocks, uint64_t counter,
+                          bool increment_counter, uint8_t flags,
+                          uint8_t flags_start, uint8_t flags_end,
+                          uint8_t* out) {
+  while (num_inputs >= 8) {
+    Hash8(input, stride, 8, blocks, counter, increment_counter, flags,
+          flags_start, flags_end, out);
+    input += 8 * stride;
+    if (increment_counter)
+      counter += 8;
+    num_inputs -= 8;
+    out += 8 * 32;
+  }
+  if (num_inputs > 1) {
+    Hash8(input, stride, num_inputs, blocks, counter, increment_counter,
+          flags, flags_start, flags_end, out);
+  } else {
+    HashManyPortable(input, stride, num_inputs, blocks, counter,
+                     increment_counter, flags, flags_start, flags_end, out);
+  }
+}
+
+#define AVX512_FN __attribute__((target("avx512f,avx2")))
+
+AVX512_FN inline __m512i Add16(__m512i a, __m512i b) {
+  return _mm512_add_epi32(a, b);
+}
+AVX512_FN inline __m512i Xor16(__m512i a, __m512i b) {
+  return _mm512_xor_si512(a, b);
+}
+
+AVX512_FN inline void Round16(__m512i v[16], const __m512i m[16], int r) {
+  const uint8_t* s = kMsgSchedule[r];
+  v[0] = Add16(v[0], m[s[0]]); v[1] = Add16(v[1], m[s[2]]);
+  v[2] = Add16(v[2], m[s[4]]); v[3] = Add16(v[3], m[s[6]]);
+  v[0] = Add16(v[0], v[4]); v[1] = Add16(v[1], v[5]);
+  v[2] = Add16(v[2], v[6]); v[3] = Add16(v[3], v[7]);
+  v[12] = _mm512_ror_epi32(Xor16(v[12], v[0]), 16);
+  v[13] = _mm512_ror_epi32(Xor16(v[13], v[1]), 16);
+  v[14] = _mm512_ror_epi32(Xor16(v[14], v[2]), 16);
+  v[15] = _mm512_ror_epi32(Xor16(v[15], v[3]), 16);
+  v[8] = Add16(v[8], v[12]); v[9] = Add16(v[9], v[13]);
+  v[10] = Add16(v[10], v[14]); v[11] = Add16(v[11], v[15]);
+  v[4] = _mm512_ror_epi32(Xor16(v[4], v[8]), 12);
+  v[5] = _mm512_ror_epi32(Xor16(v[5], v[9]), 12);
+  v[6] = _mm512_ror_epi32(Xor16(v[6], v[10]), 12);
+  v[7] = _mm512_ror_epi32(Xor16(v[7], v[11]), 12);
+  v[0] = Add16(v[0], m[s[1]]); v[1] = Add16(v[1], m[s[3]]);
+  v[2] = Add16(v[2], m[s[5]]); v[3] = Add16(v[3], m[s[7]]);
+  v[0] = Add16(v[0], v[4]); v[1] = Add16(v[1], v[5]);
+  v[2] = Add16(v[2], v[6]); v[3] = Add16(v[3], v[7]);
+  v[12] = _mm512_ror_epi32(Xor16(v[12], v[0]), 8);
+  v[13] = _mm512_ror_epi32(Xor16(v[13], v[1]), 8);
+  v[14] = _mm512_ror_epi32(Xor16(v[14], v[2]), 8);
+  v[15] = _mm512_ror_epi32(Xor16(v[15], v[3]), 8);
+  v[8] = Add16(v[8], v[12]); v[9] = Add16(v[9], v[13]);
+  v[10] = Add16(v[10], v[14]); v[11] = Add16(v[11], v[15]);
+  v[4] = _mm512_ror_epi32(Xor16(v[4], v[8]), 7);
+  v[5] = _mm512_ror_epi32(Xor16(v[5], v[9]), 7);
+  v[6] = _mm512_ror_epi32(Xor16(v[6], v[10]), 7);
+  v[7] = _mm512_ror_epi32(Xor16(v[7], v[11]), 7);
+
+  v[0] = Add16(v[0], m[s[8]]); v[1] = Add16(v[1], m[s[10]]);
+  v[2] = Add16(v[2], m[s[12]]); v[3] = Add16(v[3], m[s[14]]);
+  v[0] = Add16(v[0], v[5]); v[1] = Add16(v[1], v[6]);
+  v[2] = Add16(v[2], v[7]); v[3] = Add16(v[3], v[4]);
+  v[15] = _mm512_ror_epi32(Xor16(v[15], v[0]), 16);
+  v[12] = _mm512_ror_epi32(Xor16(v[12], v[1]), 16);
+  v[13] = _mm512_ror_epi32(Xor16(v[13], v[2]), 16);
+  v[14] = _mm512_ror_epi32(Xor16(v[14], v[3]), 16);
+  v[10] = Add16(v[10], v[15]); v[11] = Add16(v[11], v[12]);
+  v[8] = Add16(v[8], v[13]); v[9] = Add16(v[9], v[14]);
+  v[5] = _mm512_ror_epi32(Xor16(v[5], v[10]), 12);
+  v[6] = _mm512_ror_epi32(Xor16(v[6], v[11]), 12);
+  v[7] = _mm512_ror_epi32(Xor16(v[7], v[8]), 12);
+  v[4] = _mm512_ror_epi32(Xor16(v[4], v[9]), 12);
+  v[0] = Add16(v[0], m[s[9]]); v[1] = Add16(v[1], m[s[11]]);
+  v[2] = Add16(v[2], m[s[13]]); v[3] = Add16(v[3], m[s[15]]);
+  v[0] = Add16(v[0], v[5]); v[1] = Add16(v[1], v[6]);
+  v[2] = Add16(v[2], v[7]); v[3] = Add16(v[3], v[4]);
+  v[15] = _mm512_ror_epi32(Xor16(v[15], v[0]), 8);
+  v[12] = _mm512_ror_epi32(Xor16(v[12], v[1]), 8);
+  v[13] = _mm512_ror_epi32(Xor16(v[13], v[2]), 8);
+  v[14] = _mm512_ror_epi32(Xor16(v[14], v[3]), 8);
+  v[10] = Add16(v[10], v[15]); v[11] = Add16(v[11], v[12]);
+  v[8] = Add16(v[8], v[13]); v[9] = Add16(v[9], v[14]);
+  v[5] = _mm512_ror_epi32(Xor16(v[5], v[10]), 7);
+  v[6] = _mm512_ror_epi32(Xor16(v[6], v[11]), 7);
+  v[7] = _mm512_ror_epi32(Xor16(v[7], v[8]), 7);
+  v[4] = _mm512_ror_epi32(Xor16(v[4], v[9]), 7);
+}
+
+/// Transpose a 16x16 matrix of 32-bit words held in 16 rows.
+AVX512_FN inline void Transpose16(__m512i v[16]) {
+  // Within each 128-bit lane L, gather column 4L+k of four rows.
+  __m512i quad[4][4];
+  for (int q = 0; q < 4; ++q) {
+    __m512i lo01 = _mm512_unpacklo_epi32(v[4 * q], v[4 * q + 1]);
+    __m512i hi01 = _mm512_unpackhi_epi32(v[4 * q], v[4 * q + 1]);
+    __m512i lo23 = _mm512_unpacklo_epi32(v[4 * q + 2], v[4 * q + 3]);
+    __m512i hi23 = _mm512_unpackhi_epi32(v[4 * q + 2], v[4 * q + 3]);
+    quad[q][0] = _mm512_unpacklo_epi64(lo01, lo23);
+    quad[q][1] = _mm512_unpackhi_epi64(lo01, lo23);
+    quad[q][2] = _mm512_unpacklo_epi64(hi01, hi23);
+    quad[q][3] = _mm512_unpackhi_epi64(hi01, hi23);
+  }
+  // Then bring lane L of the four row groups together.
+  for (int k = 0; k < 4; ++k) {
+    __m512i t0 = _mm512_shuffle_i32x4(quad[0][k], quad[1][k], 0x88);
+    __m512i t1 = _mm512_shuffle_i32x4(quad[0][k], quad[1][k], 0xdd);
+    __m512i u0 = _mm512_shuffle_i32x4(quad[2][k], quad[3][k], 0x88);
+    __m512i u1 = _mm512_shuffle_i32x4(quad[2][k], quad[3][k], 0xdd);
+    v[k] = _mm512_shuffle_i32x4(t0, u0, 0x88);
+    v[8 + k] = _mm512_shuffle_i32x4(t0, u0, 0xdd);
+    v[4 + k] = _mm512_shuffle_i32x4(t1, u1, 0x88);
+    v[12 + k] = _mm512_shuffle_i32x4(t1, u1, 0xdd);
+  }
+}
+
+AVX512_FN void Hash16(const uint8_t* input, size_t stride, size_t lanes,
+                      size_t blocks, uint64_t counter, bool increment_counter,
+                      uint8_t flags, uint8_t flags_start, uint8_t flags_end,
+                      uint8_t* out) {
+  __m512i h[16];
+  for (int i = 0; i < 8; ++i)
+    h[i] = _mm512_set1_epi32((int)kIV[i]);
+  alignas(64) uint32_t ctr_lo[16], ctr_hi[16];
+  for (int i = 0; i < 16; ++i) {
+    uint64_t c = counter + (increment_counter ? i : 0);
+    ctr_lo[i] = (uint32_t)c;
+    ctr_hi[i] = (uint32_t)(c >> 32);
+  }
+  const __m512i counter_lo = _mm512_load_si512(ctr_lo);
+  const __m512i counter_hi = _mm512_load_si512(ctr_hi);
+
+  uint8_t block_flags = flags | flags_start;
+  for (size_t b = 0; b < blocks; ++b) {
+    if (b + 1 == blocks)
+      block_flags |= flags_end;
+    __m512i m[16];
+    for (size_t i = 0; i < 16; ++i) {
+      m[i] = _mm512_loadu_si512(input + std::min(i, lanes - 1) * stride +
+                                b * kBlockLen);
+    }
+    Transpose16(m);
+
+    __m512i v[16] = {
+      h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+      _mm512_set1_epi32((int)kIV[0]), _mm512_set1_epi32((int)kIV[1]),
+      _mm512_set1_epi32((int)kIV[2]), _mm512_set1_epi32((int)kIV[3]),
+      counter_lo, counter_hi, _mm512_set1_epi32((int)kBlockLen),
+      _mm512_set1_epi32(block_flags),
+    };
+    for (int r = 0; r < 7; ++r)
+      Round16(v, m, r);
+    for (int i = 0; i < 8; ++i)
+      h[i] = Xor16(v[i], v[i + 8]);
+    block_flags = flags;
+  }
+
+  for (int i = 8; i < 16; ++i)
+    h[i] = _mm512_setzero_si512();
+  Transpose16(h);
+  alignas(32) uint8_t partial[16 * 32];
+  uint8_t* dest = lanes == 16 ? out : partial;
+  for (int i = 0; i < 16; ++i)
+    _mm256_storeu_si256((__m256i*)(dest + 32 * i), _mm512_castsi512_si256(h[i]));
+  if (lanes < 16)
+    memcpy(out, partial, lanes * 32);
+}
+
+AVX512_FN void HashManyAvx512(const uint8_t* input, size_t stride,
+                              size_t num_inputs, size_t blocks,
+                              uint64_t counter, bool increment_counter,
+                              uint8_t flags, uint8_t flags_start,
+                              uint8_t flags_end, uint8_t* out) {
+  while (num_inputs >= 16) {
+    Hash16(input, stride, 16, blocks, counter, increment_counter, flags,
+           flags_start, flags_end, out);
+    input += 16 * stride;
+    if (increment_counter)
+      counter += 16;
+    num_inputs -= 16;
+    out += 16 * 32;
+  }
+  if (num_inputs > 8) {
+    Hash16(input, stride, num_inputs, blocks, counter, increment_counter,
+           flags, flags_start, flags_end, out);
+  } else {
+    HashManyAvx2(input, stride, num_inputs, blocks, counter,
+                 increment_counter, flags, flags_start, flags_end, out);
+  }
+}
+
+#endif  // BLAKE3_X86_SIMD
+
+struct Kernel {
+  HashManyFn hash_many;
+  const char* name;
+};
+
+Kernel SelectKernel() {
+#ifdef BLAKE3_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return { HashManyAvx512, "avx512" };
+  if (__builtin_cpu_supports("avx2"))
+    return { HashManyAvx2, "avx2" };
+#endif
+  return { HashManyPortable, "portable" };
+}
+
+const Kernel& GetKernel() {
+  static const Kernel kernel = SelectKernel();
+  return kernel;
+}
+
+Output ChunkOutput(const uint8_t* input, size_t len, uint64_t chunk_counter) {
+  uint32_t cv[8];
+  memcpy(cv, kIV, sizeof(cv));
+  uint8_t start = CHUNK_START;
+  while (len > kBlockLen) {
+    CompressInPlace(cv, input, kBlockLen, chunk_counter, start);
+    start = 0;
+    input += kBlockLen;
+    len -= kBlockLen;
+  }
+  Output out;
+  memcpy(out.cv, cv, sizeof(cv));
+  memset(out.block, 0, sizeof(out.block));
+  memcpy(out.block, input, len);
+  out.block_len = (uint8_t)len;
+  out.counter = chunk_counter;
+  out.flags = start | CHUNK_END;
+  return out;
+}
+
+/// Write the chaining values of every chunk of |input| (|len| > 0) to
+/// |cvs|, numbering chunks from |chunk_counter|. Returns the chunk count.
+size_t ChunkCvs(const uint8_t* input, size_t len, uint64_t chunk_counter,
+                uint8_t* cvs) {
+  size_t full = len / kChunkLen;
+  size_t rem = len % kChunkLen;
+  GetKernel().hash_many(input, kChunkLen, full, kChunkLen / kBlockLen,
+                        chunk_counter, true, 0, CHUNK_START, CHUNK_END, cvs);
+  if (rem == 0)
+    return full;
+  ChunkOutput(input + full * kChunkLen, rem, chunk_counter + full)
+      .ChainingValue(cvs + full * 32);
+  return full + 1;
+}
+
+/// Replace |n| >= 2 chaining values by the next tree level in place: each
+/// pair becomes its parent and an odd last value is carried up unchanged.
+/// This is exactly the left-complete tree BLAKE3 defines.
+size_t ParentLevel(uint8_t* cvs, size_t n) {
+  size_t pairs = n / 2;
+  GetKernel().hash_many(cvs, 2 * 32, pairs, 1, 0, false, PARENT, 0, 0, cvs);
+  if (n & 1)
+    memmove(cvs + pairs * 32, cvs + (n - 1) * 32, 32);
+  return pairs + (n & 1);
+}
+
+/// Chaining value of the complete subtree spanning |input|.
+void SubtreeCv(const uint8_t* input, size_t len, uint64_t chunk_counter,
+               uint8_t out[32]) {
+  std::vector<uint8_t> cvs(((len + kChunkLen - 1) / kChunkLen) * 32);
+  size_t n = ChunkCvs(input, len, chunk_counter, cvs.data());
+  while (n > 1)
+    n = ParentLevel(cvs.data(), n);
+  memcpy(out, cvs.data(), 32);
+}
+
+}  // namespace
+
+void Blake3Hasher::ChunkState::Reset(uint64_t counter) {
+  memcpy(cv, kIV, sizeof(cv));
+  chunk_counter = counter;
+  memset(buf, 0, sizeof(buf));
+  buf_len = 0;
+  blocks_compressed = 0;
+}
+
+void Blake3Hasher::ChunkState::Update(const uint8_t* input, size_t len) {
+  while (len > 0) {
+    if (buf_len == kBlockLen) {
+      CompressInPlace(cv, buf, kBlockLen, chunk_counter,
+                      blocks_compressed == 0 ? CHUNK_START : 0);
+      ++blocks_compressed;
+      buf_len = 0;
+      memset(buf, 0, sizeof(buf));
+    }
+    size_t take = std::min(kBlockLen - buf_len, len);
+    memcpy(buf + buf_len, input, take);
+    buf_len += (uint8_t)take;
+    input += take;
+    len -= take;
+  }
+}
+
+Blake3Hasher::Blake3Hasher() : cv_stack_len_(0) {
+  chunk_.Reset(0);
+}
+
+void Blake3Hasher::AddChunkCv(const uint8_t cv[32], uint64_t total_chunks) {
+  // Merge completed subtrees: as many as there are trailing zero bits in the
+  // number of chunks so far.
+  uint8_t node[64];
+  memcpy(node + 32, cv, 32);
+  while ((total_chunks & 1) == 0) {
+    --cv_stack_len_;
+    memcpy(node, cv_stack_ + cv_stack_len_ * 32, 32);
+    ParentOutput(node).ChainingValue(node + 32);
+    total_chunks >>= 1;
+  }
+  memcpy(cv_stack_ + cv_stack_len_ * 32, node + 32, 32);
+  ++cv_stack_len_;
+}
+
+void Blake3Hasher::Update(const void* data, size_t len) {
+  const uint8_t* input = static_cast<const uint8_t*>(data);
+  while (len > 0) {
+    // A full chunk is only finalized once more input shows it isn't the
+    // last one, which may need the root flag.
+    if (chunk_.Len() == kChunkLen) {
+      Output out;
+      memcpy(out.cv, chunk_.cv, sizeof(out.cv));
+      memcpy(out.block, chunk_.buf, kBlockLen);
+      out.block_len = chunk_.buf_len;
+      out.counter = chunk_.chunk_counter;
+      out.flags = CHUNK_END;
+      uint8_t cv[32];
+      out.ChainingValue(cv);
+      AddChunkCv(cv, chunk_.chunk_counter + 1);
+      chunk_.Reset(chunk_.chunk_counter + 1);
+    }
+    if (chunk_.Len() == 0 && len > kChunkLen) {
+      size_t n = std::min((len - 1) / kChunkLen, kBatchChunks);
+      uint8_t cvs[kBatchChunks * 32];
+      GetKernel().hash_many(input, kChunkLen, n, kChunkLen / kBlockLen,
+                            chunk_.chunk_counter, true, 0, CHUNK_START,
+                            CHUNK_END, cvs);
+      for (size_t i = 0; i < n; ++i)
+        AddChunkCv(cvs + i * 32, chunk_.chunk_counter + i + 1);
+      chunk_.Reset(chunk_.chunk_counter + n);
+      input += n * kChunkLen;
+      len -= n * kChunkLen;
+      continue;
+    }
+    size_t take = std::min(kChunkLen - chunk_.Len(), len);
+    chunk_.Update(input, take);
+    input += take;
+    len -= take;
+  }
+}
+
+void Blake3Hasher::Finalize(uint8_t out[kOutLen]) const {
+  Output output;
+  memcpy(output.cv, chunk_.cv, sizeof(output.cv));
+  memcpy(output.block, chunk_.buf, kBlockLen);
+  output.block_len = chunk_.buf_len;
+  output.counter = chunk_.chunk_counter;
+  output.flags = (chunk_.blocks_compressed == 0 ? CHUNK_START : 0) | CHUNK_END;
+  for (size_t i = cv_stack_len_; i > 0; --i) {
+    uint8_t node[64];
+    memcpy(node, cv_stack_ + (i - 1) * 32, 32);
+    output.ChainingValue(node + 32);
+    output = ParentOutput(node);
+  }
+  output.RootBytes(out);
+}
+
+void Blake3Hasher::Hash(const void* data, size_t len, uint8_t out[kOutLen]) {
+  const uint8_t* input = static_cast<const uint8_t*>(data);
+  if (len <= kChunkLen) {
+    ChunkOutput(input, len, 0).RootBytes(out);
+    return;
+  }
+
+  // Large inputs are split across a pool that is joined before returning.
+  // Pool workers hash serially rather than start more threads.
+  int jobs = len >= kParallelMinBytes && !IsThreadPoolWorker()
+                 ? GetOptimalThreadPoolJobCount() : 1;
+
+  size_t chunks = (len + kChunkLen - 1) / kChunkLen;
+  std::vector<uint8_t> cvs;
+  size_t n;
+  if (jobs > 1) {
+    // Tree mode: split into power-of-two sized, aligned subtrees so every
+    // piece but the last is a complete subtree of the final tree.
+    size_t piece_chunks = 1;
+    while (piece_chunks * jobs < chunks)
+      piece_chunks <<= 1;
+    const size_t piece_len = piece_chunks * kChunkLen;
+    n = (len + piece_len - 1) / piece_len;
+    cvs.resize(n * 32);
+    std::vector<std::function<void()>> tasks;
+    for (size_t i = 0; i < n; ++i) {
+      tasks.emplace_back([&, i]() {
+        size_t begin = i * piece_len;
+        SubtreeCv(input + begin, std::min(piece_len, len - begin),
+                  i * piece_chunks, cvs.data() + i * 32);
+      });
+    }
+    std::unique_ptr<ThreadPool> pool = CreateThreadPool();
+    pool->RunTasks(std::move(tasks));
+  } else {
+    cvs.resize(chunks * 32);
+    n = ChunkCvs(input, len, 0, cvs.data());
+  }
+  while (n > 2)
+    n = ParentLevel(cvs.data(), n);
+  ParentOutput(cvs.data()).RootBytes(out);
+}
+
+const char* Blake3Hasher::Implementation() {
+  return GetKernel().name;
+}
+
+}  // namespace RemoteExecutor
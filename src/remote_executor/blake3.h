@@ -0,0 +1,68 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+#ifndef NINJA_REMOTEEXECUTOR_BLAKE3_H
+#define NINJA_REMOTEEXECUTOR_BLAKE3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace RemoteExecutor {
+
+/// BLAKE3 in its default hash mode with a 32 byte output, as used by the
+/// REAPI BLAKE3 digest function. Whole chunks are compressed several at a
+/// time by an AVX-512, AVX2 or portable kernel picked at runtime.
+class Blake3Hasher {
+public:
+  static constexpr size_t kOutLen = 32;
+  /// Inputs at least this large are hashed as independent subtrees on the
+  /// thread pool by Hash().
+  static constexpr size_t kParallelMinBytes = 1 << 20;
+
+  Blake3Hasher();
+
+  void Update(const void* data, size_t len);
+  void Finalize(uint8_t out[kOutLen]) const;
+
+  /// One-shot hash of a complete buffer.
+  static void Hash(const void* data, size_t len, uint8_t out[kOutLen]);
+
+  /// Name of the kernel selected for this CPU: "avx512", "avx2" or
+  /// "portable".
+  static const char* Implementation();
+
+private:
+  struct ChunkState {
+    uint32_t cv[8];
+    uint64_t chunk_counter;
+    uint8_t buf[64];
+    uint8_t buf_len;
+    uint8_t blocks_compressed;
+
+    void Reset(uint64_t counter);
+    size_t Len() const { return 64 * blocks_compressed + buf_len; }
+    void Update(const uint8_t* input, size_t len);
+  };
+
+  void AddChunkCv(const uint8_t cv[32], uint64_t total_chunks);
+
+  ChunkState chunk_;
+  // Enough for 2^54 chunks, i.e. every input with a 64-bit length.
+  uint8_t cv_stack_[54 * 32];
+  uint8_t cv_stack_len_;
+};
+
+}  // namespace RemoteExecutor
+
+#endif  // NINJA_REMOTEEXECUTOR_BLAKE3_H
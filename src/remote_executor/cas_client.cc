@@ -14,23 +14,49 @@
 
 #include "cas_client.h"
 
+#include <algorithm>
+#include <atomic>
 #include <iomanip>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <uuid/uuid.h>
 
 #include "static_file_utils.h"
+#include "zstd_stream.h"
 #include "../util.h"
 
 namespace RemoteExecutor {
 
 constexpr size_t kHashBufferSizeBytes = 1024 * 64;
 
+namespace {
+std::atomic<int> g_digest_function { DigestFunction_Value_SHA256 };
+std::atomic<bool> g_zstd_bytestream { false };
+std::atomic<bool> g_zstd_batch_update { false };
+
+template <typename Values>
+bool HasValue(const Values& values, int value) {
+  return std::find(values.begin(), values.end(), value) != values.end();
+}
+}  // namespace
+
 Digest CASHash::Hash(int fd) {
-  return DigestGenerator(DigestFunction_Value_SHA256).Hash(fd);
+  return DigestGenerator(DigestFunction()).Hash(fd);
 }
 
 Digest CASHash::Hash(const std::string& str) {
-  return DigestGenerator(DigestFunction_Value_SHA256).Hash(str);
+  return DigestGenerator(DigestFunction()).Hash(str);
+}
+
+DigestFunction_Value CASHash::DigestFunction() {
+  return static_cast<DigestFunction_Value>(g_digest_function.load());
+}
+
+void CASHash::SetDigestFunction(DigestFunction_Value digest_function) {
+  g_digest_function = digest_function;
 }
 
 DigestContext::DigestContext() {
@@ -39,11 +65,22 @@ DigestContext::DigestContext() {
     Fatal("Error creating `EVP_MD_CTX` context struct");
 }
 
+DigestContext::DigestContext(DigestContext&& other)
+    : context_(other.context_), blake3_(std::move(other.blake3_)),
+      data_size_(other.data_size_), finalized_(other.finalized_) {
+  other.context_ = nullptr;
+}
+
 DigestContext::~DigestContext() {
   EVP_MD_CTX_destroy(context_);
 }
 
 void DigestContext::Init(const EVP_MD* digest_funct_struct) {
+  // A null struct selects BLAKE3, which OpenSSL doesn't provide.
+  if (!digest_funct_struct) {
+    blake3_.reset(new Blake3Hasher);
+    return;
+  }
   if (EVP_DigestInit_ex(context_, digest_funct_struct, nullptr) == 0)
     Fatal("EVP_DigestInit_ex() failed.");
 }
@@ -51,7 +88,9 @@ void DigestContext::Init(const EVP_MD* digest_funct_struct) {
 void DigestContext::Update(const char* data, size_t data_size) {
   if (finalized_)
     Fatal("Cannot update finalized digest");
-  if (EVP_DigestUpdate(context_, data, data_size) == 0)
+  if (blake3_)
+    blake3_->Update(data, data_size);
+  else if (EVP_DigestUpdate(context_, data, data_size) == 0)
     Fatal("EVP_DigestUpdate() failed.");
   data_size_ += data_size;
 }
@@ -61,8 +100,12 @@ Digest DigestContext::FinalizeDigest() {
     Fatal("Digest already finalized");
   unsigned char hash_buffer[EVP_MAX_MD_SIZE];
   unsigned int message_length;
-  if (EVP_DigestFinal_ex(context_, hash_buffer, &message_length) == 0)
+  if (blake3_) {
+    blake3_->Finalize(hash_buffer);
+    message_length = Blake3Hasher::kOutLen;
+  } else if (EVP_DigestFinal_ex(context_, hash_buffer, &message_length) == 0) {
     Fatal("EVP_DigestFinal_ex() failed.");
+  }
   finalized_ = true;
   const std::string hash = HashToHex(hash_buffer, message_length);
   Digest digest;
@@ -86,12 +129,27 @@ DigestGenerator::DigestGenerator(DigestFunction_Value digest_function)
       digest_func_struct_(GetDigestFunctionStruct(digest_function)) {}
 
 Digest DigestGenerator::Hash(const std::string& data) const {
+  if (digest_func_ == DigestFunction_Value_BLAKE3)
+    return HashBlake3(data.data(), data.size());
   auto digest_context = CreateDigestContext();
   digest_context.Update(data.c_str(), data.size());
   return digest_context.FinalizeDigest();
 }
 
 Digest DigestGenerator::Hash(int fd) const {
+  if (digest_func_ == DigestFunction_Value_BLAKE3) {
+    // Map the whole file so large objects can be hashed as parallel
+    // subtrees; fall back to streaming reads if that isn't possible.
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data != MAP_FAILED) {
+        Digest digest = HashBlake3(data, st.st_size);
+        munmap(data, st.st_size);
+        return digest;
+      }
+    }
+  }
   auto digest_context = CreateDigestContext();
   // Reading file in chunks and computing the hash incrementally:
   const auto update_function =
@@ -102,6 +160,15 @@ Digest DigestGenerator::Hash(int fd) const {
   return digest_context.FinalizeDigest();
 }
 
+Digest DigestGenerator::HashBlake3(const void* data, size_t size) {
+  unsigned char hash_buffer[Blake3Hasher::kOutLen];
+  Blake3Hasher::Hash(data, size, hash_buffer);
+  Digest digest;
+  digest.set_hash(DigestContext::HashToHex(hash_buffer, sizeof(hash_buffer)));
+  digest.set_size_bytes(static_cast<google::protobuf::int64>(size));
+  return digest;
+}
+
 DigestContext DigestGenerator::CreateDigestContext() const {
   DigestContext context;
   context.Init(digest_func_struct_);
@@ -116,6 +183,7 @@ const EVP_MD *DigestGenerator::GetDigestFunctionStruct(
     case DigestFunction_Value_SHA256: return EVP_sha256();
     case DigestFunction_Value_SHA384: return EVP_sha384();
     case DigestFunction_Value_SHA512: return EVP_sha512();
+    case DigestFunction_Value_BLAKE3: return nullptr;
     default: Fatal("Digest function value not supported: %d",
                    digest_function_value);
   }
@@ -141,6 +209,15 @@ int64_t DigestGenerator::ProcessFile(int fd,
 // Limit payload to 1 MiB to leave sufficient headroom for metadata.
 constexpr size_t kBytestreamChunkSizeBytes = 1024 * 1024;
 constexpr size_t kMaxMetadataSize = 1 << 16;
+// Parallel ByteStream reads for blobs too large to batch. Each holds at most
+// one chunk in memory.
+constexpr size_t kMaxConcurrentByteStreamReads = 4;
+
+CASClient::CASClient(GRPCClient* grpc_client,
+                     DigestFunction_Value digest_function)
+    : grpc_client_(grpc_client), digest_generator_(digest_function),
+      zstd_bytestream_(g_zstd_bytestream),
+      zstd_batch_update_(g_zstd_batch_update) {}
 
 void CASClient::Init() {
   auto channel = grpc_client_->Channel();
@@ -157,23 +234,86 @@ void CASClient::Init() {
   uuid_unparse_lower(uu, &uuid_[0]);
 }
 
+void CASClient::NegotiateCapabilities(GRPCClient* grpc_client) {
+  auto capabilities = Capabilities::NewStub(grpc_client->Channel());
+  GetCapabilitiesRequest request;
+  request.set_instance_name(grpc_client->InstanceName());
+  ServerCapabilities response;
+  grpc::ClientContext context;
+  context.set_deadline(std::chrono::system_clock::now() +
+                       std::chrono::seconds(10));
+  // Older servers may not implement GetCapabilities at all; uncompressed
+  // SHA256 is what every REAPI server understands.
+  if (!capabilities->GetCapabilities(&context, request, &response).ok()) {
+    CASHash::SetDigestFunction(DigestFunction_Value_SHA256);
+    SetZstdSupport(false, false);
+    return;
+  }
+
+  const auto& cache = response.cache_capabilities();
+  bool cache_blake3 = HasValue(cache.digest_function(),
+                               DigestFunction_Value_BLAKE3);
+  bool exec_blake3 = true;
+  if (response.has_execution_capabilities() &&
+      response.execution_capabilities().exec_enabled()) {
+    const auto& exec = response.execution_capabilities();
+    exec_blake3 = exec.digest_function() == DigestFunction_Value_BLAKE3 ||
+        HasValue(exec.digest_functions(), DigestFunction_Value_BLAKE3);
+  }
+  CASHash::SetDigestFunction(cache_blake3 && exec_blake3
+                                 ? DigestFunction_Value_BLAKE3
+                                 : DigestFunction_Value_SHA256);
+  SetZstdSupport(HasValue(cache.supported_compressors(), Compressor_Value_ZSTD),
+                 HasValue(cache.supported_batch_update_compressors(),
+                          Compressor_Value_ZSTD));
+}
+
+void CASClient::SetZstdSupport(bool bytestream, bool batch_update) {
+  g_zstd_bytestream = bytestream;
+  g_zstd_batch_update = batch_update;
+}
+
 size_t CASClient::BytestreamChunkSizeBytes() {
   return kBytestreamChunkSizeBytes;
 }
 
-std::string CASClient::MakeResourceName(const Digest& digest, bool isUpload) {
+std::string CASClient::MakeResourceName(const Digest& digest, bool isUpload,
+                                        bool compressed) {
   std::string name;
   if (!grpc_client_->InstanceName().empty())
     name.append(grpc_client_->InstanceName()).append("/");
   if (isUpload)
     name.append("uploads/").append(uuid_).append("/");
-  name.append("blobs/").append(digest.hash()).append("/");
+  name.append(compressed ? "compressed-blobs/zstd/" : "blobs/");
+  // Only digest functions added after the original REAPI v2 release carry
+  // their name in the resource name.
+  if (digest_generator_.digest_function() == DigestFunction_Value_BLAKE3)
+    name.append("blake3/");
+  name.append(digest.hash()).append("/");
   name.append(std::to_string(digest.size_bytes()));
   return name;
 }
 
 std::string CASClient::FetchString(const Digest& digest,
                                    GRPCClient::RequestStats* req_stats) {
+  if (ShouldCompress(digest)) {
+    std::string result;
+    result.reserve(digest.size_bytes());
+    DownloadCompressed(digest, [&result](const char* data, size_t size) {
+      result.append(data, size);
+    }, req_stats);
+    if (result.size() != (std::size_t)digest.size_bytes()) {
+      Fatal("Expected %d bytes, but downloaded blob was %d bytes",
+            digest.size_bytes(), result.size());
+    }
+    const auto downloaded_digest = digest_generator_.Hash(result);
+    if (downloaded_digest != digest) {
+      Fatal("Expected digest '%s', but downloaded digest '%s'",
+            toString(digest).c_str(), toString(downloaded_digest).c_str());
+    }
+    return result;
+  }
+
   const std::string resource_name = MakeResourceName(digest, false);
   std::string result;
   auto fetch_lambda = [&](grpc::ClientContext &context) {
@@ -208,9 +348,29 @@ std::string CASClient::FetchString(const Digest& digest,
 
 void CASClient::Download(int fd, const Digest& digest,
                          GRPCClient::RequestStats* req_stats) {
+  auto digest_context = digest_generator_.CreateDigestContext();
+  if (ShouldCompress(digest)) {
+    DownloadCompressed(digest, [&](const char* data, size_t size) {
+      if (write(fd, data, size) != (ssize_t)size)
+        Fatal("Error in write to descriptor %d", fd);
+      digest_context.Update(data, size);
+    }, req_stats);
+    struct stat st;
+    fstat(fd, &st);
+    if (st.st_size != digest.size_bytes()) {
+      Fatal("Expected %d bytes, but downloaded blob was %d bytes",
+            digest.size_bytes(), st.st_size);
+    }
+    const auto downloaded_digest = digest_context.FinalizeDigest();
+    if (downloaded_digest != digest) {
+      Fatal("Expected digest '%s', but downloaded digest '%s'",
+            toString(digest).c_str(), toString(downloaded_digest).c_str());
+    }
+    return;
+  }
+
   const std::string resource_name = MakeResourceName(digest, false);
   int64_t bytes_downloaded = 0;
-  auto digest_context = digest_generator_.CreateDigestContext();
   auto download_lambda = [&](grpc::ClientContext &context) {
     ReadRequest request;
     request.set_resource_name(resource_name);
@@ -250,6 +410,12 @@ void CASClient::Upload(const std::string& data, const Digest& digest,
     Fatal("Digest length of %d bytes for %s != data length of %d bytes",
           digest.size_bytes(), digest.hash().c_str(), data_size);
   }
+  if (ShouldCompress(digest)) {
+    UploadCompressed(digest, [&data](int64_t offset, char* buffer, size_t size) {
+      return data.copy(buffer, size, offset);
+    }, req_stats);
+    return;
+  }
   const std::string resource_name = MakeResourceName(digest, true);
   WriteResponse response;
   auto upload_lambda = [&](grpc::ClientContext &context) {
@@ -287,6 +453,15 @@ void CASClient::Upload(const std::string& data, const Digest& digest,
 
 void CASClient::Upload(int fd, const Digest& digest,
                        GRPCClient::RequestStats* req_stats) {
+  if (ShouldCompress(digest)) {
+    UploadCompressed(digest, [fd](int64_t offset, char* buffer, size_t size) {
+      const ssize_t bytes_read = pread(fd, buffer, size, offset);
+      if (bytes_read < 0)
+        Fatal("Error in read on descriptor %d", fd);
+      return static_cast<size_t>(bytes_read);
+    }, req_stats);
+    return;
+  }
   std::vector<char> buffer(BytestreamChunkSizeBytes());
   const std::string resource_name = MakeResourceName(digest, true);
   lseek(fd, 0, SEEK_SET);
@@ -332,6 +507,101 @@ void CASClient::Upload(int fd, const Digest& digest,
   grpc_client_->IssueRequest(upload_lambda, "ByteStream.Write()", req_stats);
 }
 
+void CASClient::UploadCompressed(const Digest& digest,
+                                 const ReadChunkFunc& read_chunk,
+                                 GRPCClient::RequestStats* req_stats) {
+  std::vector<char> buffer(BytestreamChunkSizeBytes());
+  const std::string resource_name = MakeResourceName(digest, true, true);
+  WriteResponse response;
+  auto upload_lambda = [&](grpc::ClientContext &context) {
+    // The write offset counts compressed bytes, so a retry starts over with
+    // a fresh frame.
+    ZstdCompressStream compressor;
+    auto writer = bytestream_client_->Write(&context, &response);
+    int64_t offset = 0;
+    int64_t write_offset = 0;
+    std::string compressed;
+    bool lastChunk = false;
+    bool stream_ok = true;
+    while (!lastChunk && stream_ok) {
+      const size_t want = static_cast<size_t>(std::min<int64_t>(
+          buffer.size(), digest.size_bytes() - offset));
+      if (read_chunk(offset, buffer.data(), want) != want) {
+        Fatal("Upload of %s failed: unexpected end of file",
+              digest.hash().c_str());
+      }
+      offset += want;
+      lastChunk = (offset == digest.size_bytes());
+      compressed.clear();
+      compressor.Compress(buffer.data(), want, lastChunk, &compressed);
+      // Incompressible input can grow slightly; keep each message within
+      // the chunk size.
+      size_t sent = 0;
+      do {
+        const size_t n = std::min(buffer.size(), compressed.size() - sent);
+        const bool finish = lastChunk && sent + n == compressed.size();
+        if (n == 0 && !finish)
+          break;
+        WriteRequest request;
+        request.set_resource_name(resource_name);
+        request.set_write_offset(write_offset);
+        request.set_data(compressed.data() + sent, n);
+        if (finish)
+          request.set_finish_write(true);
+        if (!writer->Write(request)) {
+          stream_ok = false;
+          break;
+        }
+        sent += n;
+        write_offset += n;
+      } while (sent < compressed.size());
+    }
+    writer->WritesDone();
+    auto status = writer->Finish();
+    // Servers report either the compressed bytes received, the blob size,
+    // or -1 when the blob already existed and the upload ended early.
+    if (status.ok() && response.committed_size() != -1 &&
+        response.committed_size() != write_offset &&
+        response.committed_size() != digest.size_bytes()) {
+      Fatal("Expected to upload %d bytes for %s, "
+            "but server reports %d bytes committed",
+            write_offset, digest.hash().c_str(), response.committed_size());
+    }
+    return status;
+  };
+  grpc_client_->IssueRequest(upload_lambda, "ByteStream.Write()", req_stats);
+}
+
+void CASClient::DownloadCompressed(const Digest& digest,
+                                   const WriteChunkFunc& write_chunk,
+                                   GRPCClient::RequestStats* req_stats) {
+  const std::string resource_name = MakeResourceName(digest, false, true);
+  // Offsets into compressed-blobs/ count uncompressed bytes, and each read
+  // is a new frame, so a retry picks up after the last byte written with a
+  // fresh decoder.
+  ZstdResumableDecompress decompressor(write_chunk);
+  auto download_lambda = [&](grpc::ClientContext &context) {
+    ReadRequest request;
+    request.set_resource_name(resource_name);
+    request.set_read_offset(decompressor.Restart());
+    auto reader = bytestream_client_->Read(&context, request);
+    ReadResponse response;
+    std::string err;
+    while (reader->Read(&response)) {
+      const std::string& data = response.data();
+      if (!decompressor.Decompress(data.data(), data.size(), &err)) {
+        Fatal("Failed to decompress blob %s: %s", toString(digest).c_str(),
+              err.c_str());
+      }
+    }
+    const auto read_status = reader->Finish();
+    if (read_status.ok() && !decompressor.Finished())
+      Fatal("Compressed blob %s ended early", toString(digest).c_str());
+    return read_status;
+  };
+  grpc_client_->IssueRequest(download_lambda, "ByteStream.Read()", req_stats);
+}
+
 void CASClient::DoUploadRequest(const UploadRequest& request,
                                 GRPCClient::RequestStats* req_stats) {
   if (!request.path.empty()) {
@@ -426,39 +696,68 @@ CASClient::DownloadResults CASClient::DownloadBlobs(
         return d1.size_bytes() < d2.size_bytes();
       });
   const auto batches = MakeBatches(request_list);
+  // Fetching all those digests that might need to be downloaded using
+  // the Bytestream API. Those will be in the range [batch_end,
+  // batches.size()). They are read concurrently, and alongside the batch
+  // requests, so one large object doesn't hold up the rest.
+  const size_t batch_end = batches.empty() ? 0 : batches.rbegin()->second;
+  std::mutex results_mutex;
+  std::atomic<size_t> next_large { batch_end };
+  // Each reader counts its retries on its own, since |req_stats| is also
+  // updated by the batches below; they are added up once all are done.
+  auto download_large = [&](GRPCClient::RequestStats* req_stats) {
+    for (size_t d = next_large++; d < request_list.size(); d = next_large++) {
+      const Digest& digest = request_list[d];
+      std::string data;
+      if (temp_dirfd < 0) {
+        data = FetchString(digest, req_stats);
+      } else {
+        // Download blob directly into a file to avoid excessive
+        // memory usage for large files.
+        data = digest.hash();
+        FileDescriptor fd(openat(temp_dirfd, data.c_str(),
+                                  O_WRONLY | O_CREAT | O_TRUNC, 0600));
+        if (fd.Get() < 0) {
+          Fatal("CASClient::downloadBlobs: Failed to create file \"%s\""
+                " in temporary directory", data.c_str());
+        }
+        Download(fd.Get(), digest, req_stats);
+      }
+      google::rpc::Status status;
+      status.set_code(grpc::StatusCode::OK);
+      std::lock_guard<std::mutex> lock(results_mutex);
+      write_blob(digest.hash(), data);
+      download_results.emplace_back(digest, status);
+    }
+  };
+  const size_t num_readers = std::min(request_list.size() - batch_end,
+                                      kMaxConcurrentByteStreamReads);
+  std::vector<GRPCClient::RequestStats> reader_stats(num_readers);
+  std::vector<std::thread> readers;
+  for (size_t i = 0; i < num_readers; ++i)
+    readers.emplace_back(download_large, &reader_stats[i]);
+
   for (const auto &batch_range : batches) {
     const size_t batch_start = batch_range.first;
     const size_t batch_end = batch_range.second;
+    // Collect outside the lock, then publish under it, since the readers
+    // report into the same containers.
+    std::vector<std::pair<std::string, std::string>> written;
     const auto batch_results = BatchDownload(request_list, batch_start,
-        batch_end, write_blob, req_stats, temp_dirfd);
+        batch_end, [&written](const std::string& hash, const std::string& data) {
+          written.emplace_back(hash, data);
+        }, req_stats, temp_dirfd);
+    std::lock_guard<std::mutex> lock(results_mutex);
+    for (const auto& blob : written)
+      write_blob(blob.first, blob.second);
     std::move(batch_results.cbegin(), batch_results.cend(),
               std::back_inserter(download_results));
   }
-  // Fetching all those digests that might need to be downloaded using
-  // the Bytestream API. Those will be in the range [batch_end,
-  // batches.size()).
-  size_t batch_end = batches.empty() ? 0 : batches.rbegin()->second;
-  for (auto d = batch_end; d < request_list.size(); d++) {
-    const Digest digest = request_list[d];
-    google::rpc::Status status;
-    if (temp_dirfd < 0) {
-      const auto data = FetchString(digest, req_stats);
-      write_blob(digest.hash(), data);
-    } else {
-      // Download blob directly into a file to avoid excessive
-      // memory usage for large files.
-      const auto path = digest.hash();
-      FileDescriptor fd(openat(temp_dirfd, path.c_str(),
-                                O_WRONLY | O_CREAT | O_TRUNC, 0600));
-      if (fd.Get() < 0) {
-        Fatal("CASClient::downloadBlobs: Failed to create file \"%s\""
-              " in temporary directory", path.c_str());
-      }
-      Download(fd.Get(), digest, req_stats);
-      write_blob(digest.hash(), path);
-    }
-    status.set_code(grpc::StatusCode::OK);
-    download_results.emplace_back(digest, status);
+  for (auto& reader : readers)
+    reader.join();
+  if (req_stats != nullptr) {
+    for (const auto& stats : reader_stats)
+      req_stats->retry_count += stats.retry_count;
   }
   return download_results;
 }
@@ -470,6 +769,7 @@ void CASClient::BatchUpload(const UploadRequests& requests,
   assert(end_index <= requests.size());
   BatchUpdateBlobsRequest request;
   request.set_instance_name(grpc_client_->InstanceName());
+  request.set_digest_function(digest_generator_.digest_function());
 
   for (auto d = start_index; d < end_index; d++) {
     const UploadRequest& upload_request = requests[d];
@@ -483,6 +783,11 @@ void CASClient::BatchUpload(const UploadRequests& requests,
     } else {
       entry->set_data(upload_request.data);
     }
+    if (zstd_batch_update_ &&
+        upload_request.digest.size_bytes() >= kMinCompressedBlobSize) {
+      entry->set_data(ZstdCompressStream::CompressAll(entry->data()));
+      entry->set_compressor(Compressor_Value_ZSTD);
+    }
   }
 
   BatchUpdateBlobsResponse response;
@@ -519,6 +824,9 @@ CASClient::DownloadResults CASClient::BatchDownload(
   assert(end_index <= digests.size());
   BatchReadBlobsRequest request;
   request.set_instance_name(grpc_client_->InstanceName());
+  request.set_digest_function(digest_generator_.digest_function());
+  if (zstd_bytestream_)
+    request.add_acceptable_compressors(Compressor_Value_ZSTD);
 
   for (auto d = start_index; d < end_index; d++) {
     auto digest = request.add_digests();
@@ -534,7 +842,22 @@ CASClient::DownloadResults CASClient::BatchDownload(
 
   DownloadResults download_results;
   download_results.reserve(static_cast<size_t>(response.responses_size()));
-  for (const auto& down_resp : response.responses()) {
+  for (auto& down_resp : *response.mutable_responses()) {
+    if (down_resp.status().code() == GRPC_STATUS_OK &&
+        down_resp.compressor() == Compressor_Value_ZSTD) {
+      std::string data, err;
+      if (!ZstdDecompressStream::DecompressAll(
+              down_resp.data(), down_resp.digest().size_bytes(), &data,
+              &err)) {
+        google::rpc::Status status;
+        status.set_code(grpc::StatusCode::INTERNAL);
+        status.set_message("Failed to decompress blob " +
+                           toString(down_resp.digest()) + ": " + err);
+        download_results.emplace_back(down_resp.digest(), status);
+        continue;
+      }
+      down_resp.set_data(std::move(data));
+    }
     if (down_resp.status().code() == GRPC_STATUS_OK) {
       const auto down_digest = digest_generator_.Hash(down_resp.data());
       if (down_digest != down_resp.digest()) {
@@ -598,6 +921,7 @@ CASClient::Digests CASClient::FindMissingBlobs(const Digests& digests,
     GRPCClient::RequestStats* req_stats) {
   FindMissingBlobsRequest request;
   request.set_instance_name(grpc_client_->InstanceName());
+  request.set_digest_function(digest_generator_.digest_function());
   // We take the given digests and split them across requests to not exceed
   // the maximum size of a gRPC message:
   std::vector<FindMissingBlobsRequest> requests_to_issue;
@@ -21,6 +21,7 @@
 #include <fcntl.h>
 #include <openssl/evp.h>
 
+#include "blake3.h"
 #include "grpc_client.h"
 
 namespace RemoteExecutor {
@@ -28,16 +29,25 @@ namespace RemoteExecutor {
 struct CASHash {
   static Digest Hash(int fd);
   static Digest Hash(const std::string& str);
+
+  /// The digest function used for every CAS and action cache key, SHA256
+  /// unless CASClient::NegotiateCapabilities() picked something else.
+  static DigestFunction_Value DigestFunction();
+  static void SetDigestFunction(DigestFunction_Value digest_function);
 };
 
 class DigestContext {
 public:
+  DigestContext(DigestContext&& other);
+  DigestContext(const DigestContext&) = delete;
+  DigestContext& operator=(const DigestContext&) = delete;
   virtual ~DigestContext();
   Digest FinalizeDigest();
   void Update(const char* data, size_t data_size);
 
 private:
   EVP_MD_CTX *context_;
+  std::unique_ptr<Blake3Hasher> blake3_;
   int64_t data_size_ { 0 };
   bool finalized_ { false };
 
@@ -58,6 +68,8 @@ public:
 
   DigestContext CreateDigestContext() const;
 
+  DigestFunction_Value digest_function() const { return digest_func_; }
+
 private:
   const DigestFunction_Value digest_func_;
   const EVP_MD *digest_func_struct_;
@@ -65,6 +77,8 @@ private:
   static const EVP_MD* GetDigestFunctionStruct(
       DigestFunction_Value digest_function_value);
 
+  static Digest HashBlake3(const void* data, size_t size);
+
   using IncrementalUpdateFunc = std::function<void(char *, size_t)>;
   static int64_t ProcessFile(int fd, const IncrementalUpdateFunc& update_func);
 };
@@ -72,11 +86,25 @@ private:
 class CASClient {
 public:
   CASClient(GRPCClient* grpc_client, DigestFunction_Value digest_function =
-      DigestFunction_Value::DigestFunction_Value_SHA256)
-    : grpc_client_(grpc_client), digest_generator_(digest_function) {}
+      DigestFunction_Value::DigestFunction_Value_SHA256);
 
   void Init();
 
+  /// Whether failed transfers throw, see GRPCClient::SetThrowOnError().
+  bool ThrowOnError() const { return grpc_client_->ThrowOnError(); }
+
+  /// Ask the server for its capabilities once and apply them process wide:
+  /// BLAKE3 when both the CAS and the execution service support it (SHA256
+  /// otherwise), and zstd transfers where the CAS advertises them.
+  static void NegotiateCapabilities(GRPCClient* grpc_client);
+
+  /// Enable zstd for ByteStream and BatchReadBlobs transfers and for
+  /// BatchUpdateBlobs uploads in CASClients created after this call.
+  static void SetZstdSupport(bool bytestream, bool batch_update);
+
+  /// Blobs smaller than this are always sent uncompressed.
+  static constexpr int64_t kMinCompressedBlobSize = 4 * 1024;
+
   std::string FetchString(const Digest& digest,
                           GRPCClient::RequestStats* req_stats = nullptr);
 
@@ -139,6 +167,8 @@ private:
   size_t max_batch_total_size_;
   std::string uuid_;
   DigestGenerator digest_generator_;
+  bool zstd_bytestream_;
+  bool zstd_batch_update_;
 
   using WriteBlobCallback =
       std::function<void(const std::string& hash, const std::string& data)>;
@@ -149,7 +179,23 @@ private:
       const WriteBlobCallback& write_blob_callback, int temp_dirfd,
       GRPCClient::RequestStats* req_stats = nullptr);
 
-  std::string MakeResourceName(const Digest& digest, bool is_upload);
+  std::string MakeResourceName(const Digest& digest, bool is_upload,
+                               bool compressed = false);
+
+  bool ShouldCompress(const Digest& digest) const {
+    return zstd_bytestream_ && digest.size_bytes() >= kMinCompressedBlobSize;
+  }
+
+  /// Returns up to |size| bytes of the blob starting at |offset|.
+  using ReadChunkFunc =
+      std::function<size_t(int64_t offset, char* buffer, size_t size)>;
+  using WriteChunkFunc = std::function<void(const char* data, size_t size)>;
+
+  void UploadCompressed(const Digest& digest, const ReadChunkFunc& read_chunk,
+                        GRPCClient::RequestStats* req_stats);
+  void DownloadCompressed(const Digest& digest,
+                          const WriteChunkFunc& write_chunk,
+                          GRPCClient::RequestStats* req_stats);
 
   DownloadBlobsResult DownloadBlobs(const Digests& digests,
       int temp_dirfd, GRPCClient::RequestStats* req_stats);
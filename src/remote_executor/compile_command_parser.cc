@@ -18,6 +18,7 @@
 #include <cstring>
 #include <functional>
 #include <map>
+#include <mutex>
 
 #include "../util.h"
 
@@ -78,8 +79,36 @@ using ParseFunc =
    std::function<void(CompileCommandParser::ParseResult*, const std::string&)>;
 using ParseRulesMap = //TODO: must be greater?
     std::map<std::string, ParseFunc, std::greater<std::string>>;
+
+/// The options of a ParseRulesMap in a prefix trie, so an argument is matched
+/// in one walk over its characters.
+class OptionTrie {
+public:
+  struct Entry {
+    std::string option;
+    ParseFunc func;
+  };
+
+  explicit OptionTrie(const ParseRulesMap& rules);
+
+  /// The entry for |option| exactly, or nullptr.
+  const Entry* Find(const char* begin, const char* end) const;
+  /// The entry for the longest option that |option| starts with, or nullptr.
+  const Entry* FindLongestPrefix(const std::string& option) const;
+
+private:
+  struct Node {
+    std::vector<std::pair<char, int>> children;
+    int entry { -1 };
+  };
+  int Child(int node, char c) const;
+
+  std::vector<Node> nodes_;
+  std::vector<Entry> entries_;
+};
+
 using ParseCommandMap = std::unordered_map<
-    StringSet/* compiler list */, ParseRulesMap, CompilerListHasher>;
+    StringSet/* compiler list */, OptionTrie, CompilerListHasher>;
 
 struct ParseRule {
   static void ParseInterfersWithDepsOption(
@@ -105,8 +134,8 @@ struct ParseRule {
 };
 
 struct ParseRuleHelper {
-  static std::pair<std::string, ParseFunc> MatchCompilerOptions(
-      const std::string& option, const ParseRulesMap& options);
+  static const OptionTrie::Entry* MatchCompilerOptions(
+      const std::string& option, const OptionTrie& options);
   static void ParseGccOption(CompileCommandParser::ParseResult* result,
                              const std::string& option, bool to_deps = true,
                              bool is_output = false, bool deps_output = false);
@@ -228,11 +257,62 @@ static const ParseRulesMap AIXRules = {
 };
 
 static const ParseCommandMap DefaultParseCommandMap = {
-  { SupportedCompilers::GccCompilers, GccRules },
-  { SupportedCompilers::GccPreprocessors, GccPreprocessorRules },
-  { SupportedCompilers::SunCPPCompilers, SunCPPRules },
-  { SupportedCompilers::AIXCompilers, AIXRules },
+  { SupportedCompilers::GccCompilers, OptionTrie(GccRules) },
+  { SupportedCompilers::GccPreprocessors, OptionTrie(GccPreprocessorRules) },
+  { SupportedCompilers::SunCPPCompilers, OptionTrie(SunCPPRules) },
+  { SupportedCompilers::AIXCompilers, OptionTrie(AIXRules) },
 };
+static const OptionTrie GccPreprocessorTrie(GccPreprocessorRules);
+static const OptionTrie EmptyTrie{ ParseRulesMap() };
+
+OptionTrie::OptionTrie(const ParseRulesMap& rules) : nodes_(1) {
+  for (const auto& rule : rules) {
+    int node = 0;
+    for (char c : rule.first) {
+      int next = Child(node, c);
+      if (next < 0) {
+        next = static_cast<int>(nodes_.size());
+        nodes_[node].children.emplace_back(c, next);
+        nodes_.emplace_back();
+      }
+      node = next;
+    }
+    nodes_[node].entry = static_cast<int>(entries_.size());
+    entries_.push_back({ rule.first, rule.second });
+  }
+}
+
+int OptionTrie::Child(int node, char c) const {
+  for (const auto& child : nodes_[node].children) {
+    if (child.first == c)
+      return child.second;
+  }
+  return -1;
+}
+
+const OptionTrie::Entry* OptionTrie::Find(const char* begin,
+                                          const char* end) const {
+  int node = 0;
+  for (const char* p = begin; p != end && node >= 0; ++p)
+    node = Child(node, *p);
+  if (node < 0 || nodes_[node].entry < 0)
+    return nullptr;
+  return &entries_[nodes_[node].entry];
+}
+
+const OptionTrie::Entry* OptionTrie::FindLongestPrefix(
+    const std::string& option) const {
+  const Entry* longest = nullptr;
+  int node = 0;
+  for (char c : option) {
+    node = Child(node, c);
+    if (node < 0)
+      break;
+    if (nodes_[node].entry >= 0)
+      longest = &entries_[nodes_[node].entry];
+  }
+  return longest;
+}
 
 /// Converts a command path ("/usr/bin/gcc-4.7") to a command name ("gcc")
 std::string CommandBaseName(const std::string& path) {
@@ -285,13 +365,13 @@ CompileCommandParser::ParseResult MakeResult(const StringVector& command) {
 }
 
 void InternalParseCommand(CompileCommandParser::ParseResult* result,
-                          const ParseRulesMap& parseRules) {
+                          const OptionTrie& parseRules) {
   while (!result->original_command.empty()) {
     const auto& currToken = result->original_command.front();
-    const auto& optionModifier =
+    const auto* optionModifier =
         ParseRuleHelper::MatchCompilerOptions(currToken, parseRules);
-    if (optionModifier.second) {
-      optionModifier.second(result, optionModifier.first);
+    if (optionModifier) {
+      optionModifier->func(result, optionModifier->option);
     } else {
       result->deps_command.push_back(currToken);
       result->original_command.pop_front();
@@ -299,21 +379,21 @@ void InternalParseCommand(CompileCommandParser::ParseResult* result,
   }
 }
 
-CompileCommandParser::ParseResult CompileCommandParser::ParseCommand(
+CompileCommandParser::ParseResult CompileCommandParser::ParseCommandUncached(
     const StringVector& command) {
   if (command.empty())
     return {};
   auto result = MakeResult(command);
 
-  ParseRulesMap rulesToUse;
+  const OptionTrie* rulesToUse = &EmptyTrie;
   for (const auto& val : DefaultParseCommandMap) {
     auto it = val.first.find(result.compiler);
     if (it != val.first.end()) {
-      rulesToUse = val.second;
+      rulesToUse = &val.second;
       break;
     }
   }
-  InternalParseCommand(&result, rulesToUse);
+  InternalParseCommand(&result, *rulesToUse);
 
   if (result.contains_unsupported_options) {
     result.is_compiler_command = false;
@@ -328,7 +408,7 @@ CompileCommandParser::ParseResult CompileCommandParser::ParseCommand(
     std::copy(result.pre_processor_options.begin(),
               result.pre_processor_options.end(),
               std::back_inserter(preprocess_result.original_command));
-    InternalParseCommand(&preprocess_result, GccPreprocessorRules);
+    InternalParseCommand(&preprocess_result, GccPreprocessorTrie);
 
     for (const auto& preproArg : preprocess_result.deps_command) {
       result.deps_command.push_back("-Xpreprocessor");
@@ -352,6 +432,136 @@ CompileCommandParser::ParseResult CompileCommandParser::ParseCommand(
   return result;
 }
 
+namespace {
+
+// Stands in for a positional argument (source, output, macro value...) in
+// a cached parse. Followed by the argument's index in the command.
+constexpr char kArgPlaceholder = '\x01';
+// Beyond this many distinct flag sets, new ones are parsed but not cached.
+constexpr size_t kMaxCachedParses = 4096;
+
+/// Parse results of commands with positional arguments replaced by
+/// placeholders. Edges of one rule usually differ only in those, so they
+/// all share one entry.
+class ParseCache {
+public:
+  bool Lookup(const std::string& key,
+              CompileCommandParser::ParseResult* result) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = templates_.find(key);
+    if (it == templates_.end())
+      return false;
+    *result = it->second;
+    return true;
+  }
+
+  void Insert(const std::string& key,
+              const CompileCommandParser::ParseResult& result) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (templates_.size() < kMaxCachedParses)
+      templates_.emplace(key, result);
+  }
+
+  void Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    templates_.clear();
+  }
+
+private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, CompileCommandParser::ParseResult> templates_;
+};
+
+ParseCache& GetParseCache() {
+  static ParseCache cache;
+  return cache;
+}
+
+bool IsPositionalArg(const StringVector& command, size_t i) {
+  // The compiler and every option are kept; so is the argument of "-x",
+  // whose value decides whether the command is supported.
+  const std::string& arg = command[i];
+  return i > 0 && (arg.empty() || arg[0] != '-') && command[i - 1] != "-x";
+}
+
+std::string Placeholder(size_t i) {
+  return kArgPlaceholder + std::to_string(i);
+}
+
+/// The cache key of |command|: its arguments with the positional ones
+/// replaced by placeholders.
+std::string MakeTemplateKey(const StringVector& command) {
+  size_t size = 0;
+  for (const auto& arg : command)
+    size += arg.size() + 1;
+  std::string key;
+  key.reserve(size);
+  for (size_t i = 0; i < command.size(); ++i) {
+    if (IsPositionalArg(command, i))
+      key.append(Placeholder(i));
+    else
+      key.append(command[i]);
+    key.push_back('\0');
+  }
+  return key;
+}
+
+StringVector MakeTemplateCommand(const StringVector& command) {
+  StringVector shape;
+  shape.reserve(command.size());
+  for (size_t i = 0; i < command.size(); ++i)
+    shape.push_back(IsPositionalArg(command, i) ? Placeholder(i) : command[i]);
+  return shape;
+}
+
+const std::string& FillArg(const std::string& value,
+                           const StringVector& command) {
+  if (value.size() < 2 || value[0] != kArgPlaceholder)
+    return value;
+  return command[strtoul(value.c_str() + 1, nullptr, 10)];
+}
+
+template <typename Container>
+void FillArgs(Container* values, const StringVector& command) {
+  for (auto& value : *values)
+    value = FillArg(value, command);
+}
+
+void FillArgs(std::set<std::string>* values, const StringVector& command) {
+  std::set<std::string> filled;
+  for (const auto& value : *values)
+    filled.insert(filled.end(), FillArg(value, command));
+  values->swap(filled);
+}
+
+}  // namespace
+
+CompileCommandParser::ParseResult CompileCommandParser::ParseCommand(
+    const StringVector& command) {
+  if (command.empty())
+    return {};
+  // AIX parses create a per-command temporary deps file, so never share them.
+  if (SupportedCompilers::AIXCompilers.count(CommandBaseName(command[0])))
+    return ParseCommandUncached(command);
+
+  const std::string key = MakeTemplateKey(command);
+  ParseResult result;
+  if (!GetParseCache().Lookup(key, &result)) {
+    result = ParseCommandUncached(MakeTemplateCommand(command));
+    GetParseCache().Insert(key, result);
+  }
+  FillArgs(&result.original_command, command);
+  FillArgs(&result.pre_processor_options, command);
+  FillArgs(&result.deps_command, command);
+  FillArgs(&result.command_products, command);
+  FillArgs(&result.deps_command_products, command);
+  return result;
+}
+
+void CompileCommandParser::ClearParseCache() {
+  GetParseCache().Clear();
+}
+
 struct ExecResult {
   int exit_code;
   std::string std_out;
@@ -434,26 +644,26 @@ const StringSet& CompileCommandParser::SupportedRemoteExecuteCommands() {
   return SupportedCompilers::SupportedRemoteExecuteCommands;
 }
 
-std::pair<std::string, ParseFunc> ParseRuleHelper::MatchCompilerOptions(
-    const std::string& option, const ParseRulesMap& options) {
-  auto opt = option;
-  if (!opt.empty() && opt.front() == '-') {
-    // Check for an equal sign, if any, return left side.
-    opt = opt.substr(0, opt.find("="));
-    // First try finding an exact match, removing and parsing until an
-    // equal sign. Remove any spaces from the option.
+const OptionTrie::Entry* ParseRuleHelper::MatchCompilerOptions(
+    const std::string& option, const OptionTrie& options) {
+  if (option.empty() || option.front() != '-')
+    return nullptr;
+  // First try finding an exact match of everything up to an equal sign,
+  // ignoring any spaces.
+  const char* begin = option.data();
+  const char* end = begin + std::min(option.find('='), option.size());
+  const OptionTrie::Entry* exact;
+  if (std::find_if(begin, end, ::isspace) == end) {
+    exact = options.Find(begin, end);
+  } else {
+    std::string opt(begin, end);
     opt.erase(remove_if(opt.begin(), opt.end(), ::isspace), opt.end());
-    if (options.count(opt) > 0)
-      return std::make_pair(opt, options.at(opt));
-    // Second, try a substring search, iterating through all the
-    // options in the map.
-    for (const auto& option_map_val : options) {
-      const auto val = option.substr(0, option_map_val.first.length());
-      if (val == option_map_val.first)
-        return std::make_pair(option_map_val.first, option_map_val.second);
-    }
+    exact = options.Find(opt.data(), opt.data() + opt.size());
   }
-  return std::make_pair("", nullptr);
+  if (exact)
+    return exact;
+  // Second, take the longest option the argument starts with.
+  return options.FindLongestPrefix(option);
 }
 
 void ParseRule::ParseInterfersWithDepsOption(
@@ -47,7 +47,14 @@ struct CompileCommandParser {
     std::pair<int, std::string> aix_deps_file { -1, "" };
   };
 
+  /// Parse a compiler command line. Results are cached by compiler and
+  /// options, so commands that differ only in their positional arguments
+  /// (sources, outputs, macro values) are classified once.
   static ParseResult ParseCommand(const std::vector<std::string>& command);
+  /// ParseCommand() without the cache, for tests and benchmarks.
+  static ParseResult ParseCommandUncached(
+      const std::vector<std::string>& command);
+  static void ClearParseCache();
   static std::set<std::string> ParseHeaders(const ParseResult& result);
   static const std::set<std::string>& SupportedRemoteExecuteCommands();
 };
@@ -0,0 +1,105 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+
+#include "compile_command_parser.h"
+
+#include "../test.h"
+
+using namespace std;
+using RemoteExecutor::CompileCommandParser;
+
+namespace {
+
+vector<string> GccCommand(const string& name) {
+  return { "/usr/bin/g++", "-DNDEBUG", "-I../include", "-O2", "-MD",
+           "-MT", "obj/" + name + ".o", "-MF", "obj/" + name + ".o.d",
+           "-o", "obj/" + name + ".o", "-c", "../src/" + name + ".cc" };
+}
+
+void ExpectSameResult(const CompileCommandParser::ParseResult& expected,
+                      const CompileCommandParser::ParseResult& actual) {
+  EXPECT_EQ(expected.is_compiler_command, actual.is_compiler_command);
+  EXPECT_EQ(expected.is_md_options, actual.is_md_options);
+  EXPECT_EQ(expected.contains_unsupported_options,
+            actual.contains_unsupported_options);
+  EXPECT_EQ(expected.compiler, actual.compiler);
+  EXPECT_EQ(expected.original_command, actual.original_command);
+  EXPECT_EQ(expected.pre_processor_options, actual.pre_processor_options);
+  EXPECT_EQ(expected.deps_command, actual.deps_command);
+  EXPECT_EQ(expected.command_products, actual.command_products);
+  EXPECT_EQ(expected.deps_command_products, actual.deps_command_products);
+}
+
+}  // namespace
+
+TEST(CompileCommandParserTest, Gcc) {
+  CompileCommandParser::ClearParseCache();
+  const auto result = CompileCommandParser::ParseCommand(GccCommand("foo"));
+  EXPECT_TRUE(result.is_compiler_command);
+  EXPECT_TRUE(result.is_md_options);
+  EXPECT_EQ("g++", result.compiler);
+  const vector<string> deps_command = { "/usr/bin/g++", "-DNDEBUG",
+      "-I../include", "-O2", "-c", "../src/foo.cc", "-M" };
+  EXPECT_EQ(deps_command, result.deps_command);
+  EXPECT_EQ(set<string>{ "obj/foo.o" }, result.command_products);
+  EXPECT_EQ((set<string>{ "obj/foo.o", "obj/foo.o.d" }),
+            result.deps_command_products);
+}
+
+TEST(CompileCommandParserTest, CachedParseKeepsPositionalArguments) {
+  CompileCommandParser::ClearParseCache();
+  for (const char* name : { "foo", "bar", "baz" }) {
+    const auto command = GccCommand(name);
+    ExpectSameResult(CompileCommandParser::ParseCommandUncached(command),
+                     CompileCommandParser::ParseCommand(command));
+  }
+}
+
+TEST(CompileCommandParserTest, CachedParseOptionArguments) {
+  CompileCommandParser::ClearParseCache();
+  const vector<vector<string>> commands = {
+    { "gcc", "-D", "NAME=1", "-Xpreprocessor", "-MD", "-Xpreprocessor",
+      "-MF", "-Xpreprocessor", "a.d", "-c", "a.c", "-o", "a.o" },
+    { "gcc", "-D", "NAME=2", "-Xpreprocessor", "-MD", "-Xpreprocessor",
+      "-MF", "-Xpreprocessor", "b.d", "-c", "b.c", "-o", "b.o" },
+    { "gcc", "-Wp,-MD,a.d", "-isystem", "/opt/a", "-c", "a.c" },
+    { "gcc", "-Wp,-MD,b.d", "-isystem", "/opt/b", "-c", "b.c" },
+    { "gcc", "--sysroot=/opt/root", "-Iinc", "-c", "a.c" },
+  };
+  for (const auto& command : commands) {
+    ExpectSameResult(CompileCommandParser::ParseCommandUncached(command),
+                     CompileCommandParser::ParseCommand(command));
+  }
+}
+
+TEST(CompileCommandParserTest, LanguageIsPartOfTheCacheKey) {
+  CompileCommandParser::ClearParseCache();
+  const auto cxx = CompileCommandParser::ParseCommand(
+      { "gcc", "-x", "c++", "-c", "a.cc" });
+  EXPECT_TRUE(cxx.is_compiler_command);
+  EXPECT_FALSE(cxx.contains_unsupported_options);
+
+  const auto assembler = CompileCommandParser::ParseCommand(
+      { "gcc", "-x", "assembler", "-c", "a.s" });
+  EXPECT_TRUE(assembler.contains_unsupported_options);
+  EXPECT_FALSE(assembler.is_compiler_command);
+}
+
+TEST(CompileCommandParserTest, LongestOptionPrefix) {
+  // "-MF" and "-M" are both prefixes; the longer one wins.
+  const auto result = CompileCommandParser::ParseCommandUncached(
+      { "gcc", "-MFdeps.d", "-c", "a.c" });
+  EXPECT_EQ(set<string>{ "deps.d" }, result.deps_command_products);
+}
@@ -14,8 +14,16 @@
 
 #include "execution_context.h"
 
+#include <errno.h>
+#include <string.h>
+
+#include <condition_variable>
 #include <fstream>
+#include <mutex>
+#include <queue>
 #include <sstream>
+#include <stdexcept>
+#include <thread>
 
 #include "google/protobuf/util/time_util.h"
 
@@ -221,6 +229,18 @@ build::bazel::remote::execution::v2::Command GenerateCommandProto(
   return cmd_proto;
 }
 
+/// The arguments as hashed and sent to the server, with path_remaps
+/// applied.
+std::vector<std::string> RemappedArguments(const RemoteSpawn* spawn) {
+  const PathRemapper remapper = RemoteSpawn::MakePathRemapper();
+  std::vector<std::string> arguments = spawn->arguments;
+  for (size_t i = 0; i < arguments.size(); ++i) {
+    if (!PathRemapper::DefinesMacro(arguments, i))
+      arguments[i] = remapper.MapArgument(arguments[i]);
+  }
+  return arguments;
+}
+
 Action BuildAction(RemoteSpawn* spawn, const std::string& cwd,
     DigestStringMap* blobs, DigestStringMap* digest_files,
     std::set<std::string>& products) {
@@ -238,7 +258,7 @@ Action BuildAction(RemoteSpawn* spawn, const std::string& cwd,
     nested_dir.AddDirectory(cmd_work_dir.c_str());
   }
   const auto dir_digest = nested_dir.ToDigest(blobs);
-  const auto cmd_proto = GenerateCommandProto(spawn->arguments, products,
+  const auto cmd_proto = GenerateCommandProto(RemappedArguments(spawn), products,
                                                  cmd_work_dir, spawn->config->rbe_config.rbe_properties);
   const auto cmd_digest = MakeDigest(cmd_proto);
   (*blobs)[cmd_digest] = cmd_proto.SerializeAsString();
@@ -272,7 +292,7 @@ bool BuildActionOutputs(RemoteSpawn* spawn, const std::string& cwd,
   // if(!StaticFileUtils::WaitForPipeClose(spawn->local_pipe_fd_))
   //     Fatal("local output produce failed!");
   for (auto& product : products) {
-    if(product.find(".o.d")!=std::string::npos){
+    if(product.find(".o.d")!=std::string::npos && product != spawn->depfile){
       continue;
     }
     std::string merklePath(product);
@@ -309,7 +329,7 @@ bool BuildActionOutputs(RemoteSpawn* spawn, const std::string& cwd,
     }
   }
   
-  const auto cmd_proto = GenerateCommandProto(spawn->arguments, products,
+  const auto cmd_proto = GenerateCommandProto(RemappedArguments(spawn), products,
                                                  cmd_work_dir,spawn->config->rbe_config.rbe_properties);
   const auto cmd_digest = MakeDigest(cmd_proto);
   (*blobs)[cmd_digest] = cmd_proto.SerializeAsString();
@@ -333,6 +353,77 @@ std::string ToolInvocationID() {
   return HostName() + ":" + std::to_string(getppid());
 }
 
+/// Downloads side outputs after their edge has been reported done. A fixed
+/// pair of threads drains the queue so a build with thousands of such
+/// outputs doesn't leave as many threads behind. A task reports failure by
+/// throwing; the failures are collected for Wait() to hand to the build.
+class BackgroundDownloader {
+public:
+  static BackgroundDownloader* Get() {
+    static BackgroundDownloader downloader;
+    return &downloader;
+  }
+
+  /// Queue |task|, which downloads |what|.
+  void Add(std::function<void()> task, const std::string& what) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (threads_.empty()) {
+      for (int i = 0; i < kThreads; ++i)
+        threads_.emplace_back([this]() { Run(); });
+    }
+    tasks_.emplace(std::move(task), what);
+    cv_.notify_one();
+  }
+
+  /// Wait for the queued tasks and return the failures among them.
+  std::vector<std::string> Wait() {
+    std::vector<std::thread> threads;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      draining_ = true;
+      threads.swap(threads_);
+    }
+    cv_.notify_all();
+    for (auto& thread : threads)
+      thread.join();
+    std::lock_guard<std::mutex> lock(mutex_);
+    draining_ = false;
+    std::vector<std::string> failures;
+    failures.swap(failures_);
+    return failures;
+  }
+
+private:
+  static constexpr int kThreads = 2;
+
+  void Run() {
+    for (;;) {
+      std::pair<std::function<void()>, std::string> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return draining_ || !tasks_.empty(); });
+        if (tasks_.empty())
+          return;
+        task = std::move(tasks_.front());
+        tasks_.pop();
+      }
+      try {
+        task.first();
+      } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        failures_.push_back("downloading " + task.second + ": " + e.what());
+      }
+    }
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::queue<std::pair<std::function<void()>, std::string>> tasks_;
+  std::vector<std::thread> threads_;
+  std::vector<std::string> failures_;
+  bool draining_ = false;
+};
+
 ConnectionOptions GetConnectOptions() {
   // For now, Server & CAS_Server & ActionCache_Server use the same
   ConnectionOptions option;
@@ -344,41 +435,51 @@ ConnectionOptions GetConnectOptions() {
   return option;
 }
 
+void ExecutionContext::NegotiateCapabilities() {
+  static std::once_flag capabilities_negotiated;
+  std::call_once(capabilities_negotiated, []() {
+    GRPCClient capabilities_grpc;
+    capabilities_grpc.Init(GetConnectOptions());
+    CASClient::NegotiateCapabilities(&capabilities_grpc);
+  });
+}
+
+ExitStatus RunLocally(const std::string& command, int fd) {
+  SubprocessSet subprocset;
+  Subprocess* subproc = subprocset.Add(command);
+  if (!subproc)
+    Fatal("Error while `Execute locally and Update to ActionCache`");
+  while ((subproc = subprocset.NextFinished()) == NULL) {
+    if (subprocset.DoWork())
+      return ExitInterrupted;
+  }
+  ExitStatus status = subproc->Finish();
+  const std::string& output = subproc->GetOutput();
+  if (!output.empty() && write(fd, output.data(), output.size()) < 0)
+    Warning("Wrote command output to fd failed.");
+  delete subproc;
+  return status;
+}
+
 void ExecutionContext::Execute(int fd, RemoteExecutor::RemoteSpawn* spawn,
                               int& exit_code) {
-  std::string command = spawn->edge->EvaluateCommand();
-  std::string rule = spawn->edge->rule().name();
-  bool can_cache = RemoteExecutor::RemoteSpawn::CanCacheRemotelly(spawn->edge);
-  if (!can_cache) {
-    // Execute locally
-    SubprocessSet subprocset;
-    Subprocess* subproc = subprocset.Add(spawn->command);
-    if (!subproc) {
-      Fatal("Error while `Execute locally and Update to ActionCache`"); 
-    }    
-    //wait for local run finished
-    subproc = NULL;
-    while ((subproc = subprocset.NextFinished()) == NULL) {
-      bool interrupted = subprocset.DoWork();
-      if (interrupted)
-        return;
-    }
-    if (subproc->Finish() == ExitSuccess) {
-      // Warning("Execute locally: %s", subproc->GetOutput().c_str());
-    }
-    delete subproc;
-    exit_code = 0;
+  if (!spawn->can_cache) {
+    exit_code = RunLocally(spawn->local_command, fd) == ExitSuccess ? 0 : 1;
     close(fd);
     return;
   }
 
+  // Every digest below depends on the digest function, so settle it (and
+  // blob compression) with the server before building the first action.
+  NegotiateCapabilities();
+  auto connect_opt = GetConnectOptions();
+
   const std::string cwd = spawn->config->rbe_config.cwd;
   DigestStringMap blobs, digest_files;
   std::set<std::string> products;
   const auto action = BuildAction(spawn, cwd, &blobs, &digest_files, products);
   const auto action_digest = MakeDigest(action);
 
-  auto connect_opt = GetConnectOptions();
   GRPCClient cas_grpc;
   cas_grpc.Init(connect_opt);
   GRPCClient exec_grpc;
@@ -393,7 +494,7 @@ void ExecutionContext::Execute(int fd, RemoteExecutor::RemoteSpawn* spawn,
   ac_grpc.SetToolDetails(kMetadataToolName, kMetadataToolVersion);
   ac_grpc.SetRequestMetadata(toString(action_digest), ToolInvocationID());
 
-  CASClient cas_client(&cas_grpc, DigestFunction_Value_SHA256);
+  CASClient cas_client(&cas_grpc, CASHash::DigestFunction());
   cas_client.Init();
   RemoteExecutionClient re_client(&exec_grpc, &ac_grpc);
   re_client.Init();
@@ -402,6 +503,8 @@ void ExecutionContext::Execute(int fd, RemoteExecutor::RemoteSpawn* spawn,
   ActionResult result;
   cached = re_client.FetchFromActionCache(action_digest, products, &result);
   // Warning("Execute locally CMD: %s,is it cached? %d", spawn->command.c_str(),cached);
+  if (cached && cache_hits_)
+    ++*cache_hits_;
   if(cached) 
     exit_code = result.exit_code();
   // Info("action cached is %d", cached);
@@ -412,23 +515,13 @@ void ExecutionContext::Execute(int fd, RemoteExecutor::RemoteSpawn* spawn,
   // spawn->work.remote = false; 时，只能本地执行
   // spawn->work.remote = false;
   if (!cached && !spawn->can_remote) {
-    // Execute locally
-    SubprocessSet subprocset;
-    Subprocess* subproc = subprocset.Add(spawn->command);
-    if (!subproc) {
-      Fatal("Error while `Execute locally and Update to ActionCache`"); 
-    }    
-    //wait for local run finished
-    subproc = NULL;
-    while ((subproc = subprocset.NextFinished()) == NULL) {
-      bool interrupted = subprocset.DoWork();
-      if (interrupted)
-        return ;
-    }
-    if (subproc->Finish() == ExitSuccess) {
-      Warning("Execute locally: %s", subproc->GetOutput().c_str());
+    // Only a successful run may be shared through the cache; a failure is
+    // reported like any other and left for the next build to retry.
+    if (RunLocally(spawn->local_command, fd) != ExitSuccess) {
+      exit_code = 1;
+      close(fd);
+      return;
     }
-    delete subproc;
 
     DigestStringMap outblobs, outputs_digest_files;
     bool ret = BuildActionOutputs(spawn, cwd, &outblobs, &outputs_digest_files, &result);
@@ -492,6 +585,45 @@ void ExecutionContext::Execute(int fd, RemoteExecutor::RemoteSpawn* spawn,
     *result.add_output_files() = output;
   }
 
+  // Side outputs are fetched on their own while the outputs dependents
+  // and the depfile need are staged here; only the latter hold up the
+  // edge.
+  if (!spawn->side_outputs.empty()) {
+    const std::set<std::string> side_paths(spawn->side_outputs.begin(),
+                                           spawn->side_outputs.end());
+    ActionResult side_result;
+    auto* files = result.mutable_output_files();
+    for (int i = 0; i < files->size();) {
+      if (side_paths.count(files->Get(i).path())) {
+        *side_result.add_output_files() = files->Get(i);
+        files->DeleteSubrange(i, 1);
+      } else {
+        ++i;
+      }
+    }
+    if (side_result.output_files_size() > 0) {
+      const std::string metadata = toString(action_digest);
+      BackgroundDownloader::Get()->Add([connect_opt, side_result, cwd,
+                                        metadata]() {
+        GRPCClient grpc;
+        grpc.Init(connect_opt);
+        // The edge is done already; failures go to the end of the build.
+        grpc.SetThrowOnError(true);
+        grpc.SetToolDetails(kMetadataToolName, kMetadataToolVersion);
+        grpc.SetRequestMetadata(metadata, ToolInvocationID());
+        CASClient cas_client(&grpc, CASHash::DigestFunction());
+        cas_client.Init();
+        RemoteExecutionClient re_client(&grpc, &grpc);
+        FileDescriptor root_dirfd(open(cwd.c_str(), O_RDONLY | O_DIRECTORY));
+        if (root_dirfd.Get() < 0) {
+          throw std::runtime_error("opening directory \"" + cwd + "\": " +
+                                   strerror(errno));
+        }
+        re_client.DownloadOutputs(&cas_client, side_result, root_dirfd.Get());
+      }, side_result.output_files(0).path());
+    }
+  }
+
   auto root = spawn->config->rbe_config.cwd.c_str();
   FileDescriptor root_dirfd(open(root, O_RDONLY | O_DIRECTORY));
   if (root_dirfd.Get() < 0)
@@ -524,6 +656,16 @@ void ExecutionContext::Execute(int fd, RemoteExecutor::RemoteSpawn* spawn,
   close(fd);
 }
 
+bool ExecutionContext::WaitForBackgroundDownloads(std::string* err) {
+  const std::vector<std::string> failures = BackgroundDownloader::Get()->Wait();
+  if (failures.empty())
+    return true;
+  *err = failures[0];
+  for (size_t i = 1; i < failures.size(); ++i)
+    *err += "\n" + failures[i];
+  return false;
+}
+
 void ExecutionContext::UploadResources(CASClient* client,
     const DigestStringMap& blobs, const DigestStringMap& digest_files) {
   std::vector<Digest> digests_upload;
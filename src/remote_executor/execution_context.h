@@ -17,6 +17,7 @@
 
 #include "cas_client.h"
 #include "remote_spawn.h"
+#include "../exit_status.h"
 
 namespace RemoteExecutor {
 
@@ -61,6 +62,18 @@ struct NestedDirectory {
 
 struct RemoteSpawn;
 
+/// Build the Action for |spawn| as Execute() does, without contacting the
+/// server. The Command and Directory messages are added to |blobs| and the
+/// input files to |digest_files|, both by digest.
+Action BuildAction(RemoteSpawn* spawn, const std::string& cwd,
+    DigestStringMap* blobs, DigestStringMap* digest_files,
+    std::set<std::string>& products);
+
+/// Run |command| here, for an action that cannot run remotely, and write
+/// what it printed to |fd|. The action's outputs may only be put in the
+/// cache if this returns ExitSuccess.
+ExitStatus RunLocally(const std::string& command, int fd);
+
 class ExecutionContext {
 public:
   void Execute(int fd, RemoteSpawn* spawn, int& exit_code);
@@ -69,9 +82,24 @@ public:
   void SetStopToken(const std::atomic_bool& stop_requested) {
     stop_requested_ = &stop_requested;
   }
+  /// Count the actions Execute() finds in the action cache in |cache_hits|.
+  void SetCacheHitCounter(std::atomic<int>& cache_hits) {
+    cache_hits_ = &cache_hits;
+  }
+
+  /// Agree on the digest function and compression with the server at
+  /// RemoteSpawn::config's grpc_url, once per process. Execute() does so
+  /// before building its first action.
+  static void NegotiateCapabilities();
+
+  /// Block until every side output queued by Execute() has been written.
+  /// Must be called before ninja exits. Returns false and fills in |err|
+  /// if any of them failed to download since the last call.
+  static bool WaitForBackgroundDownloads(std::string* err);
 
 private:
   const std::atomic_bool* stop_requested_ = nullptr;
+  std::atomic<int>* cache_hits_ = nullptr;
 };
 
 }  // namespace RemoteExecutor
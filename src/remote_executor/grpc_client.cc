@@ -16,6 +16,7 @@
 
 #include <cmath>
 #include <sstream>
+#include <stdexcept>
 #include <thread>
 
 #include "google/rpc/error_details.grpc.pb.h"
@@ -212,6 +213,11 @@ void GRPCClient::IssueRequest(const GRPCRetrier::GRPCInvocation &invocation,
     req_stats->retry_count += retrier.RetryAttempts();
   auto status = retrier.Status();
   if (!status.ok()) {
+    if (throw_on_error_) {
+      throw std::runtime_error("GRPC error " +
+                               std::to_string(status.error_code()) + ": " +
+                               status.error_message());
+    }
     Fatal("GRPC error %d: %s",
           status.error_code(), status.error_message().c_str());
   }
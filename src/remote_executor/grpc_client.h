@@ -196,6 +196,14 @@ public:
   unsigned int RetryLimit() const { return retry_limit_; }
   void SetRetryLimit(unsigned int limit) { retry_limit_ = limit; }
 
+  /// Make failed requests throw std::runtime_error instead of ending the
+  /// process, for work whose failure is reported later, like downloads
+  /// that finish after their edge.
+  bool ThrowOnError() const { return throw_on_error_; }
+  void SetThrowOnError(bool throw_on_error) {
+    throw_on_error_ = throw_on_error;
+  }
+
   std::chrono::seconds requestTimeout() const { return request_timeout_; }
   void setRequestTimeout(std::chrono::seconds& requestTimeout) {
     request_timeout_ = requestTimeout;
@@ -204,6 +212,7 @@ public:
 private:
   unsigned int retry_limit_ = 0;
   int retry_delay_ = 100;
+  bool throw_on_error_ = false;
   std::chrono::seconds request_timeout_ = std::chrono::seconds::zero();
   std::shared_ptr<grpc::Channel> channel_;
   std::string instance_name_;
@@ -0,0 +1,89 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+
+#include "multi_pattern_matcher.h"
+
+#include <queue>
+
+namespace RemoteExecutor {
+
+namespace {
+constexpr int kAlphabet = 256;
+}  // namespace
+
+MultiPatternMatcher::MultiPatternMatcher()
+    : MultiPatternMatcher(std::set<std::string>()) {}
+
+MultiPatternMatcher::MultiPatternMatcher(
+    const std::set<std::string>& patterns) {
+  // Build the trie, with -1 marking missing transitions.
+  next_.assign(kAlphabet, -1);
+  accept_.assign(1, false);
+  for (const auto& pattern : patterns) {
+    int32_t state = 0;
+    for (unsigned char c : pattern) {
+      int32_t& slot = next_[state * kAlphabet + c];
+      if (slot < 0) {
+        slot = static_cast<int32_t>(accept_.size());
+        next_.resize(next_.size() + kAlphabet, -1);
+        accept_.push_back(false);
+      }
+      state = next_[state * kAlphabet + c];
+    }
+    accept_[state] = true;
+  }
+
+  // Fill in failure transitions breadth first, so every state's failure
+  // target is complete before the state itself is visited.
+  std::vector<int32_t> fail(accept_.size(), 0);
+  std::queue<int32_t> pending;
+  for (int c = 0; c < kAlphabet; ++c) {
+    int32_t& slot = next_[c];
+    if (slot < 0) {
+      slot = 0;
+    } else {
+      pending.push(slot);
+    }
+  }
+  while (!pending.empty()) {
+    const int32_t state = pending.front();
+    pending.pop();
+    accept_[state] = accept_[state] || accept_[fail[state]];
+    for (int c = 0; c < kAlphabet; ++c) {
+      int32_t& slot = next_[state * kAlphabet + c];
+      const int32_t fallback = next_[fail[state] * kAlphabet + c];
+      if (slot < 0) {
+        slot = fallback;
+      } else {
+        fail[slot] = fallback;
+        pending.push(slot);
+      }
+    }
+  }
+}
+
+bool MultiPatternMatcher::Matches(const std::string& text) const {
+  if (accept_[0])
+    return true;
+  int32_t state = 0;
+  for (unsigned char c : text) {
+    state = next_[state * kAlphabet + c];
+    if (accept_[state])
+      return true;
+  }
+  return false;
+}
+
+}  // namespace RemoteExecutor
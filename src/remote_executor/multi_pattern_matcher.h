@@ -0,0 +1,47 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+
+#ifndef NINJA_REMOTEEXECUTOR_MULTIPATTERNMATCHER_H
+#define NINJA_REMOTEEXECUTOR_MULTIPATTERNMATCHER_H
+
+#include <stdint.h>
+
+#include <set>
+#include <string>
+#include <vector>
+
+namespace RemoteExecutor {
+
+/// Tests a string for any of a fixed set of substrings in a single pass,
+/// using an Aho-Corasick automaton compiled into a byte transition table.
+class MultiPatternMatcher {
+public:
+  MultiPatternMatcher();
+  explicit MultiPatternMatcher(const std::set<std::string>& patterns);
+
+  /// True if at least one pattern occurs in |text|. Like std::string::find,
+  /// an empty pattern matches everything.
+  bool Matches(const std::string& text) const;
+
+private:
+  // Row-major [state][byte] transitions; state 0 is the root.
+  std::vector<int32_t> next_;
+  // Whether a pattern ends at (or in a suffix of) each state.
+  std::vector<bool> accept_;
+};
+
+}  // namespace RemoteExecutor
+
+#endif  // NINJA_REMOTEEXECUTOR_MULTIPATTERNMATCHER_H
@@ -0,0 +1,65 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+
+#include "multi_pattern_matcher.h"
+
+#include <string>
+
+#include "../test.h"
+
+using namespace std;
+using RemoteExecutor::MultiPatternMatcher;
+
+TEST(MultiPatternMatcherTest, Empty) {
+  MultiPatternMatcher matcher;
+  EXPECT_FALSE(matcher.Matches(""));
+  EXPECT_FALSE(matcher.Matches("gcc -c foo.c"));
+}
+
+TEST(MultiPatternMatcherTest, Substrings) {
+  MultiPatternMatcher matcher({ "gcc ", "g++ ", "clang ", "clang++ " });
+  EXPECT_TRUE(matcher.Matches("gcc -c foo.c"));
+  EXPECT_TRUE(matcher.Matches("ccache /usr/bin/clang++ -c foo.cc"));
+  EXPECT_TRUE(matcher.Matches("x86_64-linux-gnu-g++ -c foo.cc"));
+  EXPECT_FALSE(matcher.Matches("gcc"));
+  EXPECT_FALSE(matcher.Matches("clang-format -i foo.cc"));
+  EXPECT_FALSE(matcher.Matches(""));
+}
+
+TEST(MultiPatternMatcherTest, OverlappingPatterns) {
+  // "she" and "he" share a suffix; "hers" only matches after a failure
+  // transition out of "she".
+  MultiPatternMatcher matcher({ "hers", "his", "she" });
+  EXPECT_TRUE(matcher.Matches("ushers"));
+  EXPECT_TRUE(matcher.Matches("xhis"));
+  EXPECT_TRUE(matcher.Matches("shhers"));
+  EXPECT_FALSE(matcher.Matches("hehe"));
+  EXPECT_FALSE(matcher.Matches("sh"));
+
+  MultiPatternMatcher nested({ "abcd", "bc" });
+  EXPECT_TRUE(nested.Matches("abce"));
+}
+
+TEST(MultiPatternMatcherTest, EmptyPatternMatchesEverything) {
+  MultiPatternMatcher matcher({ "", "protoc" });
+  EXPECT_TRUE(matcher.Matches(""));
+  EXPECT_TRUE(matcher.Matches("gcc -c foo.c"));
+}
+
+TEST(MultiPatternMatcherTest, NonAscii) {
+  MultiPatternMatcher matcher({ "\xe7\xbc\x96\xe8\xaf\x91" });
+  EXPECT_TRUE(matcher.Matches("echo \xe7\xbc\x96\xe8\xaf\x91 done"));
+  EXPECT_FALSE(matcher.Matches("echo \xe7\xbc\x96 done"));
+}
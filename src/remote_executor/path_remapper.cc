@@ -0,0 +1,155 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+
+#include "path_remapper.h"
+
+#include <string.h>
+
+#include "static_file_utils.h"
+
+namespace RemoteExecutor {
+
+namespace {
+
+// Characters that may precede a path inside an argument, and that end one.
+const char kPathStart[] = "=,:\"'";
+const char kPathEnd[] = "=,:\"' ";
+
+bool IsOptionChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c == '-' || c == '_' || c == '+';
+}
+
+/// Whether an absolute path may begin at |pos| of |arg|.
+bool PathStartsAt(const std::string& arg, size_t pos) {
+  if (arg[pos] != '/')
+    return false;
+  if (pos == 0)
+    return true;
+  if (strchr(kPathStart, arg[pos - 1]))
+    return true;
+  // A path joined to an option, e.g. "-I/usr/include".
+  if (arg[0] != '-')
+    return false;
+  for (size_t i = 1; i < pos; ++i) {
+    if (!IsOptionChar(arg[i]))
+      return false;
+  }
+  return true;
+}
+
+// Options whose joined value is a path, and which mean the same with the
+// path made relative.
+const char* const kPathOptions[] = { "-isystem", "-iquote", "-I", "-L", "-o",
+                                     "-MF" };
+
+std::string StripTrailingSlash(std::string path) {
+  while (path.size() > 1 && path.back() == '/')
+    path.pop_back();
+  return path;
+}
+
+}  // namespace
+
+PathRemapper::PathRemapper(const std::string& project_root,
+                           const std::string& cwd, const PrefixMap& prefix_map)
+    : project_root_(StripTrailingSlash(project_root)), cwd_(cwd) {
+  for (const auto& entry : prefix_map) {
+    if (!entry.first.empty())
+      prefix_map_.emplace_back(StripTrailingSlash(entry.first),
+                               StripTrailingSlash(entry.second));
+  }
+}
+
+std::string PathRemapper::MakeRelative(const std::string& path) const {
+  if (path.empty() || path[0] != '/' ||
+      !StaticFileUtils::HasPathPrefix(path, project_root_))
+    return path;
+  return StaticFileUtils::MakePathRelative(path, cwd_);
+}
+
+std::string PathRemapper::MapPath(const std::string& path) const {
+  std::string relative = MakeRelative(path);
+  if (relative.empty() || relative[0] != '/')
+    return relative;
+  const std::pair<std::string, std::string>* best = nullptr;
+  for (const auto& entry : prefix_map_) {
+    if (StaticFileUtils::HasPathPrefix(path, entry.first) &&
+        (!best || entry.first.size() > best->first.size()))
+      best = &entry;
+  }
+  if (!best)
+    return path;
+  return best->second + path.substr(best->first.size());
+}
+
+template <typename Func>
+std::string PathRemapper::ForEachPath(const std::string& arg,
+                                      const Func& func) {
+  if (arg.compare(0, 2, "-D") == 0)
+    return arg;
+  std::string result;
+  size_t copied = 0;
+  for (size_t pos = 0; pos < arg.size(); ++pos) {
+    if (!PathStartsAt(arg, pos))
+      continue;
+    size_t end = arg.find_first_of(kPathEnd, pos);
+    if (end == std::string::npos)
+      end = arg.size();
+    result.append(arg, copied, pos - copied);
+    result.append(func(arg.substr(pos, end - pos)));
+    copied = end;
+    pos = end;
+  }
+  if (copied == 0)
+    return arg;
+  result.append(arg, copied, std::string::npos);
+  return result;
+}
+
+std::string PathRemapper::RelativizeArgument(const std::string& arg) const {
+  if (arg.empty())
+    return arg;
+  if (arg[0] == '/')
+    return MakeRelative(arg);
+  for (const char* option : kPathOptions) {
+    size_t len = strlen(option);
+    if (arg.size() > len && arg[len] == '/' && arg.compare(0, len, option) == 0)
+      return option + MakeRelative(arg.substr(len));
+  }
+  return arg;
+}
+
+std::string PathRemapper::MapArgument(const std::string& arg) const {
+  return ForEachPath(arg, [this](const std::string& path) {
+    return MapPath(path);
+  });
+}
+
+std::vector<std::string> PathRemapper::AbsolutePaths(const std::string& arg) {
+  std::vector<std::string> paths;
+  ForEachPath(arg, [&paths](const std::string& path) {
+    paths.push_back(path);
+    return path;
+  });
+  return paths;
+}
+
+bool PathRemapper::DefinesMacro(const std::vector<std::string>& args,
+                                size_t i) {
+  return args[i].compare(0, 2, "-D") == 0 || (i > 0 && args[i - 1] == "-D");
+}
+
+}  // namespace RemoteExecutor
@@ -0,0 +1,77 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+
+#ifndef NINJA_REMOTEEXECUTOR_PATHREMAPPER_H
+#define NINJA_REMOTEEXECUTOR_PATHREMAPPER_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace RemoteExecutor {
+
+/// Rewrites the machine specific paths of an action, so the same edge built
+/// from different checkouts and home directories hashes to the same digest.
+///
+/// Paths in the project are made relative to the build directory; that keeps
+/// them valid locally. Other absolute paths go through a configured prefix
+/// map ("path_remaps"), which is only applied to what gets hashed and sent
+/// to the server.
+class PathRemapper {
+public:
+  using PrefixMap = std::vector<std::pair<std::string, std::string>>;
+
+  PathRemapper(const std::string& project_root, const std::string& cwd,
+               const PrefixMap& prefix_map = {});
+
+  /// |path| relative to the build directory if it is in the project,
+  /// otherwise unchanged.
+  std::string MakeRelative(const std::string& path) const;
+
+  /// MakeRelative(), then the longest matching prefix of the prefix map.
+  std::string MapPath(const std::string& path) const;
+
+  /// MakeRelative() for an argument that is a path, or a path joined to an
+  /// option that names a file or search directory ("-I/x", "-isystem/x",
+  /// "-iquote/x", "-L/x", "-o/x", "-MF/x"). Paths embedded anywhere else
+  /// keep their meaning only as written ("-fdebug-prefix-map=/x=.",
+  /// "-Wl,-rpath,/x"), so they are left to MapArgument().
+  std::string RelativizeArgument(const std::string& arg) const;
+
+  /// MapPath() for every absolute path in a command line argument: the
+  /// whole argument, a path joined to an option, or one following '=', ',',
+  /// ':' or a quote. Macro definitions ("-DNAME=/x") are left alone.
+  std::string MapArgument(const std::string& arg) const;
+
+  /// The absolute paths MapArgument() would look at in |arg|.
+  static std::vector<std::string> AbsolutePaths(const std::string& arg);
+
+  /// Whether |args|[i] defines a macro, as "-DNAME=value" or as the
+  /// "NAME=value" after "-D". The value ends up in the compiled code, so
+  /// its paths must stay as written.
+  static bool DefinesMacro(const std::vector<std::string>& args, size_t i);
+
+private:
+  template <typename Func>
+  static std::string ForEachPath(const std::string& arg, const Func& func);
+
+  std::string project_root_;
+  std::string cwd_;
+  PrefixMap prefix_map_;
+};
+
+}  // namespace RemoteExecutor
+
+#endif  // NINJA_REMOTEEXECUTOR_PATHREMAPPER_H
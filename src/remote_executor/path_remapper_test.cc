@@ -0,0 +1,114 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+
+#include "path_remapper.h"
+
+#include "../test.h"
+
+using namespace std;
+using RemoteExecutor::PathRemapper;
+
+namespace {
+
+PathRemapper MakeRemapper() {
+  return PathRemapper("/home/alice/proj", "/home/alice/proj/out",
+                      { { "/home/alice/toolchain/", "/toolchain" },
+                        { "/home/alice/toolchain/gcc-12", "/gcc" } });
+}
+
+}  // namespace
+
+TEST(PathRemapperTest, MakeRelative) {
+  PathRemapper remapper = MakeRemapper();
+  EXPECT_EQ("../src/a.c", remapper.MakeRelative("/home/alice/proj/src/a.c"));
+  EXPECT_EQ("gen/a.h", remapper.MakeRelative("/home/alice/proj/out/gen/a.h"));
+  EXPECT_EQ("../src/a.c", remapper.MakeRelative("../src/a.c"));
+  EXPECT_EQ("/usr/include/stdio.h",
+            remapper.MakeRelative("/usr/include/stdio.h"));
+  EXPECT_EQ("/home/alice/project2/a.c",
+            remapper.MakeRelative("/home/alice/project2/a.c"));
+}
+
+TEST(PathRemapperTest, MapPath) {
+  PathRemapper remapper = MakeRemapper();
+  EXPECT_EQ("../src/a.c", remapper.MapPath("/home/alice/proj/src/a.c"));
+  EXPECT_EQ("/toolchain/bin/ld", remapper.MapPath("/home/alice/toolchain/bin/ld"));
+  // The longest prefix wins.
+  EXPECT_EQ("/gcc/bin/g++", remapper.MapPath("/home/alice/toolchain/gcc-12/bin/g++"));
+  EXPECT_EQ("/home/alice/toolchain-old/ld",
+            remapper.MapPath("/home/alice/toolchain-old/ld"));
+  EXPECT_EQ("/usr/bin/ld", remapper.MapPath("/usr/bin/ld"));
+}
+
+TEST(PathRemapperTest, ArgumentForms) {
+  PathRemapper remapper = MakeRemapper();
+  EXPECT_EQ("../inc", remapper.RelativizeArgument("/home/alice/proj/inc"));
+  EXPECT_EQ("-I../inc", remapper.RelativizeArgument("-I/home/alice/proj/inc"));
+  EXPECT_EQ("-isystem../third_party",
+            remapper.RelativizeArgument("-isystem/home/alice/proj/third_party"));
+  EXPECT_EQ("-iquote../inc",
+            remapper.RelativizeArgument("-iquote/home/alice/proj/inc"));
+  EXPECT_EQ("-L../lib", remapper.RelativizeArgument("-L/home/alice/proj/lib"));
+  EXPECT_EQ("-oa.o", remapper.RelativizeArgument("-o/home/alice/proj/out/a.o"));
+  EXPECT_EQ("-MFa.d", remapper.RelativizeArgument("-MF/home/alice/proj/out/a.d"));
+  // Embedded paths mean something only as written: a relative prefix map
+  // matches nothing, and a relative rpath is resolved at run time.
+  EXPECT_EQ("-fdebug-prefix-map=/home/alice/proj=.",
+            remapper.RelativizeArgument("-fdebug-prefix-map=/home/alice/proj=."));
+  EXPECT_EQ("-Wl,-rpath,/home/alice/proj/lib:/usr/lib",
+            remapper.RelativizeArgument("-Wl,-rpath,/home/alice/proj/lib:/usr/lib"));
+  // Hashed as relative paths, so every checkout gets the same key.
+  EXPECT_EQ("-fdebug-prefix-map=..=.",
+            remapper.MapArgument("-fdebug-prefix-map=/home/alice/proj=."));
+  EXPECT_EQ("-Wl,-rpath,../lib:/usr/lib",
+            remapper.MapArgument("-Wl,-rpath,/home/alice/proj/lib:/usr/lib"));
+  // Macro values are compiled in; changing them changes the program.
+  EXPECT_EQ("-DROOT=\"/home/alice/proj\"",
+            remapper.RelativizeArgument("-DROOT=\"/home/alice/proj\""));
+  // Not at a path boundary.
+  EXPECT_EQ("a/home/alice/proj", remapper.RelativizeArgument("a/home/alice/proj"));
+  EXPECT_EQ("-O2", remapper.RelativizeArgument("-O2"));
+
+  EXPECT_EQ("--sysroot=/toolchain/sysroot",
+            remapper.MapArgument("--sysroot=/home/alice/toolchain/sysroot"));
+  EXPECT_EQ("-B/gcc/libexec",
+            remapper.MapArgument("-B/home/alice/toolchain/gcc-12/libexec"));
+  EXPECT_EQ("-DTOOLS=/home/alice/toolchain",
+            remapper.MapArgument("-DTOOLS=/home/alice/toolchain"));
+  // RelativizeArgument leaves the prefix map alone.
+  EXPECT_EQ("--sysroot=/home/alice/toolchain/sysroot",
+            remapper.RelativizeArgument("--sysroot=/home/alice/toolchain/sysroot"));
+}
+
+TEST(PathRemapperTest, AbsolutePaths) {
+  vector<string> paths = PathRemapper::AbsolutePaths(
+      "-fdebug-prefix-map=/home/bob/proj=/proj");
+  ASSERT_EQ(2u, paths.size());
+  EXPECT_EQ("/home/bob/proj", paths[0]);
+  EXPECT_EQ("/proj", paths[1]);
+  EXPECT_TRUE(PathRemapper::AbsolutePaths("../src/a.c").empty());
+  EXPECT_TRUE(PathRemapper::AbsolutePaths("-DROOT=/home/bob/proj").empty());
+}
+
+TEST(PathRemapperTest, DefinesMacro) {
+  const vector<string> args = { "gcc", "-DA=/x", "-D", "B=/y", "-I/z",
+                                "-DEBUG" };
+  EXPECT_FALSE(PathRemapper::DefinesMacro(args, 0));
+  EXPECT_TRUE(PathRemapper::DefinesMacro(args, 1));
+  EXPECT_TRUE(PathRemapper::DefinesMacro(args, 2));
+  EXPECT_TRUE(PathRemapper::DefinesMacro(args, 3));
+  EXPECT_FALSE(PathRemapper::DefinesMacro(args, 4));
+  EXPECT_TRUE(PathRemapper::DefinesMacro(args, 5));
+}
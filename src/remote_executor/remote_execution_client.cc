@@ -14,9 +14,14 @@
 
 #include "remote_execution_client.h"
 
+#include <condition_variable>
+#include <functional>
 #include <iomanip>
+#include <mutex>
 #include <random>
 #include <sstream>
+#include <stdexcept>
+#include <thread>
 
 #include "google/rpc/code.pb.h"
 
@@ -79,38 +84,114 @@ void CancelOperation(const std::string &op_name,
   Info("Cancelled job %s", op_name);
 }
 
-using ReaderPointer = grpc::ClientAsyncReaderInterface<Operation>*;
-
-bool ReadOperation(grpc::CompletionQueue* cq, ReaderPointer reader,
-                   Operation* op, const std::atomic_bool& stop_req,
-                   Operations::StubInterface* op_sub,
-                   GRPCClient* exec_grpc) {
-  bool logged = false;
-  reader->Read(op, nullptr);
-  while (true) {
-    void *tag;
-    bool ok;
-    const auto deadline = std::chrono::system_clock::now() + POLL_WAIT;
-    const auto status = cq->AsyncNext(&tag, &ok, deadline);
-    if (status == grpc::CompletionQueue::GOT_EVENT) {
-      if (!ok)
-        break; // No more messages in the stream
-      if (!logged && !op->name().empty())
-        logged = true;
-      if (op->done())
-        break;
-      // Previous read is complete, start read of next message
-      reader->Read(op, nullptr);
-    } else if (stop_req) {
-      cq->Shutdown();
-      Warning("Cancelling job, operation name: %s", op->name().c_str());
-      // Cancel the operation if the execution service gave it a name
-      if (!op->name().empty())
-        CancelOperation(op->name(), op_sub, exec_grpc);
-      return false; // Indicate cancellation
+using OperationReader = grpc::ClientAsyncReaderInterface<Operation>;
+
+/// Drives every Execute and WaitExecution stream in the process from one
+/// completion queue and thread. Callers just sleep until their stream
+/// ends, instead of each owning a queue and a polling loop.
+class OperationStreams {
+public:
+  static OperationStreams* Get() {
+    static OperationStreams streams;
+    return &streams;
+  }
+
+  using StartFunc =
+      std::function<std::unique_ptr<OperationReader>(grpc::CompletionQueue*)>;
+
+  /// Run the stream created by |start| on |context| until it ends, storing
+  /// each message in |operation|. If |stop_requested| is set the call is
+  /// cancelled and CANCELLED returned. |received| counts the messages.
+  grpc::Status Run(grpc::ClientContext* context, const StartFunc& start,
+                   Operation* operation, const std::atomic_bool& stop_requested,
+                   int* received);
+
+private:
+  struct Stream {
+    enum Stage { kStarting, kReading, kFinishing };
+    std::unique_ptr<OperationReader> reader;
+    Operation incoming;
+    grpc::Status status;
+    Stage stage = kStarting;
+    // Keeps the stream alive while the queue still refers to it.
+    std::shared_ptr<Stream> self;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    Operation* operation = nullptr;
+    int received = 0;
+    bool finished = false;
+  };
+
+  OperationStreams() : thread_([this]() { Loop(); }) {}
+  ~OperationStreams() {
+    cq_.Shutdown();
+    thread_.join();
+  }
+
+  void Loop();
+
+  grpc::CompletionQueue cq_;
+  std::thread thread_;
+};
+
+grpc::Status OperationStreams::Run(grpc::ClientContext* context,
+                                   const StartFunc& start,
+                                   Operation* operation,
+                                   const std::atomic_bool& stop_requested,
+                                   int* received) {
+  auto stream = std::make_shared<Stream>();
+  stream->operation = operation;
+  stream->self = stream;
+  stream->reader = start(&cq_);
+  stream->reader->StartCall(stream.get());
+
+  std::unique_lock<std::mutex> lock(stream->mutex);
+  bool cancelled = false;
+  while (!stream->finished) {
+    stream->cv.wait_for(lock, POLL_WAIT);
+    if (!cancelled && !stream->finished && stop_requested) {
+      context->TryCancel();
+      cancelled = true;
+    }
+  }
+  *received = stream->received;
+  if (cancelled)
+    return grpc::Status(grpc::CANCELLED, "Operation was cancelled");
+  return stream->status;
+}
+
+void OperationStreams::Loop() {
+  void* tag;
+  bool ok;
+  while (cq_.Next(&tag, &ok)) {
+    Stream* stream = static_cast<Stream*>(tag);
+    switch (stream->stage) {
+    case Stream::kStarting:
+    case Stream::kReading:
+      if (ok && stream->stage == Stream::kReading) {
+        std::lock_guard<std::mutex> lock(stream->mutex);
+        *stream->operation = stream->incoming;
+        ++stream->received;
+      }
+      if (ok && !(stream->stage == Stream::kReading &&
+                  stream->incoming.done())) {
+        stream->stage = Stream::kReading;
+        stream->reader->Read(&stream->incoming, stream);
+      } else {
+        stream->stage = Stream::kFinishing;
+        stream->reader->Finish(&stream->status, stream);
+      }
+      break;
+    case Stream::kFinishing: {
+      std::shared_ptr<Stream> keep = std::move(stream->self);
+      std::lock_guard<std::mutex> lock(stream->mutex);
+      stream->finished = true;
+      stream->cv.notify_all();
+      break;
+    }
     }
   }
-  return true;
 }
 
 bool RemoteExecutionClient::FetchFromActionCache(const Digest &action_digest,
@@ -119,6 +200,7 @@ bool RemoteExecutionClient::FetchFromActionCache(const Digest &action_digest,
     Fatal("ActionCache Stub not Configured");
   GetActionResultRequest action_req;
   action_req.set_instance_name(ac_grpc_->InstanceName());
+  action_req.set_digest_function(CASHash::DigestFunction());
   action_req.set_inline_stdout(true);
   action_req.set_inline_stderr(true);
   for (const auto &o : outputs) {
@@ -149,6 +231,7 @@ bool RemoteExecutionClient::UpdateToActionCache(const Digest &action_digest, Act
     Fatal("ActionCache Stub not Configured");
   UpdateActionResultRequest action_req;
   action_req.set_instance_name(ac_grpc_->InstanceName());
+  action_req.set_digest_function(CASHash::DigestFunction());
   action_req.mutable_action_digest()->CopyFrom(action_digest);
   *action_req.mutable_action_result() = *result;
 
@@ -176,49 +259,81 @@ ActionResult RemoteExecutionClient::ExecuteAction(const Digest &action_digest,
     Fatal("Execution Stubs not Configured");
   ExecuteRequest execute_request;
   execute_request.set_instance_name(exec_grpc_->InstanceName());
+  execute_request.set_digest_function(CASHash::DigestFunction());
   *execute_request.mutable_action_digest() = action_digest;
   execute_request.set_skip_cache_lookup(skip_cache);
 
+  // Once the server has named the operation, a broken stream is resumed
+  // with WaitExecution rather than by queueing the action again.
   Operation operation;
+  int empty_streams = 0;
   auto execute_lambda = [&](grpc::ClientContext &context) {
-    grpc::CompletionQueue cq;
-    void *tag;
-    bool ok;
-    auto reader_ptr = exec_stub_->AsyncExecute(&context, execute_request,
-                                               &cq, nullptr);
-    if (!cq.Next(&tag, &ok) || !ok) {
-      return grpc::Status(grpc::UNAVAILABLE,
-                          "Failed to send Execute request to the server");
-    }
-    if (!ReadOperation(&cq, reader_ptr.get(), &operation, stop_requested,
-                       op_stub_.get(), exec_grpc_)) {
-      return grpc::Status(grpc::CANCELLED, "Operation was cancelled");
-    }
-
+    const std::string name = operation.name();
+    int received = 0;
     grpc::Status status;
-    reader_ptr->Finish(&status, nullptr);
-    if (!cq.Next(&tag, &ok) || !ok) {
-      return grpc::Status(grpc::UNAVAILABLE,
-                          "Failed to finish Execute client stream");
+    if (name.empty()) {
+      status = OperationStreams::Get()->Run(&context,
+          [&](grpc::CompletionQueue* cq) {
+            return exec_stub_->PrepareAsyncExecute(&context, execute_request,
+                                                   cq);
+          }, &operation, stop_requested, &received);
+    } else {
+      WaitExecutionRequest wait_request;
+      wait_request.set_name(name);
+      status = OperationStreams::Get()->Run(&context,
+          [&](grpc::CompletionQueue* cq) {
+            return exec_stub_->PrepareAsyncWaitExecution(&context,
+                                                         wait_request, cq);
+          }, &operation, stop_requested, &received);
+      if (status.error_code() == grpc::StatusCode::NOT_FOUND) {
+        // The server forgot the operation; only now is resubmitting right.
+        Warning("Operation %s expired, executing action again", name.c_str());
+        operation.Clear();
+        return grpc::Status::OK;
+      }
+    }
+    if (status.error_code() == grpc::StatusCode::CANCELLED &&
+        stop_requested) {
+      if (!operation.name().empty())
+        CancelOperation(operation.name(), op_stub_.get(), exec_grpc_);
     }
+    empty_streams = received == 0 ? empty_streams + 1 : 0;
+    // A dropped connection is resumed below like any other early close.
+    if (status.error_code() == grpc::StatusCode::UNAVAILABLE &&
+        !operation.name().empty())
+      return grpc::Status::OK;
     return status;
   };
-  exec_grpc_->IssueRequest(execute_lambda, "Execution.Execute()", nullptr);
-
-  if (!operation.done())
-    Fatal("Server closed stream before Operation finished");
+  // Load balancers may close a healthy stream before the operation is
+  // done; that is not an error, just a reason to resume.
+  constexpr int kMaxEmptyStreams = 10;
+  while (!operation.done()) {
+    exec_grpc_->IssueRequest(execute_lambda, operation.name().empty()
+        ? "Execution.Execute()" : "Execution.WaitExecution()", nullptr);
+    if (operation.done())
+      break;
+    if (empty_streams >= kMaxEmptyStreams)
+      Fatal("Server keeps closing stream before Operation finished");
+    if (empty_streams > 0)
+      std::this_thread::sleep_for(POLL_WAIT * empty_streams);
+  }
   return GetActionResult(operation);
 }
 
-void CheckDownloadBlobsResult(const CASClient::DownloadBlobsResult &results) {
+void CheckDownloadBlobsResult(const CASClient::DownloadBlobsResult &results,
+                              bool throw_on_error) {
   std::vector<std::string> missing_blobs;
   for (const auto &result : results) {
     const auto &status = result.second.first;
     if (status.code() == grpc::StatusCode::NOT_FOUND) {
       missing_blobs.push_back(result.first);
     } else if (status.code() != grpc::StatusCode::OK) {
-      Fatal("Failed to download output blob %s: [%s] %s", result.first,
-            std::to_string(status.code()), status.message());
+      std::ostringstream error;
+      error << "Failed to download output blob " << result.first << ": ["
+            << status.code() << "] " << status.message();
+      if (throw_on_error)
+        throw std::runtime_error(error.str());
+      Fatal("%s", error.str().c_str());
     }
   }
   if (!missing_blobs.empty()) {
@@ -233,7 +348,9 @@ void CheckDownloadBlobsResult(const CASClient::DownloadBlobsResult &results) {
       error << hash;
       first = false;
     }
-    Fatal(error.str().c_str());
+    if (throw_on_error)
+      throw std::runtime_error(error.str());
+    Fatal("%s", error.str().c_str());
   }
 }
 
@@ -319,7 +436,7 @@ void RemoteExecutionClient::DownloadOutputs(
 
   const auto downloaded_trees = cas_client->DownloadBlobs(
     std::vector<Digest>(tree_digests.cbegin(), tree_digests.cend()));
-  CheckDownloadBlobsResult(downloaded_trees);
+  CheckDownloadBlobsResult(downloaded_trees, cas_client->ThrowOnError());
 
   std::unordered_set<Digest> file_digests, duplicate_file_digests;
   std::unordered_map<Digest, Directory> digest_directory_map;
@@ -373,7 +490,7 @@ void RemoteExecutionClient::DownloadOutputs(
   const auto downloaded_files = cas_client->DownloadBlobsToDirectory(
       std::vector<Digest>(file_digests.cbegin(), file_digests.cend()),
       temp_dirfd.Get());
-  CheckDownloadBlobsResult(downloaded_files);
+  CheckDownloadBlobsResult(downloaded_files, cas_client->ThrowOnError());
 
   for (const auto &file : action_result.output_files()) {
     CreateParentDirectory(dirfd, file.path());
@@ -14,7 +14,12 @@
 
 #include "remote_spawn.h"
 
+#include <algorithm>
+#include <unordered_map>
+
 #include "compile_command_parser.h"
+#include "multi_pattern_matcher.h"
+#include "path_remapper.h"
 #include "../build.h"
 #include "../graph.h"
 #include "../remote_process.h"
@@ -23,12 +28,13 @@ namespace RemoteExecutor {
 
 const BuildConfig* RemoteSpawn::config = nullptr;
 
-RemoteSpawn* RemoteSpawn::CreateRemoteSpawn(Edge* edge) {
-  RemoteSpawn* spawn = new RemoteSpawn(edge, CanExecuteRemotelly(edge));
+RemoteSpawn* RemoteSpawn::CreateRemoteSpawn(
+    Edge* edge, const std::vector<const Node*>& targets) {
   std::string command = edge->EvaluateCommand();
-  std::string rule = edge->rule().name();
+  RemoteSpawn* spawn = new RemoteSpawn(edge, Classify(edge, command));
   spawn->origin_command = command;
   spawn->command = command;
+  spawn->local_command = command;
   spawn->arguments = std::move(SplitStrings(command));
 
   for (std::size_t i = 0; i < edge->inputs_.size(); i++) {
@@ -36,8 +42,27 @@ RemoteSpawn* RemoteSpawn::CreateRemoteSpawn(Edge* edge) {
     if (!edge->is_order_only(i))
       spawn->inputs.emplace_back(cur_input);
   }
-  for (auto out_node : edge->outputs_)
+  // Ninja stats the outputs of restat and generator edges as soon as they
+  // finish, and parses the depfile, so those must always land first.
+  const bool stats_outputs = edge->GetBindingBool("restat") ||
+                             edge->GetBindingBool("generator");
+  const std::string depfile = edge->GetUnescapedDepfile();
+  for (auto out_node : edge->outputs_) {
     spawn->outputs.emplace_back(out_node->path());
+    if (!stats_outputs && out_node->out_edges().empty() &&
+        out_node->path() != depfile &&
+        std::find(targets.begin(), targets.end(), out_node) == targets.end())
+      spawn->side_outputs.emplace_back(out_node->path());
+  }
+  // Compiler edges get their depfile from the deps scan. For other cached
+  // edges, ninja reads it right after the edge finishes, so a cache hit has
+  // to bring it along.
+  if (spawn->can_cache && !spawn->can_remote && !depfile.empty()) {
+    spawn->depfile = depfile;
+    if (std::find(spawn->outputs.begin(), spawn->outputs.end(), depfile) ==
+        spawn->outputs.end())
+      spawn->outputs.emplace_back(depfile);
+  }
   return spawn;
 }
 
@@ -53,8 +78,9 @@ std::vector<std::string> RemoteSpawn::GetHeaderFiles() {
     outputs.emplace_back(dep);
   }
   auto headers = CompileCommandParser::ParseHeaders(result);
+  const PathRemapper remapper = MakePathRemapper();
   for (auto& header : headers) {
-    res.emplace_back(header);
+    res.emplace_back(remapper.MakeRelative(header));
   }
   if (res.empty()) {
     Warning("command [%s] get headerfiles fail", origin_command.c_str());
@@ -84,88 +110,98 @@ void RemoteSpawn::CleanCommand() {
   }
   command = cleaned;
   this->origin_command = command;
-  this->command = command;
   this->arguments = std::move(SplitStrings(command));
+  RelativizeArguments(MakePathRemapper());
 }
 
-bool RemoteSpawn::CanExecuteRemotelly(Edge* edge) {
-  if (!edge)
-    return false;
-  std::string command = edge->EvaluateCommand();
-  std::string rule = edge->rule().name();
-  
-  if (config->rbe_config.local_only_rules.find(rule) != config->rbe_config.local_only_rules.end()){
-    return false;
-  }
-  for (auto &cmd : config->rbe_config.local_only_fuzzy){
-    if(command.find(cmd)!=std::string::npos || rule.find(cmd)!=std::string::npos){
-      return false;
-    }
+namespace {
+
+/// The rbe_config rule lists compiled for fast matching, plus the per rule
+/// part of the decision.
+struct EligibilityRules {
+  explicit EligibilityRules(const BuildConfig* config)
+      : config(config),
+        local_only_fuzzy(config->rbe_config.local_only_fuzzy),
+        remote_commands(CompileCommandParser::SupportedRemoteExecuteCommands()) {}
+
+  struct RuleClass {
+    bool local_only;     // every edge must run locally
+    bool remote_cache;   // listed in remote_cache_rules
+  };
+
+  const RuleClass& Lookup(const Rule* rule) {
+    const std::string& name = rule->name();
+    auto it = rule_cache.find(name);
+    if (it != rule_cache.end())
+      return it->second;
+    RuleClass rule_class;
+    rule_class.local_only = config->rbe_config.local_only_rules.count(name) ||
+                            local_only_fuzzy.Matches(name);
+    rule_class.remote_cache = config->rbe_config.remote_cache_rules.count(name);
+    return rule_cache.emplace(name, rule_class).first->second;
   }
-  for (auto& it : CompileCommandParser::SupportedRemoteExecuteCommands())
-    if (command.find(it) != std::string::npos)
-      return true;
-  return false;
+
+  const BuildConfig* const config;
+  const MultiPatternMatcher local_only_fuzzy;
+  const MultiPatternMatcher remote_commands;
+  // Keyed by name: the class only depends on it, and a Rule freed by a
+  // manifest reload may have its address reused by a different rule.
+  std::unordered_map<std::string, RuleClass> rule_cache;
+};
+
+/// Whether the action of an opted in edge would cover everything it reads:
+/// a depfile or deps log entry must have been recorded by an earlier build.
+bool DependenciesKnown(const Edge* edge) {
+  if (edge->GetBinding("deps").empty() && edge->GetBinding("depfile").empty())
+    return true;
+  return edge->deps_loaded_ && !edge->deps_missing_;
 }
 
-bool RemoteSpawn::CanCacheRemotelly(Edge* edge) {
+}  // namespace
+
+RemoteEligibility RemoteSpawn::Classify(const Edge* edge,
+                                        const std::string& command) {
+  RemoteEligibility eligibility;
   if (!edge)
-    return false;
-  std::string command = edge->EvaluateCommand();
-  std::string rule = edge->rule().name();
+    return eligibility;
+  static std::unique_ptr<EligibilityRules> rules;
+  if (!rules || rules->config != config)
+    rules.reset(new EligibilityRules(config));
 
-  if (config->rbe_config.local_only_rules.find(rule) != config->rbe_config.local_only_rules.end()){
-    return false;
-  }
-  for (auto &cmd:config->rbe_config.local_only_fuzzy){
-    if (command.find(cmd)!=std::string::npos || rule.find(cmd)!=std::string::npos){
-      return false;
-    }
-  }
-  for (auto& it : CompileCommandParser::SupportedRemoteExecuteCommands())
-    if (command.find(it) != std::string::npos)
-      return true;
-  
-  return false;
+  const auto& rule_class = rules->Lookup(&edge->rule());
+  if (rule_class.local_only || rules->local_only_fuzzy.Matches(command))
+    return eligibility;
+  if (rules->remote_commands.Matches(command)) {
+    eligibility.can_execute = true;
+    eligibility.can_cache = true;
+  } else if (rule_class.remote_cache ||
+             edge->GetBindingBool("remote_cache")) {
+    // Opted in: hit the action cache, but run locally on a miss.
+    eligibility.can_cache = DependenciesKnown(edge);
+  }
+  return eligibility;
 }
 
-enum OptType { relaPath, absPath, symbol, option, toolPath, errPath = -1 };
-
-OptType OptionType(const std::string& option) {
-  if (option.empty())
-    return OptType::errPath;
-  if (option[0] == '/') {
-    const auto& prj_root = RemoteSpawn::config->rbe_config.project_root;
-    return StaticFileUtils::HasPathPrefix(option, prj_root)
-        ? OptType::absPath : OptType::toolPath;
-  }
-  if ((option[0] >= 'A' && option[0] <= 'Z') ||
-      (option[0] >= 'a' && option[0] <= 'z') || (option[0] == '_')) {
-    return OptType::relaPath;
-  }
-  if ((option[0] == '-') &&
-      (option[1] == 'I' || option[1] == 'L' || option[1] == 'l')) {
-    return OptType::option;
-  }
-  return OptType::symbol;
+PathRemapper RemoteSpawn::MakePathRemapper() {
+  return PathRemapper(config->rbe_config.project_root, config->rbe_config.cwd,
+                      config->rbe_config.path_remaps);
 }
 
 void RemoteSpawn::ConvertAllPathToRelative() {
-  for (auto& input : inputs) {
-    if (OptionType(input) == OptType::absPath)
-      input = StaticFileUtils::MakePathRelative(input, config->rbe_config.cwd);
-  }
-  for (auto& output : outputs) {
-    if (OptionType(output) == OptType::absPath)
-      output = StaticFileUtils::MakePathRelative(output, config->rbe_config.cwd);
-  }
-  for (auto& arg : arguments) {
-    auto opt = OptionType(arg);
-    if (opt == OptType::absPath)
-      arg = StaticFileUtils::MakePathRelative(arg, config->rbe_config.cwd);
-    else if (opt == OptType::option)
-      arg = arg.substr(0,2) +
-            StaticFileUtils::MakePathRelative(arg.substr(2), config->rbe_config.cwd);
+  const PathRemapper remapper = MakePathRemapper();
+  for (auto& input : inputs)
+    input = remapper.MakeRelative(input);
+  for (auto& output : outputs)
+    output = remapper.MakeRelative(output);
+  for (auto& output : side_outputs)
+    output = remapper.MakeRelative(output);
+  RelativizeArguments(remapper);
+}
+
+void RemoteSpawn::RelativizeArguments(const PathRemapper& remapper) {
+  for (size_t i = 0; i < arguments.size(); ++i) {
+    if (!PathRemapper::DefinesMacro(arguments, i))
+      arguments[i] = remapper.RelativizeArgument(arguments[i]);
   }
   command = MergeStrings(arguments);
 }
@@ -20,33 +20,65 @@
 #include <vector>
 
 #include "../build.h"
+#include "path_remapper.h"
 
 struct BuildConfig;
 struct Edge;
+struct Node;
 
 namespace RemoteExecutor {
 
+/// Where an edge may run, decided once when its RemoteSpawn is created.
+struct RemoteEligibility {
+  bool can_execute = false;  // may run on the remote executor
+  bool can_cache = false;    // may use the remote action cache
+};
+
 struct RemoteSpawn {
-  static RemoteSpawn* CreateRemoteSpawn(Edge* edge);
-  static bool CanExecuteRemotelly(Edge* edge);
-  static bool CanCacheRemotelly(Edge* edge);
+  /// |targets| are the targets of the build, which are never side outputs:
+  /// they must be in place when ninja reports the build done.
+  static RemoteSpawn* CreateRemoteSpawn(
+      Edge* edge, const std::vector<const Node*>& targets = {});
+
+  /// Classify |edge| given its already evaluated |command|. Checks that only
+  /// depend on the rule are remembered per rule name. Not thread safe: call it
+  /// from the main loop only.
+  static RemoteEligibility Classify(const Edge* edge,
+                                    const std::string& command);
 
   std::vector<std::string> GetHeaderFiles();
   void CleanCommand();
+  /// Make the project paths in inputs, outputs and arguments relative to
+  /// the build directory.
   void ConvertAllPathToRelative();
+  void RelativizeArguments(const PathRemapper& remapper);
+
+  /// The path remapping configured for this build.
+  static PathRemapper MakePathRemapper();
 
   static const BuildConfig* config;
 
   std::string command;
   std::string origin_command;
+  /// The command exactly as ninja evaluated it. Local runs use it; the
+  /// normalized forms above only go into the action.
+  std::string local_command;
   std::string rule;
   std::vector<std::string> arguments;
   std::vector<std::string> inputs;
   std::vector<std::string> outputs;
+  // Outputs no other edge reads and that are not targets of the build.
+  // Their download may finish after the edge is reported done.
+  std::vector<std::string> side_outputs;
+  // The depfile of a cache-only edge, which is one of its outputs.
+  std::string depfile;
 
-  RemoteSpawn(Edge* ed, bool remote) : edge(ed), can_remote(remote) {}
+  RemoteSpawn(Edge* ed, const RemoteEligibility& eligibility)
+      : edge(ed), can_remote(eligibility.can_execute),
+        can_cache(eligibility.can_cache) {}
   Edge* edge;
   bool can_remote;
+  bool can_cache;
   // private:
   //   RemoteSpawn() = default;
 };
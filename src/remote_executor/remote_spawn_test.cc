@@ -0,0 +1,178 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+
+#include "remote_spawn.h"
+
+#include <unistd.h>
+
+#include "execution_context.h"
+#include "../build.h"
+#include "../graph.h"
+#include "../test.h"
+
+using namespace std;
+using RemoteExecutor::RemoteEligibility;
+using RemoteExecutor::RemoteSpawn;
+using RemoteExecutor::RunLocally;
+
+namespace {
+
+struct RemoteSpawnTest : public StateTestWithBuiltinRules {
+  virtual void SetUp() {
+    config_.cloud_run = true;
+    config_.rbe_config.local_only_rules.insert("link");
+    config_.rbe_config.remote_cache_rules.insert("codegen");
+    RemoteSpawn::config = &config_;
+  }
+  virtual void TearDown() { RemoteSpawn::config = NULL; }
+
+  RemoteEligibility Classify(const char* output) {
+    Edge* edge = GetNode(output)->in_edge();
+    return RemoteSpawn::Classify(edge, edge->EvaluateCommand());
+  }
+
+  BuildConfig config_;
+};
+
+}  // namespace
+
+TEST_F(RemoteSpawnTest, Classify) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cc\n"
+"  command = gcc -c $in -o $out\n"
+"rule link\n"
+"  command = gcc $in -o $out\n"
+"rule codegen\n"
+"  command = python gen.py $in $out\n"
+"rule stamp\n"
+"  command = touch $out\n"
+"rule protoc\n"
+"  command = protoc $in -o $out\n"
+"  remote_cache = 1\n"
+"rule gendeps\n"
+"  command = python gen.py $in $out $out.d\n"
+"  depfile = $out.d\n"
+"  remote_cache = 1\n"
+"build a.o: cc a.c\n"
+"build a: link a.o\n"
+"build b.c: codegen b.in\n"
+"build s: stamp\n"
+"build p.pb: protoc p.proto\n"
+"build d.c: gendeps d.in\n"));
+
+  RemoteEligibility e = Classify("a.o");
+  EXPECT_TRUE(e.can_execute);
+  EXPECT_TRUE(e.can_cache);
+
+  // Local only rules win over the command.
+  e = Classify("a");
+  EXPECT_FALSE(e.can_execute);
+  EXPECT_FALSE(e.can_cache);
+
+  // Opted in by rbe_config or by the remote_cache binding: cache only.
+  e = Classify("b.c");
+  EXPECT_FALSE(e.can_execute);
+  EXPECT_TRUE(e.can_cache);
+  e = Classify("p.pb");
+  EXPECT_FALSE(e.can_execute);
+  EXPECT_TRUE(e.can_cache);
+
+  e = Classify("s");
+  EXPECT_FALSE(e.can_execute);
+  EXPECT_FALSE(e.can_cache);
+
+  // Not cached until its depfile dependencies have been recorded.
+  Edge* edge = GetNode("d.c")->in_edge();
+  edge->deps_loaded_ = true;
+  edge->deps_missing_ = true;
+  EXPECT_FALSE(Classify("d.c").can_cache);
+  edge->deps_missing_ = false;
+  EXPECT_TRUE(Classify("d.c").can_cache);
+}
+
+TEST_F(RemoteSpawnTest, SideOutputs) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule cc\n"
+"  command = gcc -c $in -o $out\n"
+"build a.o a.map: cc a.c\n"
+"build b.o b.map: cc b.c\n"
+"build app: cat a.o b.o\n"));
+
+  // a.map is read by nothing, so it may arrive after its edge is done.
+  std::unique_ptr<RemoteSpawn> spawn(
+      RemoteSpawn::CreateRemoteSpawn(GetNode("a.o")->in_edge()));
+  ASSERT_EQ(1u, spawn->side_outputs.size());
+  EXPECT_EQ("a.map", spawn->side_outputs[0]);
+
+  // Unless it was asked for, when it has to be there at the end.
+  const vector<const Node*> targets = { GetNode("app"), GetNode("b.map") };
+  spawn.reset(RemoteSpawn::CreateRemoteSpawn(GetNode("b.o")->in_edge(),
+                                             targets));
+  EXPECT_TRUE(spawn->side_outputs.empty());
+}
+
+namespace {
+
+/// Run |command| as a cache-only action would and return what it wrote.
+string RunLocallyOutput(const string& command, ExitStatus* status) {
+  int fds[2];
+  if (pipe(fds) < 0)
+    return "";
+  *status = RunLocally(command, fds[1]);
+  close(fds[1]);
+  string output;
+  char buf[256];
+  ssize_t len;
+  while ((len = read(fds[0], buf, sizeof(buf))) > 0)
+    output.append(buf, len);
+  close(fds[0]);
+  return output;
+}
+
+}  // namespace
+
+// A cache-only edge that fails locally must fail the build with its output,
+// and must not be treated as a result worth caching.
+TEST(RunLocallyTest, CacheOnlyEdgeFails) {
+  ExitStatus status = ExitSuccess;
+  EXPECT_EQ("oops\n", RunLocallyOutput("echo oops; exit 3", &status));
+  EXPECT_EQ(ExitFailure, status);
+}
+
+TEST(RunLocallyTest, CacheOnlyEdgeSucceeds) {
+  ExitStatus status = ExitFailure;
+  EXPECT_EQ("fine\n", RunLocallyOutput("echo fine", &status));
+  EXPECT_EQ(ExitSuccess, status);
+}
+
+// Normalizing the command for the action must not change what runs locally.
+TEST_F(RemoteSpawnTest, LocalCommand) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"rule say\n"
+"  command = echo \"a  b\" /proj/src/a.c\n"
+"build out: say\n"));
+  config_.rbe_config.project_root = "/proj";
+  config_.rbe_config.cwd = "/proj/out";
+  Edge* edge = GetNode("out")->in_edge();
+  std::unique_ptr<RemoteSpawn> spawn(RemoteSpawn::CreateRemoteSpawn(edge));
+  spawn->ConvertAllPathToRelative();
+  EXPECT_NE(edge->EvaluateCommand(), spawn->command);
+  EXPECT_EQ(edge->EvaluateCommand(), spawn->local_command);
+
+  ExitStatus status = ExitFailure;
+  EXPECT_EQ("a  b /proj/src/a.c\n",
+            RunLocallyOutput(spawn->local_command, &status));
+  EXPECT_EQ(ExitSuccess, status);
+}
@@ -0,0 +1,139 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+#include "zstd_stream.h"
+
+#include <zstd.h>
+
+#include "../util.h"
+
+namespace RemoteExecutor {
+
+namespace {
+// Build outputs are mostly object code and debug info, where higher levels
+// buy little extra ratio but cost far more CPU than the link saves.
+constexpr int kCompressionLevel = 1;
+}  // namespace
+
+ZstdCompressStream::ZstdCompressStream() : ctx_(ZSTD_createCCtx()) {
+  if (!ctx_)
+    Fatal("Error creating zstd compression context");
+  ZSTD_CCtx_setParameter(ctx_, ZSTD_c_compressionLevel, kCompressionLevel);
+}
+
+ZstdCompressStream::~ZstdCompressStream() {
+  ZSTD_freeCCtx(ctx_);
+}
+
+void ZstdCompressStream::Compress(const char* data, size_t size, bool last,
+                                  std::string* out) {
+  ZSTD_inBuffer input = { data, size, 0 };
+  const ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+  const size_t step = ZSTD_CStreamOutSize();
+  for (;;) {
+    const size_t used = out->size();
+    out->resize(used + step);
+    ZSTD_outBuffer output = { &(*out)[used], step, 0 };
+    const size_t remaining = ZSTD_compressStream2(ctx_, &output, &input, mode);
+    if (ZSTD_isError(remaining))
+      Fatal("zstd compression failed: %s", ZSTD_getErrorName(remaining));
+    out->resize(used + output.pos);
+    // With ZSTD_e_continue all input is consumed once pos reaches size; with
+    // ZSTD_e_end the frame is complete once nothing remains to flush.
+    if (last ? remaining == 0 : input.pos == input.size)
+      break;
+  }
+}
+
+std::string ZstdCompressStream::CompressAll(const std::string& data) {
+  std::string out(ZSTD_compressBound(data.size()), '\0');
+  const size_t size = ZSTD_compress(&out[0], out.size(), data.data(),
+                                    data.size(), kCompressionLevel);
+  if (ZSTD_isError(size))
+    Fatal("zstd compression failed: %s", ZSTD_getErrorName(size));
+  out.resize(size);
+  return out;
+}
+
+ZstdDecompressStream::ZstdDecompressStream()
+    : ctx_(ZSTD_createDCtx()), buffer_(ZSTD_DStreamOutSize()) {
+  if (!ctx_)
+    Fatal("Error creating zstd decompression context");
+}
+
+ZstdDecompressStream::~ZstdDecompressStream() {
+  ZSTD_freeDCtx(ctx_);
+}
+
+bool ZstdDecompressStream::Decompress(const char* data, size_t size,
+                                      const OutputFunc& output,
+                                      std::string* err) {
+  ZSTD_inBuffer input = { data, size, 0 };
+  for (;;) {
+    if (finished_ && input.pos < input.size) {
+      *err = "trailing data after zstd frame";
+      return false;
+    }
+    ZSTD_outBuffer out = { buffer_.data(), buffer_.size(), 0 };
+    const size_t ret = ZSTD_decompressStream(ctx_, &out, &input);
+    if (ZSTD_isError(ret)) {
+      *err = ZSTD_getErrorName(ret);
+      return false;
+    }
+    if (out.pos > 0)
+      output(buffer_.data(), out.pos);
+    finished_ = ret == 0;
+    // A full output buffer may mean the decoder still holds data.
+    if (input.pos == input.size && out.pos < out.size)
+      return true;
+  }
+}
+
+bool ZstdDecompressStream::DecompressAll(const std::string& data,
+                                         size_t expected_size,
+                                         std::string* out, std::string* err) {
+  out->assign(expected_size, '\0');
+  const size_t size = ZSTD_decompress(&(*out)[0], expected_size, data.data(),
+                                      data.size());
+  if (ZSTD_isError(size)) {
+    *err = ZSTD_getErrorName(size);
+    return false;
+  }
+  if (size != expected_size) {
+    *err = "decompressed " + std::to_string(size) + " bytes, expected " +
+           std::to_string(expected_size);
+    return false;
+  }
+  return true;
+}
+
+ZstdResumableDecompress::ZstdResumableDecompress(const OutputFunc& output)
+    : output_(output) {}
+
+int64_t ZstdResumableDecompress::Restart() {
+  // The server compresses each read afresh, so nothing of an earlier
+  // frame's compressed bytes or decoder state carries over.
+  stream_.reset(new ZstdDecompressStream);
+  return offset_;
+}
+
+bool ZstdResumableDecompress::Decompress(const char* data, size_t size,
+                                         std::string* err) {
+  return stream_->Decompress(data, size, [this](const char* out, size_t n) {
+    output_(out, n);
+    offset_ += n;
+  }, err);
+}
+
+} // namespace RemoteExecutor
@@ -0,0 +1,112 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+#ifndef NINJA_REMOTEEXECUTOR_ZSTDSTREAM_H
+#define NINJA_REMOTEEXECUTOR_ZSTDSTREAM_H
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
+namespace RemoteExecutor {
+
+/// Compresses a blob into a single zstd frame one chunk at a time, so
+/// uploads of large outputs never hold more than a chunk in memory.
+class ZstdCompressStream {
+public:
+  ZstdCompressStream();
+  ~ZstdCompressStream();
+
+  /// Feed |size| bytes and append whatever compressed output is ready to
+  /// |out|. |last| ends the frame and flushes everything that is left.
+  void Compress(const char* data, size_t size, bool last, std::string* out);
+
+  /// Compress a whole in-memory blob, e.g. for batch requests.
+  static std::string CompressAll(const std::string& data);
+
+private:
+  ZstdCompressStream(const ZstdCompressStream&) = delete;
+  void operator=(const ZstdCompressStream&) = delete;
+
+  ZSTD_CCtx_s* ctx_;
+};
+
+/// Decompresses a zstd frame received in arbitrary pieces.
+class ZstdDecompressStream {
+public:
+  using OutputFunc = std::function<void(const char* data, size_t size)>;
+
+  ZstdDecompressStream();
+  ~ZstdDecompressStream();
+
+  /// Feed |size| compressed bytes, passing decompressed data to |output|
+  /// as it becomes available. Returns false and fills |err| on corrupt
+  /// input.
+  bool Decompress(const char* data, size_t size, const OutputFunc& output,
+                  std::string* err);
+
+  /// True once the end of the frame has been decoded.
+  bool Finished() const { return finished_; }
+
+  /// Decompress a whole frame that must expand to exactly |expected_size|
+  /// bytes.
+  static bool DecompressAll(const std::string& data, size_t expected_size,
+                            std::string* out, std::string* err);
+
+private:
+  ZstdDecompressStream(const ZstdDecompressStream&) = delete;
+  void operator=(const ZstdDecompressStream&) = delete;
+
+  ZSTD_DCtx_s* ctx_;
+  std::vector<char> buffer_;
+  bool finished_ { false };
+};
+
+/// Decompresses a blob read from compressed-blobs/, where a read that broke
+/// off is resumed with a new zstd frame that starts at the uncompressed
+/// offset reached so far. Output already passed on is never repeated.
+class ZstdResumableDecompress {
+public:
+  using OutputFunc = ZstdDecompressStream::OutputFunc;
+
+  explicit ZstdResumableDecompress(const OutputFunc& output);
+
+  /// Drop any partly read frame and return the uncompressed offset the
+  /// next read must start at. Call before every read, including the first.
+  int64_t Restart();
+
+  /// Feed |size| bytes of the current frame. Returns false and fills |err|
+  /// on corrupt input.
+  bool Decompress(const char* data, size_t size, std::string* err);
+
+  /// True once the current frame has been decoded to its end.
+  bool Finished() const { return stream_ && stream_->Finished(); }
+
+  /// The uncompressed bytes passed to the output so far.
+  int64_t offset() const { return offset_; }
+
+private:
+  OutputFunc output_;
+  std::unique_ptr<ZstdDecompressStream> stream_;
+  int64_t offset_ { 0 };
+};
+
+} // namespace RemoteExecutor
+
+#endif // NINJA_REMOTEEXECUTOR_ZSTDSTREAM_H
@@ -0,0 +1,116 @@
+/****************************************************************************
+ * Copyright (c) CloudBuild Team. 2023. All rights reserved.
+ * Licensed under GNU Affero General Public License v3 (AGPL-3.0) .
+ * You can use this software according to the terms and conditions of the
+ * AGPL-3.0.
+ * You may obtain a copy of AGPL-3.0 at:
+ *     https://www.gnu.org/licenses/agpl-3.0.txt
+ *
+ * THIS SOFTWARE IS PROVIDED ON AN "AS IS" BASIS, WITHOUT WARRANTIES OF ANY
+ * KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FIT FOR A PARTICULAR PURPOSE.
+ * See the AGPL-3.0 for more details.
+ ****************************************************************************/
+
+#include "zstd_stream.h"
+
+#include <string>
+
+#include "../test.h"
+
+using namespace std;
+using RemoteExecutor::ZstdCompressStream;
+using RemoteExecutor::ZstdDecompressStream;
+using RemoteExecutor::ZstdResumableDecompress;
+
+namespace {
+
+// Somewhat compressible data, like object code.
+string MakeBlob(size_t size) {
+  string blob(size, '\0');
+  uint32_t x = 1;
+  for (size_t i = 0; i < size; ++i) {
+    x = x * 1103515245 + 12345;
+    blob[i] = (i % 7 == 0) ? static_cast<char>(x >> 24) : static_cast<char>(i / 64);
+  }
+  return blob;
+}
+
+}  // namespace
+
+TEST(ZstdStreamTest, ChunkedRoundTrip) {
+  const string blob = MakeBlob(3 * 1024 * 1024 + 17);
+  const size_t kChunk = 1024 * 1024;
+
+  ZstdCompressStream compressor;
+  string compressed;
+  for (size_t offset = 0; offset < blob.size(); offset += kChunk) {
+    const size_t n = min(kChunk, blob.size() - offset);
+    compressor.Compress(blob.data() + offset, n, offset + n == blob.size(),
+                        &compressed);
+  }
+  EXPECT_LT(compressed.size(), blob.size());
+
+  // Feed the frame back in odd-sized pieces.
+  ZstdDecompressStream decompressor;
+  string output, err;
+  for (size_t offset = 0; offset < compressed.size(); offset += 4099) {
+    const size_t n = min<size_t>(4099, compressed.size() - offset);
+    ASSERT_TRUE(decompressor.Decompress(
+        compressed.data() + offset, n,
+        [&output](const char* data, size_t size) { output.append(data, size); },
+        &err)) << err;
+  }
+  EXPECT_TRUE(decompressor.Finished());
+  EXPECT_EQ(blob, output);
+
+  string all;
+  EXPECT_TRUE(ZstdDecompressStream::DecompressAll(compressed, blob.size(),
+                                                  &all, &err)) << err;
+  EXPECT_EQ(blob, all);
+}
+
+TEST(ZstdStreamTest, DetectsBadInput) {
+  const string blob = MakeBlob(100000);
+  const string compressed = ZstdCompressStream::CompressAll(blob);
+  string out, err;
+
+  EXPECT_FALSE(ZstdDecompressStream::DecompressAll(compressed, blob.size() - 1,
+                                                   &out, &err));
+
+  ZstdDecompressStream truncated;
+  EXPECT_TRUE(truncated.Decompress(compressed.data(), compressed.size() / 2,
+                                   [](const char*, size_t) {}, &err));
+  EXPECT_FALSE(truncated.Finished());
+
+  ZstdDecompressStream garbage;
+  EXPECT_FALSE(garbage.Decompress("not zstd", 8, [](const char*, size_t) {},
+                                  &err));
+  EXPECT_FALSE(err.empty());
+}
+
+TEST(ZstdStreamTest, ResumesInterruptedRead) {
+  const string blob = MakeBlob(1024 * 1024 + 5);
+  string output, err;
+  ZstdResumableDecompress decompressor(
+      [&output](const char* data, size_t size) { output.append(data, size); });
+
+  // The first read breaks off partway through its frame.
+  ASSERT_EQ(0, decompressor.Restart());
+  const string first = ZstdCompressStream::CompressAll(blob);
+  ASSERT_TRUE(decompressor.Decompress(first.data(), first.size() / 2, &err))
+      << err;
+  EXPECT_FALSE(decompressor.Finished());
+  ASSERT_GT(decompressor.offset(), 0);
+  ASSERT_LT(decompressor.offset(), static_cast<int64_t>(blob.size()));
+  EXPECT_EQ(blob.substr(0, output.size()), output);
+
+  // The retry is a new frame holding only the rest of the blob.
+  const int64_t offset = decompressor.Restart();
+  EXPECT_EQ(static_cast<int64_t>(output.size()), offset);
+  const string second = ZstdCompressStream::CompressAll(blob.substr(offset));
+  ASSERT_TRUE(decompressor.Decompress(second.data(), second.size(), &err))
+      << err;
+  EXPECT_TRUE(decompressor.Finished());
+  EXPECT_EQ(blob, output);
+}
@@ -40,7 +40,8 @@ RemoteProcess::~RemoteProcess() {
 }
 
 void RemoteProcess::WorkThread(RemoteExecutor::RemoteSpawn* spawn, int fd,
-                               RemoteProcess* rproc) {
+                               RemoteProcess* rproc, RemoteProcessSet* set) {
+  ++set->started_;
   std::vector<std::string> headerfiles = spawn->GetHeaderFiles();
   for (std::size_t i = 0; i < headerfiles.size(); i++)
     spawn->inputs.emplace_back(headerfiles[i]);
@@ -53,8 +54,10 @@ void RemoteProcess::Start(struct RemoteProcessSet* set) {
     Fatal("==> pipe: %s", strerror(errno));
   fd_ = pipe_[0];
   context_->SetStopToken(stop_token);
+  context_->SetCacheHitCounter(set->cache_hits_);
   spawn_->ConvertAllPathToRelative();
-  Task task = std::bind(RemoteProcess::WorkThread, spawn_, pipe_[1], this);
+  Task task =
+      std::bind(RemoteProcess::WorkThread, spawn_, pipe_[1], this, set);
   set->thread_pool_->AddTask(task);
 }
 
@@ -83,17 +86,22 @@ bool RemoteProcess::Done() const {
   return fd_ == -1;
 }
 
-RemoteProcessSet::RemoteProcessSet(int pool_size) {
+RemoteProcessSet::RemoteProcessSet(int pool_size)
+    : added_(0), started_(0), cache_hits_(0) {
   thread_pool_ = CreateRemoteBuildThreadPool(pool_size);
 }
 
 RemoteProcessSet::~RemoteProcessSet() {
   delete thread_pool_;
+  // Failures were reported by the build already, unless it was cut short.
+  std::string err;
+  RemoteExecutor::ExecutionContext::WaitForBackgroundDownloads(&err);
 }
 
 RemoteProcess* RemoteProcessSet::Add(RemoteExecutor::RemoteSpawn* spawn) {
   RemoteProcess* rproc = new RemoteProcess();
   rproc->spawn_ = spawn;
+  ++added_;
   rproc->Start(this);
   running_.push_back(rproc);
   return rproc;
@@ -276,6 +284,10 @@ void RemoteProcessSet::Clear() {
   running_.clear();
 }
 
+int RemoteProcessSet::QueuedCount() const {
+  return added_ - started_;
+}
+
 bool RemoteProcessSet::ThreadPoolAlreadyFull() const {
   return thread_pool_->HasWaitingTask();
 }
@@ -15,6 +15,7 @@
 #ifndef NINJA_REMOTEPROCESS_H_
 #define NINJA_REMOTEPROCESS_H_
 
+#include <atomic>
 #include <memory>
 #include <queue>
 
@@ -43,7 +44,7 @@ private:
   void OnPipeReady();
 
   static void WorkThread(RemoteExecutor::RemoteSpawn* spawn, int fd,
-                         RemoteProcess* rproc);
+                         RemoteProcess* rproc, struct RemoteProcessSet* set);
 
   int fd_;
   int pipe_[2];
@@ -67,9 +68,18 @@ struct RemoteProcessSet {
   void Clear();
   bool ThreadPoolAlreadyFull() const;
 
+  /// Processes waiting for a thread of the pool.
+  int QueuedCount() const;
+
   std::vector<RemoteProcess*> running_;
   std::queue<RemoteProcess*> finished_;
 
+  /// Processes added, and those a thread of the pool started on.
+  int added_;
+  std::atomic<int> started_;
+  /// Processes whose action was found in the action cache.
+  std::atomic<int> cache_hits_;
+
   RemoteBuildThreadPool* thread_pool_;
 };
 
@@ -0,0 +1,447 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "server.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "util.h"
+
+using namespace std;
+
+const char kServerSocketPath[] = ".ninja_server";
+const char kServerBuildEnv[] = "NINJA_SERVER_BUILD";
+
+extern char** environ;
+
+namespace {
+
+/// Whether inotify sees every change to the files of a directory on the
+/// file system of type |type|, from statfs(). Remote and FUSE file systems
+/// change without the local kernel knowing.
+bool IsLocalFileSystem(uint32_t type) {
+  switch (type) {
+  case 0x6969:      // NFS
+  case 0x517b:      // SMB
+  case 0xfe534d42:  // SMB2
+  case 0xff534d42:  // CIFS
+  case 0x65735546:  // FUSE
+  case 0x01021997:  // 9P
+  case 0x5346414f:  // AFS
+  case 0x00c36400:  // Ceph
+  case 0x73757245:  // Coda
+  case 0x47504653:  // GPFS
+  case 0x0bd00bd0:  // Lustre
+    return false;
+  default:
+    return true;
+  }
+}
+
+bool MakeAddress(sockaddr_un* addr) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  strcpy(addr->sun_path, kServerSocketPath);
+  return true;
+}
+
+/// Read exactly |size| bytes, retrying after signals.
+bool ReadAll(int fd, void* data, size_t size) {
+  char* p = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t len = read(fd, p, size);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      return false;
+    p += len;
+    size -= len;
+  }
+  return true;
+}
+
+bool SendAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t len = send(fd, data, size, MSG_NOSIGNAL);
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len < 0)
+      return false;
+    data += len;
+    size -= len;
+  }
+  return true;
+}
+
+pid_t g_server_pid;
+
+void ForwardSignal(int /* signum */) {
+  // The server interrupts the build and reports back; keep waiting.
+  kill(g_server_pid, SIGINT);
+}
+
+}  // namespace
+
+// A request is a list of NUL-terminated fields: the input file, the flags
+// and then the targets.
+string ServerRequest::Serialize() const {
+  char flags[128];
+  int len = snprintf(flags, sizeof(flags), "%d %d %.17g %d %d %zu",
+                     parallelism, failures_allowed, max_load_average,
+                     verbosity, dry_run, environment.size());
+  string data = input_file;
+  data.push_back('\0');
+  data.append(flags, len);
+  data.push_back('\0');
+  data.append(debug_flags);
+  data.push_back('\0');
+  for (size_t i = 0; i < environment.size(); ++i) {
+    data.append(environment[i]);
+    data.push_back('\0');
+  }
+  for (size_t i = 0; i < targets.size(); ++i) {
+    data.append(targets[i]);
+    data.push_back('\0');
+  }
+  return data;
+}
+
+bool ServerRequest::Parse(const string& data) {
+  vector<string> fields;
+  for (size_t start = 0; start < data.size();) {
+    size_t end = data.find('\0', start);
+    if (end == string::npos)
+      return false;
+    fields.push_back(data.substr(start, end - start));
+    start = end + 1;
+  }
+  if (fields.size() < 3)
+    return false;
+  int dry = 0;
+  size_t env_size = 0;
+  if (sscanf(fields[1].c_str(), "%d %d %lf %d %d %zu", &parallelism,
+             &failures_allowed, &max_load_average, &verbosity, &dry,
+             &env_size) != 6 ||
+      env_size > fields.size() - 3)
+    return false;
+  input_file = fields[0];
+  dry_run = dry != 0;
+  debug_flags = fields[2];
+  environment.assign(fields.begin() + 3, fields.begin() + 3 + env_size);
+  targets.assign(fields.begin() + 3 + env_size, fields.end());
+  return true;
+}
+
+vector<string> CurrentEnvironment() {
+  vector<string> env;
+  for (char** var = environ; *var; ++var) {
+    // Set by each shell for itself; commands get their own.
+    if (strncmp(*var, "SHLVL=", 6) == 0 || strncmp(*var, "_=", 2) == 0 ||
+        strncmp(*var, "OLDPWD=", 7) == 0)
+      continue;
+    env.push_back(*var);
+  }
+  sort(env.begin(), env.end());
+  return env;
+}
+
+ServerClient::~ServerClient() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool ServerClient::Connect() {
+  sockaddr_un addr;
+  MakeAddress(&addr);
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0)
+    return false;
+  if (connect(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+    close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+bool ServerClient::Run(const ServerRequest& request, int* exit_code,
+                       string* err) {
+  ucred peer;
+  socklen_t peer_size = sizeof(peer);
+  if (getsockopt(fd_, SOL_SOCKET, SO_PEERCRED, &peer, &peer_size) < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+
+  // The request is its length and then its data. The descriptors travel
+  // with the length.
+  string data = request.Serialize();
+  uint32_t size = data.size();
+  int fds[2] = { 1, 2 };
+  char control[CMSG_SPACE(sizeof(fds))];
+  memset(control, 0, sizeof(control));
+  iovec iov = { &size, sizeof(size) };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+  fflush(stdout);
+  fflush(stderr);
+  if (sendmsg(fd_, &msg, MSG_NOSIGNAL) != sizeof(size) ||
+      !SendAll(fd_, data.data(), data.size())) {
+    *err = strerror(errno);
+    return false;
+  }
+
+  g_server_pid = peer.pid;
+  struct sigaction act, old_int, old_term, old_hup;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = ForwardSignal;
+  sigaction(SIGINT, &act, &old_int);
+  sigaction(SIGTERM, &act, &old_term);
+  sigaction(SIGHUP, &act, &old_hup);
+  int32_t result;
+  bool ok = ReadAll(fd_, &result, sizeof(result));
+  sigaction(SIGINT, &old_int, NULL);
+  sigaction(SIGTERM, &old_term, NULL);
+  sigaction(SIGHUP, &old_hup, NULL);
+  if (!ok) {
+    *err = "lost connection to the ninja server";
+    return false;
+  }
+  *exit_code = result;
+  return true;
+}
+
+ServerConnection::~ServerConnection() {
+  if (fd_ >= 0)
+    close(fd_);
+  if (stdout_fd_ >= 0)
+    close(stdout_fd_);
+  if (stderr_fd_ >= 0)
+    close(stderr_fd_);
+}
+
+void ServerConnection::Finish(int exit_code) {
+  int32_t result = exit_code;
+  SendAll(fd_, reinterpret_cast<const char*>(&result), sizeof(result));
+  close(fd_);
+  fd_ = -1;
+}
+
+ServerListener::~ServerListener() {
+  if (fd_ >= 0) {
+    close(fd_);
+    unlink(kServerSocketPath);
+  }
+}
+
+bool ServerListener::Listen(string* err) {
+  ServerClient other;
+  if (other.Connect()) {
+    *err = "a ninja server is already running in this directory";
+    return false;
+  }
+  // Nobody answers, so any socket file is left over from a dead server.
+  unlink(kServerSocketPath);
+
+  sockaddr_un addr;
+  MakeAddress(&addr);
+  fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd_ < 0 ||
+      bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+      listen(fd_, 16) < 0) {
+    *err = string(kServerSocketPath) + ": " + strerror(errno);
+    if (fd_ >= 0)
+      close(fd_);
+    fd_ = -1;
+    return false;
+  }
+  return true;
+}
+
+bool ServerListener::Accept(ServerConnection* connection, string* err) {
+  connection->fd_ = accept4(fd_, NULL, NULL, SOCK_CLOEXEC);
+  if (connection->fd_ < 0) {
+    *err = strerror(errno);
+    return false;
+  }
+
+  // The socket's permissions depend on the umask and the directory; only
+  // build for the user the server runs as, whatever they allow.
+  ucred peer;
+  socklen_t peer_len = sizeof(peer);
+  if (getsockopt(connection->fd_, SOL_SOCKET, SO_PEERCRED, &peer,
+                 &peer_len) < 0) {
+    *err = string("SO_PEERCRED: ") + strerror(errno);
+    return false;
+  }
+  if (peer.uid != geteuid()) {
+    *err = "refusing a request from uid " + std::to_string(peer.uid);
+    return false;
+  }
+
+  uint32_t size = 0;
+  int fds[2];
+  char control[CMSG_SPACE(sizeof(fds))];
+  iovec iov = { &size, sizeof(size) };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+  ssize_t len;
+  do {
+    len = recvmsg(connection->fd_, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+  } while (len < 0 && errno == EINTR);
+  // Another server checking whether this one is running.
+  if (len == 0)
+    return false;
+  cmsghdr* cmsg = len == sizeof(size) ? CMSG_FIRSTHDR(&msg) : NULL;
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+      cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+    *err = "malformed request";
+    return false;
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  connection->stdout_fd_ = fds[0];
+  connection->stderr_fd_ = fds[1];
+
+  const uint32_t kMaxRequestSize = 64 << 20;
+  string data(size, '\0');
+  if (size > kMaxRequestSize ||
+      !ReadAll(connection->fd_, &data[0], data.size()) ||
+      !connection->request_.Parse(data)) {
+    *err = "malformed request";
+    return false;
+  }
+  return true;
+}
+
+FileWatcher::~FileWatcher() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool FileWatcher::Init(string* err) {
+  fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd_ < 0) {
+    *err = string("inotify_init1: ") + strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+bool FileWatcher::Watch(const string& dir, string* err) {
+  const uint32_t kMask = IN_ATTRIB | IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE |
+                         IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+                         IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+  struct statfs fs;
+  if (statfs(dir.c_str(), &fs) < 0) {
+    *err = dir + ": " + strerror(errno);
+    return false;
+  }
+  if (!IsLocalFileSystem(static_cast<uint32_t>(fs.f_type))) {
+    *err = dir + ": not on a local file system";
+    return false;
+  }
+  for (size_t end = dir.find('/', 1);; end = dir.find('/', end + 1)) {
+    struct stat st;
+    const string component = dir.substr(0, end);
+    if (lstat(component.c_str(), &st) == 0 && S_ISLNK(st.st_mode)) {
+      *err = dir + ": " + component + " is a symlink";
+      return false;
+    }
+    if (end == string::npos)
+      break;
+  }
+  int wd = inotify_add_watch(fd_, dir.c_str(), kMask);
+  if (wd < 0) {
+    *err = dir + ": " + strerror(errno);
+    return false;
+  }
+  vector<string>& dirs = dirs_[wd];
+  if (find(dirs.begin(), dirs.end(), dir) == dirs.end())
+    dirs.push_back(dir);
+  return true;
+}
+
+bool FileWatcher::Reports(const string& path) {
+  struct stat st;
+  return lstat(path.c_str(), &st) < 0 || !S_ISLNK(st.st_mode);
+}
+
+bool FileWatcher::ReadChanges(vector<string>* paths) {
+  bool complete = true;
+  char buf[64 << 10]
+      __attribute__((aligned(__alignof__(struct inotify_event))));
+  for (;;) {
+    ssize_t len = read(fd_, buf, sizeof(buf));
+    if (len < 0 && errno == EINTR)
+      continue;
+    if (len <= 0)
+      break;
+    for (char* p = buf; p < buf + len;) {
+      const inotify_event* event = reinterpret_cast<inotify_event*>(p);
+      p += sizeof(inotify_event) + event->len;
+      if (event->mask & IN_Q_OVERFLOW) {
+        complete = false;
+        continue;
+      }
+      map<int, vector<string> >::iterator dir = dirs_.find(event->wd);
+      if (dir == dirs_.end())
+        continue;
+      if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+        // Everything in the directory may be gone, and nothing in it will
+        // be reported from now on.
+        dirs_.erase(dir);
+        complete = false;
+        continue;
+      }
+      if (event->len == 0)
+        continue;
+      for (size_t i = 0; i < dir->second.size(); ++i) {
+        const string& name = dir->second[i];
+        if (name == ".")
+          paths->push_back(event->name);
+        else if (name == "/")
+          paths->push_back(name + event->name);
+        else
+          paths->push_back(name + "/" + event->name);
+      }
+    }
+  }
+  return complete;
+}
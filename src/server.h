@@ -0,0 +1,153 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NINJA_SERVER_H_
+#define NINJA_SERVER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+/// Support for "ninja -t serve": a ninja that keeps the build graph, the
+/// logs and file timestamps loaded and runs the builds asked for by other
+/// ninja invocations in the same directory. Those connect to it over a
+/// Unix socket and hand over their stdout and stderr, so the build prints
+/// straight to their terminal. Linux only.
+
+/// The socket a server listens on, in the directory it builds in.
+extern const char kServerSocketPath[];
+
+/// Set in the environment of the commands a server runs, so that a ninja
+/// they start builds by itself instead of waiting on the busy server.
+extern const char kServerBuildEnv[];
+
+/// Sent instead of an exit code when the client should build by itself.
+const int kServerDeclined = -1;
+
+/// What a client asks a server to build: its targets and the flags that
+/// may differ from the server's own command line, along with what the
+/// server needs to check that it would build the same way the client
+/// would.
+struct ServerRequest {
+  ServerRequest()
+      : parallelism(1), failures_allowed(1), max_load_average(-0.0f),
+        verbosity(0), dry_run(false) {}
+
+  std::string input_file;
+  int parallelism;
+  int failures_allowed;
+  double max_load_average;
+  int verbosity;
+  bool dry_run;
+  /// The -d and -w flags in effect. The server declines a request whose
+  /// flags differ from its own.
+  std::string debug_flags;
+  /// The client's environment, as from CurrentEnvironment(). Commands run
+  /// in the server's, so it declines a request whose environment differs.
+  std::vector<std::string> environment;
+  std::vector<std::string> targets;
+
+  std::string Serialize() const;
+  bool Parse(const std::string& data);
+};
+
+/// The variables in the environment of this process, sorted, without the
+/// ones a shell keeps for itself (SHLVL, _ and OLDPWD).
+std::vector<std::string> CurrentEnvironment();
+
+/// The client end of a connection.
+struct ServerClient {
+  ServerClient() : fd_(-1) {}
+  ~ServerClient();
+
+  /// Connect to the server for the current directory.
+  /// Returns false if there is none.
+  bool Connect();
+
+  /// Send |request| along with our stdout and stderr and wait for the
+  /// build to finish, forwarding SIGINT to the server meanwhile.
+  /// Returns false and fills in |err| if the connection broke.
+  bool Run(const ServerRequest& request, int* exit_code, std::string* err);
+
+ private:
+  int fd_;
+};
+
+/// A client's request as the server received it.
+struct ServerConnection {
+  ServerConnection() : fd_(-1), stdout_fd_(-1), stderr_fd_(-1) {}
+  ~ServerConnection();
+
+  /// Send the result and hang up.
+  void Finish(int exit_code);
+
+  ServerRequest request_;
+  int fd_;
+  int stdout_fd_;
+  int stderr_fd_;
+};
+
+/// The listening socket of a server.
+struct ServerListener {
+  ServerListener() : fd_(-1) {}
+  ~ServerListener();
+
+  /// Start listening, unless another server already is.
+  bool Listen(std::string* err);
+
+  /// Accept a connection and read its request. Returns false and fills in
+  /// |err| if the client runs as another user or sent something malformed,
+  /// or leaves |err| empty if it hung up without a request.
+  bool Accept(ServerConnection* connection, std::string* err);
+
+  int fd() const { return fd_; }
+
+ private:
+  int fd_;
+};
+
+/// Reports changes to the files in a set of directories, with inotify.
+struct FileWatcher {
+  FileWatcher() : fd_(-1) {}
+  ~FileWatcher();
+
+  bool Init(std::string* err);
+
+  /// Start watching directory |dir| ("." for the current one). Fails if it
+  /// can't be watched, for example because it doesn't exist yet, or if
+  /// inotify might miss changes to it: on network and FUSE file systems,
+  /// which change behind the kernel's back, and when a component of its
+  /// path is a symlink, which could be pointed elsewhere unseen.
+  bool Watch(const std::string& dir, std::string* err);
+
+  /// Whether a change to |path| is reported once its directory is watched.
+  /// A symlink's is not: only changes to the link itself are seen, not
+  /// those to its target.
+  static bool Reports(const std::string& path);
+
+  /// Append the paths ("dir/name") of files that changed since the last
+  /// call to |paths|, without blocking. Returns false if changes were lost
+  /// and every file has to be assumed changed.
+  bool ReadChanges(std::vector<std::string>* paths);
+
+  int fd() const { return fd_; }
+
+ private:
+  int fd_;
+  /// The directories of each watch. A directory reachable through several
+  /// paths shares one watch.
+  std::map<int, std::vector<std::string> > dirs_;
+};
+
+#endif  // NINJA_SERVER_H_
@@ -0,0 +1,189 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "server.h"
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <thread>
+
+#include "test.h"
+
+using namespace std;
+
+namespace {
+
+TEST(ServerRequestTest, RoundTrip) {
+  ServerRequest request;
+  request.input_file = "build.ninja";
+  request.parallelism = 12;
+  request.failures_allowed = 0;
+  request.max_load_average = 2.5;
+  request.verbosity = 3;
+  request.dry_run = true;
+  request.debug_flags = "explain,dupbuild=err";
+  request.environment.push_back("A=1");
+  request.environment.push_back("B=");
+  request.targets.push_back("all");
+  request.targets.push_back("");
+  request.targets.push_back("a b^");
+
+  ServerRequest parsed;
+  ASSERT_TRUE(parsed.Parse(request.Serialize()));
+  EXPECT_EQ("build.ninja", parsed.input_file);
+  EXPECT_EQ(12, parsed.parallelism);
+  EXPECT_EQ(0, parsed.failures_allowed);
+  EXPECT_EQ(2.5, parsed.max_load_average);
+  EXPECT_EQ(3, parsed.verbosity);
+  EXPECT_TRUE(parsed.dry_run);
+  EXPECT_EQ("explain,dupbuild=err", parsed.debug_flags);
+  EXPECT_EQ(request.environment, parsed.environment);
+  EXPECT_EQ(request.targets, parsed.targets);
+}
+
+TEST(ServerRequestTest, Malformed) {
+  ServerRequest request;
+  EXPECT_FALSE(request.Parse(""));
+  EXPECT_FALSE(request.Parse(string("build.ninja\0", 12)));
+  EXPECT_FALSE(request.Parse(string("build.ninja\0" "1 2 3\0\0", 19)));
+  // Not terminated.
+  EXPECT_FALSE(request.Parse(string("build.ninja\0" "1 1 0 2 0 0\0\0all",
+                                    28)));
+  // More environment variables than fields.
+  EXPECT_FALSE(request.Parse(string("build.ninja\0" "1 1 0 2 0 2\0\0A=1\0",
+                                    29)));
+}
+
+struct ServerTest : public testing::Test {
+  virtual void SetUp() { temp_dir_.CreateAndEnter("Ninja-ServerTest"); }
+  virtual void TearDown() { temp_dir_.Cleanup(); }
+
+  ScopedTempDir temp_dir_;
+};
+
+TEST_F(ServerTest, Request) {
+  ServerClient unconnected;
+  EXPECT_FALSE(unconnected.Connect());
+
+  ServerListener listener;
+  string err;
+  ASSERT_TRUE(listener.Listen(&err)) << err;
+
+  ServerRequest request;
+  request.input_file = "build.ninja";
+  request.targets.push_back("all");
+  ServerConnection connection;
+  thread server([&] {
+    ASSERT_TRUE(listener.Accept(&connection, &err)) << err;
+    connection.Finish(7);
+  });
+  ServerClient client;
+  ASSERT_TRUE(client.Connect());
+  int exit_code = 0;
+  string client_err;
+  EXPECT_TRUE(client.Run(request, &exit_code, &client_err)) << client_err;
+  server.join();
+  EXPECT_EQ(7, exit_code);
+  EXPECT_EQ(request.targets, connection.request_.targets);
+  EXPECT_GE(connection.stdout_fd_, 0);
+  EXPECT_GE(connection.stderr_fd_, 0);
+
+  ServerListener second;
+  EXPECT_FALSE(second.Listen(&err));
+}
+
+TEST_F(ServerTest, RejectsOtherUsers) {
+  if (geteuid() != 0) {
+    printf("Run as root to test requests from another user\n");
+    return;
+  }
+  ServerListener listener;
+  string err;
+  ASSERT_TRUE(listener.Listen(&err)) << err;
+  // Let anyone reach the socket, so only the server's own check stops them.
+  ASSERT_EQ(0, chmod(".", 0777));
+  ASSERT_EQ(0, chmod(kServerSocketPath, 0777));
+
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    if (setuid(65534) != 0)
+      _exit(2);
+    ServerClient client;
+    if (!client.Connect())
+      _exit(3);
+    ServerRequest request;
+    int exit_code = 0;
+    client.Run(request, &exit_code, &err);
+    _exit(0);
+  }
+  {
+    // Hanging up lets the client finish.
+    ServerConnection connection;
+    EXPECT_FALSE(listener.Accept(&connection, &err));
+    EXPECT_EQ("refusing a request from uid 65534", err);
+  }
+  int status = 0;
+  ASSERT_EQ(pid, waitpid(pid, &status, 0));
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+}
+
+TEST_F(ServerTest, FileWatcher) {
+  FileWatcher watcher;
+  string err;
+  ASSERT_TRUE(watcher.Init(&err)) << err;
+  ASSERT_EQ(0, mkdir("sub", 0777));
+  ASSERT_TRUE(watcher.Watch(".", &err)) << err;
+  ASSERT_TRUE(watcher.Watch("sub", &err)) << err;
+  EXPECT_FALSE(watcher.Watch("missing", &err));
+
+  vector<string> paths;
+  EXPECT_TRUE(watcher.ReadChanges(&paths));
+  EXPECT_TRUE(paths.empty());
+
+  FILE* f = fopen("sub/a", "w");
+  ASSERT_TRUE(f);
+  fclose(f);
+  ASSERT_EQ(0, rename("sub/a", "b"));
+  EXPECT_TRUE(watcher.ReadChanges(&paths));
+  sort(paths.begin(), paths.end());
+  paths.erase(unique(paths.begin(), paths.end()), paths.end());
+  ASSERT_EQ(2u, paths.size());
+  EXPECT_EQ("b", paths[0]);
+  EXPECT_EQ("sub/a", paths[1]);
+
+  // Only changes to a symlink itself are reported, not to its target.
+  EXPECT_TRUE(FileWatcher::Reports("b"));
+  EXPECT_TRUE(FileWatcher::Reports("missing"));
+  ASSERT_EQ(0, symlink("b", "link"));
+  EXPECT_FALSE(FileWatcher::Reports("link"));
+  // Nor are changes under a symlinked directory, which may be repointed.
+  ASSERT_EQ(0, symlink("sub", "sublink"));
+  EXPECT_FALSE(watcher.Watch("sublink", &err));
+  unlink("link");
+  unlink("sublink");
+
+  // Losing a directory loses track of its files.
+  paths.clear();
+  ASSERT_EQ(0, rmdir("sub"));
+  EXPECT_FALSE(watcher.ReadChanges(&paths));
+  unlink("b");
+}
+
+}  // namespace
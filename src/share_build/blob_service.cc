@@ -0,0 +1,263 @@
+#include "blob_service.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <climits>
+#include <cstdlib>
+#include <set>
+#include <vector>
+
+#include "../remote_executor/cas_client.h"
+#include "../remote_executor/static_file_utils.h"
+
+using RemoteExecutor::CASClient;
+using RemoteExecutor::CASHash;
+using RemoteExecutor::StaticFileUtils;
+
+namespace {
+
+int64_t MtimeNs(const struct stat& st) {
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+std::string RealPath(const std::string& path) {
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved) == nullptr)
+        return path;
+    return resolved;
+}
+
+// Whether |path| stays below the directory it is relative to.
+bool IsContainedPath(const std::string& path) {
+    if (path.empty() || path.front() == '/')
+        return false;
+    size_t start = 0;
+    while (start <= path.size()) {
+        size_t end = path.find('/', start);
+        if (end == std::string::npos)
+            end = path.size();
+        if (path.compare(start, end - start, "..") == 0)
+            return false;
+        start = end + 1;
+    }
+    return true;
+}
+
+}  // namespace
+
+BlobStore::BlobStore(const std::string& ninja_dir, const std::string& project_root)
+    : ninja_dir_(RealPath(ninja_dir)) {
+    std::string root = project_root.empty() ? ninja_dir + "/.." : project_root;
+    if (root.front() != '/')
+        root = ninja_dir + "/" + root;
+    project_root_ = RealPath(root);
+}
+
+bool BlobStore::NormalizePath(const std::string& path, std::string* normalized) const {
+    if (path.empty())
+        return false;
+    if (path.front() != '/') {
+        *normalized = path;
+        return true;
+    }
+    if (!StaticFileUtils::HasPathPrefix(path, project_root_))
+        return false;
+    *normalized = StaticFileUtils::MakePathRelative(path, ninja_dir_);
+    return true;
+}
+
+bool BlobStore::AddFile(const std::string& path, api::FileEntry* entry) {
+    std::string rel;
+    if (!NormalizePath(path, &rel))
+        return false;
+
+    struct stat st;
+    if (stat(rel.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = by_path_.find(rel);
+        if (it != by_path_.end() && it->second.mtime_ns == MtimeNs(st) &&
+            it->second.size == st.st_size) {
+            *entry = it->second.entry;
+            return true;
+        }
+    }
+
+    // Hash outside the lock; a racing thread at worst hashes the same file twice.
+    int fd = open(rel.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    RemoteExecutor::Digest digest = CASHash::Hash(fd);
+    close(fd);
+
+    entry->set_path(rel);
+    entry->set_hash(digest.hash());
+    entry->set_size_bytes(digest.size_bytes());
+    entry->set_is_executable((st.st_mode & S_IXUSR) != 0);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    by_path_[rel] = CachedDigest{MtimeNs(st), st.st_size, *entry};
+    by_hash_[digest.hash()] = rel;
+    return true;
+}
+
+void BlobStore::AddKnownFile(const std::string& path, const api::FileEntry& entry) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    by_path_[path] = CachedDigest{MtimeNs(st), st.st_size, entry};
+    by_hash_[entry.hash()] = path;
+}
+
+bool BlobStore::Lookup(const std::string& hash, std::string* path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = by_hash_.find(hash);
+    if (it == by_hash_.end())
+        return false;
+    auto cached = by_path_.find(it->second);
+    struct stat st;
+    if (cached == by_path_.end() || stat(it->second.c_str(), &st) != 0 ||
+        cached->second.mtime_ns != MtimeNs(st) || cached->second.size != st.st_size)
+        return false;
+    *path = it->second;
+    return true;
+}
+
+BlobServer::~BlobServer() {
+    if (server_)
+        server_->Shutdown();
+}
+
+std::string BlobServer::Start(const std::string& host, int port) {
+    int selected_port = 0;
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort("0.0.0.0:" + std::to_string(port),
+                             grpc::InsecureServerCredentials(), &selected_port);
+    builder.RegisterService(&service_);
+    server_ = builder.BuildAndStart();
+    if (!server_ || selected_port == 0)
+        return "";
+    return host + ":" + std::to_string(selected_port);
+}
+
+grpc::Status BlobServer::Service::ReadBlob(grpc::ServerContext* context,
+                                           const api::ReadBlobRequest* request,
+                                           grpc::ServerWriter<api::ReadBlobResponse>* writer) {
+    std::string path;
+    if (!store_->Lookup(request->hash(), &path))
+        return grpc::Status(grpc::StatusCode::NOT_FOUND, "unknown blob " + request->hash());
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return grpc::Status(grpc::StatusCode::NOT_FOUND, path + ": " + strerror(errno));
+    if (request->offset() > 0)
+        lseek(fd, request->offset(), SEEK_SET);
+
+    std::vector<char> buffer(CASClient::BytestreamChunkSizeBytes());
+    api::ReadBlobResponse response;
+    ssize_t len = 0;
+    while (!context->IsCancelled() && (len = read(fd, buffer.data(), buffer.size())) > 0) {
+        response.set_data(buffer.data(), len);
+        if (!writer->Write(response))
+            break;
+    }
+    close(fd);
+    if (len < 0)
+        return grpc::Status(grpc::StatusCode::INTERNAL, path + ": " + strerror(errno));
+    return grpc::Status::OK;
+}
+
+void FillInputManifest(BlobStore* store, const std::vector<std::string>& inputs,
+                       const std::vector<std::string>& outputs,
+                       const std::string& blob_server,
+                       api::ForwardAndExecuteRequest* request) {
+    std::set<std::string> seen;
+    for (const auto& input : inputs) {
+        api::FileEntry entry;
+        if (store->AddFile(input, &entry) && seen.insert(entry.path()).second)
+            *request->add_inputs() = entry;
+    }
+    for (const auto& output : outputs)
+        request->add_outputs(output);
+    request->set_blob_server(blob_server);
+}
+
+std::string OutputBlobServer(const api::ForwardAndExecuteResponse& response) {
+    if (!response.blob_server().empty())
+        return response.blob_server();
+    return response.executor().ip() + ":" + std::to_string(response.executor().port());
+}
+
+bool FetchBlob(const std::string& address, const api::FileEntry& entry,
+               BlobStore* store, std::string* err) {
+    // The path comes from the peer; never let it write outside the build.
+    if (!IsContainedPath(entry.path())) {
+        *err = entry.path() + ": refusing to write outside the build directory";
+        return false;
+    }
+
+    api::FileEntry local;
+    if (store->AddFile(entry.path(), &local) && local.hash() == entry.hash())
+        return true;
+
+    static std::mutex stubs_mutex;
+    static std::unordered_map<std::string, std::unique_ptr<api::ShareBuildBlobs::Stub>> stubs;
+    api::ShareBuildBlobs::Stub* stub;
+    {
+        std::lock_guard<std::mutex> lock(stubs_mutex);
+        auto& slot = stubs[address];
+        if (!slot)
+            slot = api::ShareBuildBlobs::NewStub(
+                grpc::CreateChannel(address, grpc::InsecureChannelCredentials()));
+        stub = slot.get();
+    }
+
+    std::string tmp_path = entry.path() + ".sharebuild-tmp";
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC,
+                  entry.is_executable() ? 0777 : 0666);
+    if (fd < 0) {
+        *err = tmp_path + ": " + strerror(errno);
+        return false;
+    }
+
+    api::ReadBlobRequest request;
+    request.set_hash(entry.hash());
+    api::ReadBlobResponse response;
+    grpc::ClientContext context;
+    auto reader = stub->ReadBlob(&context, request);
+    bool write_ok = true;
+    int64_t written = 0;
+    while (reader->Read(&response)) {
+        const std::string& data = response.data();
+        if (write(fd, data.data(), data.size()) != static_cast<ssize_t>(data.size()))
+            write_ok = false;
+        written += data.size();
+    }
+    grpc::Status status = reader->Finish();
+    close(fd);
+
+    if (!status.ok() || !write_ok || written != entry.size_bytes()) {
+        if (!status.ok())
+            *err = entry.path() + ": " + status.error_message();
+        else if (!write_ok)
+            *err = tmp_path + ": " + strerror(errno);
+        else
+            *err = entry.path() + ": short read from " + address;
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    if (rename(tmp_path.c_str(), entry.path().c_str()) != 0) {
+        *err = entry.path() + ": " + strerror(errno);
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    store->AddKnownFile(entry.path(), entry);
+    return true;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <grpcpp/grpcpp.h>
+
+#include "proxy.grpc.pb.h"
+#include "common.pb.h"
+
+// Content-addressed view of the files a sharebuild command reads.
+// Digests are cached by (mtime, size) so headers shared by many commands
+// are hashed once per build, and every digested file can later be served
+// back by hash to peers that lack it.
+class BlobStore {
+public:
+    BlobStore(const std::string& ninja_dir, const std::string& project_root);
+
+    // Fill |entry| for |path| (relative to the ninja dir, or absolute inside
+    // the project root). Returns false for missing files and for paths
+    // outside the project, which peers are expected to provide themselves.
+    bool AddFile(const std::string& path, api::FileEntry* entry);
+
+    // Record a file whose digest is already known, e.g. a fetched output.
+    void AddKnownFile(const std::string& path, const api::FileEntry& entry);
+
+    // Return the path registered for |hash|, or false if unknown or the
+    // file changed on disk since it was digested.
+    bool Lookup(const std::string& hash, std::string* path);
+
+private:
+    struct CachedDigest {
+        int64_t mtime_ns;
+        int64_t size;
+        api::FileEntry entry;
+    };
+
+    bool NormalizePath(const std::string& path, std::string* normalized) const;
+
+    std::string ninja_dir_;
+    std::string project_root_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, CachedDigest> by_path_;
+    std::unordered_map<std::string, std::string> by_hash_;
+};
+
+// Serves blobs registered in a BlobStore over ShareBuildBlobs.ReadBlob.
+class BlobServer {
+public:
+    explicit BlobServer(BlobStore* store) : service_(store) {}
+    ~BlobServer();
+
+    // Listen on |host|:|port| (0 picks a free port). Returns the address
+    // peers should dial, or an empty string on failure.
+    std::string Start(const std::string& host, int port);
+
+private:
+    class Service : public api::ShareBuildBlobs::Service {
+    public:
+        explicit Service(BlobStore* store) : store_(store) {}
+        grpc::Status ReadBlob(grpc::ServerContext* context,
+                              const api::ReadBlobRequest* request,
+                              grpc::ServerWriter<api::ReadBlobResponse>* writer) override;
+    private:
+        BlobStore* store_;
+    };
+
+    Service service_;
+    std::unique_ptr<grpc::Server> server_;
+};
+
+// Fill the input manifest of |request|: one entry per distinct file of
+// |inputs| that |store| can digest, the |outputs| to return by digest, and
+// the |blob_server| peers fetch missing inputs from.
+void FillInputManifest(BlobStore* store, const std::vector<std::string>& inputs,
+                       const std::vector<std::string>& outputs,
+                       const std::string& blob_server,
+                       api::ForwardAndExecuteRequest* request);
+
+// The ShareBuildBlobs address to fetch the outputs of |response| from: the
+// one the executor reported, else its own ip:port. Nothing in this tree
+// serves blobs on the executor side; the executor has to.
+std::string OutputBlobServer(const api::ForwardAndExecuteResponse& response);
+
+// Download |entry| from the ShareBuildBlobs service at |address| into
+// |entry.path()| unless the local copy already has the same digest. Paths
+// that are absolute or contain ".." are refused.
+bool FetchBlob(const std::string& address, const api::FileEntry& entry,
+               BlobStore* store, std::string* err);
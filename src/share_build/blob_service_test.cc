@@ -0,0 +1,169 @@
+#include "blob_service.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "../remote_executor/cas_client.h"
+#include "../test.h"
+
+using namespace std;
+using RemoteExecutor::CASHash;
+
+namespace {
+
+void WriteFile(const string& path, const string& contents) {
+  FILE* f = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(f);
+  fwrite(contents.data(), 1, contents.size(), f);
+  fclose(f);
+}
+
+string ReadFile(const string& path) {
+  string contents;
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f)
+    return contents;
+  char buf[4096];
+  size_t len;
+  while ((len = fread(buf, 1, sizeof(buf), f)) > 0)
+    contents.append(buf, len);
+  fclose(f);
+  return contents;
+}
+
+struct BlobServiceTest : public testing::Test {
+  void SetUp() override {
+    temp_dir_.CreateAndEnter("BlobServiceTest");
+    ASSERT_EQ(0, getcwd(cwd_, sizeof(cwd_)) == nullptr);
+  }
+  void TearDown() override { temp_dir_.Cleanup(); }
+
+  ScopedTempDir temp_dir_;
+  char cwd_[4096];
+};
+
+}  // namespace
+
+TEST_F(BlobServiceTest, AddFile) {
+  BlobStore store(".", ".");
+  WriteFile("a.h", "int a;\n");
+
+  api::FileEntry entry;
+  ASSERT_TRUE(store.AddFile("a.h", &entry));
+  EXPECT_EQ("a.h", entry.path());
+  EXPECT_EQ(CASHash::Hash(string("int a;\n")).hash(), entry.hash());
+  EXPECT_EQ(7, entry.size_bytes());
+  EXPECT_FALSE(entry.is_executable());
+
+  // Absolute paths inside the project come back relative to the ninja dir.
+  api::FileEntry absolute;
+  ASSERT_TRUE(store.AddFile(string(cwd_) + "/a.h", &absolute));
+  EXPECT_EQ("a.h", absolute.path());
+  EXPECT_EQ(entry.hash(), absolute.hash());
+
+  EXPECT_FALSE(store.AddFile("missing.h", &entry));
+  EXPECT_FALSE(store.AddFile("/etc/passwd", &entry));
+}
+
+TEST_F(BlobServiceTest, LookupNoticesChanges) {
+  BlobStore store(".", ".");
+  WriteFile("a.h", "int a;\n");
+  api::FileEntry entry;
+  ASSERT_TRUE(store.AddFile("a.h", &entry));
+
+  string path;
+  ASSERT_TRUE(store.Lookup(entry.hash(), &path));
+  EXPECT_EQ("a.h", path);
+  EXPECT_FALSE(store.Lookup(CASHash::Hash(string("other")).hash(), &path));
+
+  // Serving the new contents under the old digest would be wrong.
+  WriteFile("a.h", "int a, b;\n");
+  EXPECT_FALSE(store.Lookup(entry.hash(), &path));
+
+  api::FileEntry changed;
+  ASSERT_TRUE(store.AddFile("a.h", &changed));
+  EXPECT_NE(entry.hash(), changed.hash());
+  EXPECT_TRUE(store.Lookup(changed.hash(), &path));
+}
+
+TEST_F(BlobServiceTest, FetchBlob) {
+  ASSERT_EQ(0, mkdir("served", 0777));
+  ASSERT_EQ(0, mkdir("fetched", 0777));
+  BlobStore served(".", ".");
+  string contents(3 << 20, 'x');
+  WriteFile("served/out.o", contents);
+  api::FileEntry entry;
+  ASSERT_TRUE(served.AddFile("served/out.o", &entry));
+
+  BlobServer server(&served);
+  string address = server.Start("127.0.0.1", 0);
+  ASSERT_FALSE(address.empty());
+
+  BlobStore fetched(".", ".");
+  api::FileEntry wanted = entry;
+  wanted.set_path("fetched/out.o");
+  string err;
+  ASSERT_TRUE(FetchBlob(address, wanted, &fetched, &err)) << err;
+  EXPECT_EQ(contents, ReadFile("fetched/out.o"));
+  string path;
+  EXPECT_TRUE(fetched.Lookup(entry.hash(), &path));
+  EXPECT_EQ("fetched/out.o", path);
+
+  // Up to date copies are not downloaded again.
+  EXPECT_TRUE(FetchBlob("127.0.0.1:1", wanted, &fetched, &err));
+
+  api::FileEntry unknown = wanted;
+  unknown.set_path("fetched/unknown.o");
+  unknown.set_hash(CASHash::Hash(string("unknown")).hash());
+  EXPECT_FALSE(FetchBlob(address, unknown, &fetched, &err));
+  EXPECT_NE(string::npos, err.find("unknown blob")) << err;
+  EXPECT_NE(0, access("fetched/unknown.o", F_OK));
+  EXPECT_NE(0, access("fetched/unknown.o.sharebuild-tmp", F_OK));
+
+  // Paths come from the peer and must stay inside the build directory.
+  const char* const kEscaping[] = { "../out.o", "fetched/../../out.o",
+                                    "/tmp/out.o", ".." };
+  for (const char* escaping : kEscaping) {
+    api::FileEntry outside = wanted;
+    outside.set_path(escaping);
+    err.clear();
+    EXPECT_FALSE(FetchBlob(address, outside, &fetched, &err)) << escaping;
+    EXPECT_NE(string::npos, err.find("outside the build directory")) << err;
+  }
+  EXPECT_NE(0, access("../out.o", F_OK));
+}
+
+TEST_F(BlobServiceTest, FillInputManifest) {
+  BlobStore store(".", ".");
+  WriteFile("a.cc", "#include \"a.h\"\n");
+  WriteFile("a.h", "int a;\n");
+
+  vector<string> inputs;
+  inputs.push_back("a.cc");
+  inputs.push_back("a.h");
+  inputs.push_back(string(cwd_) + "/a.h");  // the same header, as a compiler reports it
+  inputs.push_back("/usr/include/stdio.h");  // provided by the executor
+  inputs.push_back("generated.h");           // not built yet
+  vector<string> outputs(1, "a.o");
+
+  api::ForwardAndExecuteRequest request;
+  FillInputManifest(&store, inputs, outputs, "10.0.0.1:7000", &request);
+  ASSERT_EQ(2, request.inputs_size());
+  EXPECT_EQ("a.cc", request.inputs(0).path());
+  EXPECT_EQ("a.h", request.inputs(1).path());
+  EXPECT_EQ(CASHash::Hash(string("int a;\n")).hash(), request.inputs(1).hash());
+  ASSERT_EQ(1, request.outputs_size());
+  EXPECT_EQ("a.o", request.outputs(0));
+  EXPECT_EQ("10.0.0.1:7000", request.blob_server());
+}
+
+TEST(OutputBlobServerTest, PrefersReportedAddress) {
+  api::ForwardAndExecuteResponse response;
+  response.mutable_executor()->set_ip("10.0.0.2");
+  response.mutable_executor()->set_port(8000);
+  EXPECT_EQ("10.0.0.2:8000", OutputBlobServer(response));
+  response.set_blob_server("10.0.0.2:7000");
+  EXPECT_EQ("10.0.0.2:7000", OutputBlobServer(response));
+}
@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <set>
 #include <thread>
 #include <fstream>
 #include <yaml-cpp/yaml.h>
@@ -28,7 +29,7 @@ extern char** environ;
 
 ShareThread::ShareThread(bool use_console, const ProjectConfig& config)
     : fd_(-1), pid_(-1), use_console_(use_console), rbe_config_(config),
-      exit_code_(-1), is_done_(false) {}
+      result_(std::make_shared<Result>()) {}
 
 ShareThread::~ShareThread() {
     if (fd_ >= 0)
@@ -40,9 +41,7 @@ ShareThread::~ShareThread() {
 
 void work(ShareThread &share_thread, const ProjectConfig& rbe_config, string cmd_id, string cmd) {
     std::pair<int, std::string> remote_res = ShareExecute(rbe_config, cmd_id, cmd);
-    share_thread.exit_code_ = remote_res.first;
-    share_thread.result_output = remote_res.second;
-    share_thread.is_done_ = true;
+    share_thread.SetResult(remote_res.first, remote_res.second);
 }
 
 bool ShareThread::Start(ShareThreadSet* set, const string& command) {
@@ -69,15 +68,15 @@ const struct rusage* ShareThread::GetUsage() const {
 }
 
 ExitStatus ShareThread::Finish() {
-    return exit_code_ == 0 ? ExitSuccess : ExitFailure;
+    return result_->exit_code == 0 ? ExitSuccess : ExitFailure;
 }
 
 bool ShareThread::Done() const {
-    return is_done_;
+    return result_->is_done.load(std::memory_order_acquire);
 }
 
 const string& ShareThread::GetOutput() const {
-    return result_output;
+    return result_->output;
 }
 
 int ShareThreadSet::interrupted_;
@@ -104,6 +103,8 @@ void ShareThreadSet::HandlePendingInterruption() {
 ShareThreadSet::ShareThreadSet(const ProjectConfig& config) {
     size_t thread_count = GetProcessorCount() + 2;
     system_ = std::make_unique<RemoteCommandDispatcher>(config.shareproxy_addr, thread_count);
+    if (config.ship_inputs && !system_->ShipInputs(config))
+        Warning("sharebuild: cannot start blob server, peers need a shared filesystem");
     char address[INET_ADDRSTRLEN];
 
     sigset_t set;
@@ -138,8 +139,10 @@ ShareThreadSet::~ShareThreadSet() {
         Fatal("sigprocmask: %s", strerror(errno));
 }
 
-ShareThread *ShareThreadSet::Add(const EdgeCommand& cmd, const ProjectConfig& config) {
+ShareThread *ShareThreadSet::Add(const EdgeCommand& cmd, const ProjectConfig& config,
+                                 RemoteExecutor::RemoteSpawn* spawn) {
     ShareThread *shareThread = new ShareThread(cmd.use_console, config);
+    shareThread->spawn_.reset(spawn);
     if (!shareThread->Start(this, cmd.command)) {
         delete shareThread;
         return 0;
@@ -183,10 +186,60 @@ void ShareThreadSet::Clear() {
 }
 
 
-bool RemoteCommandDispatcher::SendCommand(ShareThread* st, const std::string& cmd_id, const std::string& command, const ProjectConfig& config) {
+bool RemoteCommandDispatcher::ShipInputs(const ProjectConfig& config) {
+    blob_store_ = std::make_unique<BlobStore>(config.cwd, config.project_root);
+    blob_server_ = std::make_unique<BlobServer>(blob_store_.get());
+    blob_server_addr_ = blob_server_->Start(config.self_ipv4_addr, config.blob_server_port);
+    if (blob_server_addr_.empty()) {
+        blob_server_.reset();
+        blob_store_.reset();
+        return false;
+    }
+    manifest_pool_ = std::make_unique<ShareWorkerPool>(GetProcessorCount());
+    return true;
+}
+
+void RemoteCommandDispatcher::AddInputManifest(RemoteExecutor::RemoteSpawn* spawn,
+                                               api::ForwardAndExecuteRequest* request) {
+    std::vector<std::string> inputs = spawn->inputs;
+    for (auto& header : spawn->GetHeaderFiles())
+        inputs.emplace_back(std::move(header));
+    FillInputManifest(blob_store_.get(), inputs, spawn->outputs, blob_server_addr_, request);
+}
+
+void RemoteCommandDispatcher::Dispatch(const std::shared_ptr<ShareThread::Result>& result,
+                                       const api::ForwardAndExecuteRequest& request) {
     size_t client_index = (next_client_++) % async_clients_.size();
     auto& client = async_clients_[client_index];
 
+    // Only the outputs the command declares may be written back.
+    std::set<std::string> declared(request.outputs().begin(), request.outputs().end());
+    client->AsyncExecute(request, [this, result, declared](const api::ForwardAndExecuteResponse& response, grpc::Status status) {
+        if (status.ok() && response.status().code() == api::PROXY_OK) {
+            std::string output = "stdout: " + response.std_out() + ", stderr: " + response.std_err();
+            if (blob_store_ && response.outputs_size() > 0) {
+                const std::string peer = OutputBlobServer(response);
+                for (const auto& entry : response.outputs()) {
+                    if (!declared.count(entry.path())) {
+                        result->Set(-1, "fetch output failed: " + entry.path() +
+                                        " is not an output of the command");
+                        return;
+                    }
+                    std::string err;
+                    if (!FetchBlob(peer, entry, blob_store_.get(), &err)) {
+                        result->Set(-1, "fetch output failed: " + err);
+                        return;
+                    }
+                }
+            }
+            result->Set(0, output);
+        } else {
+            result->Set(-1, "RPC failed or execution error");
+        }
+    });
+}
+
+bool RemoteCommandDispatcher::SendCommand(ShareThread* st, const std::string& cmd_id, const std::string& command, const ProjectConfig& config) {
     api::ForwardAndExecuteRequest request;
     api::Project project;
     project.set_ninja_host(config.self_ipv4_addr);
@@ -196,13 +249,17 @@ bool RemoteCommandDispatcher::SendCommand(ShareThread* st, const std::string& cm
     request.set_cmd_id(cmd_id);
     request.set_cmd_content(command);
 
-    client->AsyncExecute(request, [st](const api::ForwardAndExecuteResponse& response, grpc::Status status) {
-        if (status.ok() && response.status().code() == api::PROXY_OK) {
-            std::string result = "stdout: " + response.std_out() + ", stderr: " + response.std_err();
-            st->SetResult(0, result);
-        } else {
-            st->SetResult(-1, "RPC failed or execution error");
-        }
-    });
+    if (st->spawn_ && manifest_pool_) {
+        // Scanning headers runs the compiler's dependency pass, keep it off
+        // the main loop. The task owns what it uses, since an interrupted
+        // build deletes |st| without waiting for it.
+        manifest_pool_->Enqueue([this, spawn = st->spawn_, result = st->result_,
+                                 request]() mutable {
+            AddInputManifest(spawn.get(), &request);
+            Dispatch(result, request);
+        });
+        return true;
+    }
+    Dispatch(st->result_, request);
     return true;
-}
\ No newline at end of file
+}
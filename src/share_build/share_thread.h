@@ -19,6 +19,8 @@
 #include "../graph.h"
 #include "../exit_status.h"
 #include "../rbe_config.h"
+#include "../remote_executor/remote_spawn.h"
+#include "blob_service.h"
 #include "share_worker.h"
 
 using namespace std;
@@ -33,14 +35,24 @@ public:
 
     const string& GetOutput() const;
     const struct rusage* GetUsage() const;
-    int exit_code_;
-    bool is_done_;
-    string result_output;
+
+    /// How the command ended. Shared with the tasks and RPC callbacks that
+    /// work on it, which may still run after an interrupted build deleted
+    /// the ShareThread.
+    struct Result {
+        std::atomic<bool> is_done{false};
+        int exit_code = -1;
+        string output;
+
+        void Set(int code, std::string out) {
+            exit_code = code;
+            output = std::move(out);
+            is_done.store(true, std::memory_order_release);
+        }
+    };
 
     void SetResult(int exit_code, std::string output) {
-        exit_code_ = exit_code;
-        result_output = output;
-        is_done_ = true;
+        result_->Set(exit_code, std::move(output));
     }
 private:
     ShareThread(bool use_console, const ProjectConfig& config);
@@ -56,8 +68,13 @@ private:
     bool use_console_;
 
     friend struct ShareThreadSet;
+    friend class RemoteCommandDispatcher;
 
     const ProjectConfig& rbe_config_;
+    std::shared_ptr<Result> result_;
+    /// Set when inputs are shipped by digest. Shared with the task that
+    /// builds the input manifest.
+    std::shared_ptr<RemoteExecutor::RemoteSpawn> spawn_;
 };
 
 
@@ -70,6 +87,17 @@ class RemoteCommandDispatcher {
         std::vector<std::unique_ptr<AsyncProxyClient>> async_clients_;
         std::atomic<size_t> next_client_{0};
 
+        // Input shipping, see ShipInputs(). The manifest pool is declared
+        // last so its tasks are joined before the clients go away.
+        std::unique_ptr<BlobStore> blob_store_;
+        std::unique_ptr<BlobServer> blob_server_;
+        std::string blob_server_addr_;
+        std::unique_ptr<ShareWorkerPool> manifest_pool_;
+
+        void AddInputManifest(RemoteExecutor::RemoteSpawn* spawn, api::ForwardAndExecuteRequest* request);
+        void Dispatch(const std::shared_ptr<ShareThread::Result>& result,
+                      const api::ForwardAndExecuteRequest& request);
+
     public:
         RemoteCommandDispatcher(const std::string& server_address, int thread_count = 16)
             : thread_pool_(thread_count) {
@@ -90,6 +118,10 @@ class RemoteCommandDispatcher {
             }
         }
 
+        // Serve local files by digest so peers without a shared filesystem
+        // can fetch the inputs listed in each request's manifest.
+        bool ShipInputs(const ProjectConfig& config);
+
         bool SendCommand(ShareThread* st, const std::string& cmd_id, const std::string& command, const ProjectConfig& config);
 };
 
@@ -97,7 +129,8 @@ struct ShareThreadSet {
     ShareThreadSet(const ProjectConfig& config);
     ~ShareThreadSet();
 
-    ShareThread* Add(const EdgeCommand& cmd, const ProjectConfig& config);
+    ShareThread* Add(const EdgeCommand& cmd, const ProjectConfig& config,
+                     RemoteExecutor::RemoteSpawn* spawn = nullptr);
     bool DoWork();
     ShareThread* NextFinished();
     void Clear();
@@ -17,6 +17,7 @@
 #include <assert.h>
 #include <stdio.h>
 
+
 #include "edit_distance.h"
 #include "graph.h"
 #include "util.h"
@@ -71,6 +72,8 @@ State::State() {
   AddPool(&kConsolePool);
 }
 
+State::~State() {}
+
 void State::AddPool(Pool* pool) {
   assert(LookupPool(pool->name()) == NULL);
   pools_[pool->name()] = pool;
@@ -84,7 +87,7 @@ Pool* State::LookupPool(const string& pool_name) {
 }
 
 Edge* State::AddEdge(const Rule* rule) {
-  Edge* edge = new Edge();
+  Edge* edge = edge_objects_.New();
   edge->rule_ = rule;
   edge->pool_ = &State::kDefaultPool;
   edge->env_ = &bindings_;
@@ -94,19 +97,17 @@ Edge* State::AddEdge(const Rule* rule) {
 }
 
 Node* State::GetNode(StringPiece path, uint64_t slash_bits) {
-  Node* node = LookupNode(path);
+  uint32_t hash = Paths::Hash(path);
+  Node* node = paths_.Lookup(path, hash);
   if (node)
     return node;
-  node = new Node(path.AsString(), slash_bits);
-  paths_[node->path()] = node;
+  node = nodes_.New(path, slash_bits);
+  paths_.Insert(node, hash);
   return node;
 }
 
 Node* State::LookupNode(StringPiece path) const {
-  Paths::const_iterator i = paths_.find(path);
-  if (i != paths_.end())
-    return i->second;
-  return NULL;
+  return paths_.Lookup(path);
 }
 
 Node* State::SpellcheckNode(const string& path) {
@@ -115,12 +116,12 @@ Node* State::SpellcheckNode(const string& path) {
 
   int min_distance = kMaxValidEditDistance + 1;
   Node* result = NULL;
-  for (Paths::iterator i = paths_.begin(); i != paths_.end(); ++i) {
+  for (Paths::const_iterator i = paths_.begin(); i != paths_.end(); ++i) {
     int distance = EditDistance(
-        i->first, path, kAllowReplacements, kMaxValidEditDistance);
-    if (distance < min_distance && i->second) {
+        (*i)->path(), path, kAllowReplacements, kMaxValidEditDistance);
+    if (distance < min_distance) {
       min_distance = distance;
-      result = i->second;
+      result = *i;
     }
   }
   return result;
@@ -193,8 +194,8 @@ vector<Node*> State::DefaultNodes(string* err) const {
 }
 
 void State::Reset() {
-  for (Paths::iterator i = paths_.begin(); i != paths_.end(); ++i)
-    i->second->ResetState();
+  for (Paths::const_iterator i = paths_.begin(); i != paths_.end(); ++i)
+    (*i)->ResetState();
   for (vector<Edge*>::iterator e = edges_.begin(); e != edges_.end(); ++e) {
     (*e)->outputs_ready_ = false;
     (*e)->deps_loaded_ = false;
@@ -203,8 +204,8 @@ void State::Reset() {
 }
 
 void State::Dump() {
-  for (Paths::iterator i = paths_.begin(); i != paths_.end(); ++i) {
-    Node* node = i->second;
+  for (Paths::const_iterator i = paths_.begin(); i != paths_.end(); ++i) {
+    Node* node = *i;
     printf("%s %s [id:%d]\n",
            node->path().c_str(),
            node->status_known() ? (node->dirty() ? "dirty" : "clean")
@@ -20,9 +20,10 @@
 #include <string>
 #include <vector>
 
+#include "arena.h"
 #include "eval_env.h"
 #include "graph.h"
-#include "hash_map.h"
+#include "path_table.h"
 #include "util.h"
 
 struct Edge;
@@ -98,6 +99,7 @@ struct State {
   static const Rule kPhonyRule;
 
   State();
+  ~State();
 
   void AddPool(Pool* pool);
   Pool* LookupPool(const std::string& pool_name);
@@ -130,17 +132,28 @@ struct State {
   std::vector<Node*> DefaultNodes(std::string* error) const;
 
   /// Mapping of path -> Node.
-  typedef ExternalStringHashMap<Node*>::Type Paths;
+  typedef PathTable Paths;
   Paths paths_;
 
   /// All the pools used in the graph.
   std::map<std::string, Pool*> pools_;
 
-  /// All the edges of the graph.
+  /// All the edges of the graph, in the order of their Edge::id_.
   std::vector<Edge*> edges_;
 
   BindingEnv bindings_;
   std::vector<Node*> defaults_;
+
+ private:
+  /// Nodes and edges are owned by their arenas, which keep the fields the
+  /// dirty walk and the plan use at the start of each object in a single
+  /// cache line. Edges dropped from edges_ stay allocated until the State
+  /// is destroyed.
+  Arena<Node> nodes_;
+  Arena<Edge> edge_objects_;
+
+  State(const State&);
+  void operator=(const State&);
 };
 
 #endif  // NINJA_STATE_H_
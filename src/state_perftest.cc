@@ -0,0 +1,200 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+// Measures building a large State: manifest parsing (or loading a snapshot
+// of it), loading a deps log into it and looking up paths.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "deps_log.h"
+#include "disk_interface.h"
+#include "graph.h"
+#include "manifest_parser.h"
+#include "manifest_snapshot.h"
+#include "metrics.h"
+#include "state.h"
+#include "util.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const char kDepsLogFilename[] = "StatePerfTest-tempfile";
+const char kSnapshotFilename[] = "StatePerfTest-snapshot";
+
+// 100000 compile edges in 1000 directories, each including 200 out of 50000
+// headers: about 150000 nodes from the manifest and 50000 from the deps log.
+const int kNumSources = 100000;
+const int kNumHeaders = 50000;
+const int kDepsPerSource = 200;
+
+string SourcePath(int i) {
+  char buf[80];
+  snprintf(buf, sizeof(buf), "../../components/module%d/src/source_file_%d.cc",
+           i % 1000, i);
+  return buf;
+}
+
+string ObjectPath(int i) {
+  char buf[80];
+  snprintf(buf, sizeof(buf), "obj/components/module%d/source_file_%d.o",
+           i % 1000, i);
+  return buf;
+}
+
+string HeaderPath(int i) {
+  char buf[80];
+  snprintf(buf, sizeof(buf), "../../components/module%d/include/header_%d.h",
+           i % 1000, i);
+  return buf;
+}
+
+string MakeManifest() {
+  string manifest = "rule cxx\n  command = c++ -c $in -o $out\n"
+                    "  deps = gcc\n  depfile = $out.d\n";
+  for (int i = 0; i < kNumSources; ++i)
+    manifest += "build " + ObjectPath(i) + ": cxx " + SourcePath(i) + "\n";
+  return manifest;
+}
+
+bool WriteDepsLog(const string& manifest, string* err) {
+  State state;
+  ManifestParser parser(&state, NULL);
+  if (!parser.ParseTest(manifest, err))
+    return false;
+  DepsLog log;
+  if (!log.OpenForWrite(kDepsLogFilename, err))
+    return false;
+  vector<Node*> deps(kDepsPerSource);
+  for (int i = 0; i < kNumSources; ++i) {
+    for (int j = 0; j < kDepsPerSource; ++j)
+      deps[j] = state.GetNode(HeaderPath((i * 31 + j * 7) % kNumHeaders), 0);
+    if (!log.RecordDeps(state.LookupNode(ObjectPath(i)), 1, deps)) {
+      *err = "failed to record deps";
+      return false;
+    }
+  }
+  log.Close();
+  return true;
+}
+
+}  // namespace
+
+int main() {
+  string err;
+  const string manifest = MakeManifest();
+  if (!WriteDepsLog(manifest, &err)) {
+    fprintf(stderr, "Failed to write test data: %s\n", err.c_str());
+    return 1;
+  }
+
+  vector<string> lookups;
+  for (int i = 0; i < kNumSources; ++i) {
+    lookups.push_back(SourcePath(i));
+    lookups.push_back(ObjectPath(i));
+  }
+  for (int i = 0; i < kNumHeaders; ++i)
+    lookups.push_back(HeaderPath(i));
+  // Visit them in a scattered order, like a dependency walk does.
+  for (size_t i = lookups.size() - 1; i > 0; --i)
+    swap(lookups[i], lookups[(i * 2654435761u) % (i + 1)]);
+
+  const int kNumRepetitions = 5;
+  RealDiskInterface disk_interface;
+  int64_t best_parse = -1, best_snapshot = -1, best_deps = -1,
+          best_lookup = -1, memory = 0;
+  for (int i = 0; i < kNumRepetitions; ++i) {
+    int64_t memory_before = GetPrivateResidentKB();
+    State* state = new State;
+
+    int64_t start = GetTimeMillis();
+    ManifestParser parser(state, NULL);
+    if (!parser.ParseTest(manifest, &err)) {
+      fprintf(stderr, "Failed to parse: %s\n", err.c_str());
+      return 1;
+    }
+    int64_t parse = GetTimeMillis() - start;
+    // Snapshot the manifest alone, as ninja does before loading the logs.
+    if (i == 0 &&
+        !ManifestSnapshot::Write(kSnapshotFilename, "build.ninja", 0,
+                                 ManifestSnapshot::Recorder(&disk_interface),
+                                 *state, &err)) {
+      fprintf(stderr, "Failed to write snapshot: %s\n", err.c_str());
+      return 1;
+    }
+
+    start = GetTimeMillis();
+    DepsLog log;
+    if (log.Load(kDepsLogFilename, state, &err) == LOAD_ERROR) {
+      fprintf(stderr, "Failed to load deps log: %s\n", err.c_str());
+      return 1;
+    }
+    int64_t deps = GetTimeMillis() - start;
+    // Freed memory stays with the allocator, so the first run counts.
+    if (i == 0)
+      memory = GetPrivateResidentKB() - memory_before;
+
+    start = GetTimeMillis();
+    const int kLookupRounds = 10;
+    size_t found = 0;
+    for (int round = 0; round < kLookupRounds; ++round) {
+      for (size_t j = 0; j < lookups.size(); ++j)
+        found += state->LookupNode(lookups[j]) != NULL;
+    }
+    int64_t lookup = GetTimeMillis() - start;
+    if (found != lookups.size() * kLookupRounds) {
+      fprintf(stderr, "Lookups failed\n");
+      return 1;
+    }
+
+    State* snapshot_state = new State;
+    start = GetTimeMillis();
+    if (ManifestSnapshot::Load(kSnapshotFilename, "build.ninja", 0,
+                               &disk_interface, snapshot_state, NULL,
+                               &err) != LOAD_SUCCESS) {
+      fprintf(stderr, "Failed to load snapshot: %s\n", err.c_str());
+      return 1;
+    }
+    int64_t snapshot = GetTimeMillis() - start;
+    delete snapshot_state;
+
+    printf("parse %3dms  snapshot %3dms  deps log %3dms  %d lookups %3dms  "
+           "memory %lld kB\n",
+           (int)parse, (int)snapshot, (int)deps,
+           (int)(lookups.size() * kLookupRounds), (int)lookup,
+           (long long)memory);
+    if (best_parse < 0 || parse < best_parse) best_parse = parse;
+    if (best_snapshot < 0 || snapshot < best_snapshot)
+      best_snapshot = snapshot;
+    if (best_deps < 0 || deps < best_deps) best_deps = deps;
+    if (best_lookup < 0 || lookup < best_lookup) best_lookup = lookup;
+    delete state;
+  }
+  printf("min: parse %dms  snapshot %dms  deps log %dms  lookups %dms\n",
+         (int)best_parse, (int)best_snapshot, (int)best_deps,
+         (int)best_lookup);
+
+  unlink(kDepsLogFilename);
+  unlink(kSnapshotFilename);
+  return 0;
+}
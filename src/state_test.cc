@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stdio.h>
+
 #include "graph.h"
 #include "state.h"
 #include "test.h"
@@ -46,4 +48,46 @@ TEST(State, Basic) {
   EXPECT_FALSE(state.GetNode("out", 0)->dirty());
 }
 
+TEST(State, ManyNodes) {
+  State state;
+  const int kNumNodes = 10000;
+  vector<Node*> nodes;
+  for (int i = 0; i < kNumNodes; ++i) {
+    char path[32];
+    sprintf(path, "dir%d/file%d.h", i % 37, i);
+    nodes.push_back(state.GetNode(path, 0));
+  }
+  EXPECT_EQ((size_t)kNumNodes, state.paths_.size());
+  EXPECT_GE(state.paths_.capacity() * 7 / 8, state.paths_.size());
+
+  // Lookups find the nodes created above, and GetNode doesn't add them again.
+  for (int i = 0; i < kNumNodes; ++i) {
+    ASSERT_EQ(nodes[i], state.LookupNode(nodes[i]->path()));
+    ASSERT_EQ(nodes[i], state.GetNode(nodes[i]->path(), 0));
+  }
+  EXPECT_EQ((size_t)kNumNodes, state.paths_.size());
+  EXPECT_EQ(NULL, state.LookupNode("dir0/file1.h"));
+  EXPECT_EQ(NULL, state.LookupNode(""));
+
+  int count = 0;
+  for (State::Paths::const_iterator i = state.paths_.begin();
+       i != state.paths_.end(); ++i) {
+    ++count;
+  }
+  EXPECT_EQ(kNumNodes, count);
+}
+
+// Nodes and edges start a cache line, across arena blocks, and edges are
+// numbered in the order they are added.
+TEST(State, CacheLineAlignedGraph) {
+  State state;
+  for (int i = 0; i < 3000; ++i) {
+    Edge* edge = state.AddEdge(&State::kPhonyRule);
+    state.AddOut(edge, "out" + to_string(i), 0);
+    EXPECT_EQ((size_t)i, edge->id_);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(edge) % 64);
+    EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(edge->outputs_[0]) % 64);
+  }
+}
+
 }  // namespace
@@ -35,9 +35,20 @@
 
 using namespace std;
 
+namespace {
+
+/// Redraw the status at most 20 times a second by default. Faster than that
+/// only flickers, and at thousands of edges a second printing each one
+/// slows the build down.
+const int64_t kDefaultRefreshMillis = 50;
+
+}  // namespace
+
 StatusPrinter::StatusPrinter(const BuildConfig& config)
     : config_(config), started_edges_(0), finished_edges_(0), total_edges_(0),
-      running_edges_(0), progress_status_format_(NULL),
+      running_edges_(0), refresh_millis_(kDefaultRefreshMillis),
+      last_printed_millis_(-1), pending_edge_(NULL),
+      have_remote_progress_(false), progress_status_format_(NULL),
       current_rate_(config.parallelism) {
   // Don't do anything fancy in verbose mode.
   if (config_.verbosity != BuildConfig::NORMAL)
@@ -46,6 +57,15 @@ StatusPrinter::StatusPrinter(const BuildConfig& config)
   progress_status_format_ = getenv("NINJA_STATUS");
   if (!progress_status_format_)
     progress_status_format_ = "[%f/%t] ";
+
+  const char* refresh = getenv("NINJA_STATUS_REFRESH_MILLIS");
+  if (refresh && *refresh) {
+    char* end;
+    long long millis = strtoll(refresh, &end, 10);
+    if (*end != '\0' || millis < 0)
+      Fatal("invalid $NINJA_STATUS_REFRESH_MILLIS '%s'", refresh);
+    refresh_millis_ = millis;
+  }
 }
 
 void StatusPrinter::EdgeAddedToPlan(const Edge* edge) {
@@ -83,7 +103,7 @@ void StatusPrinter::BuildEdgeStarted(const Edge* edge,
   time_millis_ = start_time_millis;
 
   if (edge->use_console() || printer_.is_smart_terminal())
-    PrintStatus(edge, start_time_millis);
+    PrintStatus(edge, start_time_millis, edge->use_console());
 
   if (edge->use_console())
     printer_.SetConsoleLocked(true);
@@ -191,8 +211,9 @@ void StatusPrinter::BuildEdgeFinished(Edge* edge, int64_t start_time_millis,
   if (config_.verbosity == BuildConfig::QUIET)
     return;
 
+  // Show which edge the output below comes from.
   if (!edge->use_console())
-    PrintStatus(edge, end_time_millis);
+    PrintStatus(edge, end_time_millis, !success || !output.empty());
 
   --running_edges_;
 
@@ -260,67 +281,88 @@ void StatusPrinter::BuildStarted() {
   started_edges_ = 0;
   finished_edges_ = 0;
   running_edges_ = 0;
+  last_printed_millis_ = -1;
+  pending_edge_ = NULL;
+  have_remote_progress_ = false;
+}
+
+void StatusPrinter::BuildWaiting() {
+  if (pending_edge_)
+    PrintStatus(pending_edge_, time_millis_, true);
 }
 
 void StatusPrinter::BuildFinished() {
+  BuildWaiting();
   printer_.SetConsoleLocked(false);
   printer_.PrintOnNewLine("");
 }
 
+void StatusPrinter::BuildRemoteProgress(const RemoteProgress& progress) {
+  have_remote_progress_ = true;
+  remote_progress_ = progress;
+}
+
 string StatusPrinter::FormatProgressStatus(const char* progress_status_format,
                                            int64_t time_millis) const {
   string out;
+  AppendProgressStatus(progress_status_format, time_millis, &out);
+  return out;
+}
+
+void StatusPrinter::AppendProgressStatus(const char* progress_status_format,
+                                         int64_t time_millis,
+                                         string* out) const {
   char buf[32];
   for (const char* s = progress_status_format; *s != '\0'; ++s) {
     if (*s == '%') {
       ++s;
       switch (*s) {
       case '%':
-        out.push_back('%');
+        out->push_back('%');
         break;
 
         // Started edges.
       case 's':
         snprintf(buf, sizeof(buf), "%d", started_edges_);
-        out += buf;
+        out->append(buf);
         break;
 
         // Total edges.
       case 't':
         snprintf(buf, sizeof(buf), "%d", total_edges_);
-        out += buf;
+        out->append(buf);
         break;
 
         // Running edges.
       case 'r': {
         snprintf(buf, sizeof(buf), "%d", running_edges_);
-        out += buf;
+        out->append(buf);
         break;
       }
 
         // Unstarted edges.
       case 'u':
         snprintf(buf, sizeof(buf), "%d", total_edges_ - started_edges_);
-        out += buf;
+        out->append(buf);
         break;
 
         // Finished edges.
       case 'f':
         snprintf(buf, sizeof(buf), "%d", finished_edges_);
-        out += buf;
+        out->append(buf);
         break;
 
         // Overall finished edges per second.
       case 'o':
         SnprintfRate(finished_edges_ / (time_millis_ / 1e3), buf, "%.1f");
-        out += buf;
+        out->append(buf);
         break;
 
         // Current rate, average over the last '-j' jobs.
       case 'c':
         current_rate_.UpdateRate(finished_edges_, time_millis_);
         SnprintfRate(current_rate_.rate(), buf, "%.1f");
-        out += buf;
+        out->append(buf);
         break;
 
         // Percentage of edges completed
@@ -329,7 +371,7 @@ string StatusPrinter::FormatProgressStatus(const char* progress_status_format,
         if (finished_edges_ != 0 && total_edges_ != 0)
           percent = (100 * finished_edges_) / total_edges_;
         snprintf(buf, sizeof(buf), "%3i%%", percent);
-        out += buf;
+        out->append(buf);
         break;
       }
 
@@ -387,7 +429,7 @@ string StatusPrinter::FormatProgressStatus(const char* progress_status_format,
             break;
           }
         }
-        out += buf;
+        out->append(buf);
         break;
       }
 
@@ -395,39 +437,59 @@ string StatusPrinter::FormatProgressStatus(const char* progress_status_format,
       case 'P': {
         snprintf(buf, sizeof(buf), "%3i%%",
                  (int)(100. * time_predicted_percentage_));
-        out += buf;
+        out->append(buf);
         break;
       }
 
       default:
         Fatal("unknown placeholder '%%%c' in $NINJA_STATUS", *s);
-        return "";
+        return;
       }
     } else {
-      out.push_back(*s);
+      out->push_back(*s);
     }
   }
-
-  return out;
 }
 
-void StatusPrinter::PrintStatus(const Edge* edge, int64_t time_millis) {
+void StatusPrinter::PrintStatus(const Edge* edge, int64_t time_millis,
+                                bool force) {
   if (config_.verbosity == BuildConfig::QUIET
       || config_.verbosity == BuildConfig::NO_STATUS_UPDATE)
     return;
 
+  if (!force && printer_.is_smart_terminal() && last_printed_millis_ >= 0 &&
+      time_millis - last_printed_millis_ < refresh_millis_) {
+    pending_edge_ = edge;
+    return;
+  }
+  last_printed_millis_ = time_millis;
+  pending_edge_ = NULL;
+
   RecalculateProgressPrediction();
 
   bool force_full_command = config_.verbosity == BuildConfig::VERBOSE;
 
-  string to_print = edge->GetBinding("description");
-  if (to_print.empty() || force_full_command)
-    to_print = edge->GetBinding("command");
-
-  to_print = FormatProgressStatus(progress_status_format_, time_millis)
-      + to_print;
+  static const string kDescription = "description";
+  static const string kCommand = "command";
+  line_.clear();
+  AppendProgressStatus(progress_status_format_, time_millis, &line_);
+  size_t status_size = line_.size();
+  if (!force_full_command)
+    edge->AppendBinding(kDescription, &line_);
+  if (line_.size() == status_size)
+    edge->AppendBinding(kCommand, &line_);
+
+  // A second line sums up the remote commands in flight.
+  if (have_remote_progress_ && printer_.is_smart_terminal()) {
+    char buf[128];
+    int len = snprintf(buf, sizeof(buf),
+                       "\nremote: %d running, %d queued, %d cache hits",
+                       remote_progress_.running, remote_progress_.queued,
+                       remote_progress_.cache_hits);
+    line_.append(buf, len);
+  }
 
-  printer_.Print(to_print,
+  printer_.Print(line_,
                  force_full_command ? LinePrinter::FULL : LinePrinter::ELIDE);
 }
 
@@ -34,6 +34,11 @@ struct Status {
   virtual void BuildLoadDyndeps() = 0;
   virtual void BuildStarted() = 0;
   virtual void BuildFinished() = 0;
+  /// The latest counts of a CommandRunner that runs commands remotely.
+  virtual void BuildRemoteProgress(const RemoteProgress& progress) {}
+  /// The build is about to wait for a command to finish, which may take
+  /// long: show anything held back to print less often.
+  virtual void BuildWaiting() {}
 
   virtual void Info(const char* msg, ...) = 0;
   virtual void Warning(const char* msg, ...) = 0;
@@ -58,6 +63,8 @@ struct StatusPrinter : Status {
   virtual void BuildLoadDyndeps();
   virtual void BuildStarted();
   virtual void BuildFinished();
+  virtual void BuildRemoteProgress(const RemoteProgress& progress);
+  virtual void BuildWaiting();
 
   virtual void Info(const char* msg, ...);
   virtual void Warning(const char* msg, ...);
@@ -65,6 +72,9 @@ struct StatusPrinter : Status {
 
   virtual ~StatusPrinter() { }
 
+  /// Whether the status is redrawn in place, as on a terminal.
+  void set_smart_terminal(bool smart) { printer_.set_smart_terminal(smart); }
+
   /// Format the progress status string by replacing the placeholders.
   /// See the user manual for more information about the available
   /// placeholders.
@@ -72,9 +82,15 @@ struct StatusPrinter : Status {
   /// @param status The status of the edge.
   std::string FormatProgressStatus(const char* progress_status_format,
                                    int64_t time_millis) const;
+  /// Like FormatProgressStatus(), but append to |out|.
+  void AppendProgressStatus(const char* progress_status_format,
+                            int64_t time_millis, std::string* out) const;
 
  private:
-  void PrintStatus(const Edge* edge, int64_t time_millis);
+  /// Print the status line for |edge|. Unless |force| is set, a smart
+  /// terminal is redrawn at most every refresh_millis_, and a status that
+  /// was skipped is printed at the next one or when the build waits.
+  void PrintStatus(const Edge* edge, int64_t time_millis, bool force);
 
   const BuildConfig& config_;
 
@@ -107,6 +123,20 @@ struct StatusPrinter : Status {
   /// Prints progress output.
   LinePrinter printer_;
 
+  /// Minimum time between two redraws of the status on a smart terminal,
+  /// from $NINJA_STATUS_REFRESH_MILLIS. 0 redraws for every edge.
+  int64_t refresh_millis_;
+  /// When the status was last printed, -1 before the first time.
+  int64_t last_printed_millis_;
+  /// The edge of a status that was skipped and not printed yet.
+  const Edge* pending_edge_;
+  /// The status line, kept to reuse its buffer.
+  std::string line_;
+
+  /// The counts of a remote CommandRunner, if the build runs remotely.
+  bool have_remote_progress_;
+  RemoteProgress remote_progress_;
+
   /// The custom progress status format to use.
   const char* progress_status_format_;
 
@@ -14,6 +14,12 @@
 
 #include "status.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#endif
+
 #include "test.h"
 
 TEST(StatusTest, StatusFormatElapsed) {
@@ -34,3 +40,85 @@ TEST(StatusTest, StatusFormatReplacePlaceholder) {
   EXPECT_EQ("[%/s0/t0/r0/u0/f0]",
             status.FormatProgressStatus("[%%/s%s/t%t/r%r/u%u/f%f]", 0));
 }
+
+TEST(StatusTest, AppendProgressStatus) {
+  BuildConfig config;
+  StatusPrinter status(config);
+
+  // The status is appended to what the buffer already holds.
+  std::string line = "x";
+  status.AppendProgressStatus("[%f/%t] ", 0, &line);
+  EXPECT_EQ("x[0/0] ", line);
+}
+
+#ifndef _WIN32
+namespace {
+
+/// Collects what is printed to stdout while it is alive.
+struct CaptureStdout {
+  CaptureStdout() {
+    fflush(stdout);
+    saved_ = dup(1);
+    file_ = tmpfile();
+    dup2(fileno(file_), 1);
+  }
+  ~CaptureStdout() {
+    Stop();
+    fclose(file_);
+  }
+  std::string Stop() {
+    fflush(stdout);
+    if (saved_ >= 0) {
+      dup2(saved_, 1);
+      close(saved_);
+      saved_ = -1;
+    }
+    std::string out;
+    rewind(file_);
+    char buf[256];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), file_)) > 0)
+      out.append(buf, len);
+    return out;
+  }
+  int saved_;
+  FILE* file_;
+};
+
+struct StatusPrinterTest : public StateTestWithBuiltinRules {};
+
+}  // namespace
+
+TEST_F(StatusPrinterTest, ShownBeforeWaiting) {
+  ASSERT_NO_FATAL_FAILURE(AssertParse(&state_,
+"build out1: cat in1\n"
+"build out2: cat in2\n"));
+  Edge* edge1 = GetNode("out1")->in_edge();
+  Edge* edge2 = GetNode("out2")->in_edge();
+  BuildConfig config;
+  StatusPrinter status(config);
+  status.set_smart_terminal(true);
+  status.EdgeAddedToPlan(edge1);
+  status.EdgeAddedToPlan(edge2);
+  status.BuildStarted();
+
+  CaptureStdout capture;
+  status.BuildEdgeStarted(edge1, 0);
+  // Within the refresh interval, so held back...
+  status.BuildEdgeStarted(edge2, 1);
+  // ...until the build is about to wait, maybe for a long command.
+  std::string before = capture.Stop();
+  EXPECT_NE(std::string::npos, before.find("cat in1 > out1")) << before;
+  EXPECT_EQ(std::string::npos, before.find("cat in2 > out2")) << before;
+
+  CaptureStdout capture_waiting;
+  status.BuildWaiting();
+  std::string waiting = capture_waiting.Stop();
+  EXPECT_NE(std::string::npos, waiting.find("cat in2 > out2")) << waiting;
+
+  // Nothing is held back any more.
+  CaptureStdout capture_again;
+  status.BuildWaiting();
+  EXPECT_EQ("", capture_again.Stop());
+}
+#endif  // _WIN32
@@ -24,7 +24,12 @@
 #include <sys/wait.h>
 #include <spawn.h>
 
-#if defined(USE_PPOLL)
+#include <algorithm>
+#include <vector>
+
+#if defined(USE_EPOLL)
+#include <sys/epoll.h>
+#elif defined(USE_PPOLL)
 #include <poll.h>
 #else
 #include <sys/select.h>
@@ -36,13 +41,50 @@ extern char** environ;
 
 using namespace std;
 
+namespace {
+
+/// Split |command| into the arguments /bin/sh would run it with, if that
+/// takes nothing but splitting on blanks, so that it can be run without
+/// the shell: no quoting, expansions, redirections, globs, compound
+/// commands or assignments, and no builtin or reserved word to start with.
+bool SplitSimpleCommand(const string& command, vector<string>* args) {
+  static const char kShellChars[] = "|&;<>()$`\\\"'*?[]#~{}!\n\r";
+  static const char* const kShellWords[] = {
+    ".", ":", "[", "alias", "bg", "break", "case", "cd", "command",
+    "continue", "do", "done", "elif", "else", "esac", "eval", "exec", "exit",
+    "export", "fc", "fg", "fi", "for", "function", "getopts", "hash", "if",
+    "in", "jobs", "local", "read", "readonly", "return", "select", "set",
+    "shift", "source", "then", "time", "times", "trap", "type", "ulimit",
+    "umask", "unalias", "unset", "until", "wait", "while",
+  };
+  if (command.find_first_of(kShellChars) != string::npos)
+    return false;
+
+  args->clear();
+  size_t start = command.find_first_not_of(" \t");
+  while (start != string::npos) {
+    size_t end = command.find_first_of(" \t", start);
+    args->push_back(command.substr(start, end - start));
+    start = command.find_first_not_of(" \t", end);
+  }
+  if (args->empty() || (*args)[0].find('=') != string::npos)
+    return false;
+  for (size_t i = 0; i < sizeof(kShellWords) / sizeof(kShellWords[0]); ++i) {
+    if ((*args)[0] == kShellWords[i])
+      return false;
+  }
+  return true;
+}
+
+}  // anonymous namespace
+
 Subprocess::Subprocess(bool use_console) : fd_(-1), pid_(-1),
                                            use_console_(use_console) {
 }
 
 Subprocess::~Subprocess() {
   if (fd_ >= 0)
-    close(fd_);
+    ClosePipe();
   // Reap child if forgotten.
   if (pid_ != -1)
     Finish();
@@ -53,13 +95,24 @@ bool Subprocess::Start(SubprocessSet* set, const string& command) {
   if (pipe(output_pipe) < 0)
     Fatal("pipe: %s", strerror(errno));
   fd_ = output_pipe[0];
-#if !defined(USE_PPOLL)
-  // If available, we use ppoll in DoWork(); otherwise we use pselect
-  // and so must avoid overly-large FDs.
+#if !defined(USE_EPOLL) && !defined(USE_PPOLL)
+  // If available, we use epoll or ppoll in DoWork(); otherwise we use
+  // pselect and so must avoid overly-large FDs.
   if (fd_ >= static_cast<int>(FD_SETSIZE))
     Fatal("pipe: %s", strerror(EMFILE));
-#endif  // !USE_PPOLL
+#endif  // !USE_EPOLL && !USE_PPOLL
   SetCloseOnExec(fd_);
+#ifdef USE_EPOLL
+  // Edge-triggered, so OnPipeReady() must read until the pipe is empty.
+  if (fcntl(fd_, F_SETFL, O_NONBLOCK) < 0)
+    Fatal("fcntl: %s", strerror(errno));
+  epoll_fd_ = set->epoll_fd_;
+  epoll_event event;
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = this;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd_, &event) < 0)
+    Fatal("epoll_ctl: %s", strerror(errno));
+#endif
 
   posix_spawn_file_actions_t action;
   int err = posix_spawn_file_actions_init(&action);
@@ -70,33 +123,11 @@ bool Subprocess::Start(SubprocessSet* set, const string& command) {
   if (err != 0)
     Fatal("posix_spawn_file_actions_addclose: %s", strerror(err));
 
-  posix_spawnattr_t attr;
-  err = posix_spawnattr_init(&attr);
-  if (err != 0)
-    Fatal("posix_spawnattr_init: %s", strerror(err));
-
-  short flags = 0;
-
-  flags |= POSIX_SPAWN_SETSIGMASK;
-  err = posix_spawnattr_setsigmask(&attr, &set->old_mask_);
-  if (err != 0)
-    Fatal("posix_spawnattr_setsigmask: %s", strerror(err));
-  // Signals which are set to be caught in the calling process image are set to
-  // default action in the new process image, so no explicit
-  // POSIX_SPAWN_SETSIGDEF parameter is needed.
-
   if (!use_console_) {
-    // Put the child in its own process group, so ctrl-c won't reach it.
-    flags |= POSIX_SPAWN_SETPGROUP;
-    // No need to posix_spawnattr_setpgroup(&attr, 0), it's the default.
-
-    // Open /dev/null over stdin.
-    err = posix_spawn_file_actions_addopen(&action, 0, "/dev/null", O_RDONLY,
-          0);
-    if (err != 0) {
-      Fatal("posix_spawn_file_actions_addopen: %s", strerror(err));
-    }
-
+    // /dev/null over stdin.
+    err = posix_spawn_file_actions_adddup2(&action, set->devnull_fd_, 0);
+    if (err != 0)
+      Fatal("posix_spawn_file_actions_adddup2: %s", strerror(err));
     err = posix_spawn_file_actions_adddup2(&action, output_pipe[1], 1);
     if (err != 0)
       Fatal("posix_spawn_file_actions_adddup2: %s", strerror(err));
@@ -109,23 +140,28 @@ bool Subprocess::Start(SubprocessSet* set, const string& command) {
     // In the console case, output_pipe is still inherited by the child and
     // closed when the subprocess finishes, which then notifies ninja.
   }
-#ifdef POSIX_SPAWN_USEVFORK
-  flags |= POSIX_SPAWN_USEVFORK;
-#endif
-
-  err = posix_spawnattr_setflags(&attr, flags);
-  if (err != 0)
-    Fatal("posix_spawnattr_setflags: %s", strerror(err));
-
-  const char* spawned_args[] = { "/bin/sh", "-c", command.c_str(), NULL };
-  err = posix_spawn(&pid_, "/bin/sh", &action, &attr,
-        const_cast<char**>(spawned_args), environ);
-  if (err != 0)
-    Fatal("posix_spawn: %s", strerror(err));
+  const posix_spawnattr_t* attr = &set->spawn_attrs_[use_console_];
+
+  // Run simple commands directly, saving the shell's exec and startup. If
+  // that fails, the shell fails to run the command too, and reports why
+  // in the command's output as usual.
+  vector<string> args;
+  err = -1;
+  if (SplitSimpleCommand(command, &args)) {
+    vector<char*> argv;
+    for (vector<string>::iterator i = args.begin(); i != args.end(); ++i)
+      argv.push_back(const_cast<char*>(i->c_str()));
+    argv.push_back(NULL);
+    err = posix_spawnp(&pid_, argv[0], &action, attr, &argv[0], environ);
+  }
+  if (err != 0) {
+    const char* spawned_args[] = { "/bin/sh", "-c", command.c_str(), NULL };
+    err = posix_spawn(&pid_, "/bin/sh", &action, attr,
+          const_cast<char**>(spawned_args), environ);
+    if (err != 0)
+      Fatal("posix_spawn: %s", strerror(err));
+  }
 
-  err = posix_spawnattr_destroy(&attr);
-  if (err != 0)
-    Fatal("posix_spawnattr_destroy: %s", strerror(err));
   err = posix_spawn_file_actions_destroy(&action);
   if (err != 0)
     Fatal("posix_spawn_file_actions_destroy: %s", strerror(err));
@@ -136,15 +172,35 @@ bool Subprocess::Start(SubprocessSet* set, const string& command) {
 
 void Subprocess::OnPipeReady() {
   char buf[4 << 10];
+#ifdef USE_EPOLL
+  // Read everything there is now, as epoll won't report the pipe again
+  // until more arrives.
+  ssize_t len;
+  while ((len = read(fd_, buf, sizeof(buf))) > 0)
+    buf_.append(buf, len);
+  if (len < 0 && errno == EAGAIN)
+    return;
+#else
   ssize_t len = read(fd_, buf, sizeof(buf));
   if (len > 0) {
     buf_.append(buf, len);
-  } else {
-    if (len < 0)
-      Fatal("read: %s", strerror(errno));
-    close(fd_);
-    fd_ = -1;
+    return;
   }
+#endif
+  if (len < 0)
+    Fatal("read: %s", strerror(errno));
+  ClosePipe();
+}
+
+void Subprocess::ClosePipe() {
+#ifdef USE_EPOLL
+  // A child spawned meanwhile on another thread may hold a copy of fd_
+  // until it execs, which would keep it registered after close().
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd_, NULL) < 0)
+    Fatal("epoll_ctl: %s", strerror(errno));
+#endif
+  close(fd_);
+  fd_ = -1;
 }
 
 ExitStatus Subprocess::Finish() {
@@ -223,11 +279,64 @@ SubprocessSet::SubprocessSet() {
     Fatal("sigaction: %s", strerror(errno));
   if (sigaction(SIGHUP, &act, &old_hup_act_) < 0)
     Fatal("sigaction: %s", strerror(errno));
+
+  // The attributes and stdin of the children don't change, so they are
+  // set up once here rather than for each of them.
+  for (int use_console = 0; use_console < 2; ++use_console) {
+    posix_spawnattr_t* attr = &spawn_attrs_[use_console];
+    int err = posix_spawnattr_init(attr);
+    if (err != 0)
+      Fatal("posix_spawnattr_init: %s", strerror(err));
+
+    short flags = 0;
+
+    flags |= POSIX_SPAWN_SETSIGMASK;
+    err = posix_spawnattr_setsigmask(attr, &old_mask_);
+    if (err != 0)
+      Fatal("posix_spawnattr_setsigmask: %s", strerror(err));
+    // Signals which are set to be caught in the calling process image are
+    // set to default action in the new process image, so no explicit
+    // POSIX_SPAWN_SETSIGDEF parameter is needed.
+
+    if (!use_console) {
+      // Put the child in its own process group, so ctrl-c won't reach it.
+      flags |= POSIX_SPAWN_SETPGROUP;
+      // No need to posix_spawnattr_setpgroup(attr, 0), it's the default.
+    }
+#ifdef POSIX_SPAWN_USEVFORK
+    flags |= POSIX_SPAWN_USEVFORK;
+#endif
+
+    err = posix_spawnattr_setflags(attr, flags);
+    if (err != 0)
+      Fatal("posix_spawnattr_setflags: %s", strerror(err));
+  }
+
+  devnull_fd_ = open("/dev/null", O_RDONLY);
+  if (devnull_fd_ < 0)
+    Fatal("open(/dev/null): %s", strerror(errno));
+  SetCloseOnExec(devnull_fd_);
+
+#ifdef USE_EPOLL
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd_ < 0)
+    Fatal("epoll_create1: %s", strerror(errno));
+#endif
 }
 
 SubprocessSet::~SubprocessSet() {
   Clear();
 
+#ifdef USE_EPOLL
+  close(epoll_fd_);
+#endif
+  close(devnull_fd_);
+  for (int use_console = 0; use_console < 2; ++use_console) {
+    int err = posix_spawnattr_destroy(&spawn_attrs_[use_console]);
+    if (err != 0)
+      Fatal("posix_spawnattr_destroy: %s", strerror(err));
+  }
+
   if (sigaction(SIGINT, &old_int_act_, 0) < 0)
     Fatal("sigaction: %s", strerror(errno));
   if (sigaction(SIGTERM, &old_term_act_, 0) < 0)
@@ -244,11 +353,48 @@ Subprocess *SubprocessSet::Add(const string& command, bool use_console) {
     delete subprocess;
     return 0;
   }
+#ifdef USE_EPOLL
+  subprocess->running_index_ = running_.size();
+#endif
   running_.push_back(subprocess);
   return subprocess;
 }
 
-#ifdef USE_PPOLL
+#if defined(USE_EPOLL)
+bool SubprocessSet::DoWork() {
+  epoll_event events[256];
+  interrupted_ = 0;
+  int ret = epoll_pwait(epoll_fd_, events, sizeof(events) / sizeof(events[0]),
+                        -1, &old_mask_);
+  if (ret == -1) {
+    if (errno != EINTR) {
+      perror("ninja: epoll_pwait");
+      return false;
+    }
+    return IsInterrupted();
+  }
+
+  HandlePendingInterruption();
+  if (IsInterrupted())
+    return true;
+
+  for (int i = 0; i < ret; ++i) {
+    Subprocess* subproc = static_cast<Subprocess*>(events[i].data.ptr);
+    subproc->OnPipeReady();
+    if (subproc->Done()) {
+      finished_.push(subproc);
+      // The order of running_ doesn't matter, so move the last one here.
+      Subprocess* last = running_.back();
+      running_[subproc->running_index_] = last;
+      last->running_index_ = subproc->running_index_;
+      running_.pop_back();
+    }
+  }
+
+  return IsInterrupted();
+}
+
+#elif defined(USE_PPOLL)
 bool SubprocessSet::DoWork() {
   vector<pollfd> fds;
   nfds_t nfds = 0;
@@ -298,7 +444,7 @@ bool SubprocessSet::DoWork() {
   return IsInterrupted();
 }
 
-#else  // !defined(USE_PPOLL)
+#else  // !defined(USE_EPOLL) && !defined(USE_PPOLL)
 bool SubprocessSet::DoWork() {
   fd_set set;
   int nfds = 0;
@@ -344,7 +490,7 @@ bool SubprocessSet::DoWork() {
 
   return IsInterrupted();
 }
-#endif  // !defined(USE_PPOLL)
+#endif  // !defined(USE_EPOLL) && !defined(USE_PPOLL)
 
 Subprocess* SubprocessSet::NextFinished() {
   if (finished_.empty())
@@ -23,6 +23,7 @@
 #include <windows.h>
 #else
 #include <signal.h>
+#include <spawn.h>
 #endif
 
 // ppoll() exists on FreeBSD, but only on newer versions.
@@ -54,6 +55,9 @@ struct Subprocess {
   Subprocess(bool use_console);
   bool Start(struct SubprocessSet* set, const std::string& command);
   void OnPipeReady();
+#ifndef _WIN32
+  void ClosePipe();
+#endif
 
   std::string buf_;
 
@@ -70,6 +74,12 @@ struct Subprocess {
 #else
   int fd_;
   pid_t pid_;
+#ifdef USE_EPOLL
+  /// The epoll instance of the SubprocessSet that fd_ is registered with.
+  int epoll_fd_;
+  /// Where this is in SubprocessSet::running_, to remove it in O(1).
+  size_t running_index_;
+#endif
 #endif
   bool use_console_;
 
@@ -77,7 +87,8 @@ struct Subprocess {
   friend struct RemoteProcessSet;
 };
 
-/// SubprocessSet runs a ppoll/pselect() loop around a set of Subprocesses.
+/// SubprocessSet runs an epoll/ppoll/pselect() loop around a set of
+/// Subprocesses.
 /// DoWork() waits for any state change in subprocesses; finished_
 /// is a queue of subprocesses as they finish.
 struct SubprocessSet {
@@ -108,6 +119,17 @@ struct SubprocessSet {
   struct sigaction old_term_act_;
   struct sigaction old_hup_act_;
   sigset_t old_mask_;
+
+  /// The spawn attributes of every Subprocess, indexed by use_console.
+  posix_spawnattr_t spawn_attrs_[2];
+  /// /dev/null, opened once to be the stdin of every non-console child.
+  int devnull_fd_;
+
+#ifdef USE_EPOLL
+  /// Each running Subprocess's pipe is registered here once, when it
+  /// starts, so that DoWork() only hears about those that are ready.
+  int epoll_fd_;
+#endif
 #endif
 };
 
@@ -0,0 +1,139 @@
+// Copyright 2024 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Measures how many short commands SubprocessSet starts and reaps a second,
+// run directly and through the shell, one at a time and many at once, and
+// what each completion costs ninja with a thousand children running.
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <string>
+
+#include "metrics.h"
+#include "subprocess.h"
+#include "util.h"
+
+using namespace std;
+
+namespace {
+
+const int kNumCommands = 2000;
+
+/// Run |command| kNumCommands times, |parallelism| at once, and return how
+/// long it took in milliseconds, or -1 if a command failed.
+int64_t RunCommands(const string& command, size_t parallelism) {
+  SubprocessSet subprocs;
+  int started = 0, finished = 0;
+  int64_t start = GetTimeMillis();
+  while (finished < kNumCommands) {
+    while (started < kNumCommands && subprocs.running_.size() < parallelism) {
+      if (!subprocs.Add(command))
+        return -1;
+      ++started;
+    }
+    subprocs.DoWork();
+    while (Subprocess* subproc = subprocs.NextFinished()) {
+      ExitStatus status = subproc->Finish();
+      delete subproc;
+      if (status != ExitSuccess)
+        return -1;
+      ++finished;
+    }
+  }
+  return GetTimeMillis() - start;
+}
+
+/// The CPU time this process has used, in milliseconds.
+double CpuMillis() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000.0 +
+         (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000.0;
+}
+
+/// Keep |parallelism| children running until |count| have finished, each
+/// sleeping a different while so that they finish one by one, and return
+/// the CPU time ninja spent per child, in microseconds, or -1 on failure.
+double RunConcurrently(size_t parallelism, int count) {
+  SubprocessSet subprocs;
+  int started = 0, finished = 0;
+  double start = CpuMillis();
+  while (finished < count) {
+    while (started < count && subprocs.running_.size() < parallelism) {
+      char command[32];
+      snprintf(command, sizeof(command), "sleep 1.%03d", started * 7 % 1000);
+      if (!subprocs.Add(command))
+        return -1;
+      ++started;
+    }
+    subprocs.DoWork();
+    while (Subprocess* subproc = subprocs.NextFinished()) {
+      ExitStatus status = subproc->Finish();
+      delete subproc;
+      if (status != ExitSuccess)
+        return -1;
+      ++finished;
+    }
+  }
+  return (CpuMillis() - start) * 1000 / count;
+}
+
+}  // anonymous namespace
+
+int main() {
+  // "exec" makes the shell run the same program, after starting up itself.
+  const char* kCommands[][2] = {
+    { "direct", "true" },
+    { "shell", "exec true" },
+  };
+  const size_t kParallelism[] = { 1, 32 };
+  const int kNumRepetitions = 3;
+  for (size_t p = 0; p < sizeof(kParallelism) / sizeof(kParallelism[0]); ++p) {
+    for (size_t c = 0; c < sizeof(kCommands) / sizeof(kCommands[0]); ++c) {
+      int64_t best = -1;
+      for (int i = 0; i < kNumRepetitions; ++i) {
+        int64_t millis = RunCommands(kCommands[c][1], kParallelism[p]);
+        if (millis < 0) {
+          fprintf(stderr, "Failed to run %s\n", kCommands[c][1]);
+          return 1;
+        }
+        if (best < 0 || millis < best)
+          best = millis;
+      }
+      printf("-j%-3d %-6s %d commands in %5dms, %6.0f commands/s\n",
+             (int)kParallelism[p], kCommands[c][0], kNumCommands, (int)best,
+             kNumCommands * 1000.0 / (best ? best : 1));
+    }
+  }
+
+  // Make sure [ulimit -n] isn't going to stop us from working.
+  const size_t kNumConcurrent = 1000;
+  rlimit rlim;
+  if (getrlimit(RLIMIT_NOFILE, &rlim) == 0 &&
+      rlim.rlim_cur < kNumConcurrent + 100) {
+    printf("Raise [ulimit -n] above %d to run %d children at once\n",
+           (int)kNumConcurrent + 100, (int)kNumConcurrent);
+    return 0;
+  }
+  double micros = RunConcurrently(kNumConcurrent, 5 * kNumConcurrent);
+  if (micros < 0) {
+    fprintf(stderr, "Failed to run children\n");
+    return 1;
+  }
+  printf("-j%d  %.0fus of ninja CPU time per child\n", (int)kNumConcurrent,
+         micros);
+  return 0;
+}
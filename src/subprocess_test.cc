@@ -16,6 +16,8 @@
 
 #include "test.h"
 
+#include <algorithm>
+
 #ifndef _WIN32
 // SetWithLots need setrlimit.
 #include <stdio.h>
@@ -146,6 +148,40 @@ TEST_F(SubprocessTest, InterruptParentWithSigHup) {
   ASSERT_FALSE("We should have been interrupted");
 }
 
+// Simple commands run without the shell split into the same arguments.
+TEST_F(SubprocessTest, SimpleCommand) {
+  Subprocess* subproc = subprocs_.Add("printf  %s-%s\t a  b ");
+  ASSERT_NE((Subprocess *) 0, subproc);
+
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+
+  EXPECT_EQ(ExitSuccess, subproc->Finish());
+  EXPECT_EQ("a-b", subproc->GetOutput());
+}
+
+// Anything else still goes through the shell.
+TEST_F(SubprocessTest, ShellCommand) {
+  const char* kCommands[] = {
+    "FOO=bar printenv FOO", "echo 'a  b'", "cd / && pwd", "exit 3",
+    "echo x > /dev/null; echo y",
+  };
+  const char* kOutputs[] = { "bar\n", "a  b\n", "/\n", "", "y\n" };
+  for (size_t i = 0; i < sizeof(kCommands) / sizeof(kCommands[0]); ++i) {
+    Subprocess* subproc = subprocs_.Add(kCommands[i]);
+    ASSERT_NE((Subprocess *) 0, subproc);
+
+    while (!subproc->Done()) {
+      subprocs_.DoWork();
+    }
+
+    EXPECT_EQ(i == 3 ? ExitFailure : ExitSuccess, subproc->Finish())
+        << kCommands[i];
+    EXPECT_EQ(kOutputs[i], subproc->GetOutput()) << kCommands[i];
+  }
+}
+
 TEST_F(SubprocessTest, Console) {
   // Skip test if we don't have the console ourselves.
   if (isatty(0) && isatty(1) && isatty(2)) {
@@ -216,7 +252,7 @@ TEST_F(SubprocessTest, SetWithMulti) {
   }
 }
 
-#if defined(USE_PPOLL)
+#if defined(USE_PPOLL) || defined(USE_EPOLL)
 TEST_F(SubprocessTest, SetWithLots) {
   // Arbitrary big number; needs to be over 1024 to confirm we're no longer
   // hostage to pselect.
@@ -247,6 +283,52 @@ TEST_F(SubprocessTest, SetWithLots) {
 }
 #endif  // !__APPLE__ && !_WIN32
 
+#ifndef _WIN32
+// Children finishing in any order leave the others in running_ exactly once.
+TEST_F(SubprocessTest, FinishOutOfOrder) {
+  vector<Subprocess*> procs;
+  for (int i = 0; i < 4; ++i) {
+    char command[32];
+    snprintf(command, sizeof(command), "sleep 0.%d", 4 - i);
+    procs.push_back(subprocs_.Add(command));
+    ASSERT_NE((Subprocess *) 0, procs.back());
+  }
+  size_t finished = 0;
+  while (finished < procs.size()) {
+    subprocs_.DoWork();
+    while (Subprocess* subproc = subprocs_.NextFinished()) {
+      ++finished;
+      ASSERT_EQ(ExitSuccess, subproc->Finish());
+      ASSERT_TRUE(find(subprocs_.running_.begin(), subprocs_.running_.end(),
+                       subproc) == subprocs_.running_.end());
+    }
+    ASSERT_EQ(procs.size() - finished, subprocs_.running_.size());
+    for (size_t i = 0; i < procs.size(); ++i) {
+      EXPECT_EQ(procs[i]->Done() ? 0 : 1,
+                count(subprocs_.running_.begin(), subprocs_.running_.end(),
+                      procs[i]));
+    }
+  }
+  for (size_t i = 0; i < procs.size(); ++i)
+    delete procs[i];
+}
+
+// All the output of a command is read, however it arrives.
+TEST_F(SubprocessTest, LargeOutput) {
+  Subprocess* subproc = subprocs_.Add("seq 100000");
+  ASSERT_NE((Subprocess *) 0, subproc);
+
+  while (!subproc->Done()) {
+    subprocs_.DoWork();
+  }
+
+  EXPECT_EQ(ExitSuccess, subproc->Finish());
+  const string& output = subproc->GetOutput();
+  EXPECT_EQ(100000, count(output.begin(), output.end(), '\n'));
+  EXPECT_EQ("100000\n", output.substr(output.size() - 7));
+}
+#endif  // _WIN32
+
 // TODO: this test could work on Windows, just not sure how to simply
 // read stdin.
 #ifndef _WIN32
@@ -133,7 +133,7 @@ void VerifyGraph(const State& state) {
   set<const Edge*> node_edge_set;
   for (State::Paths::const_iterator p = state.paths_.begin();
        p != state.paths_.end(); ++p) {
-    const Node* n = p->second;
+    const Node* n = *p;
     if (n->in_edge())
       node_edge_set.insert(n->in_edge());
     node_edge_set.insert(n->out_edges().begin(), n->out_edges().end());
@@ -171,7 +171,10 @@ bool VirtualFileSystem::MakeDir(const string& path) {
 FileReader::Status VirtualFileSystem::ReadFile(const string& path,
                                                string* contents,
                                                string* err) {
-  files_read_.push_back(path);
+  {
+    std::lock_guard<std::mutex> lock(files_read_mutex_);
+    files_read_.push_back(path);
+  }
   FileMap::iterator i = files_.find(path);
   if (i != files_.end()) {
     *contents = i->second.contents;
@@ -195,6 +198,14 @@ int VirtualFileSystem::RemoveFile(const string& path) {
   }
 }
 
+bool VirtualFileSystem::SetMtime(const string& path, TimeStamp mtime) {
+  FileMap::iterator i = files_.find(path);
+  if (i == files_.end())
+    return false;
+  i->second.mtime = mtime;
+  return true;
+}
+
 void ScopedTempDir::CreateAndEnter(const string& name) {
   // First change into the system temp dir and save it for cleanup.
   start_dir_ = GetSystemTempDir();
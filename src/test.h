@@ -17,6 +17,8 @@
 
 #include <gtest/gtest.h>
 
+#include <mutex>
+
 #include "disk_interface.h"
 #include "manifest_parser.h"
 #include "state.h"
@@ -62,11 +64,13 @@ struct VirtualFileSystem : public DiskInterface {
 
   // DiskInterface
   virtual TimeStamp Stat(const std::string& path, std::string* err) const;
+  virtual bool IsThreadSafe() const { return true; }
   virtual bool WriteFile(const std::string& path, const std::string& contents);
   virtual bool MakeDir(const std::string& path);
   virtual Status ReadFile(const std::string& path, std::string* contents,
                           std::string* err);
   virtual int RemoveFile(const std::string& path);
+  virtual bool SetMtime(const std::string& path, TimeStamp mtime);
 
   /// An entry for a single in-memory file.
   struct Entry {
@@ -77,6 +81,7 @@ struct VirtualFileSystem : public DiskInterface {
 
   std::vector<std::string> directories_made_;
   std::vector<std::string> files_read_;
+  std::mutex files_read_mutex_;  // ReadFile() may be called concurrently.
   typedef std::map<std::string, Entry> FileMap;
   FileMap files_;
   std::set<std::string> files_removed_;
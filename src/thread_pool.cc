@@ -24,6 +24,12 @@
 #include "metrics.h"
 #include "util.h"
 
+static thread_local bool t_is_worker = false;
+
+bool IsThreadPoolWorker() {
+  return t_is_worker;
+}
+
 struct ThreadPoolImpl : ThreadPool {
   ThreadPoolImpl(int num_threads);
   virtual ~ThreadPoolImpl();
@@ -63,6 +69,7 @@ ThreadPoolImpl::ThreadPoolImpl(int num_threads) {
   threads_.resize(num_threads);
   for (int i = 0; i < num_threads; ++i) {
     threads_[i] = std::thread([this] {
+      t_is_worker = true;
       WorkerThreadLoop();
     });
   }
@@ -221,6 +228,7 @@ RBThreadPoolImpl::RBThreadPoolImpl(int num_threads) {
   threads_.resize(num_threads);
   for (int i = 0; i < num_threads; ++i) {
     threads_[i] = std::thread([this] {
+      t_is_worker = true;
       WorkerThreadLoop();
     });
   }
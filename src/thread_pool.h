@@ -37,6 +37,11 @@ void SetThreadPoolThreadCount(int num_threads);
 /// thread pool.
 int GetOptimalThreadPoolJobCount();
 
+/// Whether the calling thread is a worker of a ThreadPool or a
+/// RemoteBuildThreadPool. Work started there should not fan out into more
+/// threads, the pools are already sized to the machine.
+bool IsThreadPoolWorker();
+
 /// Create a new thread pool. Destructing the thread pool joins the threads,
 /// which is important for ensuring that no worker threads are running when
 /// ninja forks child processes or handles signals.
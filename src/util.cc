@@ -35,6 +35,7 @@
 
 #ifndef _WIN32
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #endif
 
@@ -60,6 +61,10 @@
 
 #include "edit_distance.h"
 
+#ifdef NINJA_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
 void Fatal(const char* msg, ...) {
@@ -136,6 +141,34 @@ static bool IsPathSeparator(char c) {
 #endif
 }
 
+#if defined(NINJA_HAVE_SSE2) && !defined(_WIN32)
+/// Whether the path components in [src, end) are already canonical: none
+/// is empty or starts with a '.', and there is no trailing separator.
+/// Looks for a separator followed by another one or a '.' 16 bytes at a
+/// time.
+static bool IsCanonical(const char* src, const char* end) {
+  if (src == end || src[0] == '.' || src[0] == '/' || end[-1] == '/')
+    return false;
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i dot = _mm_set1_epi8('.');
+  for (; end - src > 16; src += 16) {
+    __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i next =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 1));
+    __m128i bad = _mm_and_si128(
+        _mm_cmpeq_epi8(cur, slash),
+        _mm_or_si128(_mm_cmpeq_epi8(next, slash), _mm_cmpeq_epi8(next, dot)));
+    if (_mm_movemask_epi8(bad))
+      return false;
+  }
+  for (; src + 1 < end; ++src) {
+    if (src[0] == '/' && (src[1] == '/' || src[1] == '.'))
+      return false;
+  }
+  return true;
+}
+#endif
+
 void CanonicalizePath(char* path, size_t* len, uint64_t* slash_bits) {
   // WARNING: this function is performance-critical; please benchmark
   // any changes you make to it.
@@ -178,6 +211,14 @@ void CanonicalizePath(char* path, size_t* len, uint64_t* slash_bits) {
     }
   }
 
+#if defined(NINJA_HAVE_SSE2) && !defined(_WIN32)
+  // Most paths are canonical already, and there is nothing to move.
+  if (IsCanonical(src, end)) {
+    *slash_bits = 0;
+    return;
+  }
+#endif
+
   // Loop over all components of the paths _except_ the last one, in
   // order to simplify the loop's code and make it faster.
   int component_count = 0;
@@ -475,6 +516,66 @@ int ReadFile(const string& path, string* contents, string* err) {
 #endif
 }
 
+int MappedFile::Open(const string& path, string* err) {
+  Close();
+#ifdef _WIN32
+  // A mapped file can't be deleted or replaced on Windows, and the logs are
+  // rewritten while loaded, so read it instead.
+  int ret = ReadFile(path, &contents_, err);
+  if (ret < 0)
+    return ret;
+  data_ = contents_.data();
+  size_ = contents_.size();
+  return 0;
+#else
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    err->assign(strerror(errno));
+    return -errno;
+  }
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    int ret = -errno;
+    err->assign(strerror(errno));
+    close(fd);
+    return ret;
+  }
+  size_ = st.st_size;
+  if (size_ == 0) {
+    // mmap() rejects empty mappings.
+    close(fd);
+    data_ = "";
+    return 0;
+  }
+  void* data = mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+  int ret = data == MAP_FAILED ? -errno : 0;
+  if (ret < 0)
+    err->assign(strerror(errno));
+  close(fd);
+  if (ret < 0) {
+    size_ = 0;
+    return ret;
+  }
+#ifdef MADV_WILLNEED
+  madvise(data, size_, MADV_WILLNEED);
+#endif
+  data_ = static_cast<const char*>(data);
+  mapped_ = true;
+  return 0;
+#endif
+}
+
+void MappedFile::Close() {
+#ifndef _WIN32
+  if (mapped_)
+    munmap(const_cast<char*>(data_), size_);
+#endif
+  data_ = NULL;
+  size_ = 0;
+  mapped_ = false;
+  contents_.clear();
+}
+
 void SetCloseOnExec(int fd) {
 #ifndef _WIN32
   int flags = fcntl(fd, F_GETFD);
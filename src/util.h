@@ -49,6 +49,28 @@ NORETURN void Fatal(const char* msg, ...);
 #define NINJA_FALLTHROUGH
 #endif
 
+/// Defined when the SSE2 intrinsics of <emmintrin.h> are available, for
+/// the fast paths that scan text 16 bytes at a time.
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NINJA_HAVE_SSE2
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+/// Index of the lowest set bit of a non-zero |mask|.
+inline unsigned LowestSetBit(uint32_t mask) {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
 /// Log a warning message.
 void Warning(const char* msg, ...);
 void Warning(const char* msg, va_list ap);
@@ -79,6 +101,30 @@ void GetWin32EscapedString(const std::string& input, std::string* result);
 /// Returns -errno and fills in \a err on error.
 int ReadFile(const std::string& path, std::string* contents, std::string* err);
 
+/// The contents of a file, memory mapped read-only where the platform
+/// supports it and read into memory with ReadFile() otherwise. The data
+/// stays valid until Close() or destruction, even if the file is replaced.
+struct MappedFile {
+  MappedFile() : data_(NULL), size_(0), mapped_(false) {}
+  ~MappedFile() { Close(); }
+
+  /// Returns -errno and fills in \a err on error.
+  int Open(const std::string& path, std::string* err);
+  void Close();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+  bool mapped_;
+  std::string contents_;  // when not mapped
+
+  MappedFile(const MappedFile&);
+  void operator=(const MappedFile&);
+};
+
 /// Mark a file descriptor to not be inherited on exec()s.
 void SetCloseOnExec(int fd);
 
@@ -455,6 +455,51 @@ TEST(CanonicalizePath, NotNullTerminated) {
   EXPECT_EQ("file../file bar/.", string(path));
 }
 
+#ifndef _WIN32
+TEST(CanonicalizePath, Random) {
+  // Compare against a plain component by component implementation, with
+  // paths long enough for the 16 byte fast path and separators and dots
+  // at every offset.
+  const char kAlphabet[] = "ab./";
+  uint32_t seed = 1;
+  for (int i = 0; i < 100000; ++i) {
+    string path;
+    seed = seed * 1103515245 + 12345;
+    size_t len = 1 + (seed >> 16) % 48;
+    for (size_t j = 0; j < len; ++j) {
+      seed = seed * 1103515245 + 12345;
+      path += kAlphabet[(seed >> 16) % 4];
+    }
+
+    vector<string> components;
+    for (size_t start = 0; start <= path.size();) {
+      size_t end = path.find('/', start);
+      if (end == string::npos)
+        end = path.size();
+      string component = path.substr(start, end - start);
+      if (component == "..") {
+        if (!components.empty() && components.back() != "..")
+          components.pop_back();
+        else
+          components.push_back(component);
+      } else if (!component.empty() && component != ".") {
+        components.push_back(component);
+      }
+      start = end + 1;
+    }
+    string expected = path[0] == '/' ? "/" : "";
+    for (size_t j = 0; j < components.size(); ++j)
+      expected += (j ? "/" : "") + components[j];
+    if (expected.empty())
+      expected = ".";
+
+    string canonical = path;
+    CanonicalizePath(&canonical);
+    ASSERT_EQ(expected, canonical) << path;
+  }
+}
+#endif
+
 TEST(PathEscaping, TortureTest) {
   string result;
 